@@ -0,0 +1,147 @@
+#include "file_watcher.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <cassert>
+#include <sys/stat.h>
+
+#ifdef __linux__
+#include <errno.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#endif
+
+namespace Application
+{
+
+static int64_t get_modification_time(const char* path)
+{
+	struct stat file_stat;
+	if (stat(path, &file_stat) != 0)
+		return 0;
+
+	return int64_t(file_stat.st_mtime);
+}
+
+bool FileWatcher::init()
+{
+	file_count = 0;
+
+#ifdef __linux__
+	inotify_descriptor = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (inotify_descriptor < 0)
+	{
+		printf("[FileWatcher]: inotify_init1 failed: %s\n", strerror(errno));
+		return false;
+	}
+#endif
+
+	return true;
+}
+
+void FileWatcher::cleanup()
+{
+#ifdef __linux__
+	if (inotify_descriptor >= 0)
+	{
+		// NOTE: Closing the descriptor removes every watch
+		close(inotify_descriptor);
+		inotify_descriptor = -1;
+	}
+#endif
+
+	file_count = 0;
+}
+
+bool FileWatcher::watch(const char* path)
+{
+	assert(file_count < max_file_count && "Too many watched files");
+
+	WatchedFile& file = files[file_count];
+	file.path = path;
+	const char* separator = strrchr(path, '/');
+	file.name = separator != nullptr ? separator + 1 : path;
+	file.watch_descriptor = -1;
+	file.modification_time = get_modification_time(path);
+
+#ifdef __linux__
+	char directory[256] = ".";
+	if (separator != nullptr)
+	{
+		size_t length = size_t(separator - path);
+		assert(length < sizeof(directory));
+		memcpy(directory, path, length);
+		directory[length] = '\0';
+	}
+
+	// NOTE: Watching a directory twice returns the same descriptor
+	file.watch_descriptor = inotify_add_watch(inotify_descriptor, directory, IN_CLOSE_WRITE | IN_MOVED_TO);
+	if (file.watch_descriptor < 0)
+	{
+		printf("[FileWatcher]: Could not watch %s: %s\n", directory, strerror(errno));
+		return false;
+	}
+#endif
+
+	file_count++;
+	return true;
+}
+
+static void add_changed_path(const char* path, const char** changed_paths, uint32_t max_count, uint32_t& changed_count)
+{
+	for (uint32_t i = 0; i < changed_count; ++i)
+	{
+		if (changed_paths[i] == path)
+			return;
+	}
+
+	if (changed_count < max_count)
+	{
+		changed_paths[changed_count++] = path;
+	}
+}
+
+uint32_t FileWatcher::poll(const char** changed_paths, uint32_t max_count)
+{
+	uint32_t changed_count = 0;
+
+#ifdef __linux__
+	alignas(struct inotify_event) char buffer[4096];
+	for (;;)
+	{
+		ssize_t size = read(inotify_descriptor, buffer, sizeof(buffer));
+		if (size <= 0)
+			break;
+
+		for (ssize_t offset = 0; offset < size;)
+		{
+			const struct inotify_event* event = (const struct inotify_event*)(buffer + offset);
+			offset += sizeof(struct inotify_event) + event->len;
+			if (event->len == 0)
+				continue;
+
+			for (uint32_t i = 0; i < file_count; ++i)
+			{
+				if (files[i].watch_descriptor == event->wd && strcmp(files[i].name, event->name) == 0)
+				{
+					add_changed_path(files[i].path, changed_paths, max_count, changed_count);
+				}
+			}
+		}
+	}
+#else
+	for (uint32_t i = 0; i < file_count; ++i)
+	{
+		int64_t modification_time = get_modification_time(files[i].path);
+		if (modification_time != files[i].modification_time)
+		{
+			files[i].modification_time = modification_time;
+			add_changed_path(files[i].path, changed_paths, max_count, changed_count);
+		}
+	}
+#endif
+
+	return changed_count;
+}
+
+} // namespace Application
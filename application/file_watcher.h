@@ -0,0 +1,44 @@
+#pragma once
+
+#include <stdint.h>
+
+namespace Application
+{
+
+// Tells which of a set of files were written since the last time it was
+// asked, without blocking: the main loop polls it once per frame. Uses
+// inotify on Linux, on the directories of the files so that files that
+// are replaced (written to a temporary file and renamed, like most tools
+// do) are still seen. Elsewhere it compares modification times.
+struct FileWatcher
+{
+	static const uint32_t max_file_count = 32;
+
+	bool init();
+	void cleanup();
+
+	// NOTE: The path is kept as it is and handed back by poll, it must
+	// outlive the watcher
+	bool watch(const char* path);
+
+	// Fills changed_paths with the watched files written since the last
+	// poll, each one once, and returns how many there are
+	uint32_t poll(const char** changed_paths, uint32_t max_count);
+
+private:
+
+	struct WatchedFile
+	{
+		const char* path;
+		// File name, without the directory
+		const char* name;
+		int watch_descriptor;
+		int64_t modification_time;
+	};
+
+	WatchedFile files[max_file_count];
+	uint32_t file_count = 0;
+	int inotify_descriptor = -1;
+};
+
+} // namespace Application
@@ -1,19 +1,133 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <chrono>
 #include <cassert>
 
 #include "../memory/stack.h"
 #include "../application/platform.h"
+#include "../application/thread_pool.h"
+#include "../application/file_watcher.h"
 #include "../renderer/renderer.h"
 #include "../renderer/camera.h"
 #include "../game/simulation.h"
 #include "../game/level.h"
 #include "../resources/loader.h"
+#include "../resources/package.h"
+#include "../resources/model_reloader.h"
 
-int main()
+// NOTE: The order matters, the index of a source is the id of its model
+// (see Game::Level::load_level)
+static const Resources::PackageSource level_sources[] = {
+	{ "../data/models/snake_head.glb", "snake_head" },
+	{ "../data/models/snake_body.glb", "snake_body" },
+	{ "../data/models/snake_tail.glb", "snake_tail" },
+	{ "../data/models/wall.glb", "wall" },
+	{ "../data/models/ground.glb", "ground" },
+	{ "../data/models/apple.glb", "apple" },
+};
+static const char* level_package_path = "../data/models/level.pak";
+
+// Writes RGBA8 pixels to a binary PPM file, dropping the alpha channel
+static void write_ppm(const char* path, const uint8_t* pixels, uint32_t width, uint32_t height)
+{
+	FILE* file = fopen(path, "wb");
+	if (file == nullptr)
+	{
+		printf("[Main]: Failed to open %s for writing\n", path);
+		return;
+	}
+
+	fprintf(file, "P6\n%u %u\n255\n", width, height);
+	for (uint32_t i = 0; i < width * height; ++i)
+	{
+		fwrite(&pixels[i * 4], 1, 3, file);
+	}
+
+	fclose(file);
+}
+
+// Hot reload: loads again the level models and rebuilds the pipelines
+// whose files changed on disk since the last frame
+static void reload_changed_files(Application::FileWatcher* file_watcher, Resources::ModelReloader* model_reloader, Application::ThreadPool* thread_pool, Renderer::Renderer* renderer, Game::State* game_state)
+{
+	const char* changed_paths[Application::FileWatcher::max_file_count];
+	uint32_t changed_count = file_watcher->poll(changed_paths, ARRAYSIZE(changed_paths));
+
+	for (uint32_t i = 0; i < changed_count; ++i)
+	{
+		bool is_model = false;
+		for (uint32_t model_id = 0; model_id < ARRAYSIZE(level_sources); ++model_id)
+		{
+			if (changed_paths[i] != level_sources[model_id].path)
+				continue;
+
+			is_model = true;
+			Resources::ReloadedRanges ranges = {};
+			if (model_reloader->reload(level_sources[model_id], model_id, thread_pool, ranges))
+			{
+				renderer->upload_reloaded_model(game_state, model_id, ranges);
+			}
+		}
+
+		if (!is_model)
+		{
+			renderer->reload_shader(changed_paths[i]);
+		}
+	}
+}
+
+int main(int argc, char** argv)
 {
+	// Command line
+	//   --headless <frames>  render <frames> frames offscreen, without a window
+	//   --capture <path>     in headless mode, write the last frame to <path> (PPM)
+	//   --cook               cook the level models into a package and exit
+	//   --bc7                with --cook, encode the textures to BC7 instead of BC1/BC3
+	bool headless = false;
+	bool cook = false;
+	bool high_quality_textures = false;
+	uint32_t headless_frame_count = 0;
+	const char* capture_path = nullptr;
+	for (int i = 1; i < argc; ++i)
+	{
+		if (strcmp(argv[i], "--headless") == 0 && i + 1 < argc)
+		{
+			headless = true;
+			headless_frame_count = uint32_t(atoi(argv[++i]));
+		}
+		else if (strcmp(argv[i], "--capture") == 0 && i + 1 < argc)
+		{
+			capture_path = argv[++i];
+		}
+		else if (strcmp(argv[i], "--cook") == 0)
+		{
+			cook = true;
+		}
+		else if (strcmp(argv[i], "--bc7") == 0)
+		{
+			high_quality_textures = true;
+		}
+	}
+
+	if (cook)
+	{
+		Application::ThreadPool* cook_thread_pool = new Application::ThreadPool();
+		cook_thread_pool->init();
+		bool cooked = Resources::Package::cook(level_package_path, level_sources, ARRAYSIZE(level_sources), cook_thread_pool, high_quality_textures);
+		cook_thread_pool->cleanup();
+		delete cook_thread_pool;
+		return cooked ? 0 : 1;
+	}
+
+	const uint32_t width = 1600;
+	const uint32_t height = 1200;
+
 	Application::Platform* platform = new Application::Platform();
-	platform->init("73 Games", 1600, 1200);
+	platform->init("73 Games", width, height, headless);
+
+	Application::ThreadPool* thread_pool = new Application::ThreadPool();
+	thread_pool->init();
 
 	Renderer::Renderer* renderer = new Renderer::Renderer(platform);
 	renderer->init();
@@ -28,12 +142,33 @@ int main()
 
 	// Level preparation
 	Resources::AssetsInfo* assets_info = new Resources::AssetsInfo();
-	uint32_t snake_head_id = Resources::Loader::load_model("../data/models/snake_head.glb", "snake_head", assets_info);
-	uint32_t snake_body_id = Resources::Loader::load_model("../data/models/snake_body.glb", "snake_body", assets_info);
-	uint32_t snake_tail_id = Resources::Loader::load_model("../data/models/snake_tail.glb", "snake_tail", assets_info);
-	uint32_t wall_id = Resources::Loader::load_model("../data/models/wall.glb", "wall", assets_info);
-	uint32_t ground_id = Resources::Loader::load_model("../data/models/ground.glb", "ground", assets_info);
-	uint32_t apple_id = Resources::Loader::load_model("../data/models/apple.glb", "apple", assets_info);
+	// Use the cooked package when there is one, parse the sources otherwise.
+	// NOTE: Cooked textures are block compressed, GPUs that cannot sample
+	// BC formats load the RGBA8 textures of the sources instead
+	bool use_package = renderer->backend->device->context->gpu_enabled_features.textureCompressionBC == VK_TRUE;
+	if (!use_package)
+	{
+		printf("[Main]: The GPU does not support BC textures, loading the sources instead of %s\n", level_package_path);
+	}
+
+	if (!use_package || !Resources::Package::load(level_package_path, assets_info))
+	{
+		auto load_begin = std::chrono::high_resolution_clock::now();
+
+		uint32_t model_ids[ARRAYSIZE(level_sources)];
+		Resources::Loader::load_models(level_sources, ARRAYSIZE(level_sources), assets_info, thread_pool, model_ids);
+		for (uint32_t i = 0; i < ARRAYSIZE(level_sources); ++i)
+		{
+			assert(model_ids[i] == i);
+		}
+
+		auto load_end = std::chrono::high_resolution_clock::now();
+		printf("[Main]: Loaded %u models on %u threads in %.2f ms\n",
+			(uint32_t)ARRAYSIZE(level_sources),
+			thread_pool->worker_count + 1,
+			std::chrono::duration<double, std::milli>(load_end - load_begin).count());
+	}
+	assets_info->print_memory_report();
 	game_state->assets_info = assets_info;
  
 	// Load a level data
@@ -41,8 +176,66 @@ int main()
 	Game::Level::load_level(game_state, "");
 	// Upload vertices and indices data to the GPU
 	renderer->upload_buffers(game_state);
-	// Upload nodes UBOs data to the GPU
-	renderer->upload_dynamic_uniform_buffers(game_state, 0, game_state->entity_count);
+	// Node matrices and draw list of every entity
+	renderer->add_entities(game_state, 0, game_state->entity_count);
+
+	if (headless)
+	{
+		// NOTE: Headless runs advance the simulation exactly one tick per
+		// rendered frame, so that two runs with the same frame count produce
+		// the same images and comparable timings.
+		auto begin = std::chrono::high_resolution_clock::now();
+
+		for (uint32_t frame = 0; frame < headless_frame_count; ++frame)
+		{
+			simulation->update(game_state, frame);
+			renderer->render_frame(game_state, 0.0f);
+		}
+
+		auto end = std::chrono::high_resolution_clock::now();
+		double total_ms = std::chrono::duration<double, std::milli>(end - begin).count();
+		printf("[Main]: Rendered %u frames in %.2f ms (%.3f ms/frame, cpu avg %.3f ms, gpu avg %.3f ms)\n",
+			headless_frame_count,
+			total_ms,
+			headless_frame_count > 0 ? total_ms / headless_frame_count : 0.0,
+			renderer->frame_cpu_avg,
+			renderer->backend->device->frame_gpu_avg);
+
+		if (capture_path != nullptr && headless_frame_count > 0)
+		{
+			uint8_t* pixels = new uint8_t[width * height * 4];
+			renderer->backend->device->read_back_frame(pixels);
+			write_ppm(capture_path, pixels, width, height);
+			delete[] pixels;
+		}
+
+		simulation->cleanup();
+		renderer->cleanup();
+		assets_info->cleanup();
+		thread_pool->cleanup();
+		platform->cleanup();
+
+		return 0;
+	}
+
+	// Watch the level sources and the shaders, the cooked package is not
+	// reloaded: the sources are what gets edited
+	Application::FileWatcher* file_watcher = new Application::FileWatcher();
+	Resources::ModelReloader* model_reloader = new Resources::ModelReloader();
+	if (file_watcher->init())
+	{
+		for (uint32_t i = 0; i < ARRAYSIZE(level_sources); ++i)
+		{
+			file_watcher->watch(level_sources[i].path);
+		}
+
+		for (uint32_t i = 0; i < renderer->shader_path_count; ++i)
+		{
+			file_watcher->watch(renderer->shader_paths[i]);
+		}
+	}
+	model_reloader->init(assets_info, renderer->vertex_capacity, renderer->index_capacities[Resources::IndexType::Uint16], renderer->index_capacities[Resources::IndexType::Uint32],
+		renderer->meshlet_capacity, Renderer::Renderer::max_texture_count, Renderer::Renderer::max_material_count);
 
 	// TODO: Explain how this works
 	const uint32_t ticks_per_second = 25;
@@ -56,6 +249,8 @@ int main()
 
 	while (platform->alive())
 	{
+		reload_changed_files(file_watcher, model_reloader, thread_pool, renderer, game_state);
+
 		loops = 0;
 		while (glfwGetTime() * 1000.0f > next_game_tick && loops < max_frame_skip)
 		{
@@ -69,8 +264,12 @@ int main()
 		renderer->render_frame(game_state, interpolation);
 	}
 
+	file_watcher->cleanup();
+	model_reloader->cleanup();
 	simulation->cleanup();
 	renderer->cleanup();
+	assets_info->cleanup();
+	thread_pool->cleanup();
 	platform->cleanup();
 
 	return 0;
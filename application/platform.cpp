@@ -1,13 +1,25 @@
 #include "platform.h"
 
 #include <stdio.h>
+#include <string.h>
 #include <cassert>
 
 namespace Application
 {
 
-void Platform::init(const char* title, uint32_t width, uint32_t height)
+void Platform::init(const char* title, uint32_t width, uint32_t height, bool headless)
 {
+	this->headless = headless;
+	window_parameters.width = width;
+	window_parameters.height = height;
+
+	if (headless)
+	{
+		window_parameters.title = new char[strlen(title) + 1];
+		sprintf(window_parameters.title, "%s", title);
+		return;
+	}
+
 #ifdef SNAKE_USE_GLFW
 	glfwInit();
 
@@ -52,6 +64,10 @@ void Platform::init(const char* title, uint32_t width, uint32_t height)
 
 bool Platform::alive()
 {
+	// NOTE: In headless mode the caller decides how many frames to run
+	if (headless)
+		return true;
+
 #ifdef SNAKE_USE_GLFW
 	glfwPollEvents();
 	return !glfwWindowShouldClose(window_parameters.window);
@@ -60,7 +76,12 @@ bool Platform::alive()
 
 void Platform::cleanup()
 {
+	if (headless)
+		return;
+
+#ifdef SNAKE_USE_GLFW
 	glfwDestroyWindow(window_parameters.window);
+#endif
 }
 
 void* Platform::allocate(size_t size)
@@ -81,6 +102,9 @@ void Platform::free(void* base_address, size_t size)
 
 void Platform::set_window_title(const char* title)
 {
+	if (headless)
+		return;
+
 #ifdef SNAKE_USE_GLFW
 	char buffer[256];
 	sprintf(buffer, "%s: %s", window_parameters.title, title);
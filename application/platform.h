@@ -42,12 +42,18 @@ struct Platform
 	struct WindowParameters
 	{
 		char* title;
+		uint32_t width;
+		uint32_t height;
 #ifdef SNAKE_USE_GLFW
-		GLFWwindow* window;
+		GLFWwindow* window = nullptr;
 #endif
 	};
 
-	void init(const char* title, uint32_t width, uint32_t height);
+	// NOTE: When headless is true no window is created and no windowing
+	// system is touched at all, so the renderer can run on machines without
+	// a display (build farm, perf CI). The Vulkan backend renders into
+	// offscreen images instead of a swapchain.
+	void init(const char* title, uint32_t width, uint32_t height, bool headless = false);
 	void cleanup();
 	bool alive();
 	void set_window_title(const char* title);
@@ -59,6 +65,7 @@ struct Platform
 
 	WindowParameters window_parameters;
 	InputState input_state;
+	bool headless = false;
 };
 
 #ifdef SNAKE_USE_GLFW
@@ -0,0 +1,114 @@
+#include "thread_pool.h"
+
+#include <stdio.h>
+#include <cassert>
+
+namespace Application
+{
+
+void ThreadPool::init(uint32_t worker_count)
+{
+	if (worker_count == 0)
+	{
+		uint32_t hardware_thread_count = std::thread::hardware_concurrency();
+		worker_count = hardware_thread_count > 1 ? hardware_thread_count - 1 : 0;
+	}
+
+	if (worker_count > max_worker_count)
+		worker_count = max_worker_count;
+
+	this->worker_count = worker_count;
+	next_job = 0;
+	quit = false;
+
+	workers = new std::thread[worker_count];
+	for (uint32_t i = 0; i < worker_count; ++i)
+	{
+		workers[i] = std::thread(&ThreadPool::worker_loop, this);
+	}
+
+	printf("[ThreadPool]: Started %u workers\n", worker_count);
+}
+
+void ThreadPool::cleanup()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		quit = true;
+	}
+	work_available.notify_all();
+
+	for (uint32_t i = 0; i < worker_count; ++i)
+	{
+		workers[i].join();
+	}
+
+	delete[] workers;
+	workers = nullptr;
+	worker_count = 0;
+}
+
+void ThreadPool::dispatch(uint32_t job_count, JobFunction function, void* data)
+{
+	if (job_count == 0)
+		return;
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		this->function = function;
+		this->data = data;
+		this->job_count = job_count;
+		next_job = 0;
+		finished_worker_count = 0;
+		generation++;
+	}
+	work_available.notify_all();
+
+	run_jobs();
+
+	// NOTE: We wait for every worker to be done with this generation, not
+	// just for the jobs to be done. This way no worker can still be looking
+	// at this batch when the next dispatch changes it.
+	std::unique_lock<std::mutex> lock(mutex);
+	work_done.wait(lock, [this] { return finished_worker_count == this->worker_count; });
+}
+
+void ThreadPool::worker_loop()
+{
+	uint64_t last_generation = 0;
+
+	for (;;)
+	{
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			work_available.wait(lock, [this, last_generation] { return quit || generation != last_generation; });
+			if (quit)
+				return;
+
+			last_generation = generation;
+		}
+
+		run_jobs();
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			finished_worker_count++;
+			assert(finished_worker_count <= worker_count);
+		}
+		work_done.notify_one();
+	}
+}
+
+void ThreadPool::run_jobs()
+{
+	for (;;)
+	{
+		uint32_t job_index = next_job.fetch_add(1);
+		if (job_index >= job_count)
+			break;
+
+		function(job_index, data);
+	}
+}
+
+} // namespace Application
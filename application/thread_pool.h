@@ -0,0 +1,56 @@
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+namespace Application
+{
+
+// A job gets the index of the work item it has to process, in [0, job_count)
+typedef void (*JobFunction)(uint32_t job_index, void* data);
+
+// A fixed set of worker threads, created once at startup.
+// NOTE: dispatch() is meant to be called from one thread at a time (the
+// main thread), jobs must not dispatch other jobs.
+struct ThreadPool
+{
+	static const uint32_t max_worker_count = 32;
+
+	// With worker_count == 0 one worker is created per hardware thread,
+	// minus the calling thread which works on every dispatch as well
+	void init(uint32_t worker_count = 0);
+	void cleanup();
+
+	// Runs function once for every job index and returns when all of the
+	// jobs are done. Jobs are picked up in index order, but may finish in
+	// any order.
+	void dispatch(uint32_t job_count, JobFunction function, void* data);
+
+	uint32_t worker_count = 0;
+
+private:
+
+	std::thread* workers = nullptr;
+
+	std::mutex mutex;
+	std::condition_variable work_available;
+	std::condition_variable work_done;
+
+	// The batch being processed, written under the mutex
+	JobFunction function = nullptr;
+	void* data = nullptr;
+	uint32_t job_count = 0;
+	uint64_t generation = 0;
+	uint32_t finished_worker_count = 0;
+	bool quit = false;
+
+	std::atomic<uint32_t> next_job;
+
+	void worker_loop();
+	void run_jobs();
+};
+
+} // namespace Application
@@ -0,0 +1,104 @@
+#include "allocation_tracker.h"
+#include "../resources/resources.h"
+
+#include <stdlib.h>
+#include <atomic>
+#include <new>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+namespace Benchmarks
+{
+
+static std::atomic<uint64_t> allocation_count;
+static std::atomic<uint64_t> allocated_size;
+static std::atomic<int64_t> live_size;
+static std::atomic<int64_t> peak_live_size;
+
+static void track(size_t old_size, size_t new_size)
+{
+	if (new_size > 0)
+	{
+		allocation_count++;
+		allocated_size += new_size;
+	}
+
+	int64_t live = live_size += int64_t(new_size) - int64_t(old_size);
+	int64_t peak = peak_live_size.load();
+	while (live > peak && !peak_live_size.compare_exchange_weak(peak, live))
+	{
+	}
+}
+
+void AllocationTracker::reset()
+{
+	Resources::table_allocation_hook = track;
+	allocation_count = 0;
+	allocated_size = 0;
+	live_size = 0;
+	peak_live_size = 0;
+}
+
+AllocationStats AllocationTracker::stats()
+{
+	AllocationStats stats = {};
+	stats.allocation_count = allocation_count;
+	stats.allocated_size = allocated_size;
+	stats.live_size = live_size;
+	stats.peak_live_size = peak_live_size;
+	return stats;
+}
+
+size_t AllocationTracker::process_peak_memory()
+{
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS counters = {};
+	GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters));
+	return counters.PeakWorkingSetSize;
+#else
+	struct rusage usage = {};
+	getrusage(RUSAGE_SELF, &usage);
+	// NOTE: Kilobytes on Linux
+	return size_t(usage.ru_maxrss) * 1024;
+#endif
+}
+
+// Every allocation carries its size in front of it, so delete knows how
+// much it frees. 16 bytes keep the alignment new guarantees.
+static const size_t header_size = 16;
+
+static void* allocate(size_t size)
+{
+	uint8_t* block = static_cast<uint8_t*>(malloc(size + header_size));
+	if (block == nullptr)
+		throw std::bad_alloc();
+
+	*reinterpret_cast<size_t*>(block) = size;
+	track(0, size);
+	return block + header_size;
+}
+
+static void deallocate(void* pointer)
+{
+	if (pointer == nullptr)
+		return;
+
+	uint8_t* block = static_cast<uint8_t*>(pointer) - header_size;
+	track(*reinterpret_cast<size_t*>(block), 0);
+	free(block);
+}
+
+} // namespace Benchmarks
+
+void* operator new(size_t size) { return Benchmarks::allocate(size); }
+void* operator new[](size_t size) { return Benchmarks::allocate(size); }
+void operator delete(void* pointer) noexcept { Benchmarks::deallocate(pointer); }
+void operator delete[](void* pointer) noexcept { Benchmarks::deallocate(pointer); }
+void operator delete(void* pointer, size_t) noexcept { Benchmarks::deallocate(pointer); }
+void operator delete[](void* pointer, size_t) noexcept { Benchmarks::deallocate(pointer); }
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+namespace Benchmarks
+{
+
+// Heap activity since the last reset: every operator new and delete of
+// the program and every table allocation (see
+// Resources::table_allocation_hook)
+struct AllocationStats
+{
+	uint64_t allocation_count;
+	uint64_t allocated_size;
+	// Bytes alive now and at most, relative to the reset
+	int64_t live_size;
+	int64_t peak_live_size;
+};
+
+struct AllocationTracker
+{
+	// Installs the table hook and starts counting from zero
+	static void reset();
+	static AllocationStats stats();
+
+	// Peak resident memory of the whole process since it started, as
+	// reported by the OS. Includes the mapped files.
+	static size_t process_peak_memory();
+};
+
+} // namespace Benchmarks
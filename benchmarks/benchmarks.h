@@ -0,0 +1,12 @@
+#pragma once
+
+// Every benchmark gets the command line arguments that follow its name and
+// returns the exit code of the program
+namespace Benchmarks
+{
+
+int gltf_parser(int argc, char** argv);
+int loader(int argc, char** argv);
+int mesh_optimizer(int argc, char** argv);
+
+} // namespace Benchmarks
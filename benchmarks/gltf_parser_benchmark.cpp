@@ -0,0 +1,435 @@
+#include "benchmarks.h"
+#include "tools.h"
+#include "../resources/gltf_parser.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+
+#include "rapidjson/document.h"
+
+// Compares the SAX parser of the loader with the DOM path it replaced: a
+// rapidjson::Document walked with HasMember and operator[], filling the
+// same tables. Both run on a synthetic document with one buffer view per
+// accessor and one mesh, node and primitive per four accessors.
+
+namespace Benchmarks
+{
+
+using namespace Resources;
+
+typedef rapidjson::GenericObject<false, rapidjson::Value::ValueType> JsonObject;
+typedef rapidjson::GenericArray<false, rapidjson::Value::ValueType> JsonArray;
+
+static void write_document(TextWriter& writer, uint32_t accessor_count)
+{
+	uint32_t mesh_count = accessor_count / 4;
+	uint32_t material_count = mesh_count / 8 + 1;
+	uint32_t vertex_count = 1024;
+
+	writer.print("{\"asset\":{\"version\":\"2.0\",\"generator\":\"gltf_parser_benchmark\"},\"scene\":0,");
+
+	writer.print("\"scenes\":[{\"name\":\"Scene\",\"nodes\":[");
+	for (uint32_t i = 0; i < mesh_count; ++i)
+	{
+		writer.print(i > 0 ? ",%u" : "%u", i);
+	}
+	writer.print("]}],");
+
+	writer.print("\"nodes\":[");
+	for (uint32_t i = 0; i < mesh_count; ++i)
+	{
+		writer.print("%s{\"name\":\"node_%u\",\"mesh\":%u,\"translation\":[%f,0.0,%f],\"rotation\":[0.0,0.7071068,0.0,0.7071068],\"scale\":[1.0,2.0,1.0]}",
+			i > 0 ? "," : "", i, i, float(i % 100), float(i / 100));
+	}
+	writer.print("],");
+
+	writer.print("\"meshes\":[");
+	for (uint32_t i = 0; i < mesh_count; ++i)
+	{
+		writer.print("%s{\"name\":\"mesh_%u\",\"primitives\":[{\"attributes\":{\"POSITION\":%u,\"NORMAL\":%u,\"TEXCOORD_0\":%u},\"indices\":%u,\"material\":%u,\"mode\":4}]}",
+			i > 0 ? "," : "", i, i * 4, i * 4 + 1, i * 4 + 2, i * 4 + 3, i % material_count);
+	}
+	writer.print("],");
+
+	writer.print("\"materials\":[");
+	for (uint32_t i = 0; i < material_count; ++i)
+	{
+		writer.print("%s{\"name\":\"material_%u\",\"alphaMode\":\"%s\",\"pbrMetallicRoughness\":{\"baseColorFactor\":[%f,0.5,0.25,1.0],\"metallicFactor\":0.5,\"roughnessFactor\":0.75}}",
+			i > 0 ? "," : "", i, i % 2 == 0 ? "OPAQUE" : "BLEND", float(i % 10) / 10.0f);
+	}
+	writer.print("],");
+
+	// Position, normal, uv and index accessors, each in its own buffer view
+	static const char* types[] = { "VEC3", "VEC3", "VEC2", "SCALAR" };
+	static const uint32_t sizes[] = { 12, 12, 8, 2 };
+	writer.print("\"accessors\":[");
+	for (uint32_t i = 0; i < accessor_count; ++i)
+	{
+		uint32_t kind = i % 4;
+		writer.print("%s{\"bufferView\":%u,\"componentType\":%u,\"count\":%u,\"type\":\"%s\"", i > 0 ? "," : "", i, kind == 3 ? 5123 : 5126, kind == 3 ? vertex_count * 3 : vertex_count, types[kind]);
+		if (kind == 0)
+		{
+			writer.print(",\"min\":[-1.0,-1.0,-1.0],\"max\":[1.0,1.0,1.0]");
+		}
+		writer.print("}");
+	}
+	writer.print("],");
+
+	writer.print("\"bufferViews\":[");
+	uint32_t byte_offset = 0;
+	for (uint32_t i = 0; i < accessor_count; ++i)
+	{
+		uint32_t kind = i % 4;
+		uint32_t byte_length = sizes[kind] * (kind == 3 ? vertex_count * 3 : vertex_count);
+		writer.print("%s{\"buffer\":0,\"byteOffset\":%u,\"byteLength\":%u,\"target\":%u}", i > 0 ? "," : "", byte_offset, byte_length, kind == 3 ? 34963 : 34962);
+		byte_offset += byte_length;
+	}
+	writer.print("],");
+
+	writer.print("\"buffers\":[{\"byteLength\":%u}]}", byte_offset);
+}
+
+// The DOM path, as the loader did it before the SAX parser. dom keeps the
+// strings the names point to.
+static void parse_dom(const char* json, size_t length, rapidjson::Document& dom, GltfDocument& document)
+{
+	dom.Parse<rapidjson::kParseStopWhenDoneFlag>(json, length);
+	assert(!dom.HasParseError());
+
+	JsonObject __asset = dom["asset"].GetObject();
+	document.valid_version = __asset.HasMember("version") && strcmp("2.0", __asset["version"].GetString()) == 0;
+	document.buffer_count = dom["buffers"].GetArray().Size();
+	document.scene = dom.HasMember("scene") ? dom["scene"].GetInt() : -1;
+
+	JsonArray __buffer_views = dom["bufferViews"].GetArray();
+	for (rapidjson::SizeType i = 0; i < __buffer_views.Size(); ++i)
+	{
+		JsonObject __buffer_view = __buffer_views[i].GetObject();
+		BufferView buffer_view = {};
+		buffer_view.buffer_id = __buffer_view["buffer"].GetInt();
+		buffer_view.byte_length = __buffer_view["byteLength"].GetInt();
+		buffer_view.byte_offset = __buffer_view.HasMember("byteOffset") ? __buffer_view["byteOffset"].GetInt() : 0;
+		buffer_view.byte_stride = __buffer_view.HasMember("byteStride") ? __buffer_view["byteStride"].GetInt() : 0;
+		buffer_view.target = __buffer_view.HasMember("target") ? __buffer_view["target"].GetInt() : 0;
+		document.buffer_views.push(buffer_view);
+	}
+
+	JsonArray __accessors = dom["accessors"].GetArray();
+	for (rapidjson::SizeType i = 0; i < __accessors.Size(); ++i)
+	{
+		JsonObject __accessor = __accessors[i].GetObject();
+		Accessor accessor = {};
+		accessor.component_type = static_cast<ComponentType>(__accessor["componentType"].GetInt());
+		accessor.count = __accessor["count"].GetInt();
+		const char* type = __accessor["type"].GetString();
+		accessor.type = strcmp("SCALAR", type) == 0 ? Type::Scalar : strcmp("VEC2", type) == 0 ? Type::Vec2 : Type::Vec3;
+		accessor.buffer_view_id = __accessor.HasMember("bufferView") ? __accessor["bufferView"].GetInt() : 0;
+		accessor.byte_offset = __accessor.HasMember("byteOffset") ? __accessor["byteOffset"].GetInt() : 0;
+		accessor.normalized = __accessor.HasMember("normalized") ? __accessor["normalized"].GetBool() : false;
+
+		if (__accessor.HasMember("min"))
+		{
+			JsonArray min = __accessor["min"].GetArray();
+			accessor.min_length = (size_t)min.Size();
+			for (size_t j = 0; j < accessor.min_length; ++j)
+			{
+				accessor.min[j] = min[j].GetDouble();
+			}
+		}
+
+		if (__accessor.HasMember("max"))
+		{
+			JsonArray max = __accessor["max"].GetArray();
+			accessor.max_length = (size_t)max.Size();
+			for (size_t j = 0; j < accessor.max_length; ++j)
+			{
+				accessor.max[j] = max[j].GetDouble();
+			}
+		}
+
+		document.accessors.push(accessor);
+	}
+
+	JsonArray __materials = dom["materials"].GetArray();
+	for (rapidjson::SizeType i = 0; i < __materials.Size(); ++i)
+	{
+		JsonObject __material = __materials[i].GetObject();
+		Material material = {};
+		material.name_length = (uint32_t)strlen(__material["name"].GetString());
+		memcpy(material.name, __material["name"].GetString(), material.name_length);
+		material.alpha_mode = MaterialAlphaMode::Opaque;
+		if (__material.HasMember("alphaMode"))
+		{
+			const char* alpha_mode = __material["alphaMode"].GetString();
+			material.alpha_mode = strcmp("MASK", alpha_mode) == 0 ? MaterialAlphaMode::Mask : strcmp("BLEND", alpha_mode) == 0 ? MaterialAlphaMode::Blend : MaterialAlphaMode::Opaque;
+		}
+
+		JsonObject __pbr_metallic = __material["pbrMetallicRoughness"].GetObject();
+		if (__pbr_metallic.HasMember("baseColorFactor"))
+		{
+			JsonArray __base_color_factor = __pbr_metallic["baseColorFactor"].GetArray();
+			material.pbr_metallic_roughness.base_color_factor.r = __base_color_factor[0].GetFloat();
+			material.pbr_metallic_roughness.base_color_factor.g = __base_color_factor[1].GetFloat();
+			material.pbr_metallic_roughness.base_color_factor.b = __base_color_factor[2].GetFloat();
+			material.pbr_metallic_roughness.base_color_factor.a = __base_color_factor[3].GetFloat();
+		}
+
+		if (__pbr_metallic.HasMember("metallicFactor"))
+		{
+			material.pbr_metallic_roughness.metallic_factor = __pbr_metallic["metallicFactor"].GetFloat();
+		}
+
+		if (__pbr_metallic.HasMember("roughnessFactor"))
+		{
+			material.pbr_metallic_roughness.roughness_factor = __pbr_metallic["roughnessFactor"].GetFloat();
+		}
+
+		document.materials.push(material);
+	}
+
+	JsonArray __meshes = dom["meshes"].GetArray();
+	for (rapidjson::SizeType i = 0; i < __meshes.Size(); ++i)
+	{
+		JsonObject __mesh = __meshes[i].GetObject();
+		JsonArray __primitives = __mesh["primitives"].GetArray();
+
+		GltfMesh mesh = {};
+		mesh.name = __mesh.HasMember("name") ? __mesh["name"].GetString() : nullptr;
+		mesh.name_length = mesh.name != nullptr ? (uint32_t)strlen(mesh.name) : 0;
+		mesh.primitive_offset = (uint32_t)document.primitives.count;
+		mesh.primitive_count = __primitives.Size();
+		document.meshes.push(mesh);
+
+		for (rapidjson::SizeType p = 0; p < __primitives.Size(); ++p)
+		{
+			JsonObject __primitive = __primitives[p].GetObject();
+			JsonObject __attributes = __primitive["attributes"].GetObject();
+
+			GltfPrimitive primitive = {};
+			primitive.position = __attributes.HasMember("POSITION") ? __attributes["POSITION"].GetInt() : -1;
+			primitive.normal = __attributes.HasMember("NORMAL") ? __attributes["NORMAL"].GetInt() : -1;
+			primitive.uv_0 = __attributes.HasMember("TEXCOORD_0") ? __attributes["TEXCOORD_0"].GetInt() : -1;
+			primitive.indices = __primitive.HasMember("indices") ? __primitive["indices"].GetInt() : -1;
+			primitive.material = __primitive.HasMember("material") ? __primitive["material"].GetInt() : -1;
+			primitive.mode = __primitive.HasMember("mode") ? __primitive["mode"].GetInt() : 4;
+			document.primitives.push(primitive);
+		}
+	}
+
+	JsonArray __nodes = dom["nodes"].GetArray();
+	for (rapidjson::SizeType i = 0; i < __nodes.Size(); ++i)
+	{
+		JsonObject __node = __nodes[i].GetObject();
+
+		GltfNode node = {};
+		node.name = __node.HasMember("name") ? __node["name"].GetString() : nullptr;
+		node.name_length = node.name != nullptr ? (uint32_t)strlen(node.name) : 0;
+		node.mesh = __node.HasMember("mesh") ? __node["mesh"].GetInt() : -1;
+		node.rotation[3] = 1.0f;
+		node.scale[0] = node.scale[1] = node.scale[2] = 1.0f;
+
+		if (__node.HasMember("children"))
+		{
+			JsonArray __children = __node["children"].GetArray();
+			node.child_offset = (uint32_t)document.node_ids.count;
+			node.child_count = __children.Size();
+			for (rapidjson::SizeType c = 0; c < __children.Size(); ++c)
+			{
+				document.node_ids.push(__children[c].GetInt());
+			}
+		}
+
+		if (__node.HasMember("translation"))
+		{
+			JsonArray __translation = __node["translation"].GetArray();
+			for (uint32_t c = 0; c < 3; ++c)
+			{
+				node.translation[c] = __translation[c].GetFloat();
+			}
+		}
+
+		if (__node.HasMember("rotation"))
+		{
+			JsonArray __rotation = __node["rotation"].GetArray();
+			for (uint32_t c = 0; c < 4; ++c)
+			{
+				node.rotation[c] = __rotation[c].GetFloat();
+			}
+		}
+
+		if (__node.HasMember("scale"))
+		{
+			JsonArray __scale = __node["scale"].GetArray();
+			for (uint32_t c = 0; c < 3; ++c)
+			{
+				node.scale[c] = __scale[c].GetFloat();
+			}
+		}
+
+		document.nodes.push(node);
+	}
+
+	JsonArray __scenes = dom["scenes"].GetArray();
+	for (rapidjson::SizeType i = 0; i < __scenes.Size(); ++i)
+	{
+		JsonArray __root_nodes = __scenes[i].GetObject()["nodes"].GetArray();
+
+		GltfScene scene = {};
+		scene.node_offset = (uint32_t)document.node_ids.count;
+		scene.node_count = __root_nodes.Size();
+		for (rapidjson::SizeType n = 0; n < __root_nodes.Size(); ++n)
+		{
+			document.node_ids.push(__root_nodes[n].GetInt());
+		}
+
+		document.scenes.push(scene);
+	}
+}
+
+static bool same_documents(const GltfDocument& a, const GltfDocument& b)
+{
+	if (a.valid_version != b.valid_version || a.buffer_count != b.buffer_count || a.scene != b.scene
+		|| a.buffer_views.count != b.buffer_views.count || a.accessors.count != b.accessors.count
+		|| a.materials.count != b.materials.count || a.meshes.count != b.meshes.count
+		|| a.primitives.count != b.primitives.count || a.nodes.count != b.nodes.count
+		|| a.scenes.count != b.scenes.count || a.node_ids.count != b.node_ids.count)
+		return false;
+
+	for (size_t i = 0; i < a.buffer_views.count; ++i)
+	{
+		const BufferView& x = a.buffer_views[i];
+		const BufferView& y = b.buffer_views[i];
+		if (x.buffer_id != y.buffer_id || x.byte_offset != y.byte_offset || x.byte_length != y.byte_length || x.byte_stride != y.byte_stride || x.target != y.target)
+			return false;
+	}
+
+	for (size_t i = 0; i < a.accessors.count; ++i)
+	{
+		const Accessor& x = a.accessors[i];
+		const Accessor& y = b.accessors[i];
+		if (x.buffer_view_id != y.buffer_view_id || x.byte_offset != y.byte_offset || x.count != y.count || x.component_type != y.component_type
+			|| x.type != y.type || x.normalized != y.normalized || x.min_length != y.min_length || x.max_length != y.max_length
+			|| memcmp(x.min, y.min, x.min_length * sizeof(double)) != 0 || memcmp(x.max, y.max, x.max_length * sizeof(double)) != 0)
+			return false;
+	}
+
+	for (size_t i = 0; i < a.materials.count; ++i)
+	{
+		const Material& x = a.materials[i];
+		const Material& y = b.materials[i];
+		if (x.name_length != y.name_length || memcmp(x.name, y.name, x.name_length) != 0 || x.alpha_mode != y.alpha_mode
+			|| x.pbr_metallic_roughness.base_color_factor != y.pbr_metallic_roughness.base_color_factor
+			|| x.pbr_metallic_roughness.metallic_factor != y.pbr_metallic_roughness.metallic_factor
+			|| x.pbr_metallic_roughness.roughness_factor != y.pbr_metallic_roughness.roughness_factor)
+			return false;
+	}
+
+	for (size_t i = 0; i < a.meshes.count; ++i)
+	{
+		const GltfMesh& x = a.meshes[i];
+		const GltfMesh& y = b.meshes[i];
+		if (x.name_length != y.name_length || memcmp(x.name, y.name, x.name_length) != 0 || x.primitive_offset != y.primitive_offset || x.primitive_count != y.primitive_count)
+			return false;
+	}
+
+	if (memcmp(a.primitives.data, b.primitives.data, a.primitives.count * sizeof(GltfPrimitive)) != 0
+		|| memcmp(a.node_ids.data, b.node_ids.data, a.node_ids.count * sizeof(uint32_t)) != 0
+		|| memcmp(a.scenes.data, b.scenes.data, a.scenes.count * sizeof(GltfScene)) != 0)
+		return false;
+
+	for (size_t i = 0; i < a.nodes.count; ++i)
+	{
+		const GltfNode& x = a.nodes[i];
+		const GltfNode& y = b.nodes[i];
+		if (x.name_length != y.name_length || memcmp(x.name, y.name, x.name_length) != 0 || x.mesh != y.mesh
+			|| x.child_offset != y.child_offset || x.child_count != y.child_count || x.has_matrix != y.has_matrix
+			|| memcmp(x.translation, y.translation, sizeof(x.translation)) != 0
+			|| memcmp(x.rotation, y.rotation, sizeof(x.rotation)) != 0
+			|| memcmp(x.scale, y.scale, sizeof(x.scale)) != 0)
+			return false;
+	}
+
+	return true;
+}
+
+int gltf_parser(int argc, char** argv)
+{
+	uint32_t accessor_count = 10000;
+	uint32_t iteration_count = 20;
+	for (int i = 0; i + 1 < argc; i += 2)
+	{
+		if (strcmp(argv[i], "--accessors") == 0)
+		{
+			accessor_count = (uint32_t)atoi(argv[i + 1]);
+		}
+		else if (strcmp(argv[i], "--iterations") == 0)
+		{
+			iteration_count = (uint32_t)atoi(argv[i + 1]);
+		}
+	}
+
+	accessor_count = accessor_count < 4 ? 4 : accessor_count;
+	iteration_count = iteration_count < 1 ? 1 : iteration_count;
+
+	TextWriter writer = {};
+	write_document(writer, accessor_count);
+	size_t length = writer.text.count;
+
+	// The SAX parser writes to the text, every run gets a fresh copy
+	char* scratch = new char[length];
+
+	// Both paths must fill the same tables, or the timings mean nothing
+	rapidjson::Document reference_dom;
+	GltfDocument reference = {};
+	parse_dom(writer.text.data, length, reference_dom, reference);
+
+	memcpy(scratch, writer.text.data, length);
+	GltfDocument sax_document = {};
+	bool same = GltfParser::parse(scratch, length, sax_document) && same_documents(sax_document, reference);
+	sax_document.release();
+	reference.release();
+
+	Timings dom_timings = {};
+	Timings sax_timings = {};
+
+	// NOTE: The DOM and the tables are released inside the timed sections,
+	// like the loader does once a model is written
+	for (uint32_t iteration = 0; iteration < iteration_count; ++iteration)
+	{
+		auto dom_begin = std::chrono::high_resolution_clock::now();
+		{
+			rapidjson::Document dom;
+			GltfDocument document = {};
+			parse_dom(writer.text.data, length, dom, document);
+			document.release();
+		}
+		auto dom_end = std::chrono::high_resolution_clock::now();
+		dom_timings.add(std::chrono::duration<double, std::milli>(dom_end - dom_begin).count());
+
+		memcpy(scratch, writer.text.data, length);
+
+		auto sax_begin = std::chrono::high_resolution_clock::now();
+		{
+			GltfDocument document = {};
+			GltfParser::parse(scratch, length, document);
+			document.release();
+		}
+		auto sax_end = std::chrono::high_resolution_clock::now();
+		sax_timings.add(std::chrono::duration<double, std::milli>(sax_end - sax_begin).count());
+	}
+
+	double megabytes = double(length) / (1024.0 * 1024.0);
+	printf("[Benchmark]: gltf_parser: %u accessors, %.2f MB of JSON, %u iterations\n", accessor_count, megabytes, iteration_count);
+	printf("[Benchmark]:   DOM: best %.3f ms (%.1f MB/s), average %.3f ms\n", dom_timings.best, megabytes / (dom_timings.best / 1000.0), dom_timings.total / iteration_count);
+	printf("[Benchmark]:   SAX: best %.3f ms (%.1f MB/s), average %.3f ms\n", sax_timings.best, megabytes / (sax_timings.best / 1000.0), sax_timings.total / iteration_count);
+	printf("[Benchmark]:   SAX is %.2fx faster, tables %s\n", dom_timings.best / sax_timings.best, same ? "match" : "DO NOT MATCH");
+
+	writer.text.release();
+	delete[] scratch;
+
+	return same ? 0 : 1;
+}
+
+} // namespace Benchmarks
@@ -0,0 +1,100 @@
+#include "benchmarks.h"
+#include "tools.h"
+#include "synthetic_glb.h"
+#include "allocation_tracker.h"
+#include "../resources/loader.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+
+// Times Resources::Loader::load_model end to end on a synthetic GLB file:
+// mapping, parsing, optimizing, quantizing, simplifying and writing the
+// model into a fresh AssetsInfo. The file is written once, before the
+// first iteration, so the OS has it cached for every load.
+
+namespace Benchmarks
+{
+
+using namespace Resources;
+
+int loader(int argc, char** argv)
+{
+	SyntheticGlbParams params = {};
+	uint32_t iteration_count = 5;
+	const char* path = "synthetic.glb";
+	for (int i = 0; i + 1 < argc; i += 2)
+	{
+		if (strcmp(argv[i], "--meshes") == 0)
+		{
+			params.mesh_count = (uint32_t)atoi(argv[i + 1]);
+		}
+		else if (strcmp(argv[i], "--vertices") == 0)
+		{
+			params.vertex_count = (uint32_t)atoi(argv[i + 1]);
+		}
+		else if (strcmp(argv[i], "--materials") == 0)
+		{
+			params.material_count = (uint32_t)atoi(argv[i + 1]);
+		}
+		else if (strcmp(argv[i], "--iterations") == 0)
+		{
+			iteration_count = (uint32_t)atoi(argv[i + 1]);
+		}
+		else if (strcmp(argv[i], "--path") == 0)
+		{
+			path = argv[i + 1];
+		}
+	}
+
+	iteration_count = iteration_count < 1 ? 1 : iteration_count;
+
+	size_t file_size = write_synthetic_glb(path, params);
+	if (file_size == 0)
+		return 1;
+
+	Timings timings = {};
+	AllocationStats worst = {};
+	size_t vertex_count = 0;
+	size_t index_count = 0;
+
+	for (uint32_t iteration = 0; iteration < iteration_count; ++iteration)
+	{
+		AssetsInfo* assets_info = new AssetsInfo();
+		AllocationTracker::reset();
+
+		auto begin = std::chrono::high_resolution_clock::now();
+		Loader::load_model(path, "synthetic", assets_info);
+		auto end = std::chrono::high_resolution_clock::now();
+		timings.add(std::chrono::duration<double, std::milli>(end - begin).count());
+
+		// NOTE: Every load does the same work, the allocations should only
+		// differ by what the thread pool or the CRT do behind our back
+		AllocationStats stats = AllocationTracker::stats();
+		if (stats.peak_live_size > worst.peak_live_size)
+		{
+			worst = stats;
+		}
+
+		vertex_count = assets_info->vertex_count();
+		index_count = assets_info->indices16.count + assets_info->indices32.count;
+
+		assets_info->cleanup();
+		delete assets_info;
+	}
+
+	double megabytes = double(file_size) / (1024.0 * 1024.0);
+	printf("[Benchmark]: loader: %u meshes, %u vertices per mesh, %u materials, %.2f MB file, %u iterations\n",
+		params.mesh_count, params.vertex_count, params.material_count, megabytes, iteration_count);
+	printf("[Benchmark]:   load_model: best %.3f ms (%.1f MB/s), average %.3f ms\n", timings.best, megabytes / (timings.best / 1000.0), timings.total / iteration_count);
+	printf("[Benchmark]:   output: %zu vertices, %zu indices\n", vertex_count, index_count);
+	printf("[Benchmark]:   allocations: %llu per load, %.2f MB allocated, %.2f MB peak heap, %.2f MB kept by the assets\n",
+		(unsigned long long)worst.allocation_count, double(worst.allocated_size) / (1024.0 * 1024.0),
+		double(worst.peak_live_size) / (1024.0 * 1024.0), double(worst.live_size) / (1024.0 * 1024.0));
+	printf("[Benchmark]:   process peak memory: %.2f MB\n", double(AllocationTracker::process_peak_memory()) / (1024.0 * 1024.0));
+
+	return 0;
+}
+
+} // namespace Benchmarks
@@ -0,0 +1,40 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "benchmarks.h"
+
+struct Benchmark
+{
+	const char* name;
+	int (*run)(int argc, char** argv);
+	const char* usage;
+};
+
+static const Benchmark benchmarks[] = {
+	{ "gltf_parser", Benchmarks::gltf_parser, "[--accessors <count>] [--iterations <count>]" },
+	{ "loader", Benchmarks::loader, "[--meshes <count>] [--vertices <count>] [--materials <count>] [--iterations <count>] [--path <file>]" },
+	{ "mesh_optimizer", Benchmarks::mesh_optimizer, "[--size <quads per side>] [--iterations <count>]" },
+};
+
+int main(int argc, char** argv)
+{
+	// Command line
+	//   <benchmark> [options]  run one benchmark, see the usage below
+	if (argc >= 2)
+	{
+		for (uint32_t i = 0; i < sizeof(benchmarks) / sizeof(benchmarks[0]); ++i)
+		{
+			if (strcmp(argv[1], benchmarks[i].name) == 0)
+				return benchmarks[i].run(argc - 2, argv + 2);
+		}
+	}
+
+	printf("Usage:\n");
+	for (uint32_t i = 0; i < sizeof(benchmarks) / sizeof(benchmarks[0]); ++i)
+	{
+		printf("  %s %s %s\n", argc > 0 ? argv[0] : "benchmarks", benchmarks[i].name, benchmarks[i].usage);
+	}
+
+	return 1;
+}
@@ -0,0 +1,197 @@
+#include "benchmarks.h"
+#include "tools.h"
+#include "../resources/mesh_optimizer.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+
+// Runs Resources::MeshOptimizer on a size x size grid of quads whose
+// triangles are shuffled, the worst case for the vertex cache. Reports the
+// ACMR after Tipsify alone and after every pass, and checks that the
+// optimized primitive still has the same triangles.
+
+namespace Benchmarks
+{
+
+using namespace Resources;
+
+struct Grid
+{
+	uint32_t vertex_count;
+	uint32_t index_count;
+	glm::vec3* positions;
+	glm::vec3* normals;
+	glm::vec2* uvs;
+	uint32_t* indices;
+
+	void release()
+	{
+		delete[] positions;
+		delete[] normals;
+		delete[] uvs;
+		delete[] indices;
+	}
+};
+
+// NOTE: uv.x holds the original id of every vertex, optimize_vertex_fetch
+// moves it along with the vertex so the triangles can be compared after
+static void make_grid(Grid& grid, uint32_t size)
+{
+	grid.vertex_count = (size + 1) * (size + 1);
+	grid.index_count = size * size * 6;
+	grid.positions = new glm::vec3[grid.vertex_count];
+	grid.normals = new glm::vec3[grid.vertex_count];
+	grid.uvs = new glm::vec2[grid.vertex_count];
+	grid.indices = new uint32_t[grid.index_count];
+
+	for (uint32_t y = 0; y <= size; ++y)
+	{
+		for (uint32_t x = 0; x <= size; ++x)
+		{
+			uint32_t v = y * (size + 1) + x;
+			grid.positions[v] = glm::vec3(float(x), 0.0f, float(y));
+			grid.normals[v] = glm::vec3(0.0f, 1.0f, 0.0f);
+			grid.uvs[v] = glm::vec2(float(v), 0.0f);
+		}
+	}
+
+	uint32_t* triangle = grid.indices;
+	for (uint32_t y = 0; y < size; ++y)
+	{
+		for (uint32_t x = 0; x < size; ++x)
+		{
+			uint32_t v = y * (size + 1) + x;
+			triangle[0] = v;
+			triangle[1] = v + size + 1;
+			triangle[2] = v + 1;
+			triangle[3] = v + 1;
+			triangle[4] = v + size + 1;
+			triangle[5] = v + size + 2;
+			triangle += 6;
+		}
+	}
+
+	// Fisher-Yates over the triangles, with a fixed seed so every run
+	// measures the same input
+	uint32_t triangle_count = grid.index_count / 3;
+	uint32_t seed = 12345;
+	for (uint32_t i = triangle_count - 1; i > 0; --i)
+	{
+		seed = seed * 1664525 + 1013904223;
+		uint32_t j = seed % (i + 1);
+		for (uint32_t k = 0; k < 3; ++k)
+		{
+			std::swap(grid.indices[i * 3 + k], grid.indices[j * 3 + k]);
+		}
+	}
+}
+
+struct Triangle
+{
+	uint32_t v[3];
+
+	bool operator<(const Triangle& other) const
+	{
+		if (v[0] != other.v[0])
+			return v[0] < other.v[0];
+		if (v[1] != other.v[1])
+			return v[1] < other.v[1];
+		return v[2] < other.v[2];
+	}
+};
+
+// The triangles of a primitive by original vertex id, rotated so the
+// smallest id comes first (which keeps the winding) and sorted
+static Triangle* sorted_triangles(const uint32_t* indices, uint32_t index_count, const glm::vec2* uvs)
+{
+	uint32_t triangle_count = index_count / 3;
+	Triangle* triangles = new Triangle[triangle_count];
+	for (uint32_t i = 0; i < triangle_count; ++i)
+	{
+		uint32_t ids[3];
+		for (uint32_t k = 0; k < 3; ++k)
+		{
+			ids[k] = uint32_t(uvs[indices[i * 3 + k]].x);
+		}
+
+		uint32_t first = ids[0] < ids[1] ? (ids[0] < ids[2] ? 0 : 2) : (ids[1] < ids[2] ? 1 : 2);
+		for (uint32_t k = 0; k < 3; ++k)
+		{
+			triangles[i].v[k] = ids[(first + k) % 3];
+		}
+	}
+
+	std::sort(triangles, triangles + triangle_count);
+	return triangles;
+}
+
+int mesh_optimizer(int argc, char** argv)
+{
+	uint32_t size = 64;
+	uint32_t iteration_count = 10;
+	for (int i = 0; i + 1 < argc; i += 2)
+	{
+		if (strcmp(argv[i], "--size") == 0)
+		{
+			size = (uint32_t)atoi(argv[i + 1]);
+		}
+		else if (strcmp(argv[i], "--iterations") == 0)
+		{
+			iteration_count = (uint32_t)atoi(argv[i + 1]);
+		}
+	}
+
+	size = size < 1 ? 1 : size;
+	iteration_count = iteration_count < 1 ? 1 : iteration_count;
+
+	Grid reference = {};
+	make_grid(reference, size);
+	Triangle* reference_triangles = sorted_triangles(reference.indices, reference.index_count, reference.uvs);
+
+	uint32_t* tipsify_indices = new uint32_t[reference.index_count];
+	MeshOptimizer::optimize_vertex_cache(tipsify_indices, reference.indices, reference.index_count, reference.vertex_count);
+	VertexCacheStats tipsify = MeshOptimizer::analyze_vertex_cache(tipsify_indices, reference.index_count, reference.vertex_count);
+	delete[] tipsify_indices;
+
+	Timings timings = {};
+	VertexCacheStats before = {};
+	VertexCacheStats after = {};
+	bool same = true;
+
+	for (uint32_t iteration = 0; iteration < iteration_count; ++iteration)
+	{
+		Grid grid = {};
+		make_grid(grid, size);
+
+		auto begin = std::chrono::high_resolution_clock::now();
+		MeshOptimizer::optimize_primitive(grid.indices, grid.index_count, grid.positions, grid.normals, grid.uvs, grid.vertex_count, &before, &after);
+		auto end = std::chrono::high_resolution_clock::now();
+		timings.add(std::chrono::duration<double, std::milli>(end - begin).count());
+
+		// Every run optimizes the same input, checking the first is enough
+		if (iteration == 0)
+		{
+			Triangle* triangles = sorted_triangles(grid.indices, grid.index_count, grid.uvs);
+			same = memcmp(triangles, reference_triangles, sizeof(Triangle) * (grid.index_count / 3)) == 0;
+			delete[] triangles;
+		}
+
+		grid.release();
+	}
+
+	printf("[Benchmark]: mesh_optimizer: %ux%u grid, %u triangles, %u vertices, %u iterations\n", size, size, reference.index_count / 3, reference.vertex_count, iteration_count);
+	printf("[Benchmark]:   optimize_primitive: best %.3f ms, average %.3f ms\n", timings.best, timings.total / iteration_count);
+	printf("[Benchmark]:   ACMR: shuffled %.3f, Tipsify %.3f, optimized %.3f\n", before.acmr(), tipsify.acmr(), after.acmr());
+	printf("[Benchmark]:   ATVR: shuffled %.3f, Tipsify %.3f, optimized %.3f\n", before.atvr(), tipsify.atvr(), after.atvr());
+	printf("[Benchmark]:   triangles %s\n", same ? "match" : "DO NOT MATCH");
+
+	delete[] reference_triangles;
+	reference.release();
+
+	return same ? 0 : 1;
+}
+
+} // namespace Benchmarks
@@ -0,0 +1,198 @@
+#include "synthetic_glb.h"
+#include "tools.h"
+#include "../resources/resources.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+namespace Benchmarks
+{
+
+using namespace Resources;
+
+static void append_bytes(Table<uint8_t>& bytes, const void* data, size_t size)
+{
+	bytes.reserve(bytes.count + size);
+	memcpy(bytes.data + bytes.count, data, size);
+	bytes.count += size;
+}
+
+static void pad(Table<uint8_t>& bytes, uint8_t value)
+{
+	while (bytes.count % 4 != 0)
+	{
+		append_bytes(bytes, &value, 1);
+	}
+}
+
+size_t write_synthetic_glb(const char* path, const SyntheticGlbParams& params)
+{
+	uint32_t mesh_count = params.mesh_count < 1 ? 1 : params.mesh_count;
+	uint32_t material_count = params.material_count < 1 ? 1 : params.material_count;
+
+	// A side x side grid of vertices, at least one quad
+	uint32_t side = (uint32_t)sqrt(double(params.vertex_count));
+	side = side < 2 ? 2 : side;
+	uint32_t vertex_count = side * side;
+	uint32_t index_count = (side - 1) * (side - 1) * 6;
+	bool wide_indices = vertex_count > 65536;
+	uint32_t index_size = wide_indices ? 4 : 2;
+
+	uint32_t position_size = vertex_count * 12;
+	uint32_t normal_size = vertex_count * 12;
+	uint32_t uv_size = vertex_count * 8;
+	uint32_t indices_size = (index_count * index_size + 3) & ~3u;
+	uint32_t mesh_size = position_size + normal_size + uv_size + indices_size;
+
+	// Every mesh gets its own height field, so that no two meshes are
+	// identical and the loader can't deduplicate them
+	Table<uint8_t> bin = {};
+	bin.reserve(size_t(mesh_size) * mesh_count);
+	for (uint32_t mesh = 0; mesh < mesh_count; ++mesh)
+	{
+		float phase = float(mesh) * 0.37f;
+		for (uint32_t y = 0; y < side; ++y)
+		{
+			for (uint32_t x = 0; x < side; ++x)
+			{
+				float u = float(x) / float(side - 1);
+				float v = float(y) / float(side - 1);
+				float position[3] = { u, 0.2f * sinf(u * 6.0f + phase) * cosf(v * 6.0f), v };
+				append_bytes(bin, position, sizeof(position));
+			}
+		}
+
+		for (uint32_t i = 0; i < vertex_count; ++i)
+		{
+			float normal[3] = { 0.0f, 1.0f, 0.0f };
+			append_bytes(bin, normal, sizeof(normal));
+		}
+
+		for (uint32_t y = 0; y < side; ++y)
+		{
+			for (uint32_t x = 0; x < side; ++x)
+			{
+				float uv[2] = { float(x) / float(side - 1), float(y) / float(side - 1) };
+				append_bytes(bin, uv, sizeof(uv));
+			}
+		}
+
+		for (uint32_t y = 0; y + 1 < side; ++y)
+		{
+			for (uint32_t x = 0; x + 1 < side; ++x)
+			{
+				uint32_t a = y * side + x;
+				uint32_t c = a + side;
+				uint32_t quad[6] = { a, c, a + 1, a + 1, c, c + 1 };
+				for (uint32_t i = 0; i < 6; ++i)
+				{
+					if (wide_indices)
+					{
+						append_bytes(bin, &quad[i], 4);
+					}
+					else
+					{
+						uint16_t index = (uint16_t)quad[i];
+						append_bytes(bin, &index, 2);
+					}
+				}
+			}
+		}
+		pad(bin, 0);
+	}
+
+	TextWriter writer = {};
+	writer.print("{\"asset\":{\"version\":\"2.0\",\"generator\":\"loader_benchmark\"},\"scene\":0,");
+
+	// A single root node, parent of one node per mesh
+	writer.print("\"scenes\":[{\"name\":\"Scene\",\"nodes\":[0]}],");
+
+	writer.print("\"nodes\":[{\"name\":\"root\",\"scale\":[2.0,2.0,2.0],\"children\":[");
+	for (uint32_t i = 0; i < mesh_count; ++i)
+	{
+		writer.print(i > 0 ? ",%u" : "%u", i + 1);
+	}
+	writer.print("]}");
+	for (uint32_t i = 0; i < mesh_count; ++i)
+	{
+		writer.print(",{\"name\":\"node_%u\",\"mesh\":%u,\"translation\":[%f,0.0,%f]}", i, i, float(i % 16) * 1.5f, float(i / 16) * 1.5f);
+	}
+	writer.print("],");
+
+	writer.print("\"meshes\":[");
+	for (uint32_t i = 0; i < mesh_count; ++i)
+	{
+		writer.print("%s{\"name\":\"mesh_%u\",\"primitives\":[{\"attributes\":{\"POSITION\":%u,\"NORMAL\":%u,\"TEXCOORD_0\":%u},\"indices\":%u,\"material\":%u,\"mode\":4}]}",
+			i > 0 ? "," : "", i, i * 4, i * 4 + 1, i * 4 + 2, i * 4 + 3, i % material_count);
+	}
+	writer.print("],");
+
+	writer.print("\"materials\":[");
+	for (uint32_t i = 0; i < material_count; ++i)
+	{
+		writer.print("%s{\"name\":\"material_%u\",\"pbrMetallicRoughness\":{\"baseColorFactor\":[%f,0.5,0.25,1.0],\"metallicFactor\":0.5,\"roughnessFactor\":0.75}}",
+			i > 0 ? "," : "", i, float(i) / float(material_count));
+	}
+	writer.print("],");
+
+	writer.print("\"accessors\":[");
+	for (uint32_t i = 0; i < mesh_count; ++i)
+	{
+		writer.print("%s{\"bufferView\":%u,\"componentType\":5126,\"count\":%u,\"type\":\"VEC3\",\"min\":[0.0,-0.2,0.0],\"max\":[1.0,0.2,1.0]},", i > 0 ? "," : "", i * 4, vertex_count);
+		writer.print("{\"bufferView\":%u,\"componentType\":5126,\"count\":%u,\"type\":\"VEC3\"},", i * 4 + 1, vertex_count);
+		writer.print("{\"bufferView\":%u,\"componentType\":5126,\"count\":%u,\"type\":\"VEC2\"},", i * 4 + 2, vertex_count);
+		writer.print("{\"bufferView\":%u,\"componentType\":%u,\"count\":%u,\"type\":\"SCALAR\"}", i * 4 + 3, wide_indices ? 5125 : 5123, index_count);
+	}
+	writer.print("],");
+
+	writer.print("\"bufferViews\":[");
+	for (uint32_t i = 0; i < mesh_count; ++i)
+	{
+		size_t offset = size_t(i) * mesh_size;
+		writer.print("%s{\"buffer\":0,\"byteOffset\":%zu,\"byteLength\":%u,\"target\":34962},", i > 0 ? "," : "", offset, position_size);
+		writer.print("{\"buffer\":0,\"byteOffset\":%zu,\"byteLength\":%u,\"target\":34962},", offset + position_size, normal_size);
+		writer.print("{\"buffer\":0,\"byteOffset\":%zu,\"byteLength\":%u,\"target\":34962},", offset + position_size + normal_size, uv_size);
+		writer.print("{\"buffer\":0,\"byteOffset\":%zu,\"byteLength\":%u,\"target\":34963}", offset + position_size + normal_size + uv_size, index_count * index_size);
+	}
+	writer.print("],");
+
+	writer.print("\"buffers\":[{\"byteLength\":%zu}]}", bin.count);
+
+	// GLB: a 12 byte header, then the JSON chunk padded with spaces and the
+	// BIN chunk, both 4 byte aligned
+	Table<uint8_t> json = {};
+	append_bytes(json, writer.text.data, writer.text.count);
+	pad(json, ' ');
+	writer.text.release();
+
+	uint32_t total_size = uint32_t(12 + 8 + json.count + 8 + bin.count);
+	uint32_t header[3] = { 0x46546C67, 2, total_size };
+	uint32_t json_header[2] = { uint32_t(json.count), 0x4E4F534A };
+	uint32_t bin_header[2] = { uint32_t(bin.count), 0x004E4942 };
+
+	size_t written = 0;
+	FILE* file = fopen(path, "wb");
+	if (file != nullptr)
+	{
+		written += fwrite(header, 1, sizeof(header), file);
+		written += fwrite(json_header, 1, sizeof(json_header), file);
+		written += fwrite(json.data, 1, json.count, file);
+		written += fwrite(bin_header, 1, sizeof(bin_header), file);
+		written += fwrite(bin.data, 1, bin.count, file);
+		fclose(file);
+	}
+
+	json.release();
+	bin.release();
+
+	if (written != total_size)
+	{
+		printf("[Benchmark]: Could not write %s\n", path);
+		return 0;
+	}
+
+	return written;
+}
+
+} // namespace Benchmarks
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+namespace Benchmarks
+{
+
+struct SyntheticGlbParams
+{
+	uint32_t mesh_count = 64;
+	// Vertices of each mesh, rounded down to a square grid
+	uint32_t vertex_count = 16384;
+	uint32_t material_count = 8;
+};
+
+// Writes a GLB file with mesh_count distinct grid meshes, each with one
+// primitive (positions, normals, uvs and indices) and a material picked
+// round robin among material_count distinct ones. Every mesh has its own
+// node, child of a single root node. Returns the size of the file, 0 on
+// failure.
+size_t write_synthetic_glb(const char* path, const SyntheticGlbParams& params);
+
+} // namespace Benchmarks
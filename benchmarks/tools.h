@@ -0,0 +1,46 @@
+#pragma once
+
+#include "../resources/resources.h"
+
+#include <stdio.h>
+#include <stdarg.h>
+
+namespace Benchmarks
+{
+
+// A growing string, the synthetic documents are written with printf
+struct TextWriter
+{
+	Resources::Table<char> text;
+
+	void print(const char* format, ...)
+	{
+		va_list arguments;
+		va_start(arguments, format);
+		int length = vsnprintf(nullptr, 0, format, arguments);
+		va_end(arguments);
+
+		// NOTE: vsnprintf always writes the null terminator, it is
+		// overwritten by the next print
+		text.reserve(text.count + length + 1);
+		va_start(arguments, format);
+		vsnprintf(text.data + text.count, length + 1, format, arguments);
+		va_end(arguments);
+		text.count += length;
+	}
+};
+
+// Best and total time of the iterations of a benchmark
+struct Timings
+{
+	double best = 0.0;
+	double total = 0.0;
+
+	void add(double milliseconds)
+	{
+		best = total == 0.0 || milliseconds < best ? milliseconds : best;
+		total += milliseconds;
+	}
+};
+
+} // namespace Benchmarks
@@ -1,8 +1,17 @@
 %VULKAN_SDK%\Bin\glslangValidator.exe -V data\shaders\static_entity.vert -o data\shaders\static_entity.vert.spv
+%VULKAN_SDK%\Bin\glslangValidator.exe -V data\shaders\static_entity_quantized.vert -o data\shaders\static_entity_quantized.vert.spv
 %VULKAN_SDK%\Bin\glslangValidator.exe -V data\shaders\static_entity.frag -o data\shaders\static_entity.frag.spv
 %VULKAN_SDK%\Bin\glslangValidator.exe -V data\shaders\dynamic_entity.vert -o data\shaders\dynamic_entity.vert.spv
+%VULKAN_SDK%\Bin\glslangValidator.exe -V data\shaders\dynamic_entity_quantized.vert -o data\shaders\dynamic_entity_quantized.vert.spv
 %VULKAN_SDK%\Bin\glslangValidator.exe -V data\shaders\dynamic_entity.frag -o data\shaders\dynamic_entity.frag.spv
 %VULKAN_SDK%\Bin\glslangValidator.exe -V data\shaders\debug_draw.vert -o data\shaders\debug_draw.vert.spv
 %VULKAN_SDK%\Bin\glslangValidator.exe -V data\shaders\debug_draw.frag -o data\shaders\debug_draw.frag.spv
 %VULKAN_SDK%\Bin\glslangValidator.exe -V data\shaders\ui.vert -o data\shaders\ui.vert.spv
 %VULKAN_SDK%\Bin\glslangValidator.exe -V data\shaders\ui.frag -o data\shaders\ui.frag.spv
+%VULKAN_SDK%\Bin\glslangValidator.exe -V data\shaders\cull_meshlets.comp -o data\shaders\cull_meshlets.comp.spv
+%VULKAN_SDK%\Bin\glslangValidator.exe -V data\shaders\entity_indirect.vert -o data\shaders\entity_indirect.vert.spv
+%VULKAN_SDK%\Bin\glslangValidator.exe -V data\shaders\entity_indirect_quantized.vert -o data\shaders\entity_indirect_quantized.vert.spv
+%VULKAN_SDK%\Bin\glslangValidator.exe -V data\shaders\entity_indirect.frag -o data\shaders\entity_indirect.frag.spv
+%VULKAN_SDK%\Bin\glslangValidator.exe -V data\shaders\cull_instances.comp -o data\shaders\cull_instances.comp.spv
+%VULKAN_SDK%\Bin\glslangValidator.exe -V data\shaders\depth_reduce.comp -o data\shaders\depth_reduce.comp.spv
+%VULKAN_SDK%\Bin\glslangValidator.exe -V data\shaders\depth_reduce_ms.comp -o data\shaders\depth_reduce_ms.comp.spv
@@ -0,0 +1,59 @@
+#version 450
+#extension GL_ARB_shader_draw_parameters : require
+
+layout (set = 0, binding = 0) uniform ViewUniformBufferObject
+{
+	mat4 view;
+	mat4 projection;
+	vec3 camera_position;
+} ubo;
+
+// One per instance of the draw: a node of an entity
+// NOTE: Matches Renderer::Instance
+struct Instance
+{
+	mat4 model;
+	vec4 position_offset;
+	vec4 position_scale;
+};
+
+layout (std430, set = 1, binding = 0) readonly buffer Instances
+{
+	Instance instances[];
+};
+
+layout (location = 0) in vec3 in_position;
+layout (location = 1) in vec3 in_normal;
+layout (location = 2) in vec2 in_tex_coord_0;
+
+layout (location = 0) out vec3 out_world_position;
+layout (location = 1) out vec3 out_normal;
+layout (location = 2) out vec3 out_world_normal;
+layout (location = 3) out vec2 out_tex_coord_0;
+// Where the fragment shader finds the material of the draw
+layout (location = 4) flat out uint out_draw_id;
+
+// The draw data of the draws of an indirect call start at first_draw
+layout (push_constant) uniform DrawParams
+{
+	uint first_draw;
+} draw_params;
+
+void main()
+{
+	Instance instance = instances[gl_InstanceIndex];
+	mat4 model = instance.model;
+
+	vec4 local_position = model * vec4(in_position, 1.0f);
+
+	out_world_position = local_position.xyz / local_position.w;
+	out_normal = in_normal;
+	// Transform the normal from object space to world space
+	// TODO: Maybe add why we're inverting, transposing and normalizing
+	out_world_normal = normalize(transpose(inverse(mat3(model))) * in_normal);
+
+	out_tex_coord_0 = in_tex_coord_0;
+	out_draw_id = draw_params.first_draw + gl_DrawIDARB;
+
+	gl_Position = ubo.projection * ubo.view * local_position;
+}
@@ -0,0 +1,70 @@
+#version 450
+#extension GL_GOOGLE_include_directive : require
+#extension GL_ARB_shader_draw_parameters : require
+
+layout (set = 0, binding = 0) uniform ViewUniformBufferObject
+{
+	mat4 view;
+	mat4 projection;
+	vec3 camera_position;
+} ubo;
+
+// One per instance of the draw: a node of an entity
+// NOTE: Matches Renderer::Instance
+struct Instance
+{
+	mat4 model;
+	// Bounds of the mesh, to decode the positions
+	vec4 position_offset;
+	vec4 position_scale;
+};
+
+layout (std430, set = 1, binding = 0) readonly buffer Instances
+{
+	Instance instances[];
+};
+
+// NOTE: Quantized vertex format, see Resources::VertexQuantizer
+// R16G16B16A16_UNORM: position relative to the mesh bounds
+layout (location = 0) in vec4 in_position;
+// R16G16_SNORM: octahedral encoded normal
+layout (location = 1) in vec2 in_normal;
+// R16G16_SFLOAT
+layout (location = 2) in vec2 in_tex_coord_0;
+
+#include "quantized_vertex.glsl"
+
+layout (location = 0) out vec3 out_world_position;
+layout (location = 1) out vec3 out_normal;
+layout (location = 2) out vec3 out_world_normal;
+layout (location = 3) out vec2 out_tex_coord_0;
+// Where the fragment shader finds the material of the draw
+layout (location = 4) flat out uint out_draw_id;
+
+// The draw data of the draws of an indirect call start at first_draw
+layout (push_constant) uniform DrawParams
+{
+	uint first_draw;
+} draw_params;
+
+void main()
+{
+	Instance instance = instances[gl_InstanceIndex];
+	mat4 model = instance.model;
+
+	vec3 position = dequantize_position(in_position, instance.position_offset, instance.position_scale);
+	vec3 normal = decode_octahedral(in_normal);
+
+	vec4 local_position = model * vec4(position, 1.0f);
+
+	out_world_position = local_position.xyz / local_position.w;
+	out_normal = normal;
+	// Transform the normal from object space to world space with the inverse
+	// transpose, which undoes non uniform scales, and normalize it back
+	out_world_normal = normalize(transpose(inverse(mat3(model))) * normal);
+
+	out_tex_coord_0 = in_tex_coord_0;
+	out_draw_id = draw_params.first_draw + gl_DrawIDARB;
+
+	gl_Position = ubo.projection * ubo.view * local_position;
+}
@@ -0,0 +1,21 @@
+// Decoding of the quantized vertex format, see Resources::VertexQuantizer
+// NOTE: Texture coordinates are R16G16_SFLOAT and need no decoding,
+// the input assembler already returns them as floats
+
+// in_position is R16G16B16A16_UNORM, relative to the bounds of the mesh
+vec3 dequantize_position(vec4 position, vec4 position_offset, vec4 position_scale)
+{
+	return position_offset.xyz + position.xyz * position_scale.xyz;
+}
+
+// in_normal is R16G16_SNORM, the normal projected on an octahedron and
+// the octahedron unfolded on a square
+vec3 decode_octahedral(vec2 encoded)
+{
+	vec3 normal = vec3(encoded, 1.0f - abs(encoded.x) - abs(encoded.y));
+	// Unfold the lower half of the octahedron
+	float fold = max(-normal.z, 0.0f);
+	normal.x += normal.x >= 0.0f ? -fold : fold;
+	normal.y += normal.y >= 0.0f ? -fold : fold;
+	return normalize(normal);
+}
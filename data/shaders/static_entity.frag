@@ -4,6 +4,7 @@
 layout (location = 0) in vec3 in_world_position;
 layout (location = 1) in vec3 in_normal;
 layout (location = 2) in vec3 in_world_normal;
+layout (location = 3) in vec2 in_tex_coord_0;
 
 layout (set = 0, binding = 0) uniform ViewUniformBufferObject
 {
@@ -12,6 +13,8 @@ layout (set = 0, binding = 0) uniform ViewUniformBufferObject
 	vec3 camera_position;
 } ubo;
 
+layout (set = 2, binding = 0) uniform sampler2D base_color_texture;
+
 layout(location = 0) out vec4 outFragColor;
 
 // Normal Distribution Function
@@ -34,15 +37,16 @@ void main()
 	vec3 light_position = vec3(0.0f, 5.0f, 0.0f);
 	vec4 light_color = vec4(1.0f, 1.0f, 1.0f, 1.0f);
 
-	// TODO: Compute the albedo form the albedo map once we have one
-	vec3 albedo = material.baseColorFormat.rgb;
+	// The base color texture is sRGB, sampling returns linear values.
+	// Materials without one sample a white texture.
+	vec3 albedo = material.baseColorFormat.rgb * texture(base_color_texture, in_tex_coord_0).rgb;
 
     vec3 N = normalize(in_world_normal);
 	vec3 V = normalize(ubo.camera_position - in_world_position);
 
 	// Precomputing F0
 	vec3 F0 = vec3(0.04f);
-	F0 = mix(F0, material.baseColorFormat.rgb, material.metallicFactor);
+	F0 = mix(F0, albedo, material.metallicFactor);
 
 	// Reflectance equation
 	// calculate direct-light radiance
@@ -135,7 +135,7 @@ void Simulation::update(Game::State* game_state, uint32_t simulation_frame_index
 				game_state->player_matrices[game_state->player_body_part_count++] = glm::translate(glm::mat4(1.0f), player_body_position);
 				// assert(game_state->entity_count == ++transform_offset);
 
-				renderer->upload_dynamic_uniform_buffers(game_state, game_state->entity_count - 1, game_state->entity_count);
+				renderer->add_entities(game_state, game_state->entity_count - 1, game_state->entity_count);
 			}
 		}
 
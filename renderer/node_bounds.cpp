@@ -0,0 +1,152 @@
+#include "node_bounds.h"
+
+#include <float.h>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(_M_X64) || defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace Renderer
+{
+
+void NodeBounds::append(uint32_t node_count)
+{
+	size_t first = center_x.append(node_count);
+	center_y.append(node_count);
+	center_z.append(node_count);
+	radius.append(node_count);
+	visible.append(node_count);
+
+	for (size_t i = first; i < first + node_count; ++i)
+	{
+		center_x.data[i] = 0.0f;
+		center_y.data[i] = 0.0f;
+		center_z.data[i] = 0.0f;
+		radius.data[i] = -FLT_MAX;
+		visible.data[i] = 0;
+	}
+}
+
+void NodeBounds::set(uint32_t node_slot, const glm::vec4& sphere)
+{
+	center_x[node_slot] = sphere.x;
+	center_y[node_slot] = sphere.y;
+	center_z[node_slot] = sphere.z;
+	radius[node_slot] = sphere.w;
+}
+
+// A sphere is visible when it isn't entirely behind any of the planes
+static bool is_sphere_visible(const glm::vec4 frustum_planes[6], float x, float y, float z, float r)
+{
+	bool visible = true;
+	for (uint32_t p = 0; p < 6; ++p)
+	{
+		const glm::vec4& plane = frustum_planes[p];
+		visible = visible && plane.x * x + plane.y * y + plane.z * z + plane.w > -r;
+	}
+
+	return visible;
+}
+
+void NodeBounds::cull(const glm::vec4 frustum_planes[6])
+{
+	size_t count = center_x.count;
+	size_t i = 0;
+	uint32_t mesh_count = 0;
+	visible_count = 0;
+
+#if defined(__AVX__)
+	// NOTE: Unaligned loads, the tables are not 32 bytes aligned
+	for (; i + 8 <= count; i += 8)
+	{
+		__m256 x = _mm256_loadu_ps(center_x.data + i);
+		__m256 y = _mm256_loadu_ps(center_y.data + i);
+		__m256 z = _mm256_loadu_ps(center_z.data + i);
+		__m256 r = _mm256_loadu_ps(radius.data + i);
+		__m256 negative_r = _mm256_sub_ps(_mm256_setzero_ps(), r);
+
+		__m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+		for (uint32_t p = 0; p < 6; ++p)
+		{
+			const glm::vec4& plane = frustum_planes[p];
+			__m256 distance = _mm256_add_ps(_mm256_mul_ps(x, _mm256_set1_ps(plane.x)), _mm256_set1_ps(plane.w));
+			distance = _mm256_add_ps(distance, _mm256_mul_ps(y, _mm256_set1_ps(plane.y)));
+			distance = _mm256_add_ps(distance, _mm256_mul_ps(z, _mm256_set1_ps(plane.z)));
+			inside = _mm256_and_ps(inside, _mm256_cmp_ps(distance, negative_r, _CMP_GT_OQ));
+		}
+
+		int visible_mask = _mm256_movemask_ps(inside);
+		int mesh_mask = _mm256_movemask_ps(_mm256_cmp_ps(r, _mm256_setzero_ps(), _CMP_GE_OQ));
+		for (uint32_t lane = 0; lane < 8; ++lane)
+		{
+			visible.data[i + lane] = uint8_t((visible_mask >> lane) & 1);
+			visible_count += uint32_t((visible_mask >> lane) & 1);
+			mesh_count += uint32_t((mesh_mask >> lane) & 1);
+		}
+	}
+#elif defined(_M_X64) || defined(__SSE2__)
+	for (; i + 4 <= count; i += 4)
+	{
+		__m128 x = _mm_loadu_ps(center_x.data + i);
+		__m128 y = _mm_loadu_ps(center_y.data + i);
+		__m128 z = _mm_loadu_ps(center_z.data + i);
+		__m128 r = _mm_loadu_ps(radius.data + i);
+		__m128 negative_r = _mm_sub_ps(_mm_setzero_ps(), r);
+
+		__m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+		for (uint32_t p = 0; p < 6; ++p)
+		{
+			const glm::vec4& plane = frustum_planes[p];
+			__m128 distance = _mm_add_ps(_mm_mul_ps(x, _mm_set1_ps(plane.x)), _mm_set1_ps(plane.w));
+			distance = _mm_add_ps(distance, _mm_mul_ps(y, _mm_set1_ps(plane.y)));
+			distance = _mm_add_ps(distance, _mm_mul_ps(z, _mm_set1_ps(plane.z)));
+			inside = _mm_and_ps(inside, _mm_cmpgt_ps(distance, negative_r));
+		}
+
+		int visible_mask = _mm_movemask_ps(inside);
+		int mesh_mask = _mm_movemask_ps(_mm_cmpge_ps(r, _mm_setzero_ps()));
+		for (uint32_t lane = 0; lane < 4; ++lane)
+		{
+			visible.data[i + lane] = uint8_t((visible_mask >> lane) & 1);
+			visible_count += uint32_t((visible_mask >> lane) & 1);
+			mesh_count += uint32_t((mesh_mask >> lane) & 1);
+		}
+	}
+#endif
+
+	// The nodes left over, or all of them without SIMD
+	for (; i < count; ++i)
+	{
+		bool node_visible = is_sphere_visible(frustum_planes, center_x.data[i], center_y.data[i], center_z.data[i], radius.data[i]);
+		visible.data[i] = node_visible ? 1 : 0;
+		visible_count += node_visible ? 1 : 0;
+		mesh_count += radius.data[i] >= 0.0f ? 1 : 0;
+	}
+
+	culled_count = mesh_count - visible_count;
+}
+
+void NodeBounds::show_all()
+{
+	visible_count = 0;
+	for (size_t i = 0; i < radius.count; ++i)
+	{
+		visible.data[i] = radius.data[i] >= 0.0f ? 1 : 0;
+		visible_count += visible.data[i];
+	}
+
+	culled_count = 0;
+}
+
+void NodeBounds::release()
+{
+	center_x.release();
+	center_y.release();
+	center_z.release();
+	radius.release();
+	visible.release();
+}
+
+} // namespace Renderer
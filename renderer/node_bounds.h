@@ -0,0 +1,37 @@
+#pragma once
+
+#include "../resources/resources.h"
+
+namespace Renderer
+{
+
+// World space bounding spheres of every node of every entity, indexed by
+// node slot (entity.node_offset + node). Each component has its own array
+// so that the frustum test goes through 8 spheres at a time with AVX, or 4
+// with SSE.
+// NOTE: Nodes without a mesh have a radius of -FLT_MAX, they are never
+// visible and never counted.
+struct NodeBounds
+{
+	Resources::Table<float> center_x;
+	Resources::Table<float> center_y;
+	Resources::Table<float> center_z;
+	Resources::Table<float> radius;
+	// 1 when the sphere of the node is at least partially in the frustum
+	Resources::Table<uint8_t> visible;
+
+	// Of the nodes with a mesh, after the last cull
+	uint32_t visible_count = 0;
+	uint32_t culled_count = 0;
+
+	// Appends the bounds of node_count nodes, without a mesh until set
+	void append(uint32_t node_count);
+	void set(uint32_t node_slot, const glm::vec4& sphere);
+	// frustum_planes point inside and are normalized
+	void cull(const glm::vec4 frustum_planes[6]);
+	// Marks every node with a mesh visible
+	void show_all();
+	void release();
+};
+
+} // namespace Renderer
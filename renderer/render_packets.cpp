@@ -0,0 +1,90 @@
+#include "render_packets.h"
+
+#include <algorithm>
+
+namespace Renderer
+{
+
+static bool packet_less(const RenderPacket& a, const RenderPacket& b)
+{
+	if (a.pipeline != b.pipeline)
+		return a.pipeline < b.pipeline;
+	if (a.mesh_id != b.mesh_id)
+		return a.mesh_id < b.mesh_id;
+	if (a.primitive_id != b.primitive_id)
+		return a.primitive_id < b.primitive_id;
+
+	return a.node_slot < b.node_slot;
+}
+
+bool RenderPacketList::same_primitive(const RenderPacket& a, const RenderPacket& b)
+{
+	return a.pipeline == b.pipeline && a.mesh_id == b.mesh_id && a.primitive_id == b.primitive_id;
+}
+
+void RenderPacketList::add_entities(const Game::State* game_state, uint32_t entity_id_offset, uint32_t entity_count)
+{
+	const Resources::AssetsInfo* assets_info = game_state->assets_info;
+
+	for (uint32_t e = entity_id_offset; e < entity_count; ++e)
+	{
+		const Entity& entity = game_state->entities[e];
+		const Resources::Model& model = assets_info->models[entity.model_id];
+
+		// NOTE: Dynamic entities get their model matrix from the player
+		// input every frame: the apple first, then the player body parts
+		RenderPacket packet = {};
+		if (e < game_state->apple_id)
+		{
+			packet.pipeline = RenderPipeline::Static;
+			packet.matrix_id = 0;
+		}
+		else
+		{
+			packet.pipeline = RenderPipeline::Dynamic;
+			packet.matrix_id = e == game_state->apple_id ? 0 : 1 + e - game_state->player_head_id;
+		}
+
+		for (uint32_t n = 0; n < model.node_count; ++n)
+		{
+			uint32_t mesh_id = assets_info->node_mesh_ids[model.node_offset + n];
+			if (mesh_id == Resources::no_mesh)
+				continue;
+
+			const Resources::Mesh& mesh = assets_info->meshes[mesh_id];
+			packet.node_slot = entity.node_offset + n;
+			packet.mesh_id = mesh_id;
+			packet.index_type = uint32_t(mesh.index_type);
+
+			for (uint32_t p = 0; p < mesh.primitive_count; ++p)
+			{
+				const Resources::Primitive& primitive = mesh.primitives[p];
+				packet.primitive_id = p;
+				packet.material_id = primitive.material_id;
+				packet.vertex_offset = primitive.vertex_offset;
+				packet.index_offset = primitive.index_offset;
+				packet.index_count = primitive.index_count;
+				packet.meshlet_offset = primitive.meshlet_offset;
+				packet.meshlet_count = primitive.meshlet_count;
+
+				packets.push(packet);
+			}
+		}
+	}
+
+	// NOTE: No two packets have the same node slot and primitive
+	std::sort(packets.data, packets.data + packets.count, packet_less);
+}
+
+void RenderPacketList::rebuild(const Game::State* game_state)
+{
+	packets.count = 0;
+	add_entities(game_state, 0, game_state->entity_count);
+}
+
+void RenderPacketList::release()
+{
+	packets.release();
+}
+
+} // namespace Renderer
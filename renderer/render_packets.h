@@ -0,0 +1,76 @@
+#pragma once
+
+#include "../game/state.h"
+#include "../resources/resources.h"
+
+namespace Renderer
+{
+
+enum RenderPipeline
+{
+	Static,
+	Dynamic
+};
+
+// Everything drawing one primitive of one node of an entity takes, so that
+// frames don't have to go through entities, models, nodes and meshes.
+// NOTE: The index and meshlet ranges are the primitive's LOD 0, the other
+// levels are looked up in the mesh when a node is drawn simplified.
+struct RenderPacket
+{
+	// RenderPipeline
+	uint32_t pipeline;
+	// Dynamic pipeline only: the entity matrix of the node, in
+	// Renderer::dynamic_matrices
+	uint32_t matrix_id;
+	// entity.node_offset + node: where the node lives in
+	// Renderer::node_matrices
+	uint32_t node_slot;
+	uint32_t mesh_id;
+	uint32_t primitive_id;
+	uint32_t material_id;
+	uint32_t index_type;
+	uint32_t vertex_offset;
+	uint32_t index_offset;
+	uint32_t index_count;
+	uint32_t meshlet_offset;
+	uint32_t meshlet_count;
+};
+
+// One draw of the primitive of a run of packets, with one instance per
+// packet. Built every frame from the packet list.
+struct InstancedDraw
+{
+	// The first packet of the run
+	uint32_t packet_id;
+	// In the instance buffer of the frame
+	uint32_t first_instance;
+	uint32_t instance_count;
+	// The most detailed level any of the instances needs
+	uint32_t lod;
+	// 0 when the normal cones of the meshlets are not valid in world space
+	// for one of the instances
+	uint32_t cone_culling;
+};
+
+// The packets of every entity, sorted by pipeline, mesh, primitive and
+// node slot. Packets that only differ by their node draw the same
+// primitive with the same material and are next to each other: each run
+// is drawn once, instanced. The runs of the primitives of a mesh have the
+// same nodes in the same order.
+// Packets are added when entities are, and rebuilt when a model changes.
+struct RenderPacketList
+{
+	Resources::Table<RenderPacket> packets;
+
+	// Adds the packets of the entities [entity_id_offset, entity_count),
+	// whose nodes must have their slots already (see entity.node_offset)
+	void add_entities(const Game::State* game_state, uint32_t entity_id_offset, uint32_t entity_count);
+	void rebuild(const Game::State* game_state);
+	void release();
+
+	// True when two packets draw the same primitive with the same pipeline
+	static bool same_primitive(const RenderPacket& a, const RenderPacket& b);
+};
+
+} // namespace Renderer
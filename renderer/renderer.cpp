@@ -2,6 +2,9 @@
 #include "../vulkan/shaders.h"
 #include <cassert>
 #include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <float.h>
 #include <algorithm>
 #include <chrono>
 
@@ -12,6 +15,7 @@
 
 #include "../application/stb_image.h"
 #include "../resources/resources.h"
+#include "../resources/texture_encoder.h"
 #include "../renderer/types.h"
 
 #include "../extern/imgui/imgui.h"
@@ -35,15 +39,51 @@ void Renderer::init()
 
 	create_descriptor_pool();
 	create_ubo_buffers();
+	create_cull_buffers();
+	create_instance_buffers();
 	prepare_uniform_buffers();
 
+	// NOTE: The culled draws are instanced, their first instance is only
+	// read from the indirect commands with drawIndirectFirstInstance
+	if (backend->device->context->gpu_enabled_features.drawIndirectFirstInstance != VK_TRUE)
+	{
+		printf("[Renderer]: drawIndirectFirstInstance is not supported, meshlet culling is off\n");
+		meshlet_culling = false;
+	}
+
+	const Vulkan::Context* context = backend->device->context;
+	if (context->gpu_enabled_features.multiDrawIndirect != VK_TRUE ||
+		context->gpu_enabled_features.drawIndirectFirstInstance != VK_TRUE ||
+		context->gpu_enabled_features.shaderSampledImageArrayDynamicIndexing != VK_TRUE ||
+		!context->shader_draw_parameters)
+	{
+		printf("[Renderer]: multi draw indirect is not supported, entities are drawn one by one\n");
+		multi_draw_indirect = false;
+	}
+
+	// NOTE: The visible instances are compacted into the instance buffer
+	// the indirect draws read
+	if (!multi_draw_indirect)
+	{
+		instance_culling = false;
+	}
+
+	if (instance_culling && !(context->gpu_properties.limits.sampledImageDepthSampleCounts & context->msaa_samples))
+	{
+		printf("[Renderer]: the depth buffer can't be sampled, occlusion culling is off\n");
+		occlusion_culling = false;
+	}
+
+	create_indirect_buffers();
+	create_instance_cull_buffers();
+
 	// Init frame resources
 	for (uint32_t i = 0; i < ARRAYSIZE(frames); ++i)
 	{
 		VkDeviceSize size = 1 * 1024 * 1024;
 		frames[i].debug_vertex_buffer = new Vulkan::Buffer(
 			backend->device->context->device,
-			backend->device->context->gpu,
+			backend->device->context->allocator,
 			VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
 			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
 			size);
@@ -79,7 +119,7 @@ void Renderer::init()
 
 	imgui_font = new Vulkan::Image(
 		backend->device->context->device,
-		backend->device->context->gpu,
+		backend->device->context->allocator,
 		{ (uint32_t)tex_width, (uint32_t)tex_height },
 		VK_FORMAT_R8G8B8A8_UNORM,
 		VK_SAMPLE_COUNT_1_BIT,
@@ -87,223 +127,1242 @@ void Renderer::init()
 		VK_IMAGE_TILING_OPTIMAL,
 		VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
 
-	Vulkan::Buffer* font_staging_buffer = new Vulkan::Buffer(
+	Vulkan::StagingSlice font_staging_slice = backend->device->allocate_staging(upload_size);
+	memcpy(font_staging_slice.data, font_data, upload_size);
+
+	backend->device->upload_buffer_to_image(font_staging_slice, imgui_font->image, VK_FORMAT_R8G8_UNORM, tex_width, tex_height, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+
+	VkSamplerCreateInfo sampler_ci = { VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO };
+	sampler_ci.magFilter = VK_FILTER_LINEAR;
+	sampler_ci.minFilter = VK_FILTER_LINEAR;
+	sampler_ci.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
+	sampler_ci.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	sampler_ci.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	sampler_ci.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	sampler_ci.borderColor = VK_BORDER_COLOR_FLOAT_OPAQUE_WHITE;
+	VkResult result = vkCreateSampler(backend->device->context->device, &sampler_ci, nullptr, &imgui_font_sampler);
+	assert(result == VK_SUCCESS);
+
+	// Descriptor Set Layout
+	VkDescriptorSetLayoutBinding imgui_set_layout_bindings[1];
+	imgui_set_layout_bindings[0] = {};
+	imgui_set_layout_bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	imgui_set_layout_bindings[0].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+	imgui_set_layout_bindings[0].binding = 0;
+	imgui_set_layout_bindings[0].descriptorCount = 1;
+	imgui_set_layout_bindings[0].pImmutableSamplers = nullptr;
+
+	VkDescriptorSetLayoutCreateInfo set_layout_ci = { VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO };
+	set_layout_ci.bindingCount = ARRAYSIZE(imgui_set_layout_bindings);
+	set_layout_ci.pBindings = imgui_set_layout_bindings;
+	result = vkCreateDescriptorSetLayout(backend->device->context->device, &set_layout_ci, nullptr, &imgui_descriptor_set_layout);
+	assert(result == VK_SUCCESS);
+
+	create_descriptor_set_layouts();
+	create_pipelines();
+}
+
+// The vertex streams of vertex_format, with their element sizes
+static void get_vertex_streams(const Resources::AssetsInfo* assets_info, Resources::VertexFormat vertex_format, const uint8_t* streams[3], VkDeviceSize strides[3])
+{
+	if (vertex_format == Resources::VertexFormat::Quantized)
+	{
+		streams[0] = (const uint8_t*)assets_info->quantized_positions.data;
+		streams[1] = (const uint8_t*)assets_info->quantized_normals.data;
+		streams[2] = (const uint8_t*)assets_info->quantized_uvs.data;
+		strides[0] = sizeof(Resources::QuantizedPosition);
+		strides[1] = sizeof(Resources::QuantizedNormal);
+		strides[2] = sizeof(Resources::QuantizedUv);
+	}
+	else
+	{
+		streams[0] = (const uint8_t*)assets_info->positions.data;
+		streams[1] = (const uint8_t*)assets_info->normals.data;
+		streams[2] = (const uint8_t*)assets_info->uvs.data;
+		strides[0] = sizeof(glm::vec3);
+		strides[1] = sizeof(glm::vec3);
+		strides[2] = sizeof(glm::vec2);
+	}
+}
+
+void Renderer::upload_buffers(const Game::State* game_state)
+{
+	const Resources::AssetsInfo* assets_info = game_state->assets_info;
+	size_t vertex_count = assets_info->vertex_count();
+	Vulkan::Device* device = backend->device;
+
+	// NOTE: Every table gets a region sized for the whole free space of its
+	// buffer rather than for its current content, so that reloaded models
+	// (see Resources::ModelReloader) can be uploaded without moving
+	// anything: the capacities bound the tables on the CPU side.
+
+	// Vertex streams of vertex_format, one region each in the Vertex Buffer
+	const uint8_t* streams[ARRAYSIZE(vertex_stream_offsets)];
+	VkDeviceSize stream_strides[ARRAYSIZE(vertex_stream_offsets)];
+	get_vertex_streams(assets_info, vertex_format, streams, stream_strides);
+
+	VkDeviceSize vertex_stride = 0;
+	for (uint32_t i = 0; i < ARRAYSIZE(vertex_stream_offsets); ++i)
+	{
+		vertex_stride += stream_strides[i];
+	}
+
+	vertex_capacity = uint32_t((device->vertex_buffer->size - device->vertex_head_cursor) / vertex_stride);
+	assert(vertex_count <= vertex_capacity && "The vertices don't fit in the vertex buffer");
+
+	VkDeviceSize vertex_data_size = 0;
+	for (uint32_t i = 0; i < ARRAYSIZE(vertex_stream_offsets); ++i)
+	{
+		vertex_stream_offsets[i] = device->reserve_vertex_buffer(stream_strides[i] * vertex_capacity);
+
+		VkDeviceSize stream_size = stream_strides[i] * vertex_count;
+		if (stream_size == 0)
+			continue;
+
+		Vulkan::StagingSlice vertex_staging_slice = device->allocate_staging(stream_size);
+		memcpy(vertex_staging_slice.data, streams[i], stream_size);
+
+		device->update_vertex_buffer(vertex_staging_slice, vertex_stream_offsets[i]);
+		vertex_data_size += stream_size;
+	}
+
+	bool quantized = vertex_format == Resources::VertexFormat::Quantized;
+	printf("[Renderer]: Uploaded %zu %s vertices, %.1f KB, room for %u\n", vertex_count, quantized ? "quantized" : "float", double(vertex_data_size) / 1024.0, vertex_capacity);
+
+	// Both index tables share the Index Buffer, each one gets its content
+	// and half of the space left. 32 bit indices go first, so both tables
+	// start at an offset aligned to their index size.
+	VkDeviceSize indices32_size = sizeof(Resources::Index32) * assets_info->indices32.count;
+	VkDeviceSize indices16_size = sizeof(Resources::Index16) * assets_info->indices16.count;
+	VkDeviceSize free_index_size = device->index_buffer->size - device->index_head_cursor;
+	assert(indices32_size + indices16_size <= free_index_size && "The indices don't fit in the index buffer");
+	VkDeviceSize spare_index_size = free_index_size - indices32_size - indices16_size;
+
+	index_capacities[Resources::IndexType::Uint32] = uint32_t((indices32_size + spare_index_size / 2) / sizeof(Resources::Index32));
+	index_table_offsets[Resources::IndexType::Uint32] = device->reserve_index_buffer(index_capacities[Resources::IndexType::Uint32] * sizeof(Resources::Index32));
+	assert(index_table_offsets[Resources::IndexType::Uint32] % sizeof(Resources::Index32) == 0);
+	if (indices32_size > 0)
+	{
+		Vulkan::StagingSlice index_staging_slice = device->allocate_staging(indices32_size);
+		memcpy(index_staging_slice.data, assets_info->indices32.data, indices32_size);
+
+		device->update_index_buffer(index_staging_slice, index_table_offsets[Resources::IndexType::Uint32]);
+	}
+
+	index_capacities[Resources::IndexType::Uint16] = uint32_t((device->index_buffer->size - device->index_head_cursor) / sizeof(Resources::Index16));
+	index_table_offsets[Resources::IndexType::Uint16] = device->reserve_index_buffer(index_capacities[Resources::IndexType::Uint16] * sizeof(Resources::Index16));
+	if (indices16_size > 0)
+	{
+		Vulkan::StagingSlice index_staging_slice = device->allocate_staging(indices16_size);
+		memcpy(index_staging_slice.data, assets_info->indices16.data, indices16_size);
+
+		device->update_index_buffer(index_staging_slice, index_table_offsets[Resources::IndexType::Uint16]);
+	}
+
+	// Meshlets, in the Storage Buffer
+	meshlet_capacity = uint32_t((device->storage_buffer->size - device->storage_head_cursor) / sizeof(Resources::Meshlet));
+	assert(assets_info->meshlets.count <= meshlet_capacity && "The meshlets don't fit in the storage buffer");
+	meshlet_buffer_size = sizeof(Resources::Meshlet) * meshlet_capacity;
+	meshlet_buffer_offset = device->reserve_storage_buffer(meshlet_buffer_size);
+
+	VkDeviceSize meshlet_data_size = sizeof(Resources::Meshlet) * assets_info->meshlets.count;
+	if (meshlet_data_size > 0)
+	{
+		Vulkan::StagingSlice meshlet_staging_slice = device->allocate_staging(meshlet_data_size);
+		memcpy(meshlet_staging_slice.data, assets_info->meshlets.data, meshlet_data_size);
+
+		device->update_storage_buffer(meshlet_staging_slice, meshlet_buffer_offset);
+	}
+
+	upload_textures(assets_info);
+	write_material_buffer(assets_info);
+
+	upload_token = device->submit_uploads();
+}
+
+static VkFormat get_texture_format(Resources::TextureFormat format)
+{
+	switch (format)
+	{
+	case Resources::TextureFormat::Bc1:
+		return VK_FORMAT_BC1_RGB_SRGB_BLOCK;
+	case Resources::TextureFormat::Bc3:
+		return VK_FORMAT_BC3_SRGB_BLOCK;
+	case Resources::TextureFormat::Bc5:
+		return VK_FORMAT_BC5_UNORM_BLOCK;
+	case Resources::TextureFormat::Bc7:
+		return VK_FORMAT_BC7_SRGB_BLOCK;
+	default:
+		return VK_FORMAT_R8G8B8A8_SRGB;
+	}
+}
+
+void Renderer::upload_textures(const Resources::AssetsInfo* assets_info)
+{
+	assert(assets_info->textures.count <= max_texture_count && "Too many textures");
+	texture_count = (uint32_t)assets_info->textures.count;
+
+	// NOTE: The mip chains are built by the loader, and block compressed by
+	// the package cook, here the levels are only copied, in the same upload
+	// batch as the geometry
+	size_t texture_data_size = 0;
+	for (uint32_t i = 0; i < texture_count; ++i)
+	{
+		const Resources::Texture& texture = assets_info->textures[i];
+		create_texture(i, texture, assets_info->texture_pixels.data + texture.pixel_offset);
+		texture_data_size += texture.pixel_size;
+	}
+
+	static const uint8_t white_pixel[4] = { 255, 255, 255, 255 };
+	Resources::Texture white_texture = { 1, 1, 1, 0, sizeof(white_pixel), Resources::TextureFormat::Rgba8 };
+	create_texture(max_texture_count, white_texture, white_pixel);
+
+	// Every element of the array is written, the ones past texture_count
+	// point to the white texture until a reload fills them
+	write_texture_array(0, max_texture_count + 1);
+
+	printf("[Renderer]: Uploaded %u textures, %.1f KB\n", texture_count, double(texture_data_size) / 1024.0);
+}
+
+void Renderer::create_texture(uint32_t texture_id, const Resources::Texture& texture, const uint8_t* pixels)
+{
+	assert(textures[texture_id] == nullptr);
+	assert((texture.format == Resources::TextureFormat::Rgba8 || backend->device->context->gpu_enabled_features.textureCompressionBC) && "Block compressed textures are not supported by the GPU, load the sources instead of the package");
+	textures[texture_id] = new Vulkan::Image(
 		backend->device->context->device,
-		backend->device->context->gpu,
-		VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-		upload_size);
+		backend->device->context->allocator,
+		{ texture.width, texture.height },
+		get_texture_format(texture.format),
+		VK_SAMPLE_COUNT_1_BIT,
+		VK_IMAGE_ASPECT_COLOR_BIT,
+		VK_IMAGE_TILING_OPTIMAL,
+		VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+		VK_SHARING_MODE_EXCLUSIVE, texture.mip_count);
+
+	backend->device->upload_image(textures[texture_id], pixels, texture.width, texture.height, Resources::TextureEncoder::block_extent(texture.format), Resources::TextureEncoder::block_size(texture.format));
+
+	VkResult result = allocate_descriptor_set(descriptor_set_layouts[2], texture_descriptor_sets[texture_id]);
+	assert(result == VK_SUCCESS);
+
+	VkDescriptorImageInfo image_info = {};
+	image_info.sampler = texture_sampler;
+	image_info.imageView = textures[texture_id]->image_view;
+	image_info.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+
+	VkWriteDescriptorSet descriptor_writes[1];
+	descriptor_writes[0] = { VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET };
+	descriptor_writes[0].dstSet = texture_descriptor_sets[texture_id];
+	descriptor_writes[0].dstBinding = 0;
+	descriptor_writes[0].dstArrayElement = 0;
+	descriptor_writes[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	descriptor_writes[0].descriptorCount = 1;
+	descriptor_writes[0].pImageInfo = &image_info;
+
+	vkUpdateDescriptorSets(backend->device->context->device, ARRAYSIZE(descriptor_writes), descriptor_writes, 0, nullptr);
+}
+
+void Renderer::destroy_textures()
+{
+	for (uint32_t i = 0; i <= max_texture_count; ++i)
+	{
+		if (textures[i] != nullptr)
+		{
+			textures[i]->destroy(backend->device->context->device);
+			delete textures[i];
+			textures[i] = nullptr;
+		}
+	}
+
+	texture_count = 0;
+}
+
+void Renderer::write_texture_array(uint32_t first, uint32_t count)
+{
+	if (!multi_draw_indirect || count == 0)
+		return;
+
+	if (texture_array_descriptor_set == VK_NULL_HANDLE)
+	{
+		VkResult result = allocate_descriptor_set(texture_array_descriptor_set_layout, texture_array_descriptor_set);
+		assert(result == VK_SUCCESS);
+	}
+
+	assert(first + count <= max_texture_count + 1);
+	VkDescriptorImageInfo image_infos[max_texture_count + 1];
+	for (uint32_t i = 0; i < count; ++i)
+	{
+		const Vulkan::Image* texture = textures[first + i] != nullptr ? textures[first + i] : textures[max_texture_count];
+		image_infos[i].sampler = texture_sampler;
+		image_infos[i].imageView = texture->image_view;
+		image_infos[i].imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	}
+
+	VkWriteDescriptorSet descriptor_writes[1];
+	descriptor_writes[0] = { VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET };
+	descriptor_writes[0].dstSet = texture_array_descriptor_set;
+	descriptor_writes[0].dstBinding = 0;
+	descriptor_writes[0].dstArrayElement = first;
+	descriptor_writes[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	descriptor_writes[0].descriptorCount = count;
+	descriptor_writes[0].pImageInfo = image_infos;
+
+	vkUpdateDescriptorSets(backend->device->context->device, ARRAYSIZE(descriptor_writes), descriptor_writes, 0, nullptr);
+}
+
+void Renderer::write_material_buffer(const Resources::AssetsInfo* assets_info)
+{
+	if (!multi_draw_indirect)
+		return;
+
+	assert(assets_info->materials.count <= max_material_count && "Too many materials");
+
+	material_buffer->map(backend->device->context->device);
+	IndirectMaterial* materials = (IndirectMaterial*) material_buffer->mapped;
+	for (size_t i = 0; i < assets_info->materials.count; ++i)
+	{
+		const Resources::Material& material = assets_info->materials[i];
+		materials[i].base_color_factor = material.pbr_metallic_roughness.base_color_factor;
+		materials[i].metallic_factor = material.pbr_metallic_roughness.metallic_factor;
+		materials[i].roughness_factor = material.pbr_metallic_roughness.roughness_factor;
+		materials[i].base_color_texture_id = material.base_color_texture_id != Resources::no_texture ? material.base_color_texture_id : max_texture_count;
+		materials[i].padding = 0;
+	}
+	material_buffer->unmap(backend->device->context->device);
+}
+
+void Renderer::bind_material_textures(VkCommandBuffer command_buffer, VkPipelineLayout pipeline_layout, const Resources::Material& material)
+{
+	uint32_t texture_id = material.base_color_texture_id != Resources::no_texture ? material.base_color_texture_id : max_texture_count;
+	if (bound_texture_id == texture_id)
+		return;
+
+	vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline_layout, 2, 1, &texture_descriptor_sets[texture_id], 0, nullptr);
+	bound_texture_id = texture_id;
+}
+
+void Renderer::bind_index_buffer(VkCommandBuffer command_buffer, Resources::IndexType index_type)
+{
+	if (bound_index_type == int32_t(index_type))
+		return;
+
+	VkIndexType vk_index_type = index_type == Resources::IndexType::Uint16 ? VK_INDEX_TYPE_UINT16 : VK_INDEX_TYPE_UINT32;
+	vkCmdBindIndexBuffer(command_buffer, backend->device->index_buffer->buffer, index_table_offsets[index_type], vk_index_type);
+	bound_index_type = int32_t(index_type);
+}
+
+void Renderer::bind_culled_index_buffer(VkCommandBuffer command_buffer, const Frame* frame)
+{
+	if (bound_index_type == culled_index_stream)
+		return;
+
+	vkCmdBindIndexBuffer(command_buffer, frame->cull_index_buffer->buffer, 0, VK_INDEX_TYPE_UINT32);
+	bound_index_type = culled_index_stream;
+}
+
+uint32_t Renderer::select_lod(const Frame* frame, const Game::State* game_state, const Resources::Mesh& mesh, const glm::mat4& model_matrix) const
+{
+	if (!lod_selection || mesh.lod_count <= 1)
+		return 0;
+
+	// Bounding sphere of the mesh in world space
+	float scale = glm::max(glm::length(glm::vec3(model_matrix[0])), glm::max(glm::length(glm::vec3(model_matrix[1])), glm::length(glm::vec3(model_matrix[2]))));
+	glm::vec3 center = glm::vec3(model_matrix * glm::vec4((mesh.bounds_min + mesh.bounds_max) * 0.5f, 1.0f));
+	float radius = glm::length(mesh.bounds_max - mesh.bounds_min) * 0.5f * scale;
+
+	// NOTE: The error is projected at the closest point of the sphere, so
+	// it never looks bigger than estimated
+	float distance = glm::length(center - game_state->current_camera->position) - radius;
+	if (distance <= 0.0f)
+		return 0;
+
+	float pixels_per_unit = frame->lod_projection_scale * scale / distance;
+
+	uint32_t lod = 0;
+	for (uint32_t level = 1; level < mesh.lod_count; ++level)
+	{
+		if (mesh.lod_errors[level] * pixels_per_unit > lod_error_threshold)
+			break;
+
+		lod = level;
+	}
+
+	return lod;
+}
+
+glm::mat4 Renderer::packet_model_matrix(const RenderPacket& packet) const
+{
+	if (packet.pipeline == RenderPipeline::Dynamic)
+		return dynamic_matrices[packet.matrix_id] * node_matrices[packet.node_slot];
+
+	return node_matrices[packet.node_slot];
+}
+
+// Bounding sphere of a mesh in world space: center and radius
+static glm::vec4 get_bounding_sphere(const Resources::Mesh& mesh, const glm::mat4& model_matrix)
+{
+	float scale = glm::max(glm::length(glm::vec3(model_matrix[0])), glm::max(glm::length(glm::vec3(model_matrix[1])), glm::length(glm::vec3(model_matrix[2]))));
+	glm::vec3 center = glm::vec3(model_matrix * glm::vec4((mesh.bounds_min + mesh.bounds_max) * 0.5f, 1.0f));
+	float radius = glm::length(mesh.bounds_max - mesh.bounds_min) * 0.5f * scale;
+	return glm::vec4(center, radius);
+}
+
+// World space frustum planes from a view projection matrix (Gribb and
+// Hartmann), for a 0 to 1 depth range. They point inside and are normalized.
+static void get_frustum_planes(const glm::mat4& view_projection, glm::vec4 planes[6])
+{
+	// Row i of the matrix is (m[0][i], m[1][i], m[2][i], m[3][i])
+	const glm::mat4& m = view_projection;
+	glm::vec4 rows[4];
+	for (uint32_t i = 0; i < 4; ++i)
+	{
+		rows[i] = glm::vec4(m[0][i], m[1][i], m[2][i], m[3][i]);
+	}
+
+	planes[0] = rows[3] + rows[0];
+	planes[1] = rows[3] - rows[0];
+	planes[2] = rows[3] + rows[1];
+	planes[3] = rows[3] - rows[1];
+	planes[4] = rows[2];
+	planes[5] = rows[3] - rows[2];
+	for (uint32_t i = 0; i < 6; ++i)
+	{
+		planes[i] /= glm::length(glm::vec3(planes[i]));
+	}
+}
 
-	void* mapped;
-	vkMapMemory(backend->device->context->device, font_staging_buffer->device_memory, 0, font_staging_buffer->size, 0, &mapped);
-	memcpy(mapped, font_data, upload_size);
-	vkUnmapMemory(backend->device->context->device, font_staging_buffer->device_memory);
+// The index and meshlet ranges of a level of the primitive of a packet
+static Resources::PrimitiveLod get_packet_lod(const Resources::AssetsInfo* assets_info, const RenderPacket& packet, uint32_t lod)
+{
+	if (lod == 0)
+		return { packet.index_offset, packet.index_count, packet.meshlet_offset, packet.meshlet_count };
+
+	return assets_info->meshes[packet.mesh_id].primitives[packet.primitive_id].lod(lod);
+}
 
-	backend->device->upload_buffer_to_image(font_staging_buffer->buffer, imgui_font->image, VK_FORMAT_R8G8_UNORM, tex_width, tex_height, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+void Renderer::draw_instanced(VkCommandBuffer command_buffer, const Frame* frame, const Resources::AssetsInfo* assets_info, const InstancedDraw& draw, uint32_t& cull_draw_id)
+{
+	const RenderPacket& packet = render_packets.packets[draw.packet_id];
+	Resources::PrimitiveLod primitive_lod = get_packet_lod(assets_info, packet, draw.lod);
+	lod_triangle_count += primitive_lod.index_count / 3 * draw.instance_count;
+	full_triangle_count += packet.index_count / 3 * draw.instance_count;
+	entity_draw_count++;
 
-	font_staging_buffer->destroy(backend->device->context->device);
+	if (primitive_lod.meshlet_count > 0 && cull_draw_id < frame->cull_draw_count)
+	{
+		bind_culled_index_buffer(command_buffer, frame);
+		vkCmdDrawIndexedIndirect(command_buffer, frame->cull_command_buffer->buffer, cull_draw_id * sizeof(VkDrawIndexedIndirectCommand), 1, sizeof(VkDrawIndexedIndirectCommand));
+		cull_draw_id++;
+		return;
+	}
+
+	bind_index_buffer(command_buffer, Resources::IndexType(packet.index_type));
+	vkCmdDrawIndexed(command_buffer, primitive_lod.index_count, draw.instance_count, primitive_lod.index_offset, packet.vertex_offset, draw.first_instance);
+}
+
+// NOTE: The normal cones of the meshlets are transformed by the model
+// matrix, which is only correct for rotations and uniform scales. Mirrored
+// nodes flip the winding.
+static bool has_valid_normal_cones(const glm::mat4& model_matrix)
+{
+	float scale_x = glm::length(glm::vec3(model_matrix[0]));
+	float scale_y = glm::length(glm::vec3(model_matrix[1]));
+	float scale_z = glm::length(glm::vec3(model_matrix[2]));
+	bool uniform_scale = fabsf(scale_x - scale_y) <= 0.01f * scale_x && fabsf(scale_x - scale_z) <= 0.01f * scale_x;
+	return uniform_scale && glm::determinant(glm::mat3(model_matrix)) > 0.0f;
+}
+
+void Renderer::prepare_instanced_draws(Frame* frame, const Game::State* game_state)
+{
+	const Resources::AssetsInfo* assets_info = game_state->assets_info;
+	const Resources::Table<RenderPacket>& packets = render_packets.packets;
+
+	instanced_draws.count = 0;
+	frame->instance_count = 0;
+	frame->cull_run_count = 0;
+
+	frame->instance_buffer->map(backend->device->context->device);
+	Instance* instances = (Instance*) frame->instance_buffer->mapped;
+	CullInstance* cull_instances = nullptr;
+	if (instance_culling)
+	{
+		frame->cull_instance_buffer->map(backend->device->context->device);
+		cull_instances = (CullInstance*) frame->cull_instance_buffer->mapped;
+	}
+
+	size_t run_begin = 0;
+	while (run_begin < packets.count)
+	{
+		const RenderPacket& packet = packets.data[run_begin];
+		size_t run_end = run_begin + 1;
+		while (run_end < packets.count && RenderPacketList::same_primitive(packet, packets.data[run_end]))
+		{
+			run_end++;
+		}
+
+		// NOTE: The nodes outside the frustum are not instances of the draw,
+		// the runs of the other primitives of the mesh leave out the same ones
+		uint32_t visible_count = 0;
+		for (size_t p = run_begin; p < run_end; ++p)
+		{
+			visible_count += node_bounds.visible[packets.data[p].node_slot];
+		}
+
+		if (visible_count == 0)
+		{
+			run_begin = run_end;
+			continue;
+		}
+
+		InstancedDraw draw = {};
+		draw.packet_id = uint32_t(run_begin);
+		draw.instance_count = visible_count;
+
+		// The other primitives of a mesh are drawn by the same nodes, in the
+		// same order, their instances are written once
+		const InstancedDraw* previous_draw = instanced_draws.count > 0 ? &instanced_draws.data[instanced_draws.count - 1] : nullptr;
+		const RenderPacket* previous_packet = previous_draw != nullptr ? &packets.data[previous_draw->packet_id] : nullptr;
+		if (previous_packet != nullptr && previous_packet->pipeline == packet.pipeline && previous_packet->mesh_id == packet.mesh_id)
+		{
+			assert(previous_draw->instance_count == draw.instance_count);
+			draw.first_instance = previous_draw->first_instance;
+			draw.lod = previous_draw->lod;
+			draw.cone_culling = previous_draw->cone_culling;
+		}
+		else
+		{
+			// NOTE: The remaining draws are dropped for this frame, reported
+			// once so the log isn't flooded every frame
+			if (frame->instance_count + draw.instance_count > max_instance_count)
+			{
+				if (!instance_overflow_reported)
+				{
+					printf("[Renderer]: The instance buffer is full (%u instances), some entities are not drawn\n", max_instance_count);
+					instance_overflow_reported = true;
+				}
+
+				assert(!"Too many instances for the instance buffer");
+				break;
+			}
+
+			const Resources::Mesh& mesh = assets_info->meshes[packet.mesh_id];
+			draw.first_instance = frame->instance_count;
+			draw.lod = UINT32_MAX;
+			draw.cone_culling = 1;
+
+			for (size_t p = run_begin; p < run_end; ++p)
+			{
+				if (!node_bounds.visible[packets.data[p].node_slot])
+					continue;
+
+				glm::mat4 model_matrix = packet_model_matrix(packets.data[p]);
+				if (instance_culling)
+				{
+					CullInstance& cull_instance = cull_instances[frame->instance_count];
+					cull_instance = {};
+					cull_instance.sphere = get_bounding_sphere(mesh, model_matrix);
+					cull_instance.run_id = frame->cull_run_count;
+				}
+
+				Instance& instance = instances[frame->instance_count++];
+				instance.model = model_matrix;
+				instance.position_offset = glm::vec4(mesh.bounds_min, 0.0f);
+				instance.position_scale = glm::vec4(mesh.bounds_max - mesh.bounds_min, 0.0f);
+
+				draw.lod = std::min(draw.lod, select_lod(frame, game_state, mesh, instance.model));
+				if (!has_valid_normal_cones(instance.model))
+				{
+					draw.cone_culling = 0;
+				}
+			}
+
+			frame->cull_run_count++;
+		}
+
+		instanced_draws.push(draw);
+		run_begin = run_end;
+	}
+
+	frame->instance_buffer->unmap(backend->device->context->device);
+	if (instance_culling)
+	{
+		frame->cull_instance_buffer->unmap(backend->device->context->device);
+	}
+}
+
+void Renderer::record_meshlet_culling(Game::State* game_state, Vulkan::FrameResources& frame_resources)
+{
+	Frame* frame = (Frame*) frame_resources.custom;
+	assert(frame != nullptr);
+
+	if (meshlet_buffer_size == 0)
+		return;
+
+	frame->cull_draw_buffer->map(backend->device->context->device);
+	frame->cull_job_buffer->map(backend->device->context->device);
+	frame->cull_command_buffer->map(backend->device->context->device);
+
+	// NOTE: Same order as the draw loop in render_frame, the order of the
+	// instanced draws
+	add_cull_draws(frame, game_state);
+
+	frame->cull_draw_buffer->unmap(backend->device->context->device);
+	frame->cull_job_buffer->unmap(backend->device->context->device);
+	frame->cull_command_buffer->unmap(backend->device->context->device);
+
+	if (frame->cull_job_count == 0)
+		return;
+
+	if (frame->cull_descriptor_set == VK_NULL_HANDLE)
+	{
+		VkResult result = allocate_descriptor_set(cull_descriptor_set_layout, frame->cull_descriptor_set);
+		assert(result == VK_SUCCESS);
+
+		VkDescriptorBufferInfo buffer_infos[7] = {};
+		buffer_infos[0] = { backend->device->storage_buffer->buffer, meshlet_buffer_offset, meshlet_buffer_size };
+		buffer_infos[1] = { backend->device->index_buffer->buffer, 0, VK_WHOLE_SIZE };
+		buffer_infos[2] = { frame->cull_draw_buffer->buffer, 0, VK_WHOLE_SIZE };
+		buffer_infos[3] = { frame->cull_job_buffer->buffer, 0, VK_WHOLE_SIZE };
+		buffer_infos[4] = { frame->cull_command_buffer->buffer, 0, VK_WHOLE_SIZE };
+		buffer_infos[5] = { frame->cull_index_buffer->buffer, 0, VK_WHOLE_SIZE };
+		buffer_infos[6] = { frame->instance_buffer->buffer, 0, VK_WHOLE_SIZE };
+
+		VkWriteDescriptorSet descriptor_writes[ARRAYSIZE(buffer_infos)];
+		for (uint32_t i = 0; i < ARRAYSIZE(descriptor_writes); ++i)
+		{
+			descriptor_writes[i] = { VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET };
+			descriptor_writes[i].dstSet = frame->cull_descriptor_set;
+			descriptor_writes[i].dstBinding = i;
+			descriptor_writes[i].dstArrayElement = 0;
+			descriptor_writes[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+			descriptor_writes[i].descriptorCount = 1;
+			descriptor_writes[i].pBufferInfo = &buffer_infos[i];
+		}
+
+		vkUpdateDescriptorSets(backend->device->context->device, ARRAYSIZE(descriptor_writes), descriptor_writes, 0, nullptr);
+	}
+
+	CullPushConstantBlock push_constant_block = {};
+	get_frustum_planes(frame->view_projection, push_constant_block.frustum_planes);
+	push_constant_block.camera_position = glm::vec4(game_state->current_camera->position, 1.0f);
+	push_constant_block.job_count = frame->cull_job_count;
+
+	vkCmdBindPipeline(frame_resources.command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, cull_pipeline.pipeline);
+	vkCmdBindDescriptorSets(frame_resources.command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, cull_pipeline.pipeline_layout, 0, 1, &frame->cull_descriptor_set, 0, nullptr);
+	vkCmdPushConstants(frame_resources.command_buffer, cull_pipeline.pipeline_layout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(CullPushConstantBlock), &push_constant_block);
+	vkCmdDispatch(frame_resources.command_buffer, (frame->cull_job_count + 63) / 64, 1, 1);
+
+	// The draws read the index counts and the indices the compute pass wrote
+	VkMemoryBarrier barrier = { VK_STRUCTURE_TYPE_MEMORY_BARRIER };
+	barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+	barrier.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_INDEX_READ_BIT;
+	vkCmdPipelineBarrier(frame_resources.command_buffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_INPUT_BIT,
+		0, 1, &barrier, 0, nullptr, 0, nullptr);
+}
+
+void Renderer::add_cull_draws(Frame* frame, const Game::State* game_state)
+{
+	CullDraw* draws = (CullDraw*) frame->cull_draw_buffer->mapped;
+	uint32_t* jobs = (uint32_t*) frame->cull_job_buffer->mapped;
+	VkDrawIndexedIndirectCommand* commands = (VkDrawIndexedIndirectCommand*) frame->cull_command_buffer->mapped;
+	uint32_t output_index_count = 0;
+
+	for (size_t i = 0; i < instanced_draws.count; ++i)
+	{
+		const InstancedDraw& instanced_draw = instanced_draws.data[i];
+		const RenderPacket& packet = render_packets.packets[instanced_draw.packet_id];
+		Resources::PrimitiveLod primitive_lod = get_packet_lod(game_state->assets_info, packet, instanced_draw.lod);
+		if (primitive_lod.meshlet_count == 0)
+			continue;
+
+		if (frame->cull_draw_count + 1 > max_cull_draws
+			|| frame->cull_job_count + primitive_lod.meshlet_count > max_cull_jobs
+			|| output_index_count + primitive_lod.index_count > max_cull_index_count)
+		{
+			return;
+		}
+
+		uint32_t draw_id = frame->cull_draw_count++;
+
+		CullDraw& draw = draws[draw_id];
+		draw.meshlet_offset = primitive_lod.meshlet_offset;
+		draw.meshlet_count = primitive_lod.meshlet_count;
+		draw.first_job = frame->cull_job_count;
+		draw.index_type = packet.index_type;
+		if (packet.index_type == Resources::IndexType::Uint16)
+			draw.index_offset = uint32_t(index_table_offsets[Resources::IndexType::Uint16] / sizeof(Resources::Index16)) + primitive_lod.index_offset;
+		else
+			draw.index_offset = uint32_t(index_table_offsets[Resources::IndexType::Uint32] / sizeof(Resources::Index32)) + primitive_lod.index_offset;
+		draw.output_offset = output_index_count;
+		draw.cone_culling = instanced_draw.cone_culling;
+		draw.first_instance = instanced_draw.first_instance;
+		draw.instance_count = instanced_draw.instance_count;
+
+		// The compute pass adds the indices of the visible meshlets. Every
+		// instance draws them, or every visible one when the instances are
+		// culled.
+		commands[draw_id].indexCount = 0;
+		commands[draw_id].instanceCount = instance_culling ? 0 : instanced_draw.instance_count;
+		commands[draw_id].firstIndex = output_index_count;
+		commands[draw_id].vertexOffset = int32_t(packet.vertex_offset);
+		commands[draw_id].firstInstance = instanced_draw.first_instance;
+
+		for (uint32_t m_id = 0; m_id < primitive_lod.meshlet_count; ++m_id)
+		{
+			jobs[frame->cull_job_count++] = draw_id;
+		}
+
+		output_index_count += primitive_lod.index_count;
+	}
+}
+
+void Renderer::record_instance_culling(Vulkan::FrameResources& frame_resources)
+{
+	Frame* frame = (Frame*) frame_resources.custom;
+	assert(frame != nullptr);
+
+	if (frame->instance_count == 0)
+		return;
+
+	if (frame->instance_cull_descriptor_set == VK_NULL_HANDLE)
+	{
+		VkResult result = allocate_descriptor_set(instance_cull_descriptor_set_layout, frame->instance_cull_descriptor_set);
+		assert(result == VK_SUCCESS);
+
+		VkDescriptorBufferInfo buffer_infos[7] = {};
+		buffer_infos[0] = { frame->cull_instance_buffer->buffer, 0, VK_WHOLE_SIZE };
+		buffer_infos[1] = { frame->cull_run_buffer->buffer, 0, VK_WHOLE_SIZE };
+		buffer_infos[2] = { frame->run_command_buffer->buffer, 0, VK_WHOLE_SIZE };
+		buffer_infos[3] = { frame->instance_buffer->buffer, 0, VK_WHOLE_SIZE };
+		buffer_infos[4] = { frame->visible_instance_buffer->buffer, 0, VK_WHOLE_SIZE };
+		buffer_infos[5] = { frame->cull_command_buffer->buffer, 0, VK_WHOLE_SIZE };
+		buffer_infos[6] = { frame->draw_command_buffer->buffer, 0, VK_WHOLE_SIZE };
+
+		VkDescriptorImageInfo depth_pyramid_info = {};
+		depth_pyramid_info.sampler = depth_pyramid_sampler;
+		depth_pyramid_info.imageView = depth_pyramid->image_view;
+		depth_pyramid_info.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+
+		VkWriteDescriptorSet descriptor_writes[ARRAYSIZE(buffer_infos) + 1];
+		for (uint32_t i = 0; i < ARRAYSIZE(buffer_infos); ++i)
+		{
+			descriptor_writes[i] = { VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET };
+			descriptor_writes[i].dstSet = frame->instance_cull_descriptor_set;
+			descriptor_writes[i].dstBinding = i;
+			descriptor_writes[i].dstArrayElement = 0;
+			descriptor_writes[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+			descriptor_writes[i].descriptorCount = 1;
+			descriptor_writes[i].pBufferInfo = &buffer_infos[i];
+		}
+
+		// NOTE: Pointed to the new pyramid by create_depth_pyramid
+		descriptor_writes[7] = { VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET };
+		descriptor_writes[7].dstSet = frame->instance_cull_descriptor_set;
+		descriptor_writes[7].dstBinding = 7;
+		descriptor_writes[7].dstArrayElement = 0;
+		descriptor_writes[7].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+		descriptor_writes[7].descriptorCount = 1;
+		descriptor_writes[7].pImageInfo = &depth_pyramid_info;
+
+		vkUpdateDescriptorSets(backend->device->context->device, ARRAYSIZE(descriptor_writes), descriptor_writes, 0, nullptr);
+	}
+
+	// The depth buffer holds the previous frame once one was rendered to it
+	bool occlusion = occlusion_culling && depth_buffer_rendered;
+	if (occlusion)
+	{
+		build_depth_pyramid(frame_resources.command_buffer);
+	}
+	else
+	{
+		// NOTE: The pyramid is not read, but it has to be in the layout
+		// its descriptor was written with
+		VkImageMemoryBarrier pyramid_barrier = { VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER };
+		pyramid_barrier.srcAccessMask = 0;
+		pyramid_barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+		pyramid_barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+		pyramid_barrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
+		pyramid_barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		pyramid_barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		pyramid_barrier.image = depth_pyramid->image;
+		pyramid_barrier.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, depth_pyramid_level_count, 0, 1 };
+		vkCmdPipelineBarrier(frame_resources.command_buffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+			0, 0, nullptr, 0, nullptr, 1, &pyramid_barrier);
+	}
+
+	VkExtent2D depth_extent = backend->device->wsi->swapchain_extent;
+	InstanceCullPushConstantBlock push_constant_block = {};
+	push_constant_block.view_projection = frame->view_projection;
+	push_constant_block.depth_pyramid_scale = glm::vec2(float(depth_extent.width), float(depth_extent.height)) * 0.5f;
+	push_constant_block.depth_pyramid_level_count = depth_pyramid_level_count;
+	push_constant_block.instance_count = frame->instance_count;
+	push_constant_block.occlusion_culling = occlusion ? 1 : 0;
+
+	vkCmdBindPipeline(frame_resources.command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, instance_cull_pipeline.pipeline);
+	vkCmdBindDescriptorSets(frame_resources.command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, instance_cull_pipeline.pipeline_layout, 0, 1, &frame->instance_cull_descriptor_set, 0, nullptr);
+	vkCmdPushConstants(frame_resources.command_buffer, instance_cull_pipeline.pipeline_layout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(InstanceCullPushConstantBlock), &push_constant_block);
+	vkCmdDispatch(frame_resources.command_buffer, (frame->instance_count + 63) / 64, 1, 1);
+
+	// The draws read the instance counts and the visible instances
+	VkMemoryBarrier barrier = { VK_STRUCTURE_TYPE_MEMORY_BARRIER };
+	barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+	barrier.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_SHADER_READ_BIT;
+	vkCmdPipelineBarrier(frame_resources.command_buffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT,
+		0, 1, &barrier, 0, nullptr, 0, nullptr);
+}
+
+void Renderer::build_depth_pyramid(VkCommandBuffer command_buffer)
+{
+	Vulkan::Image* depth_buffer = backend->device->depth_buffer;
+	VkImageAspectFlags depth_aspect = VK_IMAGE_ASPECT_DEPTH_BIT;
+	if (depth_buffer->image_format == VK_FORMAT_D32_SFLOAT_S8_UINT || depth_buffer->image_format == VK_FORMAT_D24_UNORM_S8_UINT)
+	{
+		depth_aspect |= VK_IMAGE_ASPECT_STENCIL_BIT;
+	}
+
+	// The render pass of the previous frame left the depth buffer in
+	// DEPTH_STENCIL_ATTACHMENT_OPTIMAL. The pyramid is written from scratch.
+	VkImageMemoryBarrier begin_barriers[2];
+	begin_barriers[0] = { VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER };
+	begin_barriers[0].srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+	begin_barriers[0].dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+	begin_barriers[0].oldLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+	begin_barriers[0].newLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;
+	begin_barriers[0].srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	begin_barriers[0].dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	begin_barriers[0].image = depth_buffer->image;
+	begin_barriers[0].subresourceRange = { depth_aspect, 0, 1, 0, 1 };
+	begin_barriers[1] = { VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER };
+	begin_barriers[1].srcAccessMask = 0;
+	begin_barriers[1].dstAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+	begin_barriers[1].oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	begin_barriers[1].newLayout = VK_IMAGE_LAYOUT_GENERAL;
+	begin_barriers[1].srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	begin_barriers[1].dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	begin_barriers[1].image = depth_pyramid->image;
+	begin_barriers[1].subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, depth_pyramid_level_count, 0, 1 };
+	vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+		0, 0, nullptr, 0, nullptr, ARRAYSIZE(begin_barriers), begin_barriers);
+
+	for (uint32_t level = 0; level < depth_pyramid_level_count; ++level)
+	{
+		// NOTE: A multisampled depth buffer is reduced over its samples too
+		const Pipeline& pipeline = level == 0 && backend->device->context->msaa_samples != VK_SAMPLE_COUNT_1_BIT ? depth_reduce_ms_pipeline : depth_reduce_pipeline;
+		uint32_t input_level = level == 0 ? 0 : level - 1;
+		uint32_t level_width = (depth_pyramid_extent.width + (1u << level) - 1) >> level;
+		uint32_t level_height = (depth_pyramid_extent.height + (1u << level) - 1) >> level;
+
+		vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline.pipeline);
+		vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline.pipeline_layout, 0, 1, &depth_reduce_descriptor_sets[level], 0, nullptr);
+		vkCmdPushConstants(command_buffer, pipeline.pipeline_layout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(input_level), &input_level);
+		vkCmdDispatch(command_buffer, (level_width + 7) / 8, (level_height + 7) / 8, 1);
+
+		// The next level, or the instance culling, reads this one
+		VkMemoryBarrier level_barrier = { VK_STRUCTURE_TYPE_MEMORY_BARRIER };
+		level_barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+		level_barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+		vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+			0, 1, &level_barrier, 0, nullptr, 0, nullptr);
+	}
+
+	// Back to the layout the render pass expects, once the first level is read
+	VkImageMemoryBarrier end_barrier = { VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER };
+	end_barrier.srcAccessMask = 0;
+	end_barrier.dstAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+	end_barrier.oldLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;
+	end_barrier.newLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+	end_barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	end_barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	end_barrier.image = depth_buffer->image;
+	end_barrier.subresourceRange = { depth_aspect, 0, 1, 0, 1 };
+	vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+		0, 0, nullptr, 0, nullptr, 1, &end_barrier);
+}
+
+// The model matrix of a node of an entity
+static glm::mat4 get_node_matrix(const Game::State* game_state, uint32_t entity_id, uint32_t node_id)
+{
+	// For dynamic entities we do not apply the game_state->transforms, since their transforms
+	// will be determined by player input
+	const glm::mat4& node_matrix = game_state->assets_info->node_model_matrices[node_id];
+	if (entity_id >= game_state->apple_id)
+		return node_matrix;
+
+	glm::mat4 model_matrix = glm::translate(glm::mat4(1.0f), game_state->transforms[entity_id].position);
+	model_matrix = glm::scale(model_matrix, game_state->transforms[entity_id].scale);
+	return model_matrix * glm::toMat4(game_state->transforms[entity_id].rotation) * node_matrix;
+}
+
+void Renderer::add_entities(const Game::State* game_state, uint32_t entity_id_offset, uint32_t entity_count)
+{
+	// NOTE: The game_state->entities table contains a list of entities,
+	// where the index in the table represent the entity id.
+	// An entity references a model by its model_id.
+	// Parallel to the game_state->entities we have the 
+	// game_state->transforms, which contains the transforms (position,
+	// scale and rotation) of an entity.
+	// The 2 tables are of the same length and a transform at index i in
+	// the game_state->transforms table, applies to the entity at index i
+	// in the game_state->entities table.
+	// By convention entity 0 corresponds to the player.
+	// 
+	// An entity references a model (via model_id) inside the
+	// assets_info->models table, and the models contains information
+	// about how to draw it. Usually a model is composed of multiple
+	// nodes, and a node contains information about the primitives to 
+	// render and also contains its onw transform.
+	// The nodes of a model are flattened at load time and their model
+	// matrices already include the transforms of their parents.
+	//
+	// To be able to render an entity correctly, we need to calculate
+	// one transform per model's node, and store them sequentally inside
+	// node_matrices. Every frame the matrices of the nodes that are drawn
+	// go to the instance buffer of the frame.
+	//
+	// As an example, image we have 2 entities E1 and E2, that point to
+	// two distinct model M1 and M2. M1 has 3 nodes M1N1, M1N2 and M1N3,
+	// while M2 has 2, M2N1 and M2N2.
+	// 
+	// This is what the data will look like in memory
+	// entities:      [ E1, E2 ]
+	// transforms:    [ T1, T2 ]
+	// node_matrices: [ M1N1 * T1, M1N2 * T1, M1N3 * T1, M2N1 * T2, M2N2 * T2 ]
+
+	assert(node_matrices.count == absolute_node_count);
+
+	for (uint32_t e = entity_id_offset; e < entity_count; ++e)
+	{
+		Entity& entity = game_state->entities[e];
+		entity.node_offset = absolute_node_count;
+		const Resources::Model& model = game_state->assets_info->models[entity.model_id];
+
+		node_matrices.append(model.node_count);
+		node_bounds.append(model.node_count);
+		for (uint32_t n = 0; n < model.node_count; ++n)
+		{
+			node_matrices[absolute_node_count] = get_node_matrix(game_state, e, model.node_offset + n);
+			update_node_bounds(game_state->assets_info, absolute_node_count, model.node_offset + n);
+			absolute_node_count++;
+		}
+	}
+
+	render_packets.add_entities(game_state, entity_id_offset, entity_count);
+}
+
+void Renderer::update_node_bounds(const Resources::AssetsInfo* assets_info, uint32_t node_slot, uint32_t node_id)
+{
+	uint32_t mesh_id = assets_info->node_mesh_ids[node_id];
+	if (mesh_id == Resources::no_mesh)
+	{
+		node_bounds.set(node_slot, glm::vec4(0.0f, 0.0f, 0.0f, -FLT_MAX));
+		return;
+	}
+
+	node_bounds.set(node_slot, get_bounding_sphere(assets_info->meshes[mesh_id], node_matrices[node_slot]));
+}
+
+void Renderer::update_dynamic_node_bounds(const Resources::AssetsInfo* assets_info)
+{
+	// NOTE: The packets are sorted by pipeline, the dynamic ones are last
+	const Resources::Table<RenderPacket>& packets = render_packets.packets;
+	for (size_t i = packets.count; i > 0 && packets.data[i - 1].pipeline == RenderPipeline::Dynamic; --i)
+	{
+		const RenderPacket& packet = packets.data[i - 1];
+		node_bounds.set(packet.node_slot, get_bounding_sphere(assets_info->meshes[packet.mesh_id], packet_model_matrix(packet)));
+	}
+}
+
+// Overwrites size bytes of a device buffer at offset with data, through
+// update (one of the Device::update_*_buffer functions). The bytes are
+// staged in chunks of at most a staging segment, so ranges of any size fit.
+static void update_buffer_range(Vulkan::Device* device, void (Vulkan::Device::*update)(const Vulkan::StagingSlice&, VkDeviceSize), const uint8_t* data, VkDeviceSize size, VkDeviceSize offset)
+{
+	for (VkDeviceSize chunk_offset = 0; chunk_offset < size; chunk_offset += Vulkan::STAGING_SEGMENT_SIZE)
+	{
+		VkDeviceSize chunk_size = size - chunk_offset < Vulkan::STAGING_SEGMENT_SIZE ? size - chunk_offset : Vulkan::STAGING_SEGMENT_SIZE;
+		Vulkan::StagingSlice staging_slice = device->allocate_staging(chunk_size);
+		memcpy(staging_slice.data, data + chunk_offset, chunk_size);
+
+		(device->*update)(staging_slice, offset + chunk_offset);
+	}
+}
+
+void Renderer::upload_reloaded_model(const Game::State* game_state, uint32_t model_id, const Resources::ReloadedRanges& ranges)
+{
+	const Resources::AssetsInfo* assets_info = game_state->assets_info;
+	Vulkan::Device* device = backend->device;
+
+	// NOTE: The ranges may have been used by the previous version of a
+	// model, which the frames in flight could still be drawing
+	vkDeviceWaitIdle(device->context->device);
+
+	const uint8_t* streams[ARRAYSIZE(vertex_stream_offsets)];
+	VkDeviceSize stream_strides[ARRAYSIZE(vertex_stream_offsets)];
+	get_vertex_streams(assets_info, vertex_format, streams, stream_strides);
+
+	assert(ranges.vertex_offset + ranges.vertex_count <= vertex_capacity);
+	for (uint32_t i = 0; i < ARRAYSIZE(vertex_stream_offsets) && ranges.vertex_count > 0; ++i)
+	{
+		VkDeviceSize range_offset = stream_strides[i] * ranges.vertex_offset;
+		VkDeviceSize range_size = stream_strides[i] * ranges.vertex_count;
+		update_buffer_range(device, &Vulkan::Device::update_vertex_buffer, streams[i] + range_offset, range_size, vertex_stream_offsets[i] + range_offset);
+	}
+
+	if (ranges.index32_count > 0)
+	{
+		assert(ranges.index32_offset + ranges.index32_count <= index_capacities[Resources::IndexType::Uint32]);
+		VkDeviceSize range_size = sizeof(Resources::Index32) * ranges.index32_count;
+		update_buffer_range(device, &Vulkan::Device::update_index_buffer, (const uint8_t*)(assets_info->indices32.data + ranges.index32_offset), range_size,
+			index_table_offsets[Resources::IndexType::Uint32] + sizeof(Resources::Index32) * ranges.index32_offset);
+	}
+
+	if (ranges.index16_count > 0)
+	{
+		assert(ranges.index16_offset + ranges.index16_count <= index_capacities[Resources::IndexType::Uint16]);
+		VkDeviceSize range_size = sizeof(Resources::Index16) * ranges.index16_count;
+		update_buffer_range(device, &Vulkan::Device::update_index_buffer, (const uint8_t*)(assets_info->indices16.data + ranges.index16_offset), range_size,
+			index_table_offsets[Resources::IndexType::Uint16] + sizeof(Resources::Index16) * ranges.index16_offset);
+	}
+
+	if (ranges.meshlet_count > 0)
+	{
+		assert(ranges.meshlet_offset + ranges.meshlet_count <= meshlet_capacity);
+		VkDeviceSize range_size = sizeof(Resources::Meshlet) * ranges.meshlet_count;
+		update_buffer_range(device, &Vulkan::Device::update_storage_buffer, (const uint8_t*)(assets_info->meshlets.data + ranges.meshlet_offset), range_size,
+			meshlet_buffer_offset + sizeof(Resources::Meshlet) * ranges.meshlet_offset);
+	}
+
+	// The new textures go after the ones already uploaded
+	assert(ranges.texture_offset == texture_count && ranges.texture_offset + ranges.texture_count <= max_texture_count);
+	for (uint32_t i = ranges.texture_offset; i < ranges.texture_offset + ranges.texture_count; ++i)
+	{
+		const Resources::Texture& texture = assets_info->textures[i];
+		create_texture(i, texture, assets_info->texture_pixels.data + texture.pixel_offset);
+	}
+	texture_count += ranges.texture_count;
+	write_texture_array(ranges.texture_offset, ranges.texture_count);
 
-	VkSamplerCreateInfo sampler_ci = { VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO };
-	sampler_ci.magFilter = VK_FILTER_LINEAR;
-	sampler_ci.minFilter = VK_FILTER_LINEAR;
-	sampler_ci.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
-	sampler_ci.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
-	sampler_ci.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
-	sampler_ci.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
-	sampler_ci.borderColor = VK_BORDER_COLOR_FLOAT_OPAQUE_WHITE;
-	VkResult result = vkCreateSampler(backend->device->context->device, &sampler_ci, nullptr, &imgui_font_sampler);
-	assert(result == VK_SUCCESS);
+	// The nodes of the model changed, and so did the matrices of the
+	// entities that use it
+	for (uint32_t e = 0; e < game_state->entity_count; ++e)
+	{
+		const Entity& entity = game_state->entities[e];
+		const Resources::Model& model = assets_info->models[entity.model_id];
+		for (uint32_t n = 0; n < model.node_count; ++n)
+		{
+			node_matrices[entity.node_offset + n] = get_node_matrix(game_state, e, model.node_offset + n);
+			update_node_bounds(assets_info, entity.node_offset + n, model.node_offset + n);
+		}
+	}
 
-	// Descriptor Set Layout
-	VkDescriptorSetLayoutBinding imgui_set_layout_bindings[1];
-	imgui_set_layout_bindings[0] = {};
-	imgui_set_layout_bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-	imgui_set_layout_bindings[0].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
-	imgui_set_layout_bindings[0].binding = 0;
-	imgui_set_layout_bindings[0].descriptorCount = 1;
-	imgui_set_layout_bindings[0].pImmutableSamplers = nullptr;
+	// The meshes, primitives and materials of the model changed
+	render_packets.rebuild(game_state);
+	write_material_buffer(assets_info);
 
-	VkDescriptorSetLayoutCreateInfo set_layout_ci = { VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO };
-	set_layout_ci.bindingCount = ARRAYSIZE(imgui_set_layout_bindings);
-	set_layout_ci.pBindings = imgui_set_layout_bindings;
-	result = vkCreateDescriptorSetLayout(backend->device->context->device, &set_layout_ci, nullptr, &imgui_descriptor_set_layout);
-	assert(result == VK_SUCCESS);
+	upload_token = device->submit_uploads();
 
-	create_pipelines();
+	printf("[Renderer]: Uploaded model %u again: %u vertices, %u + %u indices, %u meshlets, %u textures\n",
+		model_id, ranges.vertex_count, ranges.index16_count, ranges.index32_count, ranges.meshlet_count, ranges.texture_count);
 }
 
-void Renderer::upload_buffers(const Game::State* game_state)
+void Renderer::record_draws(VkCommandBuffer command_buffer, Frame* frame, const Game::State* game_state)
 {
-	const Resources::AssetsInfo* assets_info = game_state->assets_info;
-	// Upload all vertices to the Vertex Buffer
-	VkDeviceSize vertices_size = sizeof(assets_info->vertices[0]) * assets_info->vertex_offset;
+	uint32_t cull_draw_id = 0;
 
-	Vulkan::Buffer* vertex_staging_buffer = new Vulkan::Buffer(
-		backend->device->context->device,
-		backend->device->context->gpu,
-		VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT,
-		vertices_size);
+	// Indexed by RenderPipeline
+	const Pipeline* pipelines[] = { &static_pipeline, &dynamic_pipeline };
 
-	void* vertices_data;
-	vkMapMemory(backend->device->context->device, vertex_staging_buffer->device_memory, 0, vertex_staging_buffer->size, 0, &vertices_data);
-	memcpy(vertices_data, assets_info->vertices, vertices_size);
-	vkUnmapMemory(backend->device->context->device, vertex_staging_buffer->device_memory);
+	// Instanced draws are sorted by pipeline and primitive: every state is
+	// set only when it changes
+	uint32_t bound_pipeline = UINT32_MAX;
+	uint32_t bound_material_id = UINT32_MAX;
 
-	backend->device->upload_vertex_buffer(vertex_staging_buffer);
-	vertex_staging_buffer->destroy(backend->device->context->device);
+	for (size_t i = 0; i < instanced_draws.count; ++i)
+	{
+		const InstancedDraw& draw = instanced_draws.data[i];
+		const RenderPacket& packet = render_packets.packets[draw.packet_id];
+		VkPipelineLayout pipeline_layout = pipelines[packet.pipeline]->pipeline_layout;
 
-	// Upload all indices to the Index Buffer
-	VkDeviceSize indices_size = sizeof(assets_info->indices[0]) * assets_info->index_offset;
+		if (packet.pipeline != bound_pipeline)
+		{
+			VkDescriptorSet descriptor_sets[] = { frame->view_descriptor_set, frame->instance_descriptor_set };
+			vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelines[packet.pipeline]->pipeline);
+			vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline_layout, 0, ARRAYSIZE(descriptor_sets), descriptor_sets, 0, nullptr);
+			bound_pipeline = packet.pipeline;
+			bound_material_id = UINT32_MAX;
+			bound_texture_id = UINT32_MAX;
+		}
 
-	Vulkan::Buffer* index_staging_buffer = new Vulkan::Buffer(
-		backend->device->context->device,
-		backend->device->context->gpu,
-		VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT,
-		indices_size);
+		if (packet.material_id != bound_material_id)
+		{
+			const Resources::Material& material = game_state->assets_info->materials[packet.material_id];
+			vkCmdPushConstants(command_buffer, pipeline_layout, VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(Resources::Material::PBRMetallicRoughness), &material.pbr_metallic_roughness);
+			bind_material_textures(command_buffer, pipeline_layout, material);
+			bound_material_id = packet.material_id;
+		}
 
-	void* indices_data;
-	vkMapMemory(backend->device->context->device, index_staging_buffer->device_memory, 0, index_staging_buffer->size, 0, &indices_data);
-	memcpy(indices_data, assets_info->indices, indices_size);
-	vkUnmapMemory(backend->device->context->device, index_staging_buffer->device_memory);
+		draw_instanced(command_buffer, frame, game_state->assets_info, draw, cull_draw_id);
+	}
 
-	backend->device->upload_index_buffer(index_staging_buffer);
-	index_staging_buffer->destroy(backend->device->context->device);
+	assert(cull_draw_id == frame->cull_draw_count && "The draw loop and record_meshlet_culling visit the instanced draws in a different order");
 }
 
-void Renderer::upload_dynamic_uniform_buffers(const Game::State* game_state, uint32_t entity_id_offset, uint32_t entity_count)
+void Renderer::write_indirect_draws(Frame* frame, const Game::State* game_state)
 {
-	// NOTE: The game_state->entities table contains a list of entities,
-	// where the index in the table represent the entity id.
-	// An entity references a model by its model_id.
-	// Parallel to the game_state->entities we have the 
-	// game_state->transforms, which contains the transforms (position,
-	// scale and rotation) of an entity.
-	// The 2 tables are of the same length and a transform at index i in
-	// the game_state->transforms table, applies to the entity at index i
-	// in the game_state->entities table.
-	// By convention entity 0 corresponds to the player.
-	// 
-	// An entity references a model (via model_id) inside the
-	// assets_info->models table, and the models contains information
-	// about how to draw it. Usually a model is composed of multiple
-	// nodes, and a node contains information about the primitives to 
-	// render and also contains its onw transform.
-	//
-	// To be able to render an entity correctly, we need to calculate
-	// one transform per model's node, and store them sequentally inside
-	// a Dynamic Uniform Buffer on the GPU.
-	//
-	// As an example, image we have 2 entities E1 and E2, that point to
-	// two distinct model M1 and M2. M1 has 3 nodes M1N1, M1N2 and M1N3,
-	// while M2 has 2, M2N1 and M2N2.
-	// 
-	// This is what the data will look like in memory
-	// CPU:
-	// entities:   [ E1, E2 ]
-	// transforms: [ T1, T2 ]
-	//
-	// GPU:
-	// ubo:            [ M1N1 * T1, M1N2 * T1, M1N3 * T1, M2N1 * T2, M2N2 * T2 ]
-	//
-	// Calculate how many descriptor sets we need to allocate
-	// and build the ubos
+	const Resources::AssetsInfo* assets_info = game_state->assets_info;
+	frame->draw_command_buffer->map(backend->device->context->device);
+	frame->draw_data_buffer->map(backend->device->context->device);
+	VkDrawIndexedIndirectCommand* commands = (VkDrawIndexedIndirectCommand*) frame->draw_command_buffer->mapped;
+	IndirectDrawData* draw_data = (IndirectDrawData*) frame->draw_data_buffer->mapped;
+
+	// NOTE: The draws with a culled draw are in the cull commands already,
+	// in the same order record_meshlet_culling added them. The others are
+	// grouped by index type, so that each type is one call: the first pass
+	// counts them.
+	uint32_t cull_draw_id = 0;
+	uint32_t* command_counts = frame->indirect_command_counts;
+	command_counts[Resources::IndexType::Uint16] = 0;
+	command_counts[Resources::IndexType::Uint32] = 0;
+	for (size_t i = 0; i < instanced_draws.count; ++i)
+	{
+		const InstancedDraw& draw = instanced_draws.data[i];
+		const RenderPacket& packet = render_packets.packets[draw.packet_id];
+		Resources::PrimitiveLod primitive_lod = get_packet_lod(assets_info, packet, draw.lod);
+		lod_triangle_count += primitive_lod.index_count / 3 * draw.instance_count;
+		full_triangle_count += packet.index_count / 3 * draw.instance_count;
 
-	size_t min_ubo_alignment = backend->device->context->gpu_properties.limits.minUniformBufferOffsetAlignment;
-	size_t nodes = 0;
+		if (primitive_lod.meshlet_count > 0 && cull_draw_id < frame->cull_draw_count)
+		{
+			draw_data[cull_draw_id++].material_id = packet.material_id;
+			continue;
+		}
 
-	for (uint32_t e = entity_id_offset; e < entity_count; ++e)
+		command_counts[packet.index_type]++;
+	}
+
+	assert(cull_draw_id == frame->cull_draw_count && "The draw loop and record_meshlet_culling visit the instanced draws in a different order");
+	// NOTE: The commands past max_indirect_draws are dropped, reported once
+	// so the log isn't flooded every frame
+	uint32_t command_count = command_counts[Resources::IndexType::Uint16] + command_counts[Resources::IndexType::Uint32];
+	if (command_count > max_indirect_draws && !indirect_overflow_reported)
 	{
-		const Entity& entity = game_state->entities[e];
-		const Resources::Model& model = game_state->assets_info->models[entity.model_id];
-		nodes += model.node_count;
+		printf("[Renderer]: %u draws for a draw command buffer of %u, %u are not drawn\n", command_count, max_indirect_draws, command_count - max_indirect_draws);
+		indirect_overflow_reported = true;
 	}
+	assert(command_count <= max_indirect_draws && "Too many draws for the draw command buffer");
 
-	dynamic_alignment = sizeof(glm::mat4);
-	if (min_ubo_alignment > 0)
+	// The instance culling finds the commands of each run of instances
+	CullRun* runs = nullptr;
+	uint32_t* run_commands = nullptr;
+	uint32_t run_command_count = 0;
+	if (instance_culling)
 	{
-		dynamic_alignment = (dynamic_alignment + min_ubo_alignment - 1) & ~(min_ubo_alignment - 1);
+		frame->cull_run_buffer->map(backend->device->context->device);
+		frame->run_command_buffer->map(backend->device->context->device);
+		runs = (CullRun*) frame->cull_run_buffer->mapped;
+		run_commands = (uint32_t*) frame->run_command_buffer->mapped;
 	}
-	size_t buffer_size = nodes * dynamic_alignment;
-	NodeUbo dynamic_ubo;
-	dynamic_ubo.model = (glm::mat4*)_aligned_malloc(buffer_size, dynamic_alignment);
-	assert(dynamic_ubo.model);
 
-	for (uint32_t e = entity_id_offset; e < entity_count; ++e)
+	// The Uint16 commands first, then the Uint32 ones
+	uint32_t next_commands[2] = { 0, command_counts[Resources::IndexType::Uint16] };
+	uint32_t run_id = UINT32_MAX;
+	cull_draw_id = 0;
+	for (size_t i = 0; i < instanced_draws.count; ++i)
 	{
-		Entity& entity = game_state->entities[e];
-		entity.node_offset = absolute_node_count;
-		const Resources::Model& model = game_state->assets_info->models[entity.model_id];
-		uint32_t modifier = entity_id_offset > 0 ? 0 : 1;
+		const InstancedDraw& draw = instanced_draws.data[i];
+		const RenderPacket& packet = render_packets.packets[draw.packet_id];
+		Resources::PrimitiveLod primitive_lod = get_packet_lod(assets_info, packet, draw.lod);
 
-		for (uint32_t n = 0; n < model.node_count; ++n)
+		// NOTE: Same runs as prepare_instanced_draws: the draws of a run
+		// share their first instance
+		if (instance_culling && (i == 0 || draw.first_instance != instanced_draws.data[i - 1].first_instance))
 		{
-			// Aligned offset
-			glm::mat4* model_matrix = (glm::mat4*)(((uint64_t)dynamic_ubo.model + (modifier * absolute_node_count * dynamic_alignment)));
+			run_id++;
+			runs[run_id].first_instance = draw.first_instance;
+			runs[run_id].command_offset = run_command_count;
+			runs[run_id].command_count = 0;
+			runs[run_id].padding = 0;
+		}
 
-			// For dynamic entities we do not apply the game_state->transforms, since their transforms
-			// will be determined by player input
-			if (e >= game_state->apple_id)
-			{
-				*model_matrix = glm::translate(glm::mat4(1.0f), model.nodes[n].translation);
-				*model_matrix = glm::scale(*model_matrix, model.nodes[n].scale);
-				*model_matrix = *model_matrix * glm::toMat4(model.nodes[n].rotation);
-			}
-			else
-			{
-				*model_matrix = glm::translate(glm::mat4(1.0f), model.nodes[n].translation);
-				*model_matrix = glm::translate(*model_matrix, game_state->transforms[e].position);
-				*model_matrix = glm::scale(*model_matrix, model.nodes[n].scale);
-				*model_matrix = glm::scale(*model_matrix, game_state->transforms[e].scale);
-				*model_matrix = *model_matrix * glm::toMat4(model.nodes[n].rotation) * glm::toMat4(game_state->transforms[e].rotation);
-			}
+		uint32_t command_id = 0;
+		if (primitive_lod.meshlet_count > 0 && cull_draw_id < frame->cull_draw_count)
+		{
+			command_id = cull_draw_id++;
+		}
+		else
+		{
+			uint32_t draw_command_id = next_commands[packet.index_type]++;
+			if (draw_command_id >= max_indirect_draws)
+				continue;
+
+			commands[draw_command_id].indexCount = primitive_lod.index_count;
+			commands[draw_command_id].instanceCount = instance_culling ? 0 : draw.instance_count;
+			commands[draw_command_id].firstIndex = primitive_lod.index_offset;
+			commands[draw_command_id].vertexOffset = int32_t(packet.vertex_offset);
+			commands[draw_command_id].firstInstance = draw.first_instance;
+			command_id = max_cull_draws + draw_command_id;
+			draw_data[command_id].material_id = packet.material_id;
+		}
 
-			absolute_node_count++;
+		if (instance_culling)
+		{
+			run_commands[run_command_count++] = command_id;
+			runs[run_id].command_count++;
 		}
 	}
 
-	VkDescriptorBufferInfo buffer_info = {};
-	buffer_info.buffer = backend->device->uniform_buffer->buffer;
-	buffer_info.offset = 0;
-	buffer_info.range = buffer_size;
+	assert(!instance_culling || run_id + 1 == frame->cull_run_count);
 
-	Vulkan::Buffer* uniform_staging_buffer = new Vulkan::Buffer(
-		backend->device->context->device,
-		backend->device->context->gpu,
-		VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT,
-		buffer_size);
-
-	void* uniform_data;
-	vkMapMemory(backend->device->context->device, uniform_staging_buffer->device_memory, 0, uniform_staging_buffer->size, 0, &uniform_data);
-	memcpy(uniform_data, dynamic_ubo.model, buffer_size);
-	vkUnmapMemory(backend->device->context->device, uniform_staging_buffer->device_memory);
-
-	dynamic_buffer_offset = backend->device->upload_uniform_buffer(uniform_staging_buffer);
-	uniform_staging_buffer->destroy(backend->device->context->device);
-	_aligned_free(dynamic_ubo.model);
+	if (instance_culling)
+	{
+		frame->cull_run_buffer->unmap(backend->device->context->device);
+		frame->run_command_buffer->unmap(backend->device->context->device);
+	}
 
-	node_descriptor_set = VK_NULL_HANDLE;
+	frame->draw_command_buffer->unmap(backend->device->context->device);
+	frame->draw_data_buffer->unmap(backend->device->context->device);
+}
 
-	VkDescriptorSetAllocateInfo descriptor_set_ai = { VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO };
-	descriptor_set_ai.descriptorPool = descriptor_pool;
-	descriptor_set_ai.descriptorSetCount = 1;
-	descriptor_set_ai.pSetLayouts = &descriptor_set_layouts[1];
+void Renderer::record_indirect_draws(VkCommandBuffer command_buffer, Frame* frame)
+{
+	VkDescriptorSet instance_descriptor_set = instance_culling ? frame->visible_instance_descriptor_set : frame->instance_descriptor_set;
+	VkDescriptorSet descriptor_sets[] = { frame->view_descriptor_set, instance_descriptor_set, texture_array_descriptor_set, frame->indirect_descriptor_set };
+	vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, indirect_pipeline.pipeline);
+	vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, indirect_pipeline.pipeline_layout, 0, ARRAYSIZE(descriptor_sets), descriptor_sets, 0, nullptr);
+
+	const uint32_t* command_counts = frame->indirect_command_counts;
+	uint32_t max_draw_count = backend->device->context->gpu_properties.limits.maxDrawIndirectCount;
+	assert(frame->cull_draw_count <= max_draw_count && command_counts[0] + command_counts[1] <= max_draw_count);
+
+	// Where the draws of each call find their draw data
+	uint32_t first_draw = 0;
+	if (frame->cull_draw_count > 0)
+	{
+		bind_culled_index_buffer(command_buffer, frame);
+		vkCmdPushConstants(command_buffer, indirect_pipeline.pipeline_layout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(first_draw), &first_draw);
+		vkCmdDrawIndexedIndirect(command_buffer, frame->cull_command_buffer->buffer, 0, frame->cull_draw_count, sizeof(VkDrawIndexedIndirectCommand));
+		entity_draw_count++;
+	}
 
-	VkResult result =  vkAllocateDescriptorSets(backend->device->context->device, &descriptor_set_ai, &node_descriptor_set);
-	assert(result == VK_SUCCESS);
+	const Resources::IndexType index_types[] = { Resources::IndexType::Uint16, Resources::IndexType::Uint32 };
+	uint32_t first_command = 0;
+	for (uint32_t i = 0; i < ARRAYSIZE(index_types); ++i)
+	{
+		// NOTE: Commands past max_indirect_draws were not written
+		uint32_t draw_count = command_counts[index_types[i]];
+		if (first_command + draw_count > max_indirect_draws)
+			draw_count = first_command < max_indirect_draws ? max_indirect_draws - first_command : 0;
 
-	VkWriteDescriptorSet descriptor_writes[1];
-	descriptor_writes[0] = { VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET };
-	descriptor_writes[0].dstSet = node_descriptor_set;
-	descriptor_writes[0].dstBinding = 0;
-	descriptor_writes[0].dstArrayElement = 0;
-	descriptor_writes[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
-	descriptor_writes[0].descriptorCount = 1;
-	descriptor_writes[0].pBufferInfo = &buffer_info;
+		if (draw_count > 0)
+		{
+			first_draw = max_cull_draws + first_command;
+			bind_index_buffer(command_buffer, index_types[i]);
+			vkCmdPushConstants(command_buffer, indirect_pipeline.pipeline_layout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(first_draw), &first_draw);
+			vkCmdDrawIndexedIndirect(command_buffer, frame->draw_command_buffer->buffer, first_command * sizeof(VkDrawIndexedIndirectCommand), draw_count, sizeof(VkDrawIndexedIndirectCommand));
+			entity_draw_count++;
+		}
 
-	vkUpdateDescriptorSets(backend->device->context->device, 1, descriptor_writes, 0, nullptr);
+		first_command += command_counts[index_types[i]];
+	}
 }
 
 void Renderer::render_frame(Game::State* game_state, float delta_time)
@@ -321,6 +1380,14 @@ void Renderer::render_frame(Game::State* game_state, float delta_time)
 		frame_resources.custom = frame;
 	}
 
+	// The depth pyramid follows the size of the depth buffer
+	if (instance_culling && depth_pyramid_generation != backend->device->depth_buffer_generation)
+	{
+		vkDeviceWaitIdle(backend->device->context->device);
+		destroy_depth_pyramid();
+		create_depth_pyramid();
+	}
+
 	if (frame->view_descriptor_set == VK_NULL_HANDLE)
 	{
 		VkResult result = allocate_descriptor_set(descriptor_set_layouts[0], frame->view_descriptor_set);
@@ -360,6 +1427,69 @@ void Renderer::render_frame(Game::State* game_state, float delta_time)
 		font_descriptor_writes[0].pImageInfo = &font_info;
 
 		vkUpdateDescriptorSets(backend->device->context->device, ARRAYSIZE(font_descriptor_writes), font_descriptor_writes, 0, nullptr);
+
+		result = allocate_descriptor_set(descriptor_set_layouts[1], frame->instance_descriptor_set);
+		assert(result == VK_SUCCESS);
+
+		VkDescriptorBufferInfo instance_buffer_info = {};
+		instance_buffer_info.buffer = frame->instance_buffer->buffer;
+		instance_buffer_info.offset = 0;
+		instance_buffer_info.range = VK_WHOLE_SIZE;
+
+		VkWriteDescriptorSet instance_descriptor_writes[1];
+		instance_descriptor_writes[0] = { VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET };
+		instance_descriptor_writes[0].dstSet = frame->instance_descriptor_set;
+		instance_descriptor_writes[0].dstBinding = 0;
+		instance_descriptor_writes[0].dstArrayElement = 0;
+		instance_descriptor_writes[0].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		instance_descriptor_writes[0].descriptorCount = 1;
+		instance_descriptor_writes[0].pBufferInfo = &instance_buffer_info;
+
+		vkUpdateDescriptorSets(backend->device->context->device, ARRAYSIZE(instance_descriptor_writes), instance_descriptor_writes, 0, nullptr);
+
+		if (multi_draw_indirect)
+		{
+			result = allocate_descriptor_set(indirect_descriptor_set_layout, frame->indirect_descriptor_set);
+			assert(result == VK_SUCCESS);
+
+			VkDescriptorBufferInfo indirect_buffer_infos[2] = {};
+			indirect_buffer_infos[0] = { frame->draw_data_buffer->buffer, 0, VK_WHOLE_SIZE };
+			indirect_buffer_infos[1] = { material_buffer->buffer, 0, VK_WHOLE_SIZE };
+
+			VkWriteDescriptorSet indirect_descriptor_writes[ARRAYSIZE(indirect_buffer_infos)];
+			for (uint32_t i = 0; i < ARRAYSIZE(indirect_descriptor_writes); ++i)
+			{
+				indirect_descriptor_writes[i] = { VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET };
+				indirect_descriptor_writes[i].dstSet = frame->indirect_descriptor_set;
+				indirect_descriptor_writes[i].dstBinding = i;
+				indirect_descriptor_writes[i].dstArrayElement = 0;
+				indirect_descriptor_writes[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+				indirect_descriptor_writes[i].descriptorCount = 1;
+				indirect_descriptor_writes[i].pBufferInfo = &indirect_buffer_infos[i];
+			}
+
+			vkUpdateDescriptorSets(backend->device->context->device, ARRAYSIZE(indirect_descriptor_writes), indirect_descriptor_writes, 0, nullptr);
+		}
+
+		// The indirect draws read the instances the instance culling kept
+		if (instance_culling)
+		{
+			result = allocate_descriptor_set(descriptor_set_layouts[1], frame->visible_instance_descriptor_set);
+			assert(result == VK_SUCCESS);
+
+			VkDescriptorBufferInfo visible_instance_buffer_info = { frame->visible_instance_buffer->buffer, 0, VK_WHOLE_SIZE };
+
+			VkWriteDescriptorSet visible_instance_descriptor_writes[1];
+			visible_instance_descriptor_writes[0] = { VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET };
+			visible_instance_descriptor_writes[0].dstSet = frame->visible_instance_descriptor_set;
+			visible_instance_descriptor_writes[0].dstBinding = 0;
+			visible_instance_descriptor_writes[0].dstArrayElement = 0;
+			visible_instance_descriptor_writes[0].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+			visible_instance_descriptor_writes[0].descriptorCount = 1;
+			visible_instance_descriptor_writes[0].pBufferInfo = &visible_instance_buffer_info;
+
+			vkUpdateDescriptorSets(backend->device->context->device, ARRAYSIZE(visible_instance_descriptor_writes), visible_instance_descriptor_writes, 0, nullptr);
+		}
 	}
 
 	VkViewport viewport = { 0, 0, (float)backend->device->wsi->swapchain_extent.width, (float)backend->device->wsi->swapchain_extent.height, 0.0f, 1.0f };
@@ -370,19 +1500,6 @@ void Renderer::render_frame(Game::State* game_state, float delta_time)
 	VkDeviceSize offsets[] = { 0 };
 	update_uniform_buffers(game_state, frame_resources);
 
-	vkCmdBindDescriptorSets(frame_resources.command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, dynamic_pipeline.pipeline_layout, 0, 1, &frame->view_descriptor_set, 0, nullptr);
-
-	vkCmdBindPipeline(frame_resources.command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, dynamic_pipeline.pipeline);
-
-	vkCmdSetViewport(frame_resources.command_buffer, 0, 1, &viewport);
-	vkCmdSetScissor(frame_resources.command_buffer, 0, 1, &scissor);
-
-	VkBuffer vertex_buffers[] = { backend->device->vertex_buffer->buffer };
-
-	// Bind point 0: Mesh vertex buffer
-	vkCmdBindVertexBuffers(frame_resources.command_buffer, 0, 1, vertex_buffers, offsets);
-	vkCmdBindIndexBuffer(frame_resources.command_buffer, backend->device->index_buffer->buffer, 0, VK_INDEX_TYPE_UINT16);
-
 	if (!game_state->paused)
 	{
 		for (uint32_t i = 0; i < game_state->player_body_part_count; ++i)
@@ -399,81 +1516,72 @@ void Renderer::render_frame(Game::State* game_state, float delta_time)
 		}
 	}
 
-	for (uint32_t x = 0; x < game_state->player_body_part_count; ++x)
+	// Apple
+	glm::mat4 apple_matrix = glm::mat4(1.0f);
+	Transform& apple_transform = game_state->transforms[game_state->apple_id];
+	apple_matrix = glm::translate(apple_matrix, apple_transform.position);
+	// apple_matrix *= apple_transform.rotation;
+
+	// The matrices the dynamic render packets are drawn with
+	dynamic_matrices[0] = apple_matrix;
+	memcpy(&dynamic_matrices[1], game_state->player_matrices, game_state->player_body_part_count * sizeof(glm::mat4));
+
+	update_dynamic_node_bounds(game_state->assets_info);
+	if (frustum_culling)
+	{
+		glm::vec4 frustum_planes[6];
+		get_frustum_planes(frame->view_projection, frustum_planes);
+		node_bounds.cull(frustum_planes);
+	}
+	else
 	{
-		vkCmdPushConstants(frame_resources.command_buffer, dynamic_pipeline.pipeline_layout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(glm::mat4), &game_state->player_matrices[x]);
+		node_bounds.show_all();
+	}
 
-		// Render the player
-		Entity& entity = game_state->entities[x + game_state->player_head_id];
-		Resources::Model model = game_state->assets_info->models[entity.model_id];
-		for (uint32_t n_id = 0; n_id < model.node_count; ++n_id)
-		{
-			uint32_t dynamic_offset = (entity.node_offset + n_id) * static_cast<uint32_t>(dynamic_alignment);
-			Resources::Node node = model.nodes[n_id];
-			vkCmdBindDescriptorSets(frame_resources.command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, dynamic_pipeline.pipeline_layout, 1, 1, &node_descriptor_set, 1, &dynamic_offset);
-			Resources::Mesh mesh = game_state->assets_info->meshes[node.mesh_id];
-			for (uint32_t p_id = 0; p_id < mesh.primitive_count; ++p_id)
-			{
-				Resources::Primitive primitive = mesh.primitives[p_id];
-				Resources::Material material = game_state->assets_info->materials[primitive.material_id];
-				vkCmdPushConstants(frame_resources.command_buffer, dynamic_pipeline.pipeline_layout, VK_SHADER_STAGE_FRAGMENT_BIT, sizeof(glm::mat4), sizeof(Resources::Material::PBRMetallicRoughness), &material.pbr_metallic_roughness);
-				vkCmdDrawIndexed(frame_resources.command_buffer, primitive.index_count, 1, primitive.index_offset, 0, 0);
-			}
-		}
+	prepare_instanced_draws(frame, game_state);
+
+	// NOTE: Counted while the indirect draws are written
+	lod_triangle_count = 0;
+	full_triangle_count = 0;
+	entity_draw_count = 0;
+
+	frame->cull_draw_count = 0;
+	frame->cull_job_count = 0;
+	if (meshlet_culling)
+	{
+		record_meshlet_culling(game_state, frame_resources);
 	}
 
-	// Apple
-	glm::mat4 body_model = glm::mat4(1.0f);
-	Transform& transform = game_state->transforms[game_state->apple_id];
-	body_model = glm::translate(body_model, transform.position);
-	// body_model *= transform.rotation;
-
-	vkCmdPushConstants(frame_resources.command_buffer, dynamic_pipeline.pipeline_layout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(glm::mat4), &body_model);
-
-	// Render the apple
-	Entity& entity = game_state->entities[game_state->apple_id];
-	Resources::Model model = game_state->assets_info->models[entity.model_id];
-	for (uint32_t n_id = 0; n_id < model.node_count; ++n_id)
-	{
-		uint32_t dynamic_offset = (entity.node_offset + n_id) * static_cast<uint32_t>(dynamic_alignment);
-		Resources::Node node = model.nodes[n_id];
-		vkCmdBindDescriptorSets(frame_resources.command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, dynamic_pipeline.pipeline_layout, 1, 1, &node_descriptor_set, 1, &dynamic_offset);
-		Resources::Mesh mesh = game_state->assets_info->meshes[node.mesh_id];
-		for (uint32_t p_id = 0; p_id < mesh.primitive_count; ++p_id)
+	if (multi_draw_indirect)
+	{
+		write_indirect_draws(frame, game_state);
+
+		if (instance_culling)
 		{
-			Resources::Primitive primitive = mesh.primitives[p_id];
-			Resources::Material material = game_state->assets_info->materials[primitive.material_id];
-			vkCmdPushConstants(frame_resources.command_buffer, dynamic_pipeline.pipeline_layout, VK_SHADER_STAGE_FRAGMENT_BIT, sizeof(glm::mat4), sizeof(Resources::Material::PBRMetallicRoughness), &material.pbr_metallic_roughness);
-			vkCmdDrawIndexed(frame_resources.command_buffer, primitive.index_count, 1, primitive.index_offset, 0, 0);
+			record_instance_culling(frame_resources);
 		}
 	}
 
-	vkCmdBindPipeline(frame_resources.command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, static_pipeline.pipeline);
-
-	vkCmdBindDescriptorSets(frame_resources.command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, static_pipeline.pipeline_layout, 0, 1, &frame->view_descriptor_set, 0, nullptr);
+	backend->device->begin_render_pass(frame_resources);
 
 	vkCmdSetViewport(frame_resources.command_buffer, 0, 1, &viewport);
 	vkCmdSetScissor(frame_resources.command_buffer, 0, 1, &scissor);
 
-	// Render all other entities
-	for (uint32_t e_id = 0; e_id < game_state->apple_id; ++e_id)
+	VkBuffer vertex_buffers[] = { backend->device->vertex_buffer->buffer, backend->device->vertex_buffer->buffer, backend->device->vertex_buffer->buffer };
+
+	// Bind points 0, 1, 2: Mesh positions, normals and uvs, all in the vertex buffer
+	vkCmdBindVertexBuffers(frame_resources.command_buffer, 0, ARRAYSIZE(vertex_buffers), vertex_buffers, vertex_stream_offsets);
+	// NOTE: The index buffer is bound per draw, with the index type of
+	// its mesh or the culled index stream
+	bound_index_type = -1;
+
+	if (multi_draw_indirect)
 	{
-		Entity& entity = game_state->entities[e_id];
-		Resources::Model model = game_state->assets_info->models[entity.model_id];
-		for (uint32_t n_id = 0; n_id < model.node_count; ++n_id)
-		{
-			uint32_t dynamic_offset = (entity.node_offset + n_id) * static_cast<uint32_t>(dynamic_alignment);
-			Resources::Node node = model.nodes[n_id];
-			vkCmdBindDescriptorSets(frame_resources.command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, static_pipeline.pipeline_layout, 1, 1, &node_descriptor_set, 1, &dynamic_offset);
-			Resources::Mesh mesh = game_state->assets_info->meshes[node.mesh_id];
-			for (uint32_t p_id = 0; p_id < mesh.primitive_count; ++p_id)
-			{
-				Resources::Primitive primitive = mesh.primitives[p_id];
-				Resources::Material material = game_state->assets_info->materials[primitive.material_id];
-				vkCmdPushConstants(frame_resources.command_buffer, static_pipeline.pipeline_layout, VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(Resources::Material::PBRMetallicRoughness), &material.pbr_metallic_roughness);
-				vkCmdDrawIndexed(frame_resources.command_buffer, primitive.index_count, 1, primitive.index_offset, 0, 0);
-			}
-		}
+		record_indirect_draws(frame_resources.command_buffer, frame);
+	}
+	else
+	{
+		record_draws(frame_resources.command_buffer, frame, game_state);
 	}
 
 	// Debug Draw
@@ -497,6 +1605,7 @@ void Renderer::render_frame(Game::State* game_state, float delta_time)
 	imgui_draw_frame(frame_resources);
 
 	backend->device->end_draw_frame(frame_resources);
+	depth_buffer_rendered = true;
 
 	auto frame_cpu_end = std::chrono::high_resolution_clock::now();
 	auto frame_time = (frame_cpu_end - frame_cpu_start).count();
@@ -567,6 +1676,44 @@ void Renderer::imgui_new_frame(Vulkan::FrameResources& frame_resources, const Ga
 	sprintf(move_count, "Move count: %d", game_state->player_move_count);
 	ImGui::TextUnformatted(move_count);
 
+	Vulkan::AllocatorStats allocator_stats = backend->device->context->allocator->get_stats();
+	char allocator_text[128];
+	sprintf(allocator_text, "GPU memory - blocks: %u dedicated: %u allocations: %u", allocator_stats.block_count, allocator_stats.dedicated_count, allocator_stats.allocation_count);
+	ImGui::TextUnformatted(allocator_text);
+	sprintf(allocator_text, "GPU memory - used: %.2fMB / %.2fMB fragmentation: %.2f%%",
+		double(allocator_stats.bytes_used) / (1024.0 * 1024.0), double(allocator_stats.bytes_reserved) / (1024.0 * 1024.0), allocator_stats.fragmentation * 100.0f);
+	ImGui::TextUnformatted(allocator_text);
+
+	if (backend->device->is_upload_complete(upload_token))
+		ImGui::TextUnformatted("Uploads: done");
+	else
+		ImGui::TextUnformatted("Uploads: in flight");
+
+	const Frame* frame = (const Frame*) frame_resources.custom;
+	char frustum_text[128];
+	sprintf(frustum_text, "Frustum culling: %s - nodes visible: %u culled: %u", frustum_culling ? "on" : "off", node_bounds.visible_count, node_bounds.culled_count);
+	ImGui::TextUnformatted(frustum_text);
+
+	char cull_text[128];
+	sprintf(cull_text, "Meshlet culling: %s - draws: %u meshlets: %u", meshlet_culling ? "on" : "off", frame->cull_draw_count, frame->cull_job_count);
+	ImGui::TextUnformatted(cull_text);
+
+	char lod_text[128];
+	sprintf(lod_text, "LOD selection: %s - triangles: %u / %u", lod_selection ? "on" : "off", lod_triangle_count, full_triangle_count);
+	ImGui::TextUnformatted(lod_text);
+
+	char draw_text[128];
+	sprintf(draw_text, "Entity draws: %u%s - instances: %u packets: %u", entity_draw_count, multi_draw_indirect ? " (MDI)" : "", frame->instance_count, uint32_t(render_packets.packets.count));
+	ImGui::TextUnformatted(draw_text);
+
+	if (instance_culling)
+	{
+		char instance_cull_text[128];
+		sprintf(instance_cull_text, "Instance culling - runs: %u occlusion: %s (%ux%u, %u levels)", frame->cull_run_count, occlusion_culling ? "on" : "off",
+			depth_pyramid_extent.width, depth_pyramid_extent.height, depth_pyramid_level_count);
+		ImGui::TextUnformatted(instance_cull_text);
+	}
+
 	ImGui::End();
 
 	// Render to generate draw buffers
@@ -600,7 +1747,7 @@ void Renderer::imgui_update_buffers(Vulkan::FrameResources& frame_resources)
 
 		frame->imgui_vertex_buffer = new Vulkan::Buffer(
 			backend->device->context->device,
-			backend->device->context->gpu,
+			backend->device->context->allocator,
 			VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
 			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT,
 			vertex_buffer_size,
@@ -624,7 +1771,7 @@ void Renderer::imgui_update_buffers(Vulkan::FrameResources& frame_resources)
 
 		frame->imgui_index_buffer = new Vulkan::Buffer(
 			backend->device->context->device,
-			backend->device->context->gpu,
+			backend->device->context->allocator,
 			VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
 			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT,
 			index_buffer_size,
@@ -727,10 +1874,11 @@ void Renderer::prepare_uniform_buffers()
 		ubo.projection[1][1] *= -1;
 		ubo.camera_position = glm::vec3(0.0f, 0.0f, 0.0f);
 
-		void* data;
-		vkMapMemory(backend->device->context->device, frames[i].view_ubo_buffer->device_memory, 0, sizeof(ubo), 0, &data);
+		frames[i].view_ubo_buffer->map(backend->device->context->device, sizeof(ubo));
+		void* data = frames[i].view_ubo_buffer->mapped;
 		memcpy(data, &ubo, sizeof(ubo));
-		vkUnmapMemory(backend->device->context->device, frames[i].view_ubo_buffer->device_memory);
+		frames[i].view_ubo_buffer->flush(backend->device->context->device);
+		frames[i].view_ubo_buffer->unmap(backend->device->context->device);
 	}
 }
 
@@ -747,11 +1895,14 @@ void Renderer::update_uniform_buffers(Game::State* game_state, Vulkan::FrameReso
 	ubo.projection = glm::perspective(glm::radians(45.0f), (float)backend->device->wsi->swapchain_extent.width / (float)backend->device->wsi->swapchain_extent.height, 0.001f, 1000.0f);
 	ubo.projection[1][1] *= -1;
 	ubo.camera_position = game_state->current_camera->position;
+	frame->view_projection = ubo.projection * ubo.view;
+	frame->lod_projection_scale = 0.5f * float(backend->device->wsi->swapchain_extent.height) * fabsf(ubo.projection[1][1]);
 
-	void* data;
-	vkMapMemory(backend->device->context->device, frame->view_ubo_buffer->device_memory, 0, sizeof(ubo), 0, &data);
+	frame->view_ubo_buffer->map(backend->device->context->device, sizeof(ubo));
+	void* data = frame->view_ubo_buffer->mapped;
 	memcpy(data, &ubo, sizeof(ubo));
-	vkUnmapMemory(backend->device->context->device, frame->view_ubo_buffer->device_memory);
+	frame->view_ubo_buffer->flush(backend->device->context->device);
+	frame->view_ubo_buffer->unmap(backend->device->context->device);
 }
 
 void Renderer::prepare_debug_vertex_buffers()
@@ -796,9 +1947,10 @@ void Renderer::prepare_debug_vertex_buffers()
 		frames[i].debug_lines[frames[i].debug_line_count++] = { glm::vec3(0.0f, 0.0f, 0.0f), green };
 		frames[i].debug_lines[frames[i].debug_line_count++] = { glm::vec3(0.0f, 3.0f, 0.0f), green };
 
-		vkMapMemory(backend->device->context->device, frames[i].debug_vertex_buffer->device_memory, 0, sizeof(DebugLine) * frames[i].debug_line_count, 0, &frames[i].debug_vertex_buffer->mapped);
+		frames[i].debug_vertex_buffer->map(backend->device->context->device, sizeof(DebugLine) * frames[i].debug_line_count);
 		memcpy(frames[i].debug_vertex_buffer->mapped, &frames[i].debug_lines, sizeof(DebugLine) * frames[i].debug_line_count);
-		vkUnmapMemory(backend->device->context->device, frames[i].debug_vertex_buffer->device_memory);
+		frames[i].debug_vertex_buffer->flush(backend->device->context->device);
+		frames[i].debug_vertex_buffer->unmap(backend->device->context->device);
 	}
 }
 
@@ -806,57 +1958,271 @@ void Renderer::cleanup()
 {
 	vkQueueWaitIdle(backend->device->context->graphics_queue);
 
-	ImGui::DestroyContext();
+	ImGui::DestroyContext();
+
+	vkDestroySampler(backend->device->context->device, imgui_font_sampler, nullptr);
+	imgui_font->destroy(backend->device->context->device);
+
+	destroy_textures();
+	vkDestroySampler(backend->device->context->device, texture_sampler, nullptr);
+
+	destroy_ubo_buffers();
+	destroy_cull_buffers();
+	destroy_instance_buffers();
+	destroy_indirect_buffers();
+	destroy_instance_cull_buffers();
+	destroy_depth_pyramid();
+	vkDestroySampler(backend->device->context->device, depth_pyramid_sampler, nullptr);
+	destroy_descriptor_pool();
+
+	node_matrices.release();
+	node_bounds.release();
+	render_packets.release();
+	instanced_draws.release();
+
+	vkDestroyDescriptorSetLayout(backend->device->context->device, imgui_descriptor_set_layout, nullptr);
+
+	// TODO: Move this its onw cleanup function
+	for (uint32_t i = 0; i < Vulkan::MAX_FRAMES_IN_FLIGHT; ++i)
+	{
+		frames[i].debug_vertex_buffer->destroy(backend->device->context->device);
+	}
+
+	for (uint32_t i = 0; i < descriptor_set_layout_count; ++i)
+	{
+		vkDestroyDescriptorSetLayout(backend->device->context->device, descriptor_set_layouts[i], nullptr);
+		descriptor_set_layouts[i] = VK_NULL_HANDLE;
+	}
+
+	destroy_pipeline(static_pipeline);
+	destroy_pipeline(dynamic_pipeline);
+	destroy_pipeline(imgui_pipeline);
+	destroy_pipeline(debug_pipeline);
+	destroy_pipeline(cull_pipeline);
+	destroy_pipeline(indirect_pipeline);
+	destroy_pipeline(instance_cull_pipeline);
+	destroy_pipeline(depth_reduce_pipeline);
+	destroy_pipeline(depth_reduce_ms_pipeline);
+
+	vkDestroyDescriptorSetLayout(backend->device->context->device, cull_descriptor_set_layout, nullptr);
+	cull_descriptor_set_layout = VK_NULL_HANDLE;
+	vkDestroyDescriptorSetLayout(backend->device->context->device, texture_array_descriptor_set_layout, nullptr);
+	texture_array_descriptor_set_layout = VK_NULL_HANDLE;
+	vkDestroyDescriptorSetLayout(backend->device->context->device, indirect_descriptor_set_layout, nullptr);
+	indirect_descriptor_set_layout = VK_NULL_HANDLE;
+	vkDestroyDescriptorSetLayout(backend->device->context->device, instance_cull_descriptor_set_layout, nullptr);
+	instance_cull_descriptor_set_layout = VK_NULL_HANDLE;
+	vkDestroyDescriptorSetLayout(backend->device->context->device, depth_reduce_descriptor_set_layout, nullptr);
+	depth_reduce_descriptor_set_layout = VK_NULL_HANDLE;
+
+	backend->device->cleanup();
+	backend->wsi->cleanup();
+}
+
+// Whether a pipeline made of shader_paths has to be (re)created when
+// changed_shader_path changes. Every pipeline does when it is null.
+static bool uses_shader(const char* changed_shader_path, const char* vertex_shader_path, const char* fragment_shader_path = nullptr)
+{
+	if (changed_shader_path == nullptr)
+		return true;
+
+	return strcmp(changed_shader_path, vertex_shader_path) == 0 || (fragment_shader_path != nullptr && strcmp(changed_shader_path, fragment_shader_path) == 0);
+}
+
+void Renderer::create_descriptor_set_layouts()
+{
+	// View Descriptor Set Layout
+	// TODO: Add more info about these DescriptorSet Layout Bindings
+	VkDescriptorSetLayoutBinding view_descriptor_set_layout_bindings[1];
+	// View Uniform Buffer Object: Camera info (view, projection, position)
+	view_descriptor_set_layout_bindings[0] = {};
+	view_descriptor_set_layout_bindings[0].binding = 0;
+	view_descriptor_set_layout_bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+	view_descriptor_set_layout_bindings[0].descriptorCount = 1;
+	view_descriptor_set_layout_bindings[0].stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT;
+	view_descriptor_set_layout_bindings[0].pImmutableSamplers = nullptr;
+
+	VkDescriptorSetLayoutCreateInfo view_descriptor_set_layout_ci = { VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO };
+	view_descriptor_set_layout_ci.bindingCount = ARRAYSIZE(view_descriptor_set_layout_bindings);
+	view_descriptor_set_layout_ci.pBindings = view_descriptor_set_layout_bindings;
+
+	VkResult result = vkCreateDescriptorSetLayout(backend->device->context->device, &view_descriptor_set_layout_ci, nullptr, &descriptor_set_layouts[descriptor_set_layout_offset++]);
+	assert(result == VK_SUCCESS);
+	descriptor_set_layout_count++;
+
+	// Instance Descriptor Set
+	VkDescriptorSetLayoutBinding node_descriptor_set_layout_bindings[1];
+	// Instance buffer of the frame: model matrix and mesh bounds of every instance
+	node_descriptor_set_layout_bindings[0] = {};
+	node_descriptor_set_layout_bindings[0].binding = 0;
+	node_descriptor_set_layout_bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	node_descriptor_set_layout_bindings[0].descriptorCount = 1;
+	node_descriptor_set_layout_bindings[0].stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+	node_descriptor_set_layout_bindings[0].pImmutableSamplers = nullptr;
+
+	VkDescriptorSetLayoutCreateInfo node_descriptor_set_layout_ci = { VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO };
+	node_descriptor_set_layout_ci.bindingCount = ARRAYSIZE(node_descriptor_set_layout_bindings);
+	node_descriptor_set_layout_ci.pBindings = node_descriptor_set_layout_bindings;
+
+	result = vkCreateDescriptorSetLayout(backend->device->context->device, &node_descriptor_set_layout_ci, nullptr, &descriptor_set_layouts[descriptor_set_layout_offset++]);
+	assert(result == VK_SUCCESS);
+	descriptor_set_layout_count++;
+
+	// Material Descriptor Set
+	VkDescriptorSetLayoutBinding material_descriptor_set_layout_bindings[1];
+	// Base color texture
+	material_descriptor_set_layout_bindings[0] = {};
+	material_descriptor_set_layout_bindings[0].binding = 0;
+	material_descriptor_set_layout_bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	material_descriptor_set_layout_bindings[0].descriptorCount = 1;
+	material_descriptor_set_layout_bindings[0].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+	material_descriptor_set_layout_bindings[0].pImmutableSamplers = nullptr;
+
+	VkDescriptorSetLayoutCreateInfo material_descriptor_set_layout_ci = { VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO };
+	material_descriptor_set_layout_ci.bindingCount = ARRAYSIZE(material_descriptor_set_layout_bindings);
+	material_descriptor_set_layout_ci.pBindings = material_descriptor_set_layout_bindings;
+
+	result = vkCreateDescriptorSetLayout(backend->device->context->device, &material_descriptor_set_layout_ci, nullptr, &descriptor_set_layouts[descriptor_set_layout_offset++]);
+	assert(result == VK_SUCCESS);
+	descriptor_set_layout_count++;
+
+	// Every material texture is sampled with the same trilinear, repeating
+	// sampler, anisotropic when the GPU supports it
+	float max_anisotropy = backend->device->context->gpu_properties.limits.maxSamplerAnisotropy;
+	VkSamplerCreateInfo texture_sampler_ci = { VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO };
+	texture_sampler_ci.magFilter = VK_FILTER_LINEAR;
+	texture_sampler_ci.minFilter = VK_FILTER_LINEAR;
+	texture_sampler_ci.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
+	texture_sampler_ci.addressModeU = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+	texture_sampler_ci.addressModeV = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+	texture_sampler_ci.addressModeW = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+	texture_sampler_ci.anisotropyEnable = backend->device->context->gpu_enabled_features.samplerAnisotropy;
+	texture_sampler_ci.maxAnisotropy = max_anisotropy < 8.0f ? max_anisotropy : 8.0f;
+	texture_sampler_ci.minLod = 0.0f;
+	texture_sampler_ci.maxLod = VK_LOD_CLAMP_NONE;
+	texture_sampler_ci.borderColor = VK_BORDER_COLOR_FLOAT_OPAQUE_WHITE;
+	result = vkCreateSampler(backend->device->context->device, &texture_sampler_ci, nullptr, &texture_sampler);
+	assert(result == VK_SUCCESS);
+
+	// Meshlet culling
+	// Bindings: meshlets, index buffer, draws, jobs, indirect commands, culled indices, instances
+	VkDescriptorSetLayoutBinding cull_descriptor_set_layout_bindings[7];
+	for (uint32_t i = 0; i < ARRAYSIZE(cull_descriptor_set_layout_bindings); ++i)
+	{
+		cull_descriptor_set_layout_bindings[i] = {};
+		cull_descriptor_set_layout_bindings[i].binding = i;
+		cull_descriptor_set_layout_bindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		cull_descriptor_set_layout_bindings[i].descriptorCount = 1;
+		cull_descriptor_set_layout_bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+		cull_descriptor_set_layout_bindings[i].pImmutableSamplers = nullptr;
+	}
+
+	VkDescriptorSetLayoutCreateInfo cull_descriptor_set_layout_ci = { VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO };
+	cull_descriptor_set_layout_ci.bindingCount = ARRAYSIZE(cull_descriptor_set_layout_bindings);
+	cull_descriptor_set_layout_ci.pBindings = cull_descriptor_set_layout_bindings;
+
+	result = vkCreateDescriptorSetLayout(backend->device->context->device, &cull_descriptor_set_layout_ci, nullptr, &cull_descriptor_set_layout);
+	assert(result == VK_SUCCESS);
 
-	vkDestroySampler(backend->device->context->device, imgui_font_sampler, nullptr);
-	imgui_font->destroy(backend->device->context->device);
+	if (!multi_draw_indirect)
+		return;
 
-	destroy_ubo_buffers();
-	destroy_descriptor_pool();
+	// Multi draw indirect: every texture, the white one last
+	VkDescriptorSetLayoutBinding texture_array_descriptor_set_layout_bindings[1];
+	texture_array_descriptor_set_layout_bindings[0] = {};
+	texture_array_descriptor_set_layout_bindings[0].binding = 0;
+	texture_array_descriptor_set_layout_bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	texture_array_descriptor_set_layout_bindings[0].descriptorCount = max_texture_count + 1;
+	texture_array_descriptor_set_layout_bindings[0].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+	texture_array_descriptor_set_layout_bindings[0].pImmutableSamplers = nullptr;
 
-	vkDestroyDescriptorSetLayout(backend->device->context->device, imgui_descriptor_set_layout, nullptr);
+	VkDescriptorSetLayoutCreateInfo texture_array_descriptor_set_layout_ci = { VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO };
+	texture_array_descriptor_set_layout_ci.bindingCount = ARRAYSIZE(texture_array_descriptor_set_layout_bindings);
+	texture_array_descriptor_set_layout_ci.pBindings = texture_array_descriptor_set_layout_bindings;
 
-	// TODO: Move this its onw cleanup function
-	for (uint32_t i = 0; i < Vulkan::MAX_FRAMES_IN_FLIGHT; ++i)
-	{
-		frames[i].debug_vertex_buffer->destroy(backend->device->context->device);
-	}
+	result = vkCreateDescriptorSetLayout(backend->device->context->device, &texture_array_descriptor_set_layout_ci, nullptr, &texture_array_descriptor_set_layout);
+	assert(result == VK_SUCCESS);
 
-	for (uint32_t i = 0; i < descriptor_set_layout_count; ++i)
+	// Bindings: draw data, materials
+	VkDescriptorSetLayoutBinding indirect_descriptor_set_layout_bindings[2];
+	for (uint32_t i = 0; i < ARRAYSIZE(indirect_descriptor_set_layout_bindings); ++i)
 	{
-		vkDestroyDescriptorSetLayout(backend->device->context->device, descriptor_set_layouts[i], nullptr);
-		descriptor_set_layouts[i] = VK_NULL_HANDLE;
+		indirect_descriptor_set_layout_bindings[i] = {};
+		indirect_descriptor_set_layout_bindings[i].binding = i;
+		indirect_descriptor_set_layout_bindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		indirect_descriptor_set_layout_bindings[i].descriptorCount = 1;
+		indirect_descriptor_set_layout_bindings[i].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+		indirect_descriptor_set_layout_bindings[i].pImmutableSamplers = nullptr;
 	}
 
-	vkDestroyPipeline(backend->device->context->device, static_pipeline.pipeline, nullptr);
-	static_pipeline.pipeline = VK_NULL_HANDLE;
+	VkDescriptorSetLayoutCreateInfo indirect_descriptor_set_layout_ci = { VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO };
+	indirect_descriptor_set_layout_ci.bindingCount = ARRAYSIZE(indirect_descriptor_set_layout_bindings);
+	indirect_descriptor_set_layout_ci.pBindings = indirect_descriptor_set_layout_bindings;
+
+	result = vkCreateDescriptorSetLayout(backend->device->context->device, &indirect_descriptor_set_layout_ci, nullptr, &indirect_descriptor_set_layout);
+	assert(result == VK_SUCCESS);
 
-	vkDestroyPipelineLayout(backend->device->context->device, static_pipeline.pipeline_layout, nullptr);
-	static_pipeline.pipeline_layout = VK_NULL_HANDLE;
+	if (!instance_culling)
+		return;
 
-	vkDestroyPipeline(backend->device->context->device, dynamic_pipeline.pipeline, nullptr);
-	dynamic_pipeline.pipeline = VK_NULL_HANDLE;
+	// Instance culling
+	// Bindings: cull instances, runs, run commands, instances, visible instances,
+	// cull commands, draw commands, depth pyramid
+	VkDescriptorSetLayoutBinding instance_cull_descriptor_set_layout_bindings[8];
+	for (uint32_t i = 0; i < ARRAYSIZE(instance_cull_descriptor_set_layout_bindings); ++i)
+	{
+		instance_cull_descriptor_set_layout_bindings[i] = {};
+		instance_cull_descriptor_set_layout_bindings[i].binding = i;
+		instance_cull_descriptor_set_layout_bindings[i].descriptorType = i == 7 ? VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER : VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		instance_cull_descriptor_set_layout_bindings[i].descriptorCount = 1;
+		instance_cull_descriptor_set_layout_bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+		instance_cull_descriptor_set_layout_bindings[i].pImmutableSamplers = nullptr;
+	}
 
-	vkDestroyPipelineLayout(backend->device->context->device, dynamic_pipeline.pipeline_layout, nullptr);
-	dynamic_pipeline.pipeline_layout = VK_NULL_HANDLE;
+	VkDescriptorSetLayoutCreateInfo instance_cull_descriptor_set_layout_ci = { VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO };
+	instance_cull_descriptor_set_layout_ci.bindingCount = ARRAYSIZE(instance_cull_descriptor_set_layout_bindings);
+	instance_cull_descriptor_set_layout_ci.pBindings = instance_cull_descriptor_set_layout_bindings;
 
-	vkDestroyPipeline(backend->device->context->device, imgui_pipeline.pipeline, nullptr);
-	imgui_pipeline.pipeline = VK_NULL_HANDLE;
+	result = vkCreateDescriptorSetLayout(backend->device->context->device, &instance_cull_descriptor_set_layout_ci, nullptr, &instance_cull_descriptor_set_layout);
+	assert(result == VK_SUCCESS);
 
-	vkDestroyPipelineLayout(backend->device->context->device, imgui_pipeline.pipeline_layout, nullptr);
-	imgui_pipeline.pipeline_layout = VK_NULL_HANDLE;
+	// Depth pyramid
+	// Bindings: the level below (or the depth buffer), the level
+	VkDescriptorSetLayoutBinding depth_reduce_descriptor_set_layout_bindings[2];
+	for (uint32_t i = 0; i < ARRAYSIZE(depth_reduce_descriptor_set_layout_bindings); ++i)
+	{
+		depth_reduce_descriptor_set_layout_bindings[i] = {};
+		depth_reduce_descriptor_set_layout_bindings[i].binding = i;
+		depth_reduce_descriptor_set_layout_bindings[i].descriptorType = i == 0 ? VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER : VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+		depth_reduce_descriptor_set_layout_bindings[i].descriptorCount = 1;
+		depth_reduce_descriptor_set_layout_bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+		depth_reduce_descriptor_set_layout_bindings[i].pImmutableSamplers = nullptr;
+	}
 
-	vkDestroyPipeline(backend->device->context->device, debug_pipeline.pipeline, nullptr);
-	debug_pipeline.pipeline = VK_NULL_HANDLE;
+	VkDescriptorSetLayoutCreateInfo depth_reduce_descriptor_set_layout_ci = { VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO };
+	depth_reduce_descriptor_set_layout_ci.bindingCount = ARRAYSIZE(depth_reduce_descriptor_set_layout_bindings);
+	depth_reduce_descriptor_set_layout_ci.pBindings = depth_reduce_descriptor_set_layout_bindings;
 
-	vkDestroyPipelineLayout(backend->device->context->device, debug_pipeline.pipeline_layout, nullptr);
-	debug_pipeline.pipeline_layout = VK_NULL_HANDLE;
+	result = vkCreateDescriptorSetLayout(backend->device->context->device, &depth_reduce_descriptor_set_layout_ci, nullptr, &depth_reduce_descriptor_set_layout);
+	assert(result == VK_SUCCESS);
 
-	backend->device->cleanup();
-	backend->wsi->cleanup();
+	// NOTE: The shaders only texelFetch, the sampler is there for the
+	// combined image samplers
+	VkSamplerCreateInfo depth_pyramid_sampler_ci = { VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO };
+	depth_pyramid_sampler_ci.magFilter = VK_FILTER_NEAREST;
+	depth_pyramid_sampler_ci.minFilter = VK_FILTER_NEAREST;
+	depth_pyramid_sampler_ci.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+	depth_pyramid_sampler_ci.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	depth_pyramid_sampler_ci.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	depth_pyramid_sampler_ci.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	depth_pyramid_sampler_ci.minLod = 0.0f;
+	depth_pyramid_sampler_ci.maxLod = VK_LOD_CLAMP_NONE;
+	depth_pyramid_sampler_ci.borderColor = VK_BORDER_COLOR_FLOAT_OPAQUE_WHITE;
+	result = vkCreateSampler(backend->device->context->device, &depth_pyramid_sampler_ci, nullptr, &depth_pyramid_sampler);
+	assert(result == VK_SUCCESS);
 }
 
-void Renderer::create_pipelines()
+void Renderer::create_pipelines(const char* shader_path)
 {
 	// Shared resources.
 	// The static and dynamic pipelines share some of the resources (like the view uniform buffer)
@@ -940,12 +2306,22 @@ void Renderer::create_pipelines()
 	// A vertex binding describes at which rate to load data from memory throughout the vertices. 
 	// It specifies the number of bytes between data entries and whether to move to the next 
 	// data entry after each vertex or after each instance.
-	VkVertexInputBindingDescription vertex_binding_descriptions[1];
+	// NOTE: Vertex attributes are stored as separate streams, one binding each
+	bool quantized = vertex_format == Resources::VertexFormat::Quantized;
+	VkVertexInputBindingDescription vertex_binding_descriptions[3];
 	// Mesh vertex bindings
 	vertex_binding_descriptions[0] = {};
 	vertex_binding_descriptions[0].binding = 0;
-	vertex_binding_descriptions[0].stride = sizeof(Resources::Vertex);
+	vertex_binding_descriptions[0].stride = quantized ? sizeof(Resources::QuantizedPosition) : sizeof(glm::vec3);
 	vertex_binding_descriptions[0].inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+	vertex_binding_descriptions[1] = {};
+	vertex_binding_descriptions[1].binding = 1;
+	vertex_binding_descriptions[1].stride = quantized ? sizeof(Resources::QuantizedNormal) : sizeof(glm::vec3);
+	vertex_binding_descriptions[1].inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+	vertex_binding_descriptions[2] = {};
+	vertex_binding_descriptions[2].binding = 2;
+	vertex_binding_descriptions[2].stride = quantized ? sizeof(Resources::QuantizedUv) : sizeof(glm::vec2);
+	vertex_binding_descriptions[2].inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
 
 	vertex_input_ci.vertexBindingDescriptionCount = ARRAYSIZE(vertex_binding_descriptions);
 	vertex_input_ci.pVertexBindingDescriptions = vertex_binding_descriptions;
@@ -955,88 +2331,75 @@ void Renderer::create_pipelines()
 	// so we need 3 attribute description structs
 	VkVertexInputAttributeDescription vertex_input_attribute_descriptions[3];
 	// Per-vertex attributes
+	// NOTE: Quantized attributes are expanded to floats by the vertex fetch,
+	// the *_quantized.vert shaders only have to decode them
 	// Position
 	vertex_input_attribute_descriptions[0].binding = 0;
 	vertex_input_attribute_descriptions[0].location = 0;
-	vertex_input_attribute_descriptions[0].format = VK_FORMAT_R32G32B32_SFLOAT;
-	vertex_input_attribute_descriptions[0].offset = offsetof(Resources::Vertex, position);
+	vertex_input_attribute_descriptions[0].format = quantized ? VK_FORMAT_R16G16B16A16_UNORM : VK_FORMAT_R32G32B32_SFLOAT;
+	vertex_input_attribute_descriptions[0].offset = 0;
 	// Normal
-	vertex_input_attribute_descriptions[1].binding = 0;
+	vertex_input_attribute_descriptions[1].binding = 1;
 	vertex_input_attribute_descriptions[1].location = 1;
-	vertex_input_attribute_descriptions[1].format = VK_FORMAT_R32G32B32_SFLOAT;
-	vertex_input_attribute_descriptions[1].offset = offsetof(Resources::Vertex, normal);
+	vertex_input_attribute_descriptions[1].format = quantized ? VK_FORMAT_R16G16_SNORM : VK_FORMAT_R32G32B32_SFLOAT;
+	vertex_input_attribute_descriptions[1].offset = 0;
 	// Tex Coord 0
-	vertex_input_attribute_descriptions[2].binding = 0;
+	vertex_input_attribute_descriptions[2].binding = 2;
 	vertex_input_attribute_descriptions[2].location = 2;
-	vertex_input_attribute_descriptions[2].format = VK_FORMAT_R32G32_SFLOAT;
-	vertex_input_attribute_descriptions[2].offset = offsetof(Resources::Vertex, tex_coord_0);
+	vertex_input_attribute_descriptions[2].format = quantized ? VK_FORMAT_R16G16_SFLOAT : VK_FORMAT_R32G32_SFLOAT;
+	vertex_input_attribute_descriptions[2].offset = 0;
 
 	vertex_input_ci.vertexAttributeDescriptionCount = ARRAYSIZE(vertex_input_attribute_descriptions);
 	vertex_input_ci.pVertexAttributeDescriptions = vertex_input_attribute_descriptions;
 
-	// View Descriptor Set Layout
-	// TODO: Add more info about these DescriptorSet Layout Bindings
-	VkDescriptorSetLayoutBinding view_descriptor_set_layout_bindings[1];
-	// View Uniform Buffer Object: Camera info (view, projection, position)
-	view_descriptor_set_layout_bindings[0] = {};
-	view_descriptor_set_layout_bindings[0].binding = 0;
-	view_descriptor_set_layout_bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-	view_descriptor_set_layout_bindings[0].descriptorCount = 1;
-	view_descriptor_set_layout_bindings[0].stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT;
-	view_descriptor_set_layout_bindings[0].pImmutableSamplers = nullptr;
-
-	VkDescriptorSetLayoutCreateInfo view_descriptor_set_layout_ci = { VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO };
-	view_descriptor_set_layout_ci.bindingCount = ARRAYSIZE(view_descriptor_set_layout_bindings);
-	view_descriptor_set_layout_ci.pBindings = view_descriptor_set_layout_bindings;
-
-	VkResult result = vkCreateDescriptorSetLayout(backend->device->context->device, &view_descriptor_set_layout_ci, nullptr, &descriptor_set_layouts[descriptor_set_layout_offset++]);
-	assert(result == VK_SUCCESS);
-	descriptor_set_layout_count++;
-
-	// Node Descriptor Set
-	VkDescriptorSetLayoutBinding node_descriptor_set_layout_bindings[1];
-	// Node Uniform Buffer Object: translation, scale, rotation
-	node_descriptor_set_layout_bindings[0] = {};
-	node_descriptor_set_layout_bindings[0].binding = 0;
-	node_descriptor_set_layout_bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
-	node_descriptor_set_layout_bindings[0].descriptorCount = 1;
-	node_descriptor_set_layout_bindings[0].stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
-	node_descriptor_set_layout_bindings[0].pImmutableSamplers = nullptr;
-
-	VkDescriptorSetLayoutCreateInfo node_descriptor_set_layout_ci = { VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO };
-	node_descriptor_set_layout_ci.bindingCount = ARRAYSIZE(node_descriptor_set_layout_bindings);
-	node_descriptor_set_layout_ci.pBindings = node_descriptor_set_layout_bindings;
-
-	result = vkCreateDescriptorSetLayout(backend->device->context->device, &node_descriptor_set_layout_ci, nullptr, &descriptor_set_layouts[descriptor_set_layout_offset++]);
-	assert(result == VK_SUCCESS);
-	descriptor_set_layout_count++;
-
 	// Pipeline 1: Graphics pipeline for dynamic entities
-	VkPushConstantRange player_matrix = {};
-	player_matrix.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
-	player_matrix.size = sizeof(glm::mat4);
-	player_matrix.offset = 0;
-
+	// NOTE: The model matrices of the entities come from the instance buffer
 	VkPushConstantRange material_params = {};
 	material_params.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
 	material_params.size = sizeof(Resources::Material::PBRMetallicRoughness);
-	material_params.offset = sizeof(glm::mat4);
+	material_params.offset = 0;
 
-	VkPushConstantRange dynamic_pipeline_push_constant_ranges[] = { player_matrix, material_params };
+	VkPushConstantRange dynamic_pipeline_push_constant_ranges[] = { material_params };
 
-	dynamic_pipeline = create_pipeline("../data/shaders/dynamic_entity.vert.spv", "../data/shaders/dynamic_entity.frag.spv", vertex_input_ci, input_assembly_ci, descriptor_set_layout_count, descriptor_set_layouts,
-		viewport_ci, rasterizer_ci, depth_stencil_ci, multisampling_ci, color_blend_ci, dynamic_state_ci, ARRAYSIZE(dynamic_pipeline_push_constant_ranges), dynamic_pipeline_push_constant_ranges);
+	const char* dynamic_vertex_shader_path = quantized ? "../data/shaders/dynamic_entity_quantized.vert.spv" : "../data/shaders/dynamic_entity.vert.spv";
+	if (uses_shader(shader_path, dynamic_vertex_shader_path, "../data/shaders/dynamic_entity.frag.spv"))
+	{
+		destroy_pipeline(dynamic_pipeline);
+		dynamic_pipeline = create_pipeline(dynamic_vertex_shader_path, "../data/shaders/dynamic_entity.frag.spv", vertex_input_ci, input_assembly_ci, descriptor_set_layout_count, descriptor_set_layouts,
+			viewport_ci, rasterizer_ci, depth_stencil_ci, multisampling_ci, color_blend_ci, dynamic_state_ci, ARRAYSIZE(dynamic_pipeline_push_constant_ranges), dynamic_pipeline_push_constant_ranges);
+	}
 
 	// Pipeline 2: Graphics pipeline for static entities
-	// VkPushConstantRange material_params = {};
-	// material_params.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
-	// material_params.size = sizeof(Resources::Material::PBRMetallicRoughness);
-	material_params.offset = 0;
-
 	VkPushConstantRange static_pipeline_push_constant_ranges[] = { material_params };
 
-	static_pipeline = create_pipeline("../data/shaders/static_entity.vert.spv", "../data/shaders/static_entity.frag.spv", vertex_input_ci, input_assembly_ci, descriptor_set_layout_count, descriptor_set_layouts,
-		viewport_ci, rasterizer_ci, depth_stencil_ci, multisampling_ci, color_blend_ci, dynamic_state_ci, ARRAYSIZE(static_pipeline_push_constant_ranges), static_pipeline_push_constant_ranges);
+	const char* static_vertex_shader_path = quantized ? "../data/shaders/static_entity_quantized.vert.spv" : "../data/shaders/static_entity.vert.spv";
+	if (uses_shader(shader_path, static_vertex_shader_path, "../data/shaders/static_entity.frag.spv"))
+	{
+		destroy_pipeline(static_pipeline);
+		static_pipeline = create_pipeline(static_vertex_shader_path, "../data/shaders/static_entity.frag.spv", vertex_input_ci, input_assembly_ci, descriptor_set_layout_count, descriptor_set_layouts,
+			viewport_ci, rasterizer_ci, depth_stencil_ci, multisampling_ci, color_blend_ci, dynamic_state_ci, ARRAYSIZE(static_pipeline_push_constant_ranges), static_pipeline_push_constant_ranges);
+	}
+
+	// Multi draw indirect pipeline, for static and dynamic entities: the
+	// materials come from the draw data of each draw
+	if (multi_draw_indirect)
+	{
+		VkPushConstantRange draw_params = {};
+		draw_params.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+		draw_params.size = sizeof(uint32_t);
+		draw_params.offset = 0;
+
+		VkPushConstantRange indirect_pipeline_push_constant_ranges[] = { draw_params };
+		VkDescriptorSetLayout indirect_descriptor_set_layouts[] = { descriptor_set_layouts[0], descriptor_set_layouts[1], texture_array_descriptor_set_layout, indirect_descriptor_set_layout };
+
+		const char* indirect_vertex_shader_path = quantized ? "../data/shaders/entity_indirect_quantized.vert.spv" : "../data/shaders/entity_indirect.vert.spv";
+		if (uses_shader(shader_path, indirect_vertex_shader_path, "../data/shaders/entity_indirect.frag.spv"))
+		{
+			destroy_pipeline(indirect_pipeline);
+			indirect_pipeline = create_pipeline(indirect_vertex_shader_path, "../data/shaders/entity_indirect.frag.spv", vertex_input_ci, input_assembly_ci, ARRAYSIZE(indirect_descriptor_set_layouts), indirect_descriptor_set_layouts,
+				viewport_ci, rasterizer_ci, depth_stencil_ci, multisampling_ci, color_blend_ci, dynamic_state_ci, ARRAYSIZE(indirect_pipeline_push_constant_ranges), indirect_pipeline_push_constant_ranges);
+		}
+	}
 
 	// Pipeline 3: Graphics pipeline for ImGui
 	// Rasterizer
@@ -1116,8 +2479,12 @@ void Renderer::create_pipelines()
 
 	VkPushConstantRange imgui_pipeline_push_constant_ranges[] = { ui_params };
 
-	imgui_pipeline = create_pipeline("../data/shaders/ui.vert.spv", "../data/shaders/ui.frag.spv", imgui_vertex_input_ci, input_assembly_ci, 1, &imgui_descriptor_set_layout,
-		viewport_ci, imgui_rasterizer_ci, imgui_depth_stencil_ci, multisampling_ci, imgui_color_blend_ci, dynamic_state_ci, ARRAYSIZE(imgui_pipeline_push_constant_ranges), imgui_pipeline_push_constant_ranges);
+	if (uses_shader(shader_path, "../data/shaders/ui.vert.spv", "../data/shaders/ui.frag.spv"))
+	{
+		destroy_pipeline(imgui_pipeline);
+		imgui_pipeline = create_pipeline("../data/shaders/ui.vert.spv", "../data/shaders/ui.frag.spv", imgui_vertex_input_ci, input_assembly_ci, 1, &imgui_descriptor_set_layout,
+			viewport_ci, imgui_rasterizer_ci, imgui_depth_stencil_ci, multisampling_ci, imgui_color_blend_ci, dynamic_state_ci, ARRAYSIZE(imgui_pipeline_push_constant_ranges), imgui_pipeline_push_constant_ranges);
+	}
 
 	// Pipeline 4: Debug Draw pipeline for debug gizmos
 	// Pipeline Fixed Functions
@@ -1181,8 +2548,81 @@ void Renderer::create_pipelines()
 	debug_depth_stencil_ci.depthBoundsTestEnable = VK_FALSE;
 	debug_depth_stencil_ci.stencilTestEnable = VK_FALSE;
 
-	debug_pipeline = create_pipeline("../data/shaders/debug_draw.vert.spv", "../data/shaders/debug_draw.frag.spv", debug_vertex_input_ci, input_assembly_ci, 1, descriptor_set_layouts,
-		viewport_ci, rasterizer_ci, debug_depth_stencil_ci, multisampling_ci, debug_color_blend_ci, dynamic_state_ci, 0, nullptr);
+	if (uses_shader(shader_path, "../data/shaders/debug_draw.vert.spv", "../data/shaders/debug_draw.frag.spv"))
+	{
+		destroy_pipeline(debug_pipeline);
+		debug_pipeline = create_pipeline("../data/shaders/debug_draw.vert.spv", "../data/shaders/debug_draw.frag.spv", debug_vertex_input_ci, input_assembly_ci, 1, descriptor_set_layouts,
+			viewport_ci, rasterizer_ci, debug_depth_stencil_ci, multisampling_ci, debug_color_blend_ci, dynamic_state_ci, 0, nullptr);
+	}
+
+	// Compute pipeline for the meshlet culling
+	if (uses_shader(shader_path, "../data/shaders/cull_meshlets.comp.spv"))
+	{
+		destroy_pipeline(cull_pipeline);
+		cull_pipeline = create_compute_pipeline("../data/shaders/cull_meshlets.comp.spv", cull_descriptor_set_layout, sizeof(CullPushConstantBlock));
+	}
+
+	if (!instance_culling)
+		return;
+
+	// Compute pipelines for the instance culling and its depth pyramid
+	if (uses_shader(shader_path, "../data/shaders/cull_instances.comp.spv"))
+	{
+		destroy_pipeline(instance_cull_pipeline);
+		instance_cull_pipeline = create_compute_pipeline("../data/shaders/cull_instances.comp.spv", instance_cull_descriptor_set_layout, sizeof(InstanceCullPushConstantBlock));
+	}
+
+	if (!occlusion_culling)
+		return;
+
+	if (uses_shader(shader_path, "../data/shaders/depth_reduce.comp.spv"))
+	{
+		destroy_pipeline(depth_reduce_pipeline);
+		depth_reduce_pipeline = create_compute_pipeline("../data/shaders/depth_reduce.comp.spv", depth_reduce_descriptor_set_layout, sizeof(uint32_t));
+	}
+
+	if (backend->device->context->msaa_samples != VK_SAMPLE_COUNT_1_BIT && uses_shader(shader_path, "../data/shaders/depth_reduce_ms.comp.spv"))
+	{
+		destroy_pipeline(depth_reduce_ms_pipeline);
+		depth_reduce_ms_pipeline = create_compute_pipeline("../data/shaders/depth_reduce_ms.comp.spv", depth_reduce_descriptor_set_layout, sizeof(uint32_t));
+	}
+}
+
+Pipeline Renderer::create_compute_pipeline(const char* shader_path, VkDescriptorSetLayout descriptor_set_layout, uint32_t push_constant_size)
+{
+	Pipeline compute_pipeline = {};
+	add_shader_path(shader_path);
+
+	VkPipelineShaderStageCreateInfo shader_stage = Vulkan::Shader::load_shader(backend->device->context->device, backend->device->context->gpu, shader_path, VK_SHADER_STAGE_COMPUTE_BIT);
+
+	VkPushConstantRange push_constant_range = {};
+	push_constant_range.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+	push_constant_range.offset = 0;
+	push_constant_range.size = push_constant_size;
+
+	// Pipeline Layout
+	VkPipelineLayoutCreateInfo pipeline_layout_ci = { VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO };
+	pipeline_layout_ci.setLayoutCount = 1;
+	pipeline_layout_ci.pSetLayouts = &descriptor_set_layout;
+	if (push_constant_size > 0)
+	{
+		pipeline_layout_ci.pushConstantRangeCount = 1;
+		pipeline_layout_ci.pPushConstantRanges = &push_constant_range;
+	}
+
+	VkResult result = vkCreatePipelineLayout(backend->device->context->device, &pipeline_layout_ci, nullptr, &compute_pipeline.pipeline_layout);
+	assert(result == VK_SUCCESS);
+
+	VkComputePipelineCreateInfo pipeline_ci = { VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO };
+	pipeline_ci.stage = shader_stage;
+	pipeline_ci.layout = compute_pipeline.pipeline_layout;
+
+	result = vkCreateComputePipelines(backend->device->context->device, nullptr, 1, &pipeline_ci, nullptr, &compute_pipeline.pipeline);
+	assert(result == VK_SUCCESS);
+
+	vkDestroyShaderModule(backend->device->context->device, shader_stage.module, nullptr);
+
+	return compute_pipeline;
 }
 
 Pipeline Renderer::create_pipeline(const char* vertex_shader_path, const char* fragment_shader_path, VkPipelineVertexInputStateCreateInfo vertex_input_ci, VkPipelineInputAssemblyStateCreateInfo input_assembly_ci,
@@ -1191,6 +2631,8 @@ Pipeline Renderer::create_pipeline(const char* vertex_shader_path, const char* f
 								   VkPipelineDynamicStateCreateInfo dynamic_state_ci, uint32_t push_constant_range_count, VkPushConstantRange* push_constant_ranges)
 {
 	Pipeline graphics_pipeline = {};
+	add_shader_path(vertex_shader_path);
+	add_shader_path(fragment_shader_path);
 
 	VkPipelineShaderStageCreateInfo shader_stages[2];
 	shader_stages[0] = Vulkan::Shader::load_shader(backend->device->context->device, backend->device->context->gpu, vertex_shader_path, VK_SHADER_STAGE_VERTEX_BIT);
@@ -1236,19 +2678,67 @@ Pipeline Renderer::create_pipeline(const char* vertex_shader_path, const char* f
 	return graphics_pipeline;
 }
 
+void Renderer::destroy_pipeline(Pipeline& pipeline)
+{
+	vkDestroyPipeline(backend->device->context->device, pipeline.pipeline, nullptr);
+	pipeline.pipeline = VK_NULL_HANDLE;
+
+	vkDestroyPipelineLayout(backend->device->context->device, pipeline.pipeline_layout, nullptr);
+	pipeline.pipeline_layout = VK_NULL_HANDLE;
+}
+
+void Renderer::add_shader_path(const char* path)
+{
+	for (uint32_t i = 0; i < shader_path_count; ++i)
+	{
+		if (strcmp(shader_paths[i], path) == 0)
+			return;
+	}
+
+	assert(shader_path_count < max_shader_path_count);
+	shader_paths[shader_path_count++] = path;
+}
+
+bool Renderer::reload_shader(const char* path)
+{
+	if (!Vulkan::Shader::is_spirv_file(path))
+	{
+		printf("[Renderer]: %s is not a SPIR-V module, keeping the pipelines that use it\n", path);
+		return false;
+	}
+
+	// NOTE: The pipelines may still be in use by the frames in flight
+	vkDeviceWaitIdle(backend->device->context->device);
+	create_pipelines(path);
+
+	printf("[Renderer]: Rebuilt the pipelines that use %s\n", path);
+	return true;
+}
+
 // Descriptor Pool helpers
 void Renderer::create_descriptor_pool()
 {
-	VkDescriptorPoolSize pool_sizes[2];
+	VkDescriptorPoolSize pool_sizes[4];
 	pool_sizes[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
 	pool_sizes[0].descriptorCount = 3;
-	pool_sizes[1].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
-	pool_sizes[1].descriptorCount = 256;
+	// Meshlet culling (7 storage buffers), instances (1), multi draw
+	// indirect (2), instance culling (7) and visible instances (1) per
+	// frame in flight
+	pool_sizes[1].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	pool_sizes[1].descriptorCount = 96;
+	// Material textures (and the white one), their array for multi draw
+	// indirect, the ImGui font and the depth pyramid of every frame, and
+	// the input of every depth pyramid level
+	pool_sizes[2].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	pool_sizes[2].descriptorCount = 2 * (max_texture_count + 1) + 2 * Vulkan::MAX_FRAMES_IN_FLIGHT + max_depth_pyramid_levels;
+	// The output of every depth pyramid level
+	pool_sizes[3].type = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+	pool_sizes[3].descriptorCount = max_depth_pyramid_levels;
 
 	VkDescriptorPoolCreateInfo pool_ci = { VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO };
 	pool_ci.poolSizeCount = ARRAYSIZE(pool_sizes);
 	pool_ci.pPoolSizes = pool_sizes;
-	pool_ci.maxSets = 256;
+	pool_ci.maxSets = 256 + max_texture_count + 2 + max_depth_pyramid_levels;
 
 	VkResult result = vkCreateDescriptorPool(backend->device->context->device, &pool_ci, nullptr, &descriptor_pool);
 	assert(result == VK_SUCCESS);
@@ -1270,7 +2760,7 @@ void Renderer::create_ubo_buffers()
 	{
 		frames[i].view_ubo_buffer = new Vulkan::Buffer(
 			backend->device->context->device,
-			backend->device->context->gpu,
+			backend->device->context->allocator,
 			VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
 			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
 			sizeof(ViewUniformBufferObject));
@@ -1290,4 +2780,291 @@ void Renderer::destroy_ubo_buffers()
 	}
 }
 
+// Meshlet culling buffers helpers
+void Renderer::create_cull_buffers()
+{
+	for (uint32_t i = 0; i < Vulkan::MAX_FRAMES_IN_FLIGHT; ++i)
+	{
+		frames[i].cull_draw_buffer = new Vulkan::Buffer(
+			backend->device->context->device,
+			backend->device->context->allocator,
+			VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+			sizeof(CullDraw) * max_cull_draws);
+
+		frames[i].cull_job_buffer = new Vulkan::Buffer(
+			backend->device->context->device,
+			backend->device->context->allocator,
+			VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+			sizeof(uint32_t) * max_cull_jobs);
+
+		frames[i].cull_command_buffer = new Vulkan::Buffer(
+			backend->device->context->device,
+			backend->device->context->allocator,
+			VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
+			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+			sizeof(VkDrawIndexedIndirectCommand) * max_cull_draws);
+
+		frames[i].cull_index_buffer = new Vulkan::Buffer(
+			backend->device->context->device,
+			backend->device->context->allocator,
+			VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
+			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+			sizeof(uint32_t) * max_cull_index_count);
+
+		frames[i].cull_descriptor_set = VK_NULL_HANDLE;
+		frames[i].cull_draw_count = 0;
+		frames[i].cull_job_count = 0;
+	}
+}
+
+void Renderer::destroy_cull_buffers()
+{
+	for (uint32_t i = 0; i < Vulkan::MAX_FRAMES_IN_FLIGHT; ++i)
+	{
+		frames[i].cull_draw_buffer->destroy(backend->device->context->device);
+		frames[i].cull_job_buffer->destroy(backend->device->context->device);
+		frames[i].cull_command_buffer->destroy(backend->device->context->device);
+		frames[i].cull_index_buffer->destroy(backend->device->context->device);
+	}
+}
+
+void Renderer::create_instance_buffers()
+{
+	for (uint32_t i = 0; i < Vulkan::MAX_FRAMES_IN_FLIGHT; ++i)
+	{
+		frames[i].instance_buffer = new Vulkan::Buffer(
+			backend->device->context->device,
+			backend->device->context->allocator,
+			VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+			sizeof(Instance) * max_instance_count);
+
+		frames[i].instance_descriptor_set = VK_NULL_HANDLE;
+		frames[i].instance_count = 0;
+	}
+}
+
+void Renderer::destroy_instance_buffers()
+{
+	for (uint32_t i = 0; i < Vulkan::MAX_FRAMES_IN_FLIGHT; ++i)
+	{
+		frames[i].instance_buffer->destroy(backend->device->context->device);
+	}
+}
+
+void Renderer::create_indirect_buffers()
+{
+	if (!multi_draw_indirect)
+		return;
+
+	for (uint32_t i = 0; i < Vulkan::MAX_FRAMES_IN_FLIGHT; ++i)
+	{
+		frames[i].draw_command_buffer = new Vulkan::Buffer(
+			backend->device->context->device,
+			backend->device->context->allocator,
+			VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
+			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+			sizeof(VkDrawIndexedIndirectCommand) * max_indirect_draws);
+
+		frames[i].draw_data_buffer = new Vulkan::Buffer(
+			backend->device->context->device,
+			backend->device->context->allocator,
+			VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+			sizeof(IndirectDrawData) * max_draw_data_count);
+
+		frames[i].indirect_descriptor_set = VK_NULL_HANDLE;
+	}
+
+	material_buffer = new Vulkan::Buffer(
+		backend->device->context->device,
+		backend->device->context->allocator,
+		VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+		sizeof(IndirectMaterial) * max_material_count);
+}
+
+void Renderer::destroy_indirect_buffers()
+{
+	if (!multi_draw_indirect)
+		return;
+
+	for (uint32_t i = 0; i < Vulkan::MAX_FRAMES_IN_FLIGHT; ++i)
+	{
+		frames[i].draw_command_buffer->destroy(backend->device->context->device);
+		frames[i].draw_data_buffer->destroy(backend->device->context->device);
+	}
+
+	material_buffer->destroy(backend->device->context->device);
+}
+
+void Renderer::create_instance_cull_buffers()
+{
+	if (!instance_culling)
+		return;
+
+	for (uint32_t i = 0; i < Vulkan::MAX_FRAMES_IN_FLIGHT; ++i)
+	{
+		frames[i].cull_instance_buffer = new Vulkan::Buffer(
+			backend->device->context->device,
+			backend->device->context->allocator,
+			VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+			sizeof(CullInstance) * max_instance_count);
+
+		// NOTE: There are at most as many runs as instances, and as many run
+		// commands as draws
+		frames[i].cull_run_buffer = new Vulkan::Buffer(
+			backend->device->context->device,
+			backend->device->context->allocator,
+			VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+			sizeof(CullRun) * max_instance_count);
+
+		frames[i].run_command_buffer = new Vulkan::Buffer(
+			backend->device->context->device,
+			backend->device->context->allocator,
+			VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+			sizeof(uint32_t) * max_draw_data_count);
+
+		frames[i].visible_instance_buffer = new Vulkan::Buffer(
+			backend->device->context->device,
+			backend->device->context->allocator,
+			VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+			sizeof(Instance) * max_instance_count);
+
+		frames[i].instance_cull_descriptor_set = VK_NULL_HANDLE;
+		frames[i].visible_instance_descriptor_set = VK_NULL_HANDLE;
+		frames[i].cull_run_count = 0;
+	}
+}
+
+void Renderer::destroy_instance_cull_buffers()
+{
+	if (!instance_culling)
+		return;
+
+	for (uint32_t i = 0; i < Vulkan::MAX_FRAMES_IN_FLIGHT; ++i)
+	{
+		frames[i].cull_instance_buffer->destroy(backend->device->context->device);
+		frames[i].cull_run_buffer->destroy(backend->device->context->device);
+		frames[i].run_command_buffer->destroy(backend->device->context->device);
+		frames[i].visible_instance_buffer->destroy(backend->device->context->device);
+	}
+}
+
+void Renderer::create_depth_pyramid()
+{
+	VkDevice device = backend->device->context->device;
+	VkExtent2D depth_extent = backend->device->wsi->swapchain_extent;
+
+	// Every level is half the level below, rounded up, down to 1x1
+	depth_pyramid_extent = { (depth_extent.width + 1) / 2, (depth_extent.height + 1) / 2 };
+	uint32_t max_extent = depth_pyramid_extent.width > depth_pyramid_extent.height ? depth_pyramid_extent.width : depth_pyramid_extent.height;
+	depth_pyramid_level_count = 0;
+	while ((max_extent >> depth_pyramid_level_count) > 0 && depth_pyramid_level_count < max_depth_pyramid_levels)
+	{
+		depth_pyramid_level_count++;
+	}
+
+	depth_pyramid = new Vulkan::Image(
+		device,
+		backend->device->context->allocator,
+		depth_pyramid_extent,
+		VK_FORMAT_R32_SFLOAT,
+		VK_SAMPLE_COUNT_1_BIT,
+		VK_IMAGE_ASPECT_COLOR_BIT,
+		VK_IMAGE_TILING_OPTIMAL,
+		VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_STORAGE_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+		VK_SHARING_MODE_EXCLUSIVE, depth_pyramid_level_count);
+
+	for (uint32_t level = 0; level < depth_pyramid_level_count; ++level)
+	{
+		VkImageViewCreateInfo image_view_ci = { VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO };
+		image_view_ci.image = depth_pyramid->image;
+		image_view_ci.viewType = VK_IMAGE_VIEW_TYPE_2D;
+		image_view_ci.format = VK_FORMAT_R32_SFLOAT;
+		image_view_ci.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, level, 1, 0, 1 };
+
+		VkResult result = vkCreateImageView(device, &image_view_ci, nullptr, &depth_pyramid_level_views[level]);
+		assert(result == VK_SUCCESS);
+
+		if (depth_reduce_descriptor_sets[level] == VK_NULL_HANDLE)
+		{
+			result = allocate_descriptor_set(depth_reduce_descriptor_set_layout, depth_reduce_descriptor_sets[level]);
+			assert(result == VK_SUCCESS);
+		}
+
+		// The first level reads the depth buffer, the others the level below
+		// through the view of every level
+		VkDescriptorImageInfo image_infos[2] = {};
+		image_infos[0].sampler = depth_pyramid_sampler;
+		image_infos[0].imageView = level == 0 ? backend->device->depth_buffer->image_view : depth_pyramid->image_view;
+		image_infos[0].imageLayout = level == 0 ? VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL : VK_IMAGE_LAYOUT_GENERAL;
+		image_infos[1].imageView = depth_pyramid_level_views[level];
+		image_infos[1].imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+
+		VkWriteDescriptorSet descriptor_writes[ARRAYSIZE(image_infos)];
+		for (uint32_t i = 0; i < ARRAYSIZE(descriptor_writes); ++i)
+		{
+			descriptor_writes[i] = { VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET };
+			descriptor_writes[i].dstSet = depth_reduce_descriptor_sets[level];
+			descriptor_writes[i].dstBinding = i;
+			descriptor_writes[i].dstArrayElement = 0;
+			descriptor_writes[i].descriptorType = i == 0 ? VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER : VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+			descriptor_writes[i].descriptorCount = 1;
+			descriptor_writes[i].pImageInfo = &image_infos[i];
+		}
+
+		vkUpdateDescriptorSets(device, ARRAYSIZE(descriptor_writes), descriptor_writes, 0, nullptr);
+	}
+
+	// The instance culling of the frames that have their descriptor set
+	// already reads the new pyramid
+	VkDescriptorImageInfo depth_pyramid_info = {};
+	depth_pyramid_info.sampler = depth_pyramid_sampler;
+	depth_pyramid_info.imageView = depth_pyramid->image_view;
+	depth_pyramid_info.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+
+	for (uint32_t i = 0; i < Vulkan::MAX_FRAMES_IN_FLIGHT; ++i)
+	{
+		if (frames[i].instance_cull_descriptor_set == VK_NULL_HANDLE)
+			continue;
+
+		VkWriteDescriptorSet descriptor_write = { VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET };
+		descriptor_write.dstSet = frames[i].instance_cull_descriptor_set;
+		descriptor_write.dstBinding = 7;
+		descriptor_write.dstArrayElement = 0;
+		descriptor_write.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+		descriptor_write.descriptorCount = 1;
+		descriptor_write.pImageInfo = &depth_pyramid_info;
+
+		vkUpdateDescriptorSets(device, 1, &descriptor_write, 0, nullptr);
+	}
+
+	depth_pyramid_generation = backend->device->depth_buffer_generation;
+	depth_buffer_rendered = false;
+}
+
+void Renderer::destroy_depth_pyramid()
+{
+	if (depth_pyramid == nullptr)
+		return;
+
+	for (uint32_t level = 0; level < depth_pyramid_level_count; ++level)
+	{
+		vkDestroyImageView(backend->device->context->device, depth_pyramid_level_views[level], nullptr);
+		depth_pyramid_level_views[level] = VK_NULL_HANDLE;
+	}
+
+	depth_pyramid->destroy(backend->device->context->device);
+	delete depth_pyramid;
+	depth_pyramid = nullptr;
+	depth_pyramid_level_count = 0;
+}
+
 } // namespace Renderer
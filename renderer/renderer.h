@@ -5,8 +5,11 @@
 #include "../vulkan/buffer.h"
 #include "../game/state.h"
 #include "../resources/resources.h"
+#include "../resources/model_reloader.h"
 
 #include "types.h"
+#include "render_packets.h"
+#include "node_bounds.h"
 
 namespace Renderer
 {
@@ -26,6 +29,50 @@ struct Frame
 
 	DebugLine debug_lines[1024];
 	uint32_t debug_line_count;
+
+	// Instances of the entity draws, read by the vertex shaders (set 1)
+	// and the meshlet culling
+	Vulkan::Buffer* instance_buffer = nullptr;
+	VkDescriptorSet instance_descriptor_set = VK_NULL_HANDLE;
+	uint32_t instance_count = 0;
+
+	// Multi draw indirect: the commands of the draws that are not culled,
+	// and the draw data of every draw (see IndirectDrawData)
+	Vulkan::Buffer* draw_command_buffer = nullptr;
+	Vulkan::Buffer* draw_data_buffer = nullptr;
+	VkDescriptorSet indirect_descriptor_set = VK_NULL_HANDLE;
+	// Commands in the draw command buffer, per index type
+	uint32_t indirect_command_counts[2] = {};
+
+	// Instance culling. The CPU writes the bounding sphere of every instance
+	// and the runs of instances with their commands, the compute pass copies
+	// the visible instances of each run to the start of its range in
+	// visible_instance_buffer, and counts them in the instanceCount of the
+	// commands, which the CPU leaves at 0.
+	Vulkan::Buffer* cull_instance_buffer = nullptr;
+	Vulkan::Buffer* cull_run_buffer = nullptr;
+	Vulkan::Buffer* run_command_buffer = nullptr;
+	Vulkan::Buffer* visible_instance_buffer = nullptr;
+	VkDescriptorSet instance_cull_descriptor_set = VK_NULL_HANDLE;
+	// Set 1 of the indirect pipeline when the instances are culled
+	VkDescriptorSet visible_instance_descriptor_set = VK_NULL_HANDLE;
+	uint32_t cull_run_count = 0;
+
+	glm::mat4 view_projection;
+	// Pixels covered by one world unit at distance 1 from the camera
+	float lod_projection_scale;
+
+	// Meshlet culling. The CPU writes the draws, the jobs and the indirect
+	// commands (with no indices), the compute pass appends the indices of
+	// the visible meshlets to cull_index_buffer and their count to the
+	// commands.
+	Vulkan::Buffer* cull_draw_buffer = nullptr;
+	Vulkan::Buffer* cull_job_buffer = nullptr;
+	Vulkan::Buffer* cull_command_buffer = nullptr;
+	Vulkan::Buffer* cull_index_buffer = nullptr;
+	VkDescriptorSet cull_descriptor_set = VK_NULL_HANDLE;
+	uint32_t cull_draw_count = 0;
+	uint32_t cull_job_count = 0;
 };
 
 struct Pipeline
@@ -42,9 +89,15 @@ struct Renderer
 	void cleanup();
 
 	void upload_buffers(const Game::State* game_state);
-	void upload_dynamic_uniform_buffers(const Game::State* game_state, uint32_t entity_id_offset, uint32_t entity_count);
+	// Gives the nodes of the entities [entity_id_offset, entity_count) their
+	// slots and model matrices, and adds their render packets
+	void add_entities(const Game::State* game_state, uint32_t entity_id_offset, uint32_t entity_count);
 
-	void create_pipelines();
+	void create_descriptor_set_layouts();
+	// Creates every pipeline, or when shader_path is set destroys and
+	// creates again the ones made with that shader
+	void create_pipelines(const char* shader_path = nullptr);
+	void destroy_pipeline(Pipeline& pipeline);
 	Pipeline create_pipeline(const char* vertex_shader_path, const char* fragment_shader_path, VkPipelineVertexInputStateCreateInfo vertex_input_ci, VkPipelineInputAssemblyStateCreateInfo input_assembly_ci,
 		uint32_t descriptor_set_layout_count, VkDescriptorSetLayout* descriptor_set_layouts, VkPipelineViewportStateCreateInfo viewport_ci, VkPipelineRasterizationStateCreateInfo rasterizer_ci,
 		VkPipelineDepthStencilStateCreateInfo depth_stencil_ci, VkPipelineMultisampleStateCreateInfo multisampling_ci, VkPipelineColorBlendStateCreateInfo color_blend_ci,
@@ -56,15 +109,224 @@ struct Renderer
 
 	void prepare_debug_vertex_buffers();
 
+	// Meshlet culling
+	// NOTE: Per frame in flight capacity. Draws that don't fit are drawn
+	// without culling.
+	static const uint32_t max_cull_draws = 4096;
+	static const uint32_t max_cull_jobs = 64 * 1024;
+	static const uint32_t max_cull_index_count = 2 * 1024 * 1024;
+
+	// Culls the meshlets of every draw against the frustum and their normal
+	// cone. Must be recorded before the render pass begins.
+	bool meshlet_culling = true;
+	void record_meshlet_culling(Game::State* game_state, Vulkan::FrameResources& frame_resources);
+	void add_cull_draws(Frame* frame, const Game::State* game_state);
+	// Draws an instanced draw, through the culled index stream when it has
+	// a culled draw. Draws are visited in the same order
+	// record_meshlet_culling adds them, cull_draw_id is the next culled draw.
+	void draw_instanced(VkCommandBuffer command_buffer, const Frame* frame, const Resources::AssetsInfo* assets_info, const InstancedDraw& draw, uint32_t& cull_draw_id);
+	void create_cull_buffers();
+	void destroy_cull_buffers();
+
+	Pipeline cull_pipeline = {};
+	VkDescriptorSetLayout cull_descriptor_set_layout = VK_NULL_HANDLE;
+	Pipeline create_compute_pipeline(const char* shader_path, VkDescriptorSetLayout descriptor_set_layout, uint32_t push_constant_size);
+
+	// Where the meshlets start in the device storage buffer
+	VkDeviceSize meshlet_buffer_offset = 0;
+	VkDeviceSize meshlet_buffer_size = 0;
+	// Model matrices of every node, including the transform of their static
+	// entity, indexed by entity.node_offset + node
+	Resources::Table<glm::mat4> node_matrices;
+
+	// Draw list
+	// One packet per primitive of every node of every entity
+	RenderPacketList render_packets;
+	// The model matrices of the dynamic entities this frame: the apple,
+	// then every player body part
+	glm::mat4 dynamic_matrices[1 + Game::State::max_moves];
+	// Automatic instancing
+	// The packets that draw the same primitive are merged in a single
+	// instanced draw every frame, the draw loop and the meshlet culling
+	// walk the draws. Their instances go to the instance buffer of the frame.
+	// NOTE: Per frame in flight capacity
+	static const uint32_t max_instance_count = 16 * 1024;
+	bool instance_overflow_reported = false;
+	Resources::Table<InstancedDraw> instanced_draws;
+	void prepare_instanced_draws(Frame* frame, const Game::State* game_state);
+	// Draws the instanced draws one by one, binding pipelines and materials
+	// when they change. Used when multi draw indirect is off.
+	void record_draws(VkCommandBuffer command_buffer, Frame* frame, const Game::State* game_state);
+	void create_instance_buffers();
+	void destroy_instance_buffers();
+	// World matrix of the node of a packet, with the dynamic matrices of
+	// this frame
+	glm::mat4 packet_model_matrix(const RenderPacket& packet) const;
+
+	// Frustum culling
+	// The nodes whose bounding sphere is outside the frustum of the current
+	// camera are left out of the instanced draws. The spheres of the static
+	// nodes are set with their matrix, the ones of the dynamic entities
+	// every frame.
+	bool frustum_culling = true;
+	NodeBounds node_bounds;
+	// From the matrix of the node slot in node_matrices
+	void update_node_bounds(const Resources::AssetsInfo* assets_info, uint32_t node_slot, uint32_t node_id);
+	void update_dynamic_node_bounds(const Resources::AssetsInfo* assets_info);
+
+	// Level of detail selection
+	// A mesh draws its most simplified LOD whose error, projected on the
+	// screen, is at most lod_error_threshold pixels
+	bool lod_selection = true;
+	float lod_error_threshold = 1.0f;
+	uint32_t select_lod(const Frame* frame, const Game::State* game_state, const Resources::Mesh& mesh, const glm::mat4& model_matrix) const;
+	// Triangles drawn this frame (before meshlet culling), and how many
+	// the full resolution meshes would have
+	uint32_t lod_triangle_count = 0;
+	uint32_t full_triangle_count = 0;
+	// Draw calls of the entities this frame
+	uint32_t entity_draw_count = 0;
+
+	// Multi draw indirect
+	// Every entity draw is described in the draw command buffer of the
+	// frame, or in the meshlet culling commands, and the whole scene is
+	// drawn with one indirect call per index stream. The draws find their
+	// material at gl_DrawID in the draw data buffer, and their base color
+	// texture in an array of every texture.
+	// NOTE: Needs multiDrawIndirect, drawIndirectFirstInstance,
+	// shaderSampledImageArrayDynamicIndexing and shaderDrawParameters,
+	// off when one of them is not supported
+	bool multi_draw_indirect = true;
+	static const uint32_t max_indirect_draws = 4096;
+	bool indirect_overflow_reported = false;
+	static const uint32_t max_material_count = 1024;
+	// Draw data of the culled draws at their cull draw id, of the other
+	// draws at max_cull_draws + their command
+	static const uint32_t max_draw_data_count = max_cull_draws + max_indirect_draws;
+	Pipeline indirect_pipeline = {};
+	VkDescriptorSetLayout texture_array_descriptor_set_layout = VK_NULL_HANDLE;
+	VkDescriptorSetLayout indirect_descriptor_set_layout = VK_NULL_HANDLE;
+	VkDescriptorSet texture_array_descriptor_set = VK_NULL_HANDLE;
+	// Every material, as IndirectMaterial. Only written when the GPU is idle.
+	Vulkan::Buffer* material_buffer = nullptr;
+	void record_indirect_draws(VkCommandBuffer command_buffer, Frame* frame);
+	void write_material_buffer(const Resources::AssetsInfo* assets_info);
+	// Points the elements [first, first + count) of the texture array to
+	// their texture, or to the white one when they have none
+	void write_texture_array(uint32_t first, uint32_t count);
+	// Writes the commands of the draws that are not meshlet culled, and the
+	// draw data of every draw. Must be called before the culling passes are
+	// recorded, record_indirect_draws then only binds and draws.
+	void write_indirect_draws(Frame* frame, const Game::State* game_state);
+	void create_indirect_buffers();
+	void destroy_indirect_buffers();
+
+	// Instance culling
+	// The instances of every draw are culled on the GPU against the frustum
+	// and, when the depth buffer holds the previous frame, against a depth
+	// pyramid built from it: each level keeps the farthest depth of the
+	// texels of the level below. Draws whose instances are all hidden are
+	// left with no instances.
+	// NOTE: Needs multi draw indirect. The pyramid is one frame late, what
+	// an object disoccludes only shows up a frame later.
+	bool instance_culling = true;
+	bool occlusion_culling = true;
+	static const uint32_t max_depth_pyramid_levels = 16;
+	Pipeline instance_cull_pipeline = {};
+	Pipeline depth_reduce_pipeline = {};
+	// Reduces the multisampled depth buffer into the first level
+	Pipeline depth_reduce_ms_pipeline = {};
+	VkDescriptorSetLayout instance_cull_descriptor_set_layout = VK_NULL_HANDLE;
+	VkDescriptorSetLayout depth_reduce_descriptor_set_layout = VK_NULL_HANDLE;
+	// R32_SFLOAT, the first level is half the depth buffer size (rounded up).
+	// Stays in VK_IMAGE_LAYOUT_GENERAL.
+	Vulkan::Image* depth_pyramid = nullptr;
+	VkImageView depth_pyramid_level_views[max_depth_pyramid_levels] = {};
+	VkExtent2D depth_pyramid_extent = {};
+	uint32_t depth_pyramid_level_count = 0;
+	VkSampler depth_pyramid_sampler = VK_NULL_HANDLE;
+	// Level i is built with set i: the depth buffer or level i - 1 in, level i out
+	VkDescriptorSet depth_reduce_descriptor_sets[max_depth_pyramid_levels] = {};
+	// The depth buffer the pyramid is built from, and whether a frame was
+	// rendered to it since it was created
+	uint32_t depth_pyramid_generation = UINT32_MAX;
+	bool depth_buffer_rendered = false;
+	void record_instance_culling(Vulkan::FrameResources& frame_resources);
+	void build_depth_pyramid(VkCommandBuffer command_buffer);
+	// (Re)creates the pyramid for the current depth buffer, and points the
+	// descriptor sets that read it to the new one
+	void create_depth_pyramid();
+	void destroy_depth_pyramid();
+	void create_instance_cull_buffers();
+	void destroy_instance_cull_buffers();
+
 	// Platform
 	Application::Platform* platform;
 	// Vulkan Backend
 	Vulkan::Backend* backend;
 
-	// TODO: Should we store these together with the pipelines?
-	size_t dynamic_alignment;
+	// Last batch of geometry/uniform uploads handed to the transfer queue.
+	// Frames wait for it on the GPU, the CPU never has to.
+	Vulkan::UploadToken upload_token = {};
+
+	// Hot reload
+	// How many vertices, indices (indexed by Resources::IndexType) and
+	// meshlets fit in the regions upload_buffers reserves. Reloaded models
+	// must fit in them.
+	uint32_t vertex_capacity = 0;
+	uint32_t index_capacities[2] = {};
+	uint32_t meshlet_capacity = 0;
+	// Uploads the ranges of a model a Resources::ModelReloader replaced
+	// and its new textures, and computes the node matrices and the draw
+	// list again. Waits for the GPU to be idle first.
+	void upload_reloaded_model(const Game::State* game_state, uint32_t model_id, const Resources::ReloadedRanges& ranges);
+
+	// Every SPIR-V file the pipelines are made of, to watch for changes
+	static const uint32_t max_shader_path_count = 32;
+	const char* shader_paths[max_shader_path_count] = {};
+	uint32_t shader_path_count = 0;
+	void add_shader_path(const char* path);
+	// Rebuilds the pipelines made with the shader at path (one of
+	// shader_paths). Returns false, keeping them as they are, when the
+	// file is not a SPIR-V module (e.g. it is still being written).
+	bool reload_shader(const char* path);
+
+	// Which vertex streams are uploaded and which pipelines draw them.
+	// Must be set before init().
+	Resources::VertexFormat vertex_format = Resources::VertexFormat::Quantized;
+	// Where the positions, normals and uvs streams start in the device vertex buffer
+	VkDeviceSize vertex_stream_offsets[3] = {};
+	// Where the 16 and 32 bit index tables start in the device index buffer,
+	// indexed by Resources::IndexType
+	VkDeviceSize index_table_offsets[2] = {};
+
+	// Binds the index table of index_type unless it's bound already.
+	// bound_index_type is reset at the beginning of every frame.
+	// NOTE: bound_index_type is culled_index_stream when the output of the
+	// meshlet culling is bound
+	void bind_index_buffer(VkCommandBuffer command_buffer, Resources::IndexType index_type);
+	void bind_culled_index_buffer(VkCommandBuffer command_buffer, const Frame* frame);
+	static const int32_t culled_index_stream = 2;
+	int32_t bound_index_type = -1;
+
+	// Material textures: one image and descriptor set (set 2) per
+	// Resources::Texture, with its full mip chain, and a 1x1 white one
+	// at max_texture_count for the materials without a base color texture
+	static const uint32_t max_texture_count = 128;
+	uint32_t texture_count = 0;
+	Vulkan::Image* textures[max_texture_count + 1] = {};
+	VkDescriptorSet texture_descriptor_sets[max_texture_count + 1] = {};
+	VkSampler texture_sampler = VK_NULL_HANDLE;
+	void upload_textures(const Resources::AssetsInfo* assets_info);
+	void create_texture(uint32_t texture_id, const Resources::Texture& texture, const uint8_t* pixels);
+	void destroy_textures();
+
+	// Binds the base color texture of a material unless it's bound already.
+	// bound_texture_id is reset every time a pipeline is bound.
+	void bind_material_textures(VkCommandBuffer command_buffer, VkPipelineLayout pipeline_layout, const Resources::Material& material);
+	uint32_t bound_texture_id = UINT32_MAX;
+
 	uint32_t absolute_node_count = 0;
-	size_t dynamic_buffer_offset = 0;
 
 	uint32_t descriptor_set_layout_count = 0;
 	uint32_t descriptor_set_layout_offset = 0;
@@ -75,9 +337,6 @@ struct Renderer
 	Pipeline debug_pipeline = {};
 	Pipeline imgui_pipeline = {};
 
-	// Node Descriptor Sets Resources
-	VkDescriptorSet node_descriptor_set;
-
 	Frame frames[Vulkan::MAX_FRAMES_IN_FLIGHT];
 	bool wait_on_semaphores = false;
 
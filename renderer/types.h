@@ -24,9 +24,17 @@ struct Transform
 	glm::quat rotation = glm::identity<glm::quat>();
 };
 
-struct NodeUbo
+// What the instance buffer of a frame holds for every instance of a draw:
+// a node of an entity. The vertex shaders read it at gl_InstanceIndex.
+// NOTE: The layout matches the Instance struct of the entity vertex
+// shaders and of cull_meshlets.comp (std430)
+struct Instance
 {
-	glm::mat4* model;
+	glm::mat4 model;
+	// Decodes Resources::VertexFormat::Quantized positions: the bounds of
+	// the node's mesh, as min and max - min
+	glm::vec4 position_offset;
+	glm::vec4 position_scale;
 };
 
 struct DebugLine
@@ -42,6 +50,91 @@ struct ViewUniformBufferObject
 	glm::vec3 camera_position;
 };
 
+// A draw whose meshlets are culled on the GPU.
+// NOTE: The layout matches the CullDraw struct of cull_meshlets.comp (std430)
+struct CullDraw
+{
+	uint32_t meshlet_offset;
+	uint32_t meshlet_count;
+	// Index of the first meshlet of the draw in the job list
+	uint32_t first_job;
+	// In elements of the index buffer of index_type size, from the start
+	// of the buffer
+	uint32_t index_offset;
+	uint32_t index_type;
+	// Where the indices of the visible meshlets go in the output stream
+	uint32_t output_offset;
+	// 0 when the model matrix of an instance mirrors or doesn't scale
+	// uniformly, the normal cones are not valid in world space then
+	uint32_t cone_culling;
+	// The instances of the draw in the instance buffer. A meshlet is kept
+	// when any of them sees it.
+	uint32_t first_instance;
+	uint32_t instance_count;
+};
+
+// A material in the material buffer of the multi draw indirect mode.
+// NOTE: The layout matches the Material struct of entity_indirect.frag (std430)
+struct IndirectMaterial
+{
+	glm::vec4 base_color_factor;
+	float metallic_factor;
+	float roughness_factor;
+	// In the texture array, the white texture when the material has none
+	uint32_t base_color_texture_id;
+	uint32_t padding;
+};
+
+// What the draw data buffer of a frame holds for every multi draw indirect
+// draw, read at first_draw + gl_DrawID
+// NOTE: The layout matches the DrawData struct of entity_indirect.frag (std430)
+struct IndirectDrawData
+{
+	uint32_t material_id;
+};
+
+// The bounding sphere of an instance, tested by the instance culling.
+// NOTE: The layout matches the CullInstance struct of cull_instances.comp (std430)
+struct CullInstance
+{
+	// World space center and radius
+	glm::vec4 sphere;
+	uint32_t run_id;
+	uint32_t padding[3];
+};
+
+// The instances written once for the draws of the primitives of a mesh,
+// and the commands of those draws, in the run command buffer. Ids below
+// Renderer::max_cull_draws are culled draws, the others are
+// max_cull_draws + their command in the draw command buffer.
+// NOTE: The layout matches the CullRun struct of cull_instances.comp (std430)
+struct CullRun
+{
+	uint32_t first_instance;
+	uint32_t command_offset;
+	uint32_t command_count;
+	uint32_t padding;
+};
+
+struct InstanceCullPushConstantBlock
+{
+	glm::mat4 view_projection;
+	// Texels of the first level of the depth pyramid across the screen:
+	// half the depth buffer size
+	glm::vec2 depth_pyramid_scale;
+	uint32_t depth_pyramid_level_count;
+	uint32_t instance_count;
+	// 0 when the depth pyramid doesn't hold a previous frame
+	uint32_t occlusion_culling;
+};
+
+struct CullPushConstantBlock
+{
+	glm::vec4 frustum_planes[6];
+	glm::vec4 camera_position;
+	uint32_t job_count;
+};
+
 struct UIPushConstantBlock
 {
 	glm::vec2 translate;
@@ -0,0 +1,704 @@
+#include "gltf_parser.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "rapidjson/reader.h"
+#include "rapidjson/error/en.h"
+
+namespace Resources
+{
+
+void GltfDocument::release()
+{
+	buffer_views.release();
+	accessors.release();
+	materials.release();
+	images.release();
+	textures.release();
+	meshes.release();
+	primitives.release();
+	nodes.release();
+	scenes.release();
+	node_ids.release();
+}
+
+// rapidjson's InsituStringStream stops at the first null character, a GLB
+// JSON chunk is not null terminated and is followed by binary data. This
+// one stops at the end of the chunk instead.
+struct InsituChunkStream
+{
+	typedef char Ch;
+
+	char* source;
+	char* destination;
+	char* head;
+	char* end;
+
+	Ch Peek() const { return source < end ? *source : '\0'; }
+	Ch Take() { return source < end ? *source++ : '\0'; }
+	size_t Tell() const { return size_t(source - head); }
+
+	Ch* PutBegin() { return destination = source; }
+	void Put(Ch c) { assert(destination != nullptr); *destination++ = c; }
+	void Flush() {}
+	size_t PutEnd(Ch* begin) { return size_t(destination - begin); }
+
+	Ch* Push(size_t count) { Ch* begin = destination; destination += count; return begin; }
+	void Pop(size_t count) { destination -= count; }
+};
+
+// Where the parser is in the document. Objects and arrays we don't read
+// are Skip, and so is everything inside them.
+enum Scope
+{
+	Root,
+	Document,
+	Skip,
+	Asset,
+	Buffers,
+	BufferViews,
+	BufferViewObject,
+	Accessors,
+	AccessorObject,
+	AccessorMin,
+	AccessorMax,
+	Materials,
+	MaterialObject,
+	PbrMetallicRoughnessObject,
+	BaseColorFactor,
+	BaseColorTextureObject,
+	Images,
+	ImageObject,
+	Textures,
+	TextureObject,
+	Meshes,
+	MeshObject,
+	Primitives,
+	PrimitiveObject,
+	Attributes,
+	Nodes,
+	NodeObject,
+	NodeChildren,
+	NodeTranslation,
+	NodeRotation,
+	NodeScale,
+	NodeMatrix,
+	Scenes,
+	SceneObject,
+	SceneNodes
+};
+
+// The member names we read. The same name in different objects is the
+// same key, the scope tells them apart.
+enum JsonKey
+{
+	UnknownKey,
+	AssetKey,
+	VersionKey,
+	BuffersKey,
+	BufferViewsKey,
+	AccessorsKey,
+	MaterialsKey,
+	ImagesKey,
+	TexturesKey,
+	MeshesKey,
+	NodesKey,
+	ScenesKey,
+	SceneKey,
+	BufferKey,
+	ByteLengthKey,
+	ByteOffsetKey,
+	ByteStrideKey,
+	TargetKey,
+	BufferViewKey,
+	ComponentTypeKey,
+	CountKey,
+	TypeKey,
+	NormalizedKey,
+	MinKey,
+	MaxKey,
+	NameKey,
+	AlphaModeKey,
+	PbrMetallicRoughnessKey,
+	BaseColorFactorKey,
+	MetallicFactorKey,
+	RoughnessFactorKey,
+	BaseColorTextureKey,
+	IndexKey,
+	SourceKey,
+	PrimitivesKey,
+	AttributesKey,
+	IndicesKey,
+	MaterialKey,
+	ModeKey,
+	PositionKey,
+	NormalKey,
+	TexCoord0Key,
+	MeshKey,
+	ChildrenKey,
+	TranslationKey,
+	RotationKey,
+	ScaleKey,
+	MatrixKey
+};
+
+struct KeyName
+{
+	const char* name;
+	uint32_t length;
+	JsonKey key;
+};
+
+#define KEY_NAME(name, key) { name, sizeof(name) - 1, key }
+
+static const KeyName key_names[] = {
+	KEY_NAME("asset", AssetKey),
+	KEY_NAME("version", VersionKey),
+	KEY_NAME("buffers", BuffersKey),
+	KEY_NAME("bufferViews", BufferViewsKey),
+	KEY_NAME("accessors", AccessorsKey),
+	KEY_NAME("materials", MaterialsKey),
+	KEY_NAME("images", ImagesKey),
+	KEY_NAME("textures", TexturesKey),
+	KEY_NAME("meshes", MeshesKey),
+	KEY_NAME("nodes", NodesKey),
+	KEY_NAME("scenes", ScenesKey),
+	KEY_NAME("scene", SceneKey),
+	KEY_NAME("buffer", BufferKey),
+	KEY_NAME("byteLength", ByteLengthKey),
+	KEY_NAME("byteOffset", ByteOffsetKey),
+	KEY_NAME("byteStride", ByteStrideKey),
+	KEY_NAME("target", TargetKey),
+	KEY_NAME("bufferView", BufferViewKey),
+	KEY_NAME("componentType", ComponentTypeKey),
+	KEY_NAME("count", CountKey),
+	KEY_NAME("type", TypeKey),
+	KEY_NAME("normalized", NormalizedKey),
+	KEY_NAME("min", MinKey),
+	KEY_NAME("max", MaxKey),
+	KEY_NAME("name", NameKey),
+	KEY_NAME("alphaMode", AlphaModeKey),
+	KEY_NAME("pbrMetallicRoughness", PbrMetallicRoughnessKey),
+	KEY_NAME("baseColorFactor", BaseColorFactorKey),
+	KEY_NAME("metallicFactor", MetallicFactorKey),
+	KEY_NAME("roughnessFactor", RoughnessFactorKey),
+	KEY_NAME("baseColorTexture", BaseColorTextureKey),
+	KEY_NAME("index", IndexKey),
+	KEY_NAME("source", SourceKey),
+	KEY_NAME("primitives", PrimitivesKey),
+	KEY_NAME("attributes", AttributesKey),
+	KEY_NAME("indices", IndicesKey),
+	KEY_NAME("material", MaterialKey),
+	KEY_NAME("mode", ModeKey),
+	KEY_NAME("POSITION", PositionKey),
+	KEY_NAME("NORMAL", NormalKey),
+	KEY_NAME("TEXCOORD_0", TexCoord0Key),
+	KEY_NAME("mesh", MeshKey),
+	KEY_NAME("children", ChildrenKey),
+	KEY_NAME("translation", TranslationKey),
+	KEY_NAME("rotation", RotationKey),
+	KEY_NAME("scale", ScaleKey),
+	KEY_NAME("matrix", MatrixKey),
+};
+
+#undef KEY_NAME
+
+static JsonKey find_key(const char* name, uint32_t length)
+{
+	// NOTE: Comparing the lengths first rejects almost every name without
+	// touching its characters
+	for (uint32_t i = 0; i < sizeof(key_names) / sizeof(key_names[0]); ++i)
+	{
+		if (key_names[i].length == length && memcmp(key_names[i].name, name, length) == 0)
+			return key_names[i].key;
+	}
+
+	return UnknownKey;
+}
+
+static Type parse_type(const char* type)
+{
+	if (strcmp("SCALAR", type) == 0)
+		return Type::Scalar;
+	if (strcmp("VEC2", type) == 0)
+		return Type::Vec2;
+	if (strcmp("VEC3", type) == 0)
+		return Type::Vec3;
+	if (strcmp("VEC4", type) == 0)
+		return Type::Vec4;
+	if (strcmp("MAT2", type) == 0)
+		return Type::Mat2;
+	if (strcmp("MAT3", type) == 0)
+		return Type::Mat3;
+	if (strcmp("MAT4", type) == 0)
+		return Type::Mat4;
+
+	assert(!"Invalid accessor type");
+	return Type::Scalar;
+}
+
+static MaterialAlphaMode parse_alpha_mode(const char* alpha_mode)
+{
+	if (strcmp("OPAQUE", alpha_mode) == 0)
+		return MaterialAlphaMode::Opaque;
+	if (strcmp("MASK", alpha_mode) == 0)
+		return MaterialAlphaMode::Mask;
+	if (strcmp("BLEND", alpha_mode) == 0)
+		return MaterialAlphaMode::Blend;
+
+	assert(!"Invalid alphaMode");
+	return MaterialAlphaMode::Opaque;
+}
+
+// Receives the events of rapidjson's reader and writes every value to the
+// table entry it belongs to. The last element of a table is the object
+// being parsed.
+struct GltfHandler
+{
+	typedef char Ch;
+
+	struct Frame
+	{
+		Scope scope;
+		// Elements read so far, for arrays
+		uint32_t element_count;
+	};
+
+	static const uint32_t max_depth = 16;
+
+	GltfDocument* document;
+	Frame frames[max_depth];
+	uint32_t depth = 0;
+	// Nesting inside the current Skip frame
+	uint32_t skip_depth = 0;
+	// Name of the member whose value comes next
+	JsonKey key = UnknownKey;
+
+	Scope scope() const { return frames[depth - 1].scope; }
+
+	uint32_t element() const { return frames[depth - 1].element_count; }
+
+	bool push(Scope scope)
+	{
+		assert(depth < max_depth);
+		frames[depth++] = { scope, 0 };
+		return true;
+	}
+
+	// Every value moves its array forward
+	void next_element()
+	{
+		if (depth > 0)
+		{
+			frames[depth - 1].element_count++;
+		}
+	}
+
+	bool StartObject()
+	{
+		if (depth > 0 && scope() == Scope::Skip)
+		{
+			skip_depth++;
+			return true;
+		}
+
+		switch (depth > 0 ? scope() : Scope::Root)
+		{
+		case Scope::Root:
+			return push(Scope::Document);
+		case Scope::Document:
+			return push(key == AssetKey ? Scope::Asset : Scope::Skip);
+		case Scope::Buffers:
+			document->buffer_count++;
+			return push(Scope::Skip);
+		case Scope::BufferViews:
+			document->buffer_views.push({});
+			return push(Scope::BufferViewObject);
+		case Scope::Accessors:
+			document->accessors.push({});
+			return push(Scope::AccessorObject);
+		case Scope::Materials:
+		{
+			Material material = {};
+			material.alpha_mode = MaterialAlphaMode::Opaque;
+			document->materials.push(material);
+			return push(Scope::MaterialObject);
+		}
+		case Scope::MaterialObject:
+			return push(key == PbrMetallicRoughnessKey ? Scope::PbrMetallicRoughnessObject : Scope::Skip);
+		case Scope::PbrMetallicRoughnessObject:
+			return push(key == BaseColorTextureKey ? Scope::BaseColorTextureObject : Scope::Skip);
+		case Scope::Images:
+		{
+			GltfImage image = { -1 };
+			document->images.push(image);
+			return push(Scope::ImageObject);
+		}
+		case Scope::Textures:
+		{
+			GltfTexture texture = { -1 };
+			document->textures.push(texture);
+			return push(Scope::TextureObject);
+		}
+		case Scope::Meshes:
+		{
+			GltfMesh mesh = {};
+			mesh.primitive_offset = (uint32_t)document->primitives.count;
+			document->meshes.push(mesh);
+			return push(Scope::MeshObject);
+		}
+		case Scope::Primitives:
+		{
+			GltfPrimitive primitive = { -1, -1, -1, -1, -1, 4 };
+			document->primitives.push(primitive);
+			document->meshes[document->meshes.count - 1].primitive_count++;
+			return push(Scope::PrimitiveObject);
+		}
+		case Scope::PrimitiveObject:
+			return push(key == AttributesKey ? Scope::Attributes : Scope::Skip);
+		case Scope::Nodes:
+		{
+			GltfNode node = {};
+			node.mesh = -1;
+			node.rotation[3] = 1.0f;
+			node.scale[0] = node.scale[1] = node.scale[2] = 1.0f;
+			document->nodes.push(node);
+			return push(Scope::NodeObject);
+		}
+		case Scope::Scenes:
+		{
+			GltfScene scene = {};
+			scene.node_offset = (uint32_t)document->node_ids.count;
+			document->scenes.push(scene);
+			return push(Scope::SceneObject);
+		}
+		default:
+			return push(Scope::Skip);
+		}
+	}
+
+	bool StartArray()
+	{
+		if (depth > 0 && scope() == Scope::Skip)
+		{
+			skip_depth++;
+			return true;
+		}
+
+		switch (depth > 0 ? scope() : Scope::Root)
+		{
+		case Scope::Document:
+			switch (key)
+			{
+			case BuffersKey: return push(Scope::Buffers);
+			case BufferViewsKey: return push(Scope::BufferViews);
+			case AccessorsKey: return push(Scope::Accessors);
+			case MaterialsKey: return push(Scope::Materials);
+			case ImagesKey: return push(Scope::Images);
+			case TexturesKey: return push(Scope::Textures);
+			case MeshesKey: return push(Scope::Meshes);
+			case NodesKey: return push(Scope::Nodes);
+			case ScenesKey: return push(Scope::Scenes);
+			default: return push(Scope::Skip);
+			}
+		case Scope::AccessorObject:
+			return push(key == MinKey ? Scope::AccessorMin : key == MaxKey ? Scope::AccessorMax : Scope::Skip);
+		case Scope::PbrMetallicRoughnessObject:
+			return push(key == BaseColorFactorKey ? Scope::BaseColorFactor : Scope::Skip);
+		case Scope::MeshObject:
+			return push(key == PrimitivesKey ? Scope::Primitives : Scope::Skip);
+		case Scope::NodeObject:
+		{
+			GltfNode& node = document->nodes[document->nodes.count - 1];
+			switch (key)
+			{
+			case ChildrenKey:
+				node.child_offset = (uint32_t)document->node_ids.count;
+				return push(Scope::NodeChildren);
+			case TranslationKey: return push(Scope::NodeTranslation);
+			case RotationKey: return push(Scope::NodeRotation);
+			case ScaleKey: return push(Scope::NodeScale);
+			case MatrixKey:
+				node.has_matrix = true;
+				return push(Scope::NodeMatrix);
+			default: return push(Scope::Skip);
+			}
+		}
+		case Scope::SceneObject:
+			return push(key == NodesKey ? Scope::SceneNodes : Scope::Skip);
+		default:
+			return push(Scope::Skip);
+		}
+	}
+
+	bool end()
+	{
+		if (skip_depth > 0)
+		{
+			skip_depth--;
+			return true;
+		}
+
+		assert(depth > 0);
+		depth--;
+		next_element();
+		return true;
+	}
+
+	bool EndObject(rapidjson::SizeType) { return end(); }
+	bool EndArray(rapidjson::SizeType) { return end(); }
+
+	bool Key(const Ch* name, rapidjson::SizeType length, bool)
+	{
+		if (scope() != Scope::Skip)
+		{
+			key = find_key(name, length);
+		}
+
+		return true;
+	}
+
+	bool number(double value)
+	{
+		uint32_t element = this->element();
+		next_element();
+
+		switch (scope())
+		{
+		case Scope::Document:
+			if (key == SceneKey)
+				document->scene = int32_t(value);
+			break;
+		case Scope::BufferViewObject:
+		{
+			BufferView& buffer_view = document->buffer_views[document->buffer_views.count - 1];
+			switch (key)
+			{
+			case BufferKey: buffer_view.buffer_id = uint32_t(value); break;
+			case ByteLengthKey: buffer_view.byte_length = uint32_t(value); break;
+			case ByteOffsetKey: buffer_view.byte_offset = uint32_t(value); break;
+			case ByteStrideKey: buffer_view.byte_stride = uint32_t(value); break;
+			case TargetKey: buffer_view.target = uint32_t(value); break;
+			default: break;
+			}
+			break;
+		}
+		case Scope::AccessorObject:
+		{
+			Accessor& accessor = document->accessors[document->accessors.count - 1];
+			switch (key)
+			{
+			case BufferViewKey: accessor.buffer_view_id = uint32_t(value); break;
+			case ByteOffsetKey: accessor.byte_offset = uint32_t(value); break;
+			case ComponentTypeKey: accessor.component_type = static_cast<ComponentType>(int32_t(value)); break;
+			case CountKey: accessor.count = uint32_t(value); break;
+			default: break;
+			}
+			break;
+		}
+		case Scope::AccessorMin:
+		case Scope::AccessorMax:
+		{
+			Accessor& accessor = document->accessors[document->accessors.count - 1];
+			assert(element < 4);
+			if (scope() == Scope::AccessorMin)
+			{
+				accessor.min[element] = value;
+				accessor.min_length = element + 1;
+			}
+			else
+			{
+				accessor.max[element] = value;
+				accessor.max_length = element + 1;
+			}
+			break;
+		}
+		case Scope::PbrMetallicRoughnessObject:
+		{
+			Material& material = document->materials[document->materials.count - 1];
+			if (key == MetallicFactorKey)
+				material.pbr_metallic_roughness.metallic_factor = float(value);
+			else if (key == RoughnessFactorKey)
+				material.pbr_metallic_roughness.roughness_factor = float(value);
+			break;
+		}
+		case Scope::BaseColorFactor:
+			assert(element < 4);
+			document->materials[document->materials.count - 1].pbr_metallic_roughness.base_color_factor[element] = float(value);
+			break;
+		case Scope::BaseColorTextureObject:
+			// NOTE: Only TEXCOORD_0 is read, texCoord is ignored
+			if (key == IndexKey)
+				document->materials[document->materials.count - 1].base_color_texture_id = uint32_t(value);
+			break;
+		case Scope::ImageObject:
+			if (key == BufferViewKey)
+				document->images[document->images.count - 1].buffer_view = int32_t(value);
+			break;
+		case Scope::TextureObject:
+			if (key == SourceKey)
+				document->textures[document->textures.count - 1].source = int32_t(value);
+			break;
+		case Scope::PrimitiveObject:
+		{
+			GltfPrimitive& primitive = document->primitives[document->primitives.count - 1];
+			switch (key)
+			{
+			case IndicesKey: primitive.indices = int32_t(value); break;
+			case MaterialKey: primitive.material = int32_t(value); break;
+			case ModeKey: primitive.mode = uint32_t(value); break;
+			default: break;
+			}
+			break;
+		}
+		case Scope::Attributes:
+		{
+			GltfPrimitive& primitive = document->primitives[document->primitives.count - 1];
+			switch (key)
+			{
+			case PositionKey: primitive.position = int32_t(value); break;
+			case NormalKey: primitive.normal = int32_t(value); break;
+			case TexCoord0Key: primitive.uv_0 = int32_t(value); break;
+			default: break;
+			}
+			break;
+		}
+		case Scope::NodeObject:
+			if (key == MeshKey)
+				document->nodes[document->nodes.count - 1].mesh = int32_t(value);
+			break;
+		case Scope::NodeChildren:
+			document->node_ids.push(uint32_t(value));
+			document->nodes[document->nodes.count - 1].child_count++;
+			break;
+		case Scope::NodeTranslation:
+			assert(element < 3);
+			document->nodes[document->nodes.count - 1].translation[element] = float(value);
+			break;
+		case Scope::NodeRotation:
+			assert(element < 4);
+			document->nodes[document->nodes.count - 1].rotation[element] = float(value);
+			break;
+		case Scope::NodeScale:
+			assert(element < 3);
+			document->nodes[document->nodes.count - 1].scale[element] = float(value);
+			break;
+		case Scope::NodeMatrix:
+			assert(element < 16);
+			document->nodes[document->nodes.count - 1].matrix[element] = float(value);
+			break;
+		case Scope::SceneNodes:
+			document->node_ids.push(uint32_t(value));
+			document->scenes[document->scenes.count - 1].node_count++;
+			break;
+		default:
+			break;
+		}
+
+		return true;
+	}
+
+	bool Int(int value) { return number(double(value)); }
+	bool Uint(unsigned value) { return number(double(value)); }
+	bool Int64(int64_t value) { return number(double(value)); }
+	bool Uint64(uint64_t value) { return number(double(value)); }
+	bool Double(double value) { return number(value); }
+
+	bool String(const Ch* value, rapidjson::SizeType length, bool)
+	{
+		next_element();
+
+		// NOTE: Parsing in place, value is null terminated inside the text
+		switch (scope())
+		{
+		case Scope::Asset:
+			if (key == VersionKey)
+				document->valid_version = strcmp("2.0", value) == 0;
+			break;
+		case Scope::AccessorObject:
+			if (key == TypeKey)
+				document->accessors[document->accessors.count - 1].type = parse_type(value);
+			break;
+		case Scope::MaterialObject:
+		{
+			Material& material = document->materials[document->materials.count - 1];
+			if (key == NameKey)
+			{
+				material.name_length = length < sizeof(material.name) - 1 ? length : sizeof(material.name) - 1;
+				memcpy(material.name, value, material.name_length);
+				material.name[material.name_length] = '\0';
+			}
+			else if (key == AlphaModeKey)
+			{
+				material.alpha_mode = parse_alpha_mode(value);
+			}
+			break;
+		}
+		case Scope::MeshObject:
+			if (key == NameKey)
+			{
+				document->meshes[document->meshes.count - 1].name = value;
+				document->meshes[document->meshes.count - 1].name_length = length;
+			}
+			break;
+		case Scope::NodeObject:
+			if (key == NameKey)
+			{
+				document->nodes[document->nodes.count - 1].name = value;
+				document->nodes[document->nodes.count - 1].name_length = length;
+			}
+			break;
+		default:
+			break;
+		}
+
+		return true;
+	}
+
+	bool Bool(bool value)
+	{
+		next_element();
+
+		if (scope() == Scope::AccessorObject && key == NormalizedKey)
+		{
+			document->accessors[document->accessors.count - 1].normalized = value;
+		}
+
+		return true;
+	}
+
+	bool Null()
+	{
+		next_element();
+		return true;
+	}
+
+	bool RawNumber(const Ch*, rapidjson::SizeType, bool)
+	{
+		assert(!"Numbers are never parsed as strings");
+		return false;
+	}
+};
+
+bool GltfParser::parse(char* json, size_t length, GltfDocument& document)
+{
+	GltfHandler handler = {};
+	handler.document = &document;
+
+	InsituChunkStream stream = { json, nullptr, json, json + length };
+
+	// NOTE: The document is the only value in the chunk, the padding after
+	// it is never read
+	rapidjson::Reader reader;
+	rapidjson::ParseResult result = reader.Parse<rapidjson::kParseInsituFlag | rapidjson::kParseStopWhenDoneFlag>(stream, handler);
+	if (result.IsError())
+	{
+		printf("[GltfParser]: %s at offset %zu\n", rapidjson::GetParseError_En(result.Code()), result.Offset());
+		return false;
+	}
+
+	return true;
+}
+
+} // namespace Resources
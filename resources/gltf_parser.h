@@ -0,0 +1,146 @@
+#pragma once
+
+#include "resources.h"
+
+namespace Resources
+{
+
+struct BufferView
+{
+	uint32_t buffer_id;
+	uint32_t byte_offset;
+	uint32_t byte_length;
+	uint32_t byte_stride;
+	uint32_t target;
+};
+
+enum ComponentType
+{
+	Byte = 5120,
+	UnsignedByte = 5121,
+	Short = 5122,
+	UnsignedShort = 5123,
+	UnsignedInt = 5125,
+	Float = 5126
+};
+
+enum Type
+{
+	Scalar,
+	Vec2,
+	Vec3,
+	Vec4,
+	Mat2,
+	Mat3,
+	Mat4
+};
+
+struct Accessor
+{
+	uint32_t buffer_view_id;
+	uint32_t byte_offset;
+	uint32_t count;
+	ComponentType component_type;
+	Type type;
+	bool normalized;
+	size_t min_length;
+	size_t max_length;
+	double min[4];
+	double max[4];
+};
+
+// Accessor ids of a primitive, -1 when the document leaves them out
+struct GltfPrimitive
+{
+	int32_t position;
+	int32_t normal;
+	int32_t uv_0;
+	int32_t indices;
+	int32_t material;
+	uint32_t mode;
+};
+
+struct GltfMesh
+{
+	// NOTE: Names point inside the JSON text
+	const char* name;
+	uint32_t name_length;
+	uint32_t primitive_offset;
+	uint32_t primitive_count;
+};
+
+struct GltfNode
+{
+	const char* name;
+	uint32_t name_length;
+	int32_t mesh;
+	// Range of node_ids
+	uint32_t child_offset;
+	uint32_t child_count;
+	// In glTF order: x, y, z, w
+	float translation[3];
+	float rotation[4];
+	float scale[3];
+	// Column major, only set when has_matrix is
+	bool has_matrix;
+	float matrix[16];
+};
+
+// Images are only read from buffer views: GLB files embed them in their
+// BIN chunk. Images referenced by uri are not supported.
+struct GltfImage
+{
+	int32_t buffer_view;
+};
+
+// Samplers are ignored, every texture is sampled with the same sampler
+struct GltfTexture
+{
+	int32_t source;
+};
+
+struct GltfScene
+{
+	// Range of node_ids
+	uint32_t node_offset;
+	uint32_t node_count;
+};
+
+// The parts of a glTF 2 JSON document the loader works with, flattened in
+// tables. Meshes, nodes and scenes reference ranges of the shared
+// primitives and node_ids tables instead of owning arrays.
+struct GltfDocument
+{
+	bool valid_version = false;
+	uint32_t buffer_count = 0;
+	int32_t scene = -1;
+
+	Table<BufferView> buffer_views;
+	Table<Accessor> accessors;
+	// NOTE: base_color_texture_id is an index into textures
+	Table<Material> materials;
+	Table<GltfImage> images;
+	Table<GltfTexture> textures;
+	Table<GltfMesh> meshes;
+	Table<GltfPrimitive> primitives;
+	Table<GltfNode> nodes;
+	Table<GltfScene> scenes;
+	// Children of the nodes and root nodes of the scenes
+	Table<uint32_t> node_ids;
+
+	void release();
+};
+
+struct GltfParser
+{
+	// Parses a glTF 2 JSON document in a single pass with rapidjson's SAX
+	// reader, writing every object straight into its table: no DOM is
+	// built and no member is ever looked up by name. The text is parsed in
+	// place, so it must be writable and outlive the document: strings are
+	// unescaped where they are and names point at them.
+	// json doesn't need to be null terminated, the parser never reads past
+	// length bytes. Returns false and prints why on malformed JSON.
+	static bool parse(char* json, size_t length, GltfDocument& document);
+};
+
+} // namespace Resources
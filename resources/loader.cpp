@@ -1,477 +1,1303 @@
 #include "loader.h"
+#include "mapped_file.h"
+#include "gltf_parser.h"
+#include "mesh_optimizer.h"
+#include "vertex_quantizer.h"
+#include "meshlet_builder.h"
+#include "mesh_simplifier.h"
+#include "texture_decoder.h"
 
 #include <stdio.h>
+#include <string.h>
+#include <stddef.h>
 #include <cassert>
 #include <inttypes.h>
-
-#include "rapidjson/document.h"
-#include "rapidjson/error/en.h"
+#include <float.h>
+#include <atomic>
 
 namespace Resources
 {
 
-typedef rapidjson::GenericObject<false, rapidjson::Value::ValueType> JsonObject;
-typedef rapidjson::GenericArray<false, rapidjson::Value::ValueType> JsonArray;
-typedef rapidjson::GenericObject<true, rapidjson::Value::ValueType> ConstJsonObject;
-typedef rapidjson::GenericArray<true, rapidjson::Value::ValueType> ConstJsonArray;
+// Returns a pointer to the first element of an accessor, inside the buffer it references
+static const unsigned char* accessor_data(const Accessor& accessor, const BufferView* buffer_views, const unsigned char** buffers)
+{
+	const BufferView& buffer_view = buffer_views[accessor.buffer_view_id];
+	return &buffers[buffer_view.buffer_id][buffer_view.byte_offset + accessor.byte_offset];
+}
 
-uint32_t Loader::load_model(const char* path, const char* name, AssetsInfo* assets_info)
+// Copies count elements of element_size bytes from an accessor into a tightly
+// packed stream. Tightly packed views are a single memcpy, interleaved views
+// are read with their byte stride.
+static void copy_attribute(const Accessor& accessor, const BufferView* buffer_views, const unsigned char** buffers, size_t element_size, void* destination, uint32_t count)
 {
-	// Open input file
-	FILE* file_handle = NULL;
-	file_handle = fopen(path, "rb");
-	assert(file_handle != NULL && "Failed to open asset file");
+	const unsigned char* source = accessor_data(accessor, buffer_views, buffers);
+	size_t source_stride = buffer_views[accessor.buffer_view_id].byte_stride > 0 ? buffer_views[accessor.buffer_view_id].byte_stride : element_size;
+	unsigned char* target = reinterpret_cast<unsigned char*>(destination);
 
-	size_t file_length = 0;
+	if (source_stride == element_size)
+	{
+		memcpy(target, source, count * element_size);
+		return;
+	}
 
-	// Read the GLB Header
-	const size_t header_buffer_size = 3;
-	uint32_t header_buffer[header_buffer_size];
-	uint32_t objects_read = fread(header_buffer, sizeof(uint32_t), header_buffer_size, file_handle);
-	assert(objects_read == header_buffer_size);
-	assert(header_buffer[0] == GLTF_MAGIC && "The asset is not a GLFT file");
-	assert(header_buffer[1] == GLTF_VERSION && "The asset is not of the right GLTF version");
+	for (uint32_t i = 0; i < count; ++i)
+	{
+		memcpy(target, source, element_size);
+		source += source_stride;
+		target += element_size;
+	}
+}
 
-	file_length = header_buffer[2];
+// Copies the indices of an accessor into destination, widened to 32 bits.
+// Indices are copied as they are, relative to their primitive.
+static void copy_indices(const Accessor& accessor, const BufferView* buffer_views, const unsigned char** buffers, uint32_t* destination)
+{
+	const unsigned char* source = accessor_data(accessor, buffer_views, buffers);
 
-	// Read the JSON Chunk Header
-	size_t json_length = 0;
-	const size_t chunk_header_size = 2;
-	uint32_t chunk_header[chunk_header_size];
-	objects_read = fread(chunk_header, sizeof(uint32_t), chunk_header_size, file_handle);
-	assert(objects_read == chunk_header_size);
-	assert(chunk_header[1] == GLTF_CHUNK_TYPE_JSON && "The chunk of data is not JSON");
+	if (accessor.component_type == ComponentType::UnsignedByte)
+	{
+		for (uint32_t i = 0; i < accessor.count; ++i)
+		{
+			destination[i] = source[i];
+		}
+	}
+	else if (accessor.component_type == ComponentType::UnsignedShort)
+	{
+		const uint16_t* indices = reinterpret_cast<const uint16_t*>(source);
+		for (uint32_t i = 0; i < accessor.count; ++i)
+		{
+			destination[i] = indices[i];
+		}
+	}
+	else if (accessor.component_type == ComponentType::UnsignedInt)
+	{
+		memcpy(destination, source, accessor.count * sizeof(uint32_t));
+	}
+	else
+	{
+		assert(!"Component Type not supported for Indices");
+	}
+}
 
-	json_length = static_cast<size_t>(chunk_header[0]);
+// A GLB file mapped in memory and the parts of its JSON document the
+// loader works with. Buffers point inside the mapping.
+struct GlbDocument
+{
+	MappedFile file = {};
+	GltfDocument gltf;
+	const unsigned char** buffers = nullptr;
+};
 
-	// Read the JSON data
-	char* json_string = new char[json_length + 1];
-	uint32_t bytes_read = fread(json_string, sizeof(char), json_length, file_handle);
-	assert(bytes_read == json_length);
-	json_string[json_length] = '\0';
+// How many elements of each table a model needs
+struct ModelCounts
+{
+	uint32_t material_count = 0;
+	uint32_t mesh_count = 0;
+	uint32_t vertex_count = 0;
+	uint32_t index16_count = 0;
+	uint32_t index32_count = 0;
+	uint32_t node_count = 0;
+	uint32_t texture_count = 0;
+	uint32_t texture_pixel_size = 0;
+};
+
+// Where a model goes in each table
+struct ModelRanges
+{
+	uint32_t model_id;
+	uint32_t material_offset;
+	uint32_t mesh_offset;
+	uint32_t vertex_offset;
+	uint32_t index16_offset;
+	uint32_t index32_offset;
+	uint32_t node_offset;
+};
+
+// What a mesh of a source needs, and a hash of everything it is made of
+struct MeshContent
+{
+	uint64_t hash;
+	uint32_t vertex_count;
+	uint32_t index_count;
+	IndexType index_type;
+};
+
+// An image of a source, read from its header, and a hash of its encoded
+// bytes
+struct ImageContent
+{
+	uint64_t hash;
+	uint32_t width;
+	uint32_t height;
+};
+
+// The images, materials and meshes of a source and where each one goes.
+// Images, materials and meshes identical to one seen before in the batch
+// are not written again, they map to the id of the first one.
+struct ModelContent
+{
+	uint32_t image_count = 0;
+	uint32_t material_count = 0;
+	uint32_t mesh_count = 0;
+	ImageContent* images = nullptr;
+	uint64_t* material_hashes = nullptr;
+	MeshContent* meshes = nullptr;
+
+	// The nodes of the scene in the order they are written, see
+	// flatten_nodes
+	uint32_t node_count = 0;
+	uint32_t* node_order = nullptr;
+	uint32_t* node_parents = nullptr;
+
+	// Filled by plan_batch. Every image becomes a texture.
+	uint32_t* texture_ids = nullptr;
+	uint32_t* material_ids = nullptr;
+	bool* material_written = nullptr;
+	uint32_t* mesh_ids = nullptr;
+	bool* mesh_written = nullptr;
+
+	void destroy()
+	{
+		delete[] images;
+		delete[] material_hashes;
+		delete[] meshes;
+		delete[] node_order;
+		delete[] node_parents;
+		delete[] texture_ids;
+		delete[] material_ids;
+		delete[] material_written;
+		delete[] mesh_ids;
+		delete[] mesh_written;
+	}
+};
 
-	// Parse the JSON data
-	rapidjson::Document document;
-	document.Parse<rapidjson::kParseStopWhenDoneFlag>(json_string);
+// The tables a model adds to whose size is only known once its primitives
+// are optimized and simplified. Every write job fills its own, and they
+// are appended to assets_info in source order after the write jobs.
+struct GeneratedTables
+{
+	Table<Meshlet> meshlets;
+	// Indices of the LODs, in the index type of their mesh
+	Table<Index16> lod_indices16;
+	Table<Index32> lod_indices32;
+
+	void release()
+	{
+		meshlets.release();
+		lod_indices16.release();
+		lod_indices32.release();
+	}
+};
 
-	rapidjson::Value& document_asset = document["asset"];
-	assert(document_asset.IsObject());
-	auto value = document_asset.GetObject();
-	assert(value.HasMember("version") && strstr("2.0", value["version"].GetString()));
+// A texture to decode: an image of a source and the range of
+// texture_pixels reserved for its mip chain
+struct TextureJob
+{
+	uint32_t source_id;
+	uint32_t image_id;
+	uint32_t texture_id;
+	uint32_t pixel_offset;
+};
+
+// Shared by all the jobs of a load_models call
+struct LoadJobs
+{
+	const ModelSource* sources;
+	AssetsInfo* assets_info;
+	uint32_t model_offset;
+
+	// One per source, filled by the open jobs
+	GlbDocument** documents;
+	ModelContent* contents;
+	// One per source, filled by plan_batch: what the source writes once
+	// its duplicates are left out
+	ModelCounts* counts;
+	// One per source, filled by the write jobs
+	ModelRanges* ranges;
+	GeneratedTables* generated;
+	// One per texture written, filled by plan_batch
+	TextureJob* texture_jobs;
+	uint32_t texture_job_count;
+
+	// Heads of the vertex and index tables. The tables are grown once for
+	// the whole batch, then every write job reserves its ranges with a
+	// single fetch_add per table and writes them without any locking.
+	// NOTE: Texture, material and mesh ids, and the pixel ranges of the
+	// textures, are handed out by plan_batch instead, in source order, so
+	// that a duplicate knows the id of the original.
+	std::atomic<size_t> vertex_offset;
+	std::atomic<size_t> index16_offset;
+	std::atomic<size_t> index32_offset;
+};
+
+static void open_document(const char* path, GlbDocument& glb)
+{
+	// NOTE: The whole file is mapped in memory. The JSON chunk is parsed
+	// straight from the mapping and accessors point inside the BIN chunk,
+	// so no intermediate copy of the file is ever made.
+	MappedFile& file = glb.file;
+	bool opened = file.open(path, true);
+	assert(opened && "Failed to open asset file");
+
+	// Read the GLB Header
+	const size_t header_size = 3 * sizeof(uint32_t);
+	assert(file.size >= header_size);
+	const uint32_t* header = reinterpret_cast<const uint32_t*>(file.data);
+	assert(header[0] == GLTF_MAGIC && "The asset is not a GLFT file");
+	assert(header[1] == GLTF_VERSION && "The asset is not of the right GLTF version");
 
-	delete[] json_string;
+	size_t file_length = header[2];
+	assert(file_length <= file.size);
 
-	// Read all buffers
-	size_t buffer_count = (size_t)document["buffers"].GetArray().Size();
-	unsigned char** buffers = new unsigned char*[buffer_count];
+	// Read the JSON Chunk Header
+	const size_t chunk_header_size = 2 * sizeof(uint32_t);
+	size_t cursor = header_size;
+	const uint32_t* chunk_header = reinterpret_cast<const uint32_t*>(file.data + cursor);
+	assert(chunk_header[1] == GLTF_CHUNK_TYPE_JSON && "The chunk of data is not JSON");
+
+	size_t json_length = static_cast<size_t>(chunk_header[0]);
+	char* json_string = reinterpret_cast<char*>(file.writable_data() + cursor + chunk_header_size);
+	cursor += chunk_header_size + json_length;
+	assert(cursor <= file_length);
+
+	// Parse the JSON data
+	// NOTE: The JSON chunk is parsed in place. The mapping is copy-on-write,
+	// so the OS copies the pages the parser writes string terminators to
+	// and the file itself is never modified.
+	GltfDocument& gltf = glb.gltf;
+	bool parsed = GltfParser::parse(json_string, json_length, gltf);
+	assert(parsed && "The JSON chunk is not valid");
+	assert(gltf.valid_version && "The asset is not of the right GLTF version");
+
+	// Locate all buffers inside the mapping
+	size_t buffer_count = (size_t)gltf.buffer_count;
+	const unsigned char** buffers = new const unsigned char*[buffer_count];
 
 	for (size_t i = 0; i < buffer_count; ++i)
 	{
 		// Read the next Chunk Header
-		size_t chunk_length = 0;
-		const size_t chunk_header_size = 2;
-		uint32_t chunk_header[chunk_header_size];
-		uint32_t objects_read = fread(chunk_header, sizeof(uint32_t), chunk_header_size, file_handle);
-		assert(objects_read == chunk_header_size);
+		assert(cursor + chunk_header_size <= file_length);
+		const uint32_t* chunk_header = reinterpret_cast<const uint32_t*>(file.data + cursor);
 		assert(chunk_header[1] == GLTF_CHUNK_TYPE_BIN && "The chunk of data is not Binary");
 
-		chunk_length = static_cast<size_t>(chunk_header[0]);
-
-		buffers[i] = new unsigned char[chunk_length];
-		uint32_t bytes_read = fread(buffers[i], sizeof(unsigned char), chunk_length, file_handle);
-		assert(bytes_read == chunk_length);
+		size_t chunk_length = static_cast<size_t>(chunk_header[0]);
+		buffers[i] = file.data + cursor + chunk_header_size;
+		cursor += chunk_header_size + chunk_length;
+		assert(cursor <= file_length);
 	}
 
-	fclose(file_handle);
+	glb.buffers = buffers;
+}
 
-	// Parse the content of the GLFT 2 document
+static void close_document(GlbDocument& glb)
+{
+	glb.gltf.release();
+	delete[] glb.buffers;
+	glb.file.close();
+}
 
-	// Parse the Buffer Views
-	struct BufferView
+// Grows bounds_min/bounds_max to contain the positions of a primitive.
+// glTF requires min and max on POSITION accessors, the positions are only
+// scanned when an exporter left them out.
+static void add_position_bounds(const Accessor& accessor, const glm::vec3* positions, glm::vec3& bounds_min, glm::vec3& bounds_max)
+{
+	glm::vec3 accessor_min;
+	glm::vec3 accessor_max;
+	if (accessor.min_length == 3 && accessor.max_length == 3)
 	{
-		uint32_t buffer_id;
-		uint32_t byte_offset;
-		uint32_t byte_length;
-		uint32_t byte_stride;
-		uint32_t target;
-	};
+		accessor_min = glm::vec3(float(accessor.min[0]), float(accessor.min[1]), float(accessor.min[2]));
+		accessor_max = glm::vec3(float(accessor.max[0]), float(accessor.max[1]), float(accessor.max[2]));
+	}
+	else
+	{
+		accessor_min = positions[0];
+		accessor_max = positions[0];
+		for (uint32_t i = 1; i < accessor.count; ++i)
+		{
+			accessor_min = glm::min(accessor_min, positions[i]);
+			accessor_max = glm::max(accessor_max, positions[i]);
+		}
+	}
 
-	JsonArray __buffer_views = document["bufferViews"].GetArray();
-	size_t buffer_view_count = (size_t)__buffer_views.Size();
-	BufferView* buffer_views = new BufferView[buffer_view_count];
+	bounds_min = glm::min(bounds_min, accessor_min);
+	bounds_max = glm::max(bounds_max, accessor_max);
+}
 
-	for (size_t i = 0; i < buffer_view_count; ++i)
+// Picks the index type of a mesh. Indices are relative to their primitive,
+// so only the size of the biggest primitive matters, not the size of the
+// scene.
+static IndexType choose_index_type(const GltfDocument& gltf, const GltfMesh& mesh)
+{
+	for (uint32_t p = 0; p < mesh.primitive_count; ++p)
 	{
-		JsonObject __buffer_view = __buffer_views[i].GetObject();
-		buffer_views[i] = {};
+		const GltfPrimitive& primitive = gltf.primitives[mesh.primitive_offset + p];
+		assert(primitive.position >= 0 && "POSITION attribute not found");
+		if (gltf.accessors[primitive.position].count > max_index16_vertex_count)
+			return IndexType::Uint32;
+	}
+
+	return IndexType::Uint16;
+}
 
-		// Required fields
-		buffer_views[i].buffer_id = __buffer_view["buffer"].GetInt();
-		buffer_views[i].byte_length = __buffer_view["byteLength"].GetInt();
+// Hash of what a material looks like. The name is left out: two materials
+// that only differ by name draw the same. Textures are hashed by content,
+// texture_hash is the hash of the base color image, 0 without one.
+static uint64_t hash_material(const Material& material, uint64_t texture_hash)
+{
+	const Material::PBRMetallicRoughness& pbr = material.pbr_metallic_roughness;
+	uint64_t hash = hash_bytes(&material.alpha_mode, sizeof(material.alpha_mode));
+	hash = hash_bytes(&texture_hash, sizeof(texture_hash), hash);
+	hash = hash_bytes(&pbr.base_color_factor, sizeof(pbr.base_color_factor), hash);
+	hash = hash_bytes(&pbr.metallic_factor, sizeof(pbr.metallic_factor), hash);
+	hash = hash_bytes(&pbr.roughness_factor, sizeof(pbr.roughness_factor), hash);
+	return hash;
+}
 
-		// Optional fields
-		buffer_views[i].byte_offset = __buffer_view.HasMember("byteOffset") ? __buffer_view["byteOffset"].GetInt() : 0;
-		buffer_views[i].byte_stride = __buffer_view.HasMember("byteStride") ? __buffer_view["byteStride"].GetInt() : 0;
-		buffer_views[i].target = __buffer_view.HasMember("target") ? __buffer_view["target"].GetInt() : 0;
+static uint32_t component_size(ComponentType component_type)
+{
+	switch (component_type)
+	{
+	case ComponentType::Byte:
+	case ComponentType::UnsignedByte:
+		return 1;
+	case ComponentType::Short:
+	case ComponentType::UnsignedShort:
+		return 2;
+	default:
+		return 4;
 	}
+}
 
-	// Parse the Accessors
-	enum ComponentType
+// Hashes the elements of an accessor, skipping the padding of interleaved
+// buffer views
+static uint64_t hash_accessor(const Accessor& accessor, const BufferView* buffer_views, const unsigned char** buffers, uint64_t hash)
+{
+	static const uint32_t component_counts[] = { 1, 2, 3, 4, 4, 9, 16 };
+	uint32_t element_size = component_size(accessor.component_type) * component_counts[accessor.type];
+
+	hash = hash_bytes(&accessor.component_type, sizeof(accessor.component_type), hash);
+	hash = hash_bytes(&accessor.type, sizeof(accessor.type), hash);
+	hash = hash_bytes(&accessor.count, sizeof(accessor.count), hash);
+
+	const unsigned char* data = accessor_data(accessor, buffer_views, buffers);
+	uint32_t byte_stride = buffer_views[accessor.buffer_view_id].byte_stride;
+	if (byte_stride == 0 || byte_stride == element_size)
+		return hash_bytes(data, size_t(element_size) * accessor.count, hash);
+
+	for (uint32_t i = 0; i < accessor.count; ++i)
 	{
-		Byte = 5120,
-		UnsignedByte = 5121,
-		Short = 5122,
-		UnsignedShort = 5123,
-		UnsignedInt = 5125,
-		Float = 5126
-	};
+		hash = hash_bytes(data + size_t(i) * byte_stride, element_size, hash);
+	}
+
+	return hash;
+}
+
+// Flattens the node hierarchy of the scene breadth first, starting from its
+// root nodes, so that every parent comes before its children and the
+// model matrices can be computed in a single pass. node_order receives the
+// glTF node of each flattened node and node_parents the flattened index of
+// its parent. Nodes that are not part of the scene are left out.
+static void flatten_nodes(const GltfDocument& gltf, ModelContent& content)
+{
+	assert(gltf.scenes.count == 1);
+	const GltfScene& scene = gltf.scenes[0];
 
-	enum Type
+	uint32_t gltf_node_count = (uint32_t)gltf.nodes.count;
+	content.node_order = new uint32_t[gltf_node_count];
+	content.node_parents = new uint32_t[gltf_node_count];
+	bool* visited = new bool[gltf_node_count];
+	memset(visited, 0, gltf_node_count * sizeof(bool));
+
+	uint32_t node_count = 0;
+	for (uint32_t i = 0; i < scene.node_count; ++i)
 	{
-		Scalar,
-		Vec2,
-		Vec3,
-		Vec4,
-		Mat2,
-		Mat3,
-		Mat4
-	};
+		uint32_t root = gltf.node_ids[scene.node_offset + i];
+		assert(root < gltf_node_count && !visited[root]);
+		visited[root] = true;
+		content.node_order[node_count] = root;
+		content.node_parents[node_count] = no_node;
+		node_count++;
+	}
 
-	struct Accessor
+	// NOTE: node_order is the queue of the breadth first visit
+	for (uint32_t n = 0; n < node_count; ++n)
 	{
-		uint32_t buffer_view_id;
-		uint32_t byte_offset;
-		uint32_t count;
-		ComponentType component_type;
-		Type type;
-		bool normalized;
-		size_t min_length;
-		size_t max_length;
-		double min[4];
-		double max[4];
-	};
+		const GltfNode& node = gltf.nodes[content.node_order[n]];
+		for (uint32_t c = 0; c < node.child_count; ++c)
+		{
+			uint32_t child = gltf.node_ids[node.child_offset + c];
+			assert(child < gltf_node_count && !visited[child] && "A node can only have one parent");
+			visited[child] = true;
+			content.node_order[node_count] = child;
+			content.node_parents[node_count] = n;
+			node_count++;
+		}
+	}
+
+	content.node_count = node_count;
+	delete[] visited;
+}
+
+// Returns the encoded bytes of an image, inside the BIN chunk
+static const unsigned char* image_data(const GlbDocument& glb, const GltfImage& image, size_t& size)
+{
+	assert(image.buffer_view >= 0 && "Only images embedded in a buffer view are supported");
+	const BufferView& buffer_view = glb.gltf.buffer_views[image.buffer_view];
+	size = buffer_view.byte_length;
+	return &glb.buffers[buffer_view.buffer_id][buffer_view.byte_offset];
+}
 
-	JsonArray __accessors = document["accessors"].GetArray();
-	size_t accessor_count = __accessors.Size();
-	Accessor* accessors = new Accessor[accessor_count];
+// Returns the image a material samples its base color from, -1 if none
+static int32_t base_color_image(const GltfDocument& gltf, const Material& material)
+{
+	if (material.base_color_texture_id == no_texture)
+		return -1;
+
+	assert(material.base_color_texture_id < gltf.textures.count);
+	int32_t image = gltf.textures[material.base_color_texture_id].source;
+	assert(image >= 0 && uint32_t(image) < gltf.images.count && "Texture without an image");
+	return image;
+}
+
+// Hashes the images, materials and meshes of a document and counts what
+// each mesh needs. A mesh hash covers every primitive: its mode, the hash
+// of its material and the data of its attributes and indices, so two
+// meshes with the same hash produce the same vertices, indices and LODs.
+// Images are only hashed and measured here, they are decoded once the
+// duplicates are known.
+// NOTE: Hashes are trusted, the data is not compared. With 64 bits hashes
+// a collision is very unlikely at the scale of a level.
+static void scan_model(GlbDocument& glb, ModelContent& content)
+{
+	const GltfDocument& gltf = glb.gltf;
+	const Accessor* accessors = gltf.accessors.data;
 
-	for (size_t i = 0; i < accessor_count; ++i)
+	content.image_count = (uint32_t)gltf.images.count;
+	content.images = new ImageContent[content.image_count];
+
+	for (uint32_t i = 0; i < content.image_count; ++i)
 	{
-		JsonObject __accessor = __accessors[i].GetObject();
-		accessors[i] = {};
+		size_t size = 0;
+		const unsigned char* data = image_data(glb, gltf.images[i], size);
 
-		// Required fields
-		accessors[i].component_type = static_cast<ComponentType>(__accessor["componentType"].GetInt());
-		accessors[i].count = __accessor["count"].GetInt();
-		const char* string_type = __accessor["type"].GetString();
-		if (strcmp("SCALAR", string_type) == 0)
+		ImageContent& image = content.images[i];
+		image.hash = hash_bytes(data, size);
+		if (!TextureDecoder::read_size(data, size, image.width, image.height))
 		{
-			accessors[i].type = Type::Scalar;
+			// NOTE: Decoding fails as well and leaves a 1x1 magenta texture
+			printf("[Loader]: Image %u has an unsupported format\n", i);
+			image.width = 1;
+			image.height = 1;
 		}
-		else if (strcmp("VEC2", string_type) == 0)
+	}
+
+	content.material_count = (uint32_t)gltf.materials.count;
+	content.material_hashes = new uint64_t[content.material_count];
+
+	for (uint32_t i = 0; i < content.material_count; ++i)
+	{
+		int32_t image = base_color_image(gltf, gltf.materials[i]);
+		content.material_hashes[i] = hash_material(gltf.materials[i], image >= 0 ? content.images[image].hash : 0);
+	}
+
+	content.mesh_count = (uint32_t)gltf.meshes.count;
+	content.meshes = new MeshContent[content.mesh_count];
+
+	for (uint32_t mesh_id = 0; mesh_id < content.mesh_count; ++mesh_id)
+	{
+		const GltfMesh& gltf_mesh = gltf.meshes[mesh_id];
+
+		MeshContent& mesh = content.meshes[mesh_id];
+		mesh = {};
+		mesh.index_type = choose_index_type(gltf, gltf_mesh);
+		mesh.hash = hash_seed;
+
+		for (uint32_t primitive_id = 0; primitive_id < gltf_mesh.primitive_count; ++primitive_id)
 		{
-			accessors[i].type = Type::Vec2;
+			const GltfPrimitive& primitive = gltf.primitives[gltf_mesh.primitive_offset + primitive_id];
+			mesh.vertex_count += accessors[primitive.position].count;
+
+			assert(primitive.material >= 0 && "Primitives without a material are not supported");
+			mesh.hash = hash_bytes(&primitive.mode, sizeof(primitive.mode), mesh.hash);
+			mesh.hash = hash_bytes(&content.material_hashes[primitive.material], sizeof(uint64_t), mesh.hash);
+
+			const int32_t attributes[] = { primitive.position, primitive.normal, primitive.uv_0 };
+			for (uint32_t a = 0; a < sizeof(attributes) / sizeof(attributes[0]); ++a)
+			{
+				bool present = attributes[a] >= 0;
+				mesh.hash = hash_bytes(&present, sizeof(present), mesh.hash);
+				if (present)
+				{
+					mesh.hash = hash_accessor(accessors[attributes[a]], gltf.buffer_views.data, glb.buffers, mesh.hash);
+				}
+			}
+
+			bool indexed = primitive.indices >= 0;
+			mesh.hash = hash_bytes(&indexed, sizeof(indexed), mesh.hash);
+			if (indexed)
+			{
+				const Accessor& index_accessor = accessors[primitive.indices];
+				mesh.index_count += index_accessor.count;
+				mesh.hash = hash_accessor(index_accessor, gltf.buffer_views.data, glb.buffers, mesh.hash);
+			}
 		}
-		else if (strcmp("VEC3", string_type) == 0)
+	}
+
+	flatten_nodes(gltf, content);
+}
+
+// uint64_t hash -> id, open addressing with linear probing
+struct HashIndex
+{
+	uint64_t* keys = nullptr;
+	uint32_t* ids = nullptr;
+	uint32_t capacity = 0;
+
+	void init(uint32_t max_count)
+	{
+		capacity = 16;
+		while (capacity < max_count * 2)
 		{
-			accessors[i].type = Type::Vec3;
+			capacity *= 2;
 		}
-		else
+
+		keys = new uint64_t[capacity];
+		ids = new uint32_t[capacity];
+		memset(keys, 0, capacity * sizeof(uint64_t));
+	}
+
+	void destroy()
+	{
+		delete[] keys;
+		delete[] ids;
+	}
+
+	// Returns the id of key, adding it with id when it's not there yet
+	uint32_t find_or_add(uint64_t key, uint32_t id)
+	{
+		// NOTE: 0 marks the empty slots
+		key = key != 0 ? key : 1;
+		uint32_t slot = uint32_t(key) & (capacity - 1);
+		while (keys[slot] != 0)
 		{
-			assert(!"Type not yet supported");
+			if (keys[slot] == key)
+				return ids[slot];
+
+			slot = (slot + 1) & (capacity - 1);
 		}
 
-		// Optional fields
-		accessors[i].buffer_view_id = __accessor.HasMember("bufferView") ? __accessor["bufferView"].GetInt() : 0;
-		accessors[i].byte_offset = __accessor.HasMember("byteOffset") ? __accessor["byteOffset"].GetInt() : 0;
-		accessors[i].normalized = __accessor.HasMember("normalized") ? __accessor["normalized"].GetBool() : false;
+		keys[slot] = key;
+		ids[slot] = id;
+		return id;
+	}
+};
+
+// Vertex data of every stream of a vertex
+static const size_t vertex_size = 2 * sizeof(glm::vec3) + sizeof(glm::vec2) + sizeof(QuantizedPosition) + sizeof(QuantizedNormal) + sizeof(QuantizedUv);
+
+// Hands out the texture, material and mesh ids of every source, in source
+// order, mapping duplicates to the first texture, material or mesh with the
+// same hash. Fills the per source counts, the material, mesh and node
+// ranges and a decode job per texture written, and returns the bytes the
+// duplicates would have taken.
+static size_t plan_batch(LoadJobs* jobs, uint32_t source_count, size_t texture_base, size_t texture_pixel_base, size_t material_base, size_t mesh_base, size_t node_base, ModelCounts& total)
+{
+	uint32_t image_count = 0;
+	uint32_t material_count = 0;
+	uint32_t mesh_count = 0;
+	for (uint32_t i = 0; i < source_count; ++i)
+	{
+		image_count += jobs->contents[i].image_count;
+		material_count += jobs->contents[i].material_count;
+		mesh_count += jobs->contents[i].mesh_count;
+	}
 
-		// Min Max
-		if (__accessor.HasMember("min"))
+	HashIndex texture_index = {};
+	texture_index.init(image_count);
+	HashIndex material_index = {};
+	material_index.init(material_count);
+	HashIndex mesh_index = {};
+	mesh_index.init(mesh_count);
+
+	jobs->texture_jobs = new TextureJob[image_count];
+	jobs->texture_job_count = 0;
+
+	uint32_t next_texture_id = (uint32_t)texture_base;
+	uint32_t next_pixel_offset = (uint32_t)texture_pixel_base;
+	uint32_t next_material_id = (uint32_t)material_base;
+	uint32_t next_mesh_id = (uint32_t)mesh_base;
+	uint32_t next_node_id = (uint32_t)node_base;
+	uint32_t duplicate_texture_count = 0;
+	uint32_t duplicate_material_count = 0;
+	uint32_t duplicate_mesh_count = 0;
+	size_t saved_size = 0;
+
+	for (uint32_t i = 0; i < source_count; ++i)
+	{
+		ModelContent& content = jobs->contents[i];
+		ModelCounts& counts = jobs->counts[i];
+		ModelRanges& ranges = jobs->ranges[i];
+		counts = {};
+		ranges.material_offset = next_material_id;
+		ranges.mesh_offset = next_mesh_id;
+		ranges.node_offset = next_node_id;
+		counts.node_count = content.node_count;
+		next_node_id += content.node_count;
+
+		content.texture_ids = new uint32_t[content.image_count];
+		for (uint32_t m = 0; m < content.image_count; ++m)
 		{
-			JsonArray min = __accessor["min"].GetArray();
-			assert((size_t)min.Size() <= 4);
-			accessors[i].min_length = (size_t)min.Size();
-			for (size_t j = 0; j < accessors[i].min_length; ++j)
+			const ImageContent& image = content.images[m];
+			content.texture_ids[m] = texture_index.find_or_add(image.hash, next_texture_id);
+			uint32_t pixel_size = (uint32_t)TextureDecoder::mip_chain_size(image.width, image.height);
+			if (content.texture_ids[m] == next_texture_id)
 			{
-				accessors[i].min[j] = min[j].GetDouble();
+				TextureJob& texture_job = jobs->texture_jobs[jobs->texture_job_count++];
+				texture_job.source_id = i;
+				texture_job.image_id = m;
+				texture_job.texture_id = next_texture_id;
+				texture_job.pixel_offset = next_pixel_offset;
+
+				next_texture_id++;
+				next_pixel_offset += pixel_size;
+				counts.texture_count++;
+				counts.texture_pixel_size += pixel_size;
 			}
-		}
-
-		if (__accessor.HasMember("max"))
-		{
-			JsonArray max = __accessor["min"].GetArray();
-			assert((size_t)max.Size() <= 4);
-			accessors[i].max_length = (size_t)max.Size();
-			for (size_t j = 0; j < accessors[i].max_length; ++j)
+			else
 			{
-				accessors[i].max[j] = max[j].GetDouble();
+				duplicate_texture_count++;
+				saved_size += sizeof(Texture) + pixel_size;
 			}
 		}
-	}
-
-	// Parse Materials
 
-	// NOTE: The material index inside a glTF 2 JSON document is relative
-	// to the document itself. Since we're loading all the materials
-	// across different documents into one single Material* list, we
-	// need a material_base_index to keep the relation between a primitive
-	// and its associated material
-	uint32_t material_offset = assets_info->material_offset;
-
-	JsonArray __materials = document["materials"].GetArray();
-	size_t material_size = (size_t)__materials.Size();
-	for (size_t i = 0; i < material_size; ++i)
-	{
-		JsonObject __material = __materials[i].GetObject();
-		Material material = {};
-		assert(__material.HasMember("name"));
-		uint32_t name_length = strlen(__material["name"].GetString());
-		material.name_length = name_length;
-		memcpy(material.name, __material["name"].GetString(), name_length);
-
-		if (__material.HasMember("alphaMode"))
+		content.material_ids = new uint32_t[content.material_count];
+		content.material_written = new bool[content.material_count];
+		for (uint32_t m = 0; m < content.material_count; ++m)
 		{
-			if (strcmp("OPAQUE", __material["alphaMode"].GetString()) == 0)
+			content.material_ids[m] = material_index.find_or_add(content.material_hashes[m], next_material_id);
+			content.material_written[m] = content.material_ids[m] == next_material_id;
+			if (content.material_written[m])
 			{
-				material.alpha_mode = MaterialAlphaMode::Opaque;
+				next_material_id++;
+				counts.material_count++;
 			}
-			else if (strcmp("MASK", __material["alphaMode"].GetString()) == 0)
+			else
 			{
-				material.alpha_mode = MaterialAlphaMode::Mask;
+				duplicate_material_count++;
+				saved_size += sizeof(Material);
 			}
-			else if (strcmp("BLEND", __material["alphaMode"].GetString()) == 0)
+		}
+
+		content.mesh_ids = new uint32_t[content.mesh_count];
+		content.mesh_written = new bool[content.mesh_count];
+		for (uint32_t m = 0; m < content.mesh_count; ++m)
+		{
+			const MeshContent& mesh = content.meshes[m];
+			content.mesh_ids[m] = mesh_index.find_or_add(mesh.hash, next_mesh_id);
+			content.mesh_written[m] = content.mesh_ids[m] == next_mesh_id;
+			size_t index_size = mesh.index_type == IndexType::Uint16 ? sizeof(Index16) : sizeof(Index32);
+			if (content.mesh_written[m])
 			{
-				material.alpha_mode = MaterialAlphaMode::Blend;
+				next_mesh_id++;
+				counts.mesh_count++;
+				counts.vertex_count += mesh.vertex_count;
+				if (mesh.index_type == IndexType::Uint16)
+					counts.index16_count += mesh.index_count;
+				else
+					counts.index32_count += mesh.index_count;
 			}
 			else
 			{
-				assert(!"Invalid alphaMode");
+				duplicate_mesh_count++;
+				saved_size += sizeof(Mesh) + mesh.vertex_count * vertex_size + mesh.index_count * index_size;
 			}
 		}
-		else
-		{
-			material.alpha_mode = MaterialAlphaMode::Opaque;
-		}
 
-		// TODO: Add support for other workflows
-		assert(__material.HasMember("pbrMetallicRoughness"));
-		JsonObject __pbr_metallic = __material["pbrMetallicRoughness"].GetObject();
-		material.pbr_metallic_roughness = {};
-		if (__pbr_metallic.HasMember("baseColorFactor"))
-		{
-			JsonArray __base_color_format = __pbr_metallic["baseColorFactor"].GetArray();
-			material.pbr_metallic_roughness.base_color_factor.r = __base_color_format[0].GetFloat();
-			material.pbr_metallic_roughness.base_color_factor.g = __base_color_format[1].GetFloat();
-			material.pbr_metallic_roughness.base_color_factor.b = __base_color_format[2].GetFloat();
-			material.pbr_metallic_roughness.base_color_factor.a = __base_color_format[3].GetFloat();
-		}
+		total.texture_count += counts.texture_count;
+		total.texture_pixel_size += counts.texture_pixel_size;
+		total.material_count += counts.material_count;
+		total.mesh_count += counts.mesh_count;
+		total.vertex_count += counts.vertex_count;
+		total.index16_count += counts.index16_count;
+		total.index32_count += counts.index32_count;
+		total.node_count += counts.node_count;
+	}
 
-		if (__pbr_metallic.HasMember("metallicFactor"))
+	texture_index.destroy();
+	material_index.destroy();
+	mesh_index.destroy();
+
+	if (duplicate_texture_count > 0 || duplicate_material_count > 0 || duplicate_mesh_count > 0)
+	{
+		// NOTE: The LOD indices and meshlets of the duplicated meshes are
+		// saved as well, they are not counted
+		printf("[Loader]: Deduplicated %u textures, %u materials and %u meshes, %.1f KB saved\n",
+			duplicate_texture_count, duplicate_material_count, duplicate_mesh_count, double(saved_size) / 1024.0);
+	}
+
+	return saved_size;
+}
+
+// LODs are simplified until the surface moves by this much, relative to
+// the size of the mesh
+static const float lod_max_relative_error = 0.05f;
+
+// Simplifies an optimized primitive into its LODs, each one aiming for half
+// the triangles of the one before. The indices and meshlets of the LODs are
+// appended to generated, their offsets are relative to its tables.
+// lod_errors receives the error of each level.
+static void build_primitive_lods(const uint32_t* indices, const glm::vec3* positions, uint32_t vertex_count, IndexType index_type, float max_error,
+	Primitive& primitive, float* lod_errors, GeneratedTables& generated)
+{
+	primitive.lod_count = 1;
+	lod_errors[0] = 0.0f;
+
+	uint32_t* simplified = new uint32_t[primitive.index_count];
+	uint32_t* optimized = new uint32_t[primitive.index_count];
+	uint32_t previous_index_count = primitive.index_count;
+
+	for (uint32_t level = 1; level < max_lod_count; ++level)
+	{
+		// NOTE: Every level is simplified from the full resolution indices,
+		// so its error is measured against the original surface
+		uint32_t target_index_count = (primitive.index_count >> level) / 3 * 3;
+		float error = 0.0f;
+		uint32_t index_count = MeshSimplifier::simplify(simplified, indices, primitive.index_count, positions, vertex_count, target_index_count, max_error, &error);
+
+		// Not worth a level when it saves less than a fifth of the triangles
+		if (index_count == 0 || index_count > previous_index_count - previous_index_count / 5)
+			break;
+
+		MeshOptimizer::optimize_vertex_cache(optimized, simplified, index_count, vertex_count);
+
+		PrimitiveLod& lod = primitive.lods[level - 1];
+		lod.index_count = index_count;
+
+		if (index_type == IndexType::Uint16)
 		{
-			material.pbr_metallic_roughness.metallic_factor = __pbr_metallic["metallicFactor"].GetFloat();
+			lod.index_offset = (uint32_t)generated.lod_indices16.append(index_count);
+			Index16* destination = generated.lod_indices16.data + lod.index_offset;
+			for (uint32_t i = 0; i < index_count; ++i)
+			{
+				destination[i] = Index16(optimized[i]);
+			}
 		}
-
-		if (__pbr_metallic.HasMember("roughnessFactor"))
+		else
 		{
-			material.pbr_metallic_roughness.metallic_factor = __pbr_metallic["roughnessFactor"].GetFloat();
+			lod.index_offset = (uint32_t)generated.lod_indices32.append(index_count);
+			memcpy(generated.lod_indices32.data + lod.index_offset, optimized, index_count * sizeof(Index32));
 		}
 
-		assets_info->materials[assets_info->material_offset] = material;
-		assets_info->material_offset++;
+		lod.meshlet_offset = (uint32_t)generated.meshlets.count;
+		lod.meshlet_count = MeshletBuilder::build_meshlets(optimized, index_count, positions, vertex_count, generated.meshlets);
+
+		lod_errors[level] = error;
+		primitive.lod_count = level + 1;
+		previous_index_count = index_count;
 	}
 
-	// Parse the default scene
-	JsonArray __scenes = document["scenes"].GetArray();
-	assert(__scenes.Size() == 1);
-	JsonObject __scene = __scenes[0].GetObject();
+	delete[] optimized;
+	delete[] simplified;
+}
+
+// Splits a column major glTF node matrix into its translation, rotation
+// and scale. glTF requires node matrices to be decomposable, a negative
+// determinant is moved into the x scale.
+static void decompose_matrix(const float* matrix, glm::vec3& translation, glm::quat& rotation, glm::vec3& scale)
+{
+	glm::vec3 x_axis(matrix[0], matrix[1], matrix[2]);
+	glm::vec3 y_axis(matrix[4], matrix[5], matrix[6]);
+	glm::vec3 z_axis(matrix[8], matrix[9], matrix[10]);
+
+	translation = glm::vec3(matrix[12], matrix[13], matrix[14]);
+	scale = glm::vec3(glm::length(x_axis), glm::length(y_axis), glm::length(z_axis));
+	if (glm::determinant(glm::mat3(x_axis, y_axis, z_axis)) < 0.0f)
+	{
+		scale.x = -scale.x;
+	}
+
+	assert(scale.x != 0.0f && scale.y != 0.0f && scale.z != 0.0f);
+	rotation = glm::quat_cast(glm::mat3(x_axis / scale.x, y_axis / scale.y, z_axis / scale.z));
+}
+
+// Writes a model in the ranges reserved for it. Only the reserved ranges
+// of assets_info are touched, so many models can be written at once.
+// Meshlet and LOD index offsets of the primitives are relative to the
+// generated tables of the model.
+static void write_model(GlbDocument& glb, const char* name, const ModelRanges& ranges, const ModelContent& content, AssetsInfo* assets_info, GeneratedTables& generated)
+{
+	const GltfDocument& gltf = glb.gltf;
+	const unsigned char** buffers = glb.buffers;
+	const BufferView* buffer_views = gltf.buffer_views.data;
+	const Accessor* accessors = gltf.accessors.data;
 
-	// NOTE: Root nodes are the parent nodes of the scene
-	JsonArray __root_nodes = __scene["nodes"].GetArray();
-	// NOTE: Nodes are all the nodes present in the document
-	JsonArray __nodes = document["nodes"].GetArray();
-	assert(__root_nodes.Size() == __nodes.Size() && "It is time to add support for nodes hierarchy");
-	JsonArray __meshes = document["meshes"].GetArray();
+	uint32_t vertex_cursor = ranges.vertex_offset;
+	uint32_t index16_cursor = ranges.index16_offset;
+	uint32_t index32_cursor = ranges.index32_offset;
+
+	// Vertex cache statistics of the whole model, before and after the
+	// mesh optimizer
+	VertexCacheStats stats_before = {};
+	VertexCacheStats stats_after = {};
+
+	// Parse Materials
+
+	// NOTE: The material index inside a glTF 2 JSON document is relative
+	// to the document itself. Since we're loading all the materials
+	// across different documents into one single Material* list,
+	// content.material_ids keeps the relation between a primitive and
+	// its associated material. Duplicates are already in the list.
+	for (uint32_t i = 0; i < content.material_count; ++i)
+	{
+		if (!content.material_written[i])
+			continue;
+
+		Material material = gltf.materials[i];
+		int32_t image = base_color_image(gltf, material);
+		material.base_color_texture_id = image >= 0 ? content.texture_ids[image] : no_texture;
+		assets_info->materials[content.material_ids[i]] = material;
+	}
 
 	Model model = {};
-	// memcpy(model.name, __scene["name"].GetString(), strlen(__scene["name"].GetString()));
 	memcpy(model.name, name, strlen(name));
-	model.node_count = __nodes.Size();
-	assert(model.node_count <= 8);
+	model.node_offset = ranges.node_offset;
+	model.node_count = content.node_count;
 
 	// Parse the meshes
-	uint32_t mesh_offset = assets_info->mesh_offset;
-
-	for (rapidjson::SizeType mesh_id = 0; mesh_id < __meshes.Size(); ++mesh_id)
+	for (uint32_t mesh_id = 0; mesh_id < content.mesh_count; ++mesh_id)
 	{
-		JsonObject __mesh = __meshes[mesh_id].GetObject();
-		JsonArray __primitives = __mesh["primitives"].GetArray();
-		assert(__primitives.Size() <= 8);
+		if (!content.mesh_written[mesh_id])
+			continue;
+
+		const GltfMesh& gltf_mesh = gltf.meshes[mesh_id];
+		assert(gltf_mesh.primitive_count <= 8);
 
 		Mesh mesh = {};
-		mesh.primitive_count = __primitives.Size();
-		memcpy(mesh.name, __mesh["name"].GetString(), strlen(__mesh["name"].GetString()));
+		mesh.primitive_count = gltf_mesh.primitive_count;
+		mesh.index_type = choose_index_type(gltf, gltf_mesh);
+		memcpy(mesh.name, gltf_mesh.name, gltf_mesh.name_length < sizeof(mesh.name) - 1 ? gltf_mesh.name_length : sizeof(mesh.name) - 1);
+
+		// NOTE: The primitives of a mesh are written one after the other,
+		// so the vertices of the mesh are a single range
+		uint32_t mesh_vertex_offset = vertex_cursor;
+		mesh.bounds_min = glm::vec3(FLT_MAX);
+		mesh.bounds_max = glm::vec3(-FLT_MAX);
 
-		for (rapidjson::SizeType primitive_id = 0; primitive_id < __primitives.Size(); ++primitive_id)
+		// Error of each LOD of each primitive
+		float primitive_lod_errors[8][max_lod_count] = {};
+
+		for (uint32_t primitive_id = 0; primitive_id < gltf_mesh.primitive_count; ++primitive_id)
 		{
-			JsonObject __primitive = __primitives[primitive_id].GetObject();
+			const GltfPrimitive& gltf_primitive = gltf.primitives[gltf_mesh.primitive_offset + primitive_id];
 			Primitive primitive = {};
-			primitive.material_id = material_offset + __primitive["material"].GetInt();
-			primitive.index_offset = assets_info->index_offset;
-			primitive.vertex_offset = assets_info->vertex_offset;
-
-			JsonObject __attributes = __primitive["attributes"].GetObject();
+			primitive.material_id = content.material_ids[gltf_primitive.material];
+			primitive.index_offset = mesh.index_type == IndexType::Uint16 ? index16_cursor : index32_cursor;
+			primitive.vertex_offset = vertex_cursor;
+			primitive.lod_count = 1;
 
 			//
 			// Vertex Data
 			//
-			const float* position_buffer = nullptr;
-			const float* normal_buffer = nullptr;
-			// TODO: Add UV buffer
-			// const float* uv_0_buffer = nullptr;
-
 			// Position should always be there
-			assert(__attributes.HasMember("POSITION") && "POSITION attribute not found");
-			uint32_t position_accessor_id = __attributes["POSITION"].GetInt();
-			Accessor& position_accessor = accessors[position_accessor_id];
-			assert((position_accessor.count + assets_info->vertex_offset) < Resources::vertex_buffer_size && "The vertices buffer is full");
+			assert(gltf_primitive.position >= 0 && "POSITION attribute not found");
+			const Accessor& position_accessor = accessors[gltf_primitive.position];
+			assert(position_accessor.type == Type::Vec3);
+			assert(position_accessor.component_type == ComponentType::Float && "Component Type not supported for attribute POSITION");
+			primitive.vertex_count = (uint32_t)position_accessor.count;
+
+			const Accessor* normal_accessor = nullptr;
+			// Normal is not mandatory
+			if (gltf_primitive.normal >= 0)
+			{
+				normal_accessor = &accessors[gltf_primitive.normal];
+				assert(normal_accessor->type == Type::Vec3);
+				assert(normal_accessor->component_type == ComponentType::Float && "Component Type not supported for attribute NORMAL");
+				assert(normal_accessor->count == position_accessor.count);
+			}
 
-			BufferView& position_buffer_view = buffer_views[position_accessor.buffer_view_id];
+			const Accessor* uv_0_accessor = nullptr;
+			if (gltf_primitive.uv_0 >= 0)
+			{
+				uv_0_accessor = &accessors[gltf_primitive.uv_0];
+				assert(uv_0_accessor->type == Type::Vec2);
+				assert(uv_0_accessor->component_type == ComponentType::Float && "Component Type not supported for attribute TEXCOORD_0");
+				assert(uv_0_accessor->count == position_accessor.count);
+			}
 
-			assert(position_accessor.type == Type::Vec3);
+			// Each attribute goes to its own stream
+			copy_attribute(position_accessor, buffer_views, buffers, sizeof(glm::vec3), assets_info->positions.data + primitive.vertex_offset, position_accessor.count);
 
-			if (position_accessor.component_type == ComponentType::Float)
+			if (normal_accessor != nullptr)
 			{
-				position_buffer = reinterpret_cast<const float *>(&(buffers[position_buffer_view.buffer_id][position_accessor.byte_offset + position_buffer_view.byte_offset]));
+				copy_attribute(*normal_accessor, buffer_views, buffers, sizeof(glm::vec3), assets_info->normals.data + primitive.vertex_offset, position_accessor.count);
 			}
 			else
 			{
-				assert(!"Component Type not supported for attribute POSITION");
+				memset(assets_info->normals.data + primitive.vertex_offset, 0, position_accessor.count * sizeof(glm::vec3));
 			}
 
-			// Normal is not mandatory
-			if (__attributes.HasMember("NORMAL"))
+			if (uv_0_accessor != nullptr)
 			{
-				uint32_t normal_accessor_id = __attributes["NORMAL"].GetInt();
-				Accessor& normal_accessor = accessors[normal_accessor_id];
-				BufferView& normal_buffer_view = buffer_views[normal_accessor.buffer_view_id];
-
-				assert(normal_accessor.type == Type::Vec3);
-
-				if (normal_accessor.component_type == ComponentType::Float)
-				{
-					normal_buffer = reinterpret_cast<const float *>(&(buffers[normal_buffer_view.buffer_id][normal_accessor.byte_offset + normal_buffer_view.byte_offset]));
-				}
-				else
-				{
-					assert(!"Component Type not supported for attribute NORMAL");
-				}
+				copy_attribute(*uv_0_accessor, buffer_views, buffers, sizeof(glm::vec2), assets_info->uvs.data + primitive.vertex_offset, position_accessor.count);
 			}
-
-			// TODO: Add UVs
-
-			for (uint32_t v = 0; v < position_accessor.count; ++v)
+			else
 			{
-				Vertex vertex = {
-					{ position_buffer[v * 3], position_buffer[v * 3 + 1], position_buffer[v * 3 + 2] },
-					{ 0.0f, 0.0f, 0.0f },
-					{ 0.0f, 0.0f }
-				};
-
-				if (normal_buffer)
-				{
-					vertex.normal = { normal_buffer[v * 3], normal_buffer[v * 3 + 1], normal_buffer[v * 3 + 2] };
-				}
-
-				assets_info->vertices[primitive.vertex_offset + v] = vertex;
+				memset(assets_info->uvs.data + primitive.vertex_offset, 0, position_accessor.count * sizeof(glm::vec2));
 			}
 
-			assets_info->vertex_offset += position_accessor.count;
+			add_position_bounds(position_accessor, assets_info->positions.data + primitive.vertex_offset, mesh.bounds_min, mesh.bounds_max);
+			vertex_cursor += position_accessor.count;
 
 			//
 			// Index Data
 			//
-			if (__primitive.HasMember("indices"))
+			if (gltf_primitive.indices >= 0)
 			{
-				uint32_t index_accessor_id = __primitive["indices"].GetInt();
-				Accessor& index_accessor = accessors[index_accessor_id];
-				assert((index_accessor.count + assets_info->index_offset) < Resources::index_buffer_size && "The indices buffer is full");
-				BufferView& index_buffer_view = buffer_views[index_accessor.buffer_view_id];
+				const Accessor& index_accessor = accessors[gltf_primitive.indices];
+				assert(buffer_views[index_accessor.buffer_view_id].byte_stride == 0 && "Indices must be tightly packed");
+
+				primitive.index_count = index_accessor.count;
 
-				if (index_accessor.component_type == ComponentType::UnsignedShort)
+				// NOTE: Indices are read as 32 bits, optimized together with
+				// the vertices they reference, then stored with the index
+				// type of the mesh
+				uint32_t* indices = new uint32_t[primitive.index_count];
+				copy_indices(index_accessor, buffer_views, buffers, indices);
+
+				bool triangle_list = gltf_primitive.mode == 4;
+				if (triangle_list && primitive.index_count % 3 == 0)
 				{
-					const Index16* index_buffer = reinterpret_cast<const Index16 *>(&(buffers[index_buffer_view.buffer_id][index_accessor.byte_offset + index_buffer_view.byte_offset]));
-					for (uint32_t i = 0; i < index_accessor.count; ++i)
+					VertexCacheStats before = {};
+					VertexCacheStats after = {};
+					MeshOptimizer::optimize_primitive(indices, primitive.index_count,
+						assets_info->positions.data + primitive.vertex_offset,
+						assets_info->normals.data + primitive.vertex_offset,
+						assets_info->uvs.data + primitive.vertex_offset,
+						position_accessor.count, &before, &after);
+
+					stats_before.add(before);
+					stats_after.add(after);
+
+					primitive.meshlet_offset = (uint32_t)generated.meshlets.count;
+					primitive.meshlet_count = MeshletBuilder::build_meshlets(indices, primitive.index_count,
+						assets_info->positions.data + primitive.vertex_offset, position_accessor.count, generated.meshlets);
+
+					float max_error = lod_max_relative_error * glm::length(mesh.bounds_max - mesh.bounds_min);
+					build_primitive_lods(indices, assets_info->positions.data + primitive.vertex_offset, position_accessor.count, mesh.index_type, max_error,
+						primitive, primitive_lod_errors[primitive_id], generated);
+				}
+
+				if (mesh.index_type == IndexType::Uint16)
+				{
+					Index16* destination = assets_info->indices16.data + primitive.index_offset;
+					for (uint32_t i = 0; i < primitive.index_count; ++i)
 					{
-						assets_info->indices[primitive.index_offset + i] = index_buffer[i] + primitive.vertex_offset;
+						assert(indices[i] < max_index16_vertex_count);
+						destination[i] = Index16(indices[i]);
 					}
 
-					primitive.index_count = index_accessor.count;
-					assets_info->index_offset += primitive.index_count;
+					index16_cursor += primitive.index_count;
 				}
 				else
 				{
-					assert(!"Component Type not supported for Indices");
+					memcpy(assets_info->indices32.data + primitive.index_offset, indices, primitive.index_count * sizeof(Index32));
+					index32_cursor += primitive.index_count;
 				}
+
+				delete[] indices;
 			}
 
 			mesh.primitives[primitive_id] = primitive;
 		}
 
-		assets_info->meshes[mesh_offset + mesh_id] = mesh;
+		// A mesh has as many LODs as its most simplified primitive, the
+		// others keep drawing their last level
+		for (uint32_t p = 0; p < mesh.primitive_count; ++p)
+		{
+			mesh.lod_count = mesh.primitives[p].lod_count > mesh.lod_count ? mesh.primitives[p].lod_count : mesh.lod_count;
+		}
+
+		for (uint32_t level = 1; level < mesh.lod_count; ++level)
+		{
+			mesh.lod_errors[level] = 0.0f;
+			for (uint32_t p = 0; p < mesh.primitive_count; ++p)
+			{
+				uint32_t primitive_level = level < mesh.primitives[p].lod_count ? level : mesh.primitives[p].lod_count - 1;
+				float error = primitive_lod_errors[p][primitive_level];
+				mesh.lod_errors[level] = error > mesh.lod_errors[level] ? error : mesh.lod_errors[level];
+			}
+		}
+
+		if (mesh.lod_count > 1)
+		{
+			char lod_text[128] = {};
+			size_t lod_text_length = 0;
+			for (uint32_t level = 0; level < mesh.lod_count; ++level)
+			{
+				uint32_t triangle_count = 0;
+				for (uint32_t p = 0; p < mesh.primitive_count; ++p)
+				{
+					triangle_count += mesh.primitives[p].lod(level).index_count / 3;
+				}
+
+				lod_text_length += snprintf(lod_text + lod_text_length, sizeof(lod_text) - lod_text_length, "%s%u (%f)", level > 0 ? ", " : "", triangle_count, mesh.lod_errors[level]);
+			}
+
+			printf("[MeshSimplifier]: %s/%s: %u LODs, triangles (error): %s\n", name, mesh.name, mesh.lod_count, lod_text);
+		}
+
+		// Quantize the vertices once the optimizer is done reordering them
+		uint32_t mesh_vertex_count = vertex_cursor - mesh_vertex_offset;
+		if (mesh_vertex_count > 0)
+		{
+			QuantizationError error = {};
+			VertexQuantizer::quantize_vertices(
+				assets_info->positions.data + mesh_vertex_offset,
+				assets_info->normals.data + mesh_vertex_offset,
+				assets_info->uvs.data + mesh_vertex_offset,
+				mesh_vertex_count, mesh.bounds_min, mesh.bounds_max,
+				assets_info->quantized_positions.data + mesh_vertex_offset,
+				assets_info->quantized_normals.data + mesh_vertex_offset,
+				assets_info->quantized_uvs.data + mesh_vertex_offset,
+				&error);
+
+			float bounds_size = glm::length(mesh.bounds_max - mesh.bounds_min);
+			printf("[VertexQuantizer]: %s/%s: %u vertices, position error %f (%.4f%% of the bounds), normal error %.3f degrees, uv error %f\n",
+				name, mesh.name, mesh_vertex_count, error.position, bounds_size > 0.0f ? 100.0f * error.position / bounds_size : 0.0f, error.normal, error.uv);
+		}
+		else
+		{
+			mesh.bounds_min = glm::vec3(0.0f);
+			mesh.bounds_max = glm::vec3(0.0f);
+		}
+
+		assets_info->meshes[content.mesh_ids[mesh_id]] = mesh;
+	}
+
+	// Write the flattened nodes
+	for (uint32_t i = 0; i < content.node_count; ++i)
+	{
+		const GltfNode& gltf_node = gltf.nodes[content.node_order[i]];
+		uint32_t node_id = ranges.node_offset + i;
+		assets_info->node_parents[node_id] = content.node_parents[i];
+		assets_info->node_mesh_ids[node_id] = gltf_node.mesh >= 0 ? content.mesh_ids[gltf_node.mesh] : no_mesh;
+
+		if (gltf_node.has_matrix)
+		{
+			decompose_matrix(gltf_node.matrix, assets_info->node_translations[node_id], assets_info->node_rotations[node_id], assets_info->node_scales[node_id]);
+		}
+		else
+		{
+			assets_info->node_translations[node_id] = glm::vec3(gltf_node.translation[0], gltf_node.translation[1], gltf_node.translation[2]);
+			assets_info->node_scales[node_id] = glm::vec3(gltf_node.scale[0], gltf_node.scale[1], gltf_node.scale[2]);
+			// NOTE: glTF stores quaternions as x, y, z, w, glm::quat takes w first
+			assets_info->node_rotations[node_id] = glm::quat(gltf_node.rotation[3], gltf_node.rotation[0], gltf_node.rotation[1], gltf_node.rotation[2]);
+		}
+	}
+
+	assets_info->models[ranges.model_id] = model;
+	assets_info->update_node_matrices(model);
+
+	printf("[MeshOptimizer]: %s: %u triangles, ACMR %.3f -> %.3f, ATVR %.3f -> %.3f, %zu meshlets\n",
+		name, stats_after.triangle_count,
+		stats_before.acmr(), stats_after.acmr(),
+		stats_before.atvr(), stats_after.atvr(),
+		generated.meshlets.count);
+}
+
+static void open_model_job(uint32_t job_index, void* data)
+{
+	LoadJobs* jobs = reinterpret_cast<LoadJobs*>(data);
+
+	GlbDocument* glb = new GlbDocument();
+	open_document(jobs->sources[job_index].path, *glb);
+
+	jobs->documents[job_index] = glb;
+	scan_model(*glb, jobs->contents[job_index]);
+}
+
+// Decodes an image into the range reserved for its texture
+static void decode_texture(LoadJobs* jobs, const TextureJob& texture_job)
+{
+	const GlbDocument& glb = *jobs->documents[texture_job.source_id];
+	const ImageContent& image = jobs->contents[texture_job.source_id].images[texture_job.image_id];
+
+	Texture texture = {};
+	texture.width = image.width;
+	texture.height = image.height;
+	texture.mip_count = TextureDecoder::mip_count(image.width, image.height);
+	texture.pixel_offset = texture_job.pixel_offset;
+	texture.pixel_size = (uint32_t)TextureDecoder::mip_chain_size(image.width, image.height);
+	texture.format = TextureFormat::Rgba8;
+
+	size_t size = 0;
+	const unsigned char* data = image_data(glb, glb.gltf.images[texture_job.image_id], size);
+	TextureDecoder::decode(data, size, image.width, image.height, jobs->assets_info->texture_pixels.data + texture.pixel_offset);
+
+	jobs->assets_info->textures[texture_job.texture_id] = texture;
+}
+
+static void write_source(LoadJobs* jobs, uint32_t source_id)
+{
+	GlbDocument* glb = jobs->documents[source_id];
+	const ModelCounts& counts = jobs->counts[source_id];
+
+	ModelRanges& ranges = jobs->ranges[source_id];
+	ranges.model_id = jobs->model_offset + source_id;
+	ranges.vertex_offset = (uint32_t)jobs->vertex_offset.fetch_add(counts.vertex_count);
+	ranges.index16_offset = (uint32_t)jobs->index16_offset.fetch_add(counts.index16_count);
+	ranges.index32_offset = (uint32_t)jobs->index32_offset.fetch_add(counts.index32_count);
+
+	write_model(*glb, jobs->sources[source_id].name, ranges, jobs->contents[source_id], jobs->assets_info, jobs->generated[source_id]);
+}
+
+// The textures are decoded and the models written in the same dispatch.
+// Decoding comes first: jobs are picked up in index order, so the textures,
+// usually the longest jobs, start right away and the models fill the
+// workers around them instead of waiting for a dispatch of their own.
+static void write_job(uint32_t job_index, void* data)
+{
+	LoadJobs* jobs = reinterpret_cast<LoadJobs*>(data);
+	if (job_index < jobs->texture_job_count)
+	{
+		decode_texture(jobs, jobs->texture_jobs[job_index]);
+	}
+	else
+	{
+		write_source(jobs, job_index - jobs->texture_job_count);
 	}
+}
 
-	assets_info->mesh_offset += __meshes.Size();
+uint32_t Loader::load_model(const char* path, const char* name, AssetsInfo* assets_info)
+{
+	ModelSource source = { path, name };
+	uint32_t model_id = 0;
+	load_models(&source, 1, assets_info, nullptr, &model_id);
+	return model_id;
+}
 
-	model.node_count = __root_nodes.Size();
+static void run_jobs(Application::ThreadPool* thread_pool, uint32_t job_count, Application::JobFunction function, LoadJobs* jobs)
+{
+	if (thread_pool != nullptr)
+	{
+		thread_pool->dispatch(job_count, function, jobs);
+	}
+	else
+	{
+		for (uint32_t i = 0; i < job_count; ++i)
+		{
+			function(i, jobs);
+		}
+	}
+}
 
-	for (rapidjson::SizeType i = 0; i < __root_nodes.Size(); ++i)
+void Loader::load_models(const ModelSource* sources, uint32_t source_count, AssetsInfo* assets_info, Application::ThreadPool* thread_pool, uint32_t* model_ids)
+{
+	LoadJobs* jobs = new LoadJobs();
+	jobs->sources = sources;
+	jobs->assets_info = assets_info;
+	jobs->documents = new GlbDocument*[source_count];
+	jobs->contents = new ModelContent[source_count];
+	jobs->counts = new ModelCounts[source_count];
+	jobs->ranges = new ModelRanges[source_count];
+	jobs->generated = new GeneratedTables[source_count];
+
+	// Parse and hash every document
+	run_jobs(thread_pool, source_count, open_model_job, jobs);
+
+	// Find the duplicates and count what is left to write
+	ModelCounts total = {};
+	plan_batch(jobs, source_count, assets_info->textures.count, assets_info->texture_pixels.count,
+		assets_info->materials.count, assets_info->meshes.count, assets_info->node_count(), total);
+
+	// Grow every table once for the whole batch. Nothing moves the tables
+	// while the write jobs run.
+	// NOTE: Model, texture, material, mesh and node ids are handed out in source order, so
+	// they don't depend on which job finishes first. The vertex and index
+	// tables are filled in the order the jobs reserve their ranges.
+	jobs->model_offset = (uint32_t)assets_info->models.append(source_count);
+	assets_info->textures.append(total.texture_count);
+	assets_info->texture_pixels.append(total.texture_pixel_size);
+	assets_info->materials.append(total.material_count);
+	assets_info->meshes.append(total.mesh_count);
+	assets_info->append_nodes(total.node_count);
+	jobs->vertex_offset = assets_info->append_vertices(total.vertex_count);
+	jobs->index16_offset = assets_info->indices16.append(total.index16_count);
+	jobs->index32_offset = assets_info->indices32.append(total.index32_count);
+
+	// Decode every texture and copy every document into its ranges
+	run_jobs(thread_pool, jobs->texture_job_count + source_count, write_job, jobs);
+
+	for (uint32_t i = 0; i < source_count; ++i)
 	{
-		uint32_t node_index = (uint32_t)__root_nodes[i].GetInt();
-		JsonObject __node = __nodes[node_index].GetObject();
-		assert(!__node.HasMember("matrix") && "Add matrix support");
-		Node node = {};
-		node.mesh_id = mesh_offset + __node["mesh"].GetInt();
+		close_document(*jobs->documents[i]);
+		delete jobs->documents[i];
+	}
 
-		if (__node.HasMember("translation"))
+	assert(jobs->vertex_offset == assets_info->vertex_count());
+	assert(jobs->index16_offset == assets_info->indices16.count);
+	assert(jobs->index32_offset == assets_info->indices32.count);
+
+	// Append the meshlets and LOD indices of every model and rebase its
+	// primitives
+	for (uint32_t i = 0; i < source_count; ++i)
+	{
+		GeneratedTables& generated = jobs->generated[i];
+		size_t meshlet_offset = assets_info->meshlets.append(generated.meshlets.count);
+		if (generated.meshlets.count > 0)
 		{
-			JsonArray __translation = __node["translation"].GetArray();
-			node.translation = {
-				__translation[0].GetFloat(),
-				__translation[1].GetFloat(),
-				__translation[2].GetFloat()
-			};
+			memcpy(assets_info->meshlets.data + meshlet_offset, generated.meshlets.data, generated.meshlets.count * sizeof(Meshlet));
 		}
 
-		if (__node.HasMember("scale"))
+		size_t lod_index16_offset = assets_info->indices16.append(generated.lod_indices16.count);
+		if (generated.lod_indices16.count > 0)
 		{
-			JsonArray __scale = __node["scale"].GetArray();
-			node.scale = {
-				__scale[0].GetFloat(),
-				__scale[1].GetFloat(),
-				__scale[2].GetFloat()
-			};
+			memcpy(assets_info->indices16.data + lod_index16_offset, generated.lod_indices16.data, generated.lod_indices16.count * sizeof(Index16));
 		}
 
-		if (__node.HasMember("rotation"))
+		size_t lod_index32_offset = assets_info->indices32.append(generated.lod_indices32.count);
+		if (generated.lod_indices32.count > 0)
 		{
-			JsonArray __rotation = __node["rotation"].GetArray();
-			node.rotation = {
-				__rotation[0].GetFloat(),
-				__rotation[1].GetFloat(),
-				__rotation[2].GetFloat(),
-				__rotation[3].GetFloat()
-			};
+			memcpy(assets_info->indices32.data + lod_index32_offset, generated.lod_indices32.data, generated.lod_indices32.count * sizeof(Index32));
 		}
 
-		model.nodes[i] = node;
+		const ModelRanges& ranges = jobs->ranges[i];
+		for (uint32_t m = 0; m < jobs->counts[i].mesh_count; ++m)
+		{
+			Mesh& mesh = assets_info->meshes[ranges.mesh_offset + m];
+			uint32_t lod_index_offset = (uint32_t)(mesh.index_type == IndexType::Uint16 ? lod_index16_offset : lod_index32_offset);
+			for (uint32_t p = 0; p < mesh.primitive_count; ++p)
+			{
+				Primitive& primitive = mesh.primitives[p];
+				primitive.meshlet_offset += (uint32_t)meshlet_offset;
+				for (uint32_t l = 1; l < primitive.lod_count; ++l)
+				{
+					primitive.lods[l - 1].index_offset += lod_index_offset;
+					primitive.lods[l - 1].meshlet_offset += (uint32_t)meshlet_offset;
+				}
+			}
+		}
+
+		generated.release();
 	}
 
-	assets_info->models[assets_info->model_offset] = model;
-	uint32_t model_index = assets_info->model_offset;
-	assets_info->model_offset++;
+	for (uint32_t i = 0; i < source_count; ++i)
+	{
+		model_ids[i] = jobs->model_offset + i;
+	}
+
+	for (uint32_t i = 0; i < source_count; ++i)
+	{
+		jobs->contents[i].destroy();
+	}
 
-	return model_index;
+	delete[] jobs->documents;
+	delete[] jobs->contents;
+	delete[] jobs->counts;
+	delete[] jobs->ranges;
+	delete[] jobs->generated;
+	delete[] jobs->texture_jobs;
+	delete jobs;
 }
 
-}
\ No newline at end of file
+} // namespace Resources
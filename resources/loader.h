@@ -1,6 +1,7 @@
 #pragma once
 
 #include "resources.h"
+#include "../application/thread_pool.h"
 
 namespace Resources
 {
@@ -10,9 +11,23 @@ static const uint32_t GLTF_VERSION = 0x00000002;
 static const uint32_t GLTF_CHUNK_TYPE_JSON = 0x4E4F534A;
 static const uint32_t GLTF_CHUNK_TYPE_BIN = 0x004E4942;
 
+// A GLB file on disk and the name its model gets
+struct ModelSource
+{
+	const char* path;
+	const char* name;
+};
+
 struct Loader
 {
 	static uint32_t load_model(const char* path, const char* name, AssetsInfo* assets_info);
+
+	// Loads many GLB files at once, parsing them and decoding their
+	// textures concurrently on the thread pool (or on the calling thread
+	// when thread_pool is null). model_ids
+	// receives the id of each source's model, in source order: ids are
+	// consecutive and don't depend on how the jobs are scheduled.
+	static void load_models(const ModelSource* sources, uint32_t source_count, AssetsInfo* assets_info, Application::ThreadPool* thread_pool, uint32_t* model_ids);
 };
 
 }
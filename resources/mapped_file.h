@@ -0,0 +1,39 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <cassert>
+
+namespace Resources
+{
+
+// A read-only view of a whole file mapped in memory. Pages are only
+// loaded by the OS when they're touched, so reading from the mapping
+// never needs an intermediate heap buffer.
+struct MappedFile
+{
+	// When copy_on_write is true the mapping can be written to: the pages
+	// written are copied by the OS and the file on disk never changes.
+	bool open(const char* path, bool copy_on_write = false);
+	void close();
+
+	uint8_t* writable_data() const
+	{
+		assert(copy_on_write && "The file was mapped read-only");
+		return const_cast<uint8_t*>(data);
+	}
+
+	const uint8_t* data = nullptr;
+	size_t size = 0;
+	bool copy_on_write = false;
+
+private:
+#ifdef _WIN32
+	void* file_handle = nullptr;
+	void* mapping_handle = nullptr;
+#else
+	int file_descriptor = -1;
+#endif
+};
+
+} // namespace Resources
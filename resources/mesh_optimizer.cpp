@@ -0,0 +1,471 @@
+#include "mesh_optimizer.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <cassert>
+
+namespace Resources
+{
+
+// A FIFO cache simulated with timestamps: a vertex is in the cache when it
+// was last transformed less than cache_size misses ago
+struct FifoCache
+{
+	uint32_t* times;
+	uint32_t timestamp;
+
+	void init(uint32_t vertex_count)
+	{
+		times = new uint32_t[vertex_count];
+		memset(times, 0, vertex_count * sizeof(uint32_t));
+		timestamp = MeshOptimizer::cache_size + 1;
+	}
+
+	void destroy()
+	{
+		delete[] times;
+		times = nullptr;
+	}
+
+	bool contains(uint32_t vertex) const
+	{
+		return timestamp - times[vertex] <= MeshOptimizer::cache_size;
+	}
+
+	// Returns true on a miss
+	bool access(uint32_t vertex)
+	{
+		if (contains(vertex))
+			return false;
+
+		times[vertex] = timestamp++;
+		return true;
+	}
+
+	void flush()
+	{
+		timestamp += MeshOptimizer::cache_size + 1;
+	}
+};
+
+// Triangles using each vertex, as offsets into a single array
+struct TriangleAdjacency
+{
+	uint32_t* counts;
+	uint32_t* offsets;
+	uint32_t* triangles;
+
+	void init(const uint32_t* indices, uint32_t index_count, uint32_t vertex_count)
+	{
+		counts = new uint32_t[vertex_count];
+		offsets = new uint32_t[vertex_count];
+		triangles = new uint32_t[index_count];
+		memset(counts, 0, vertex_count * sizeof(uint32_t));
+
+		for (uint32_t i = 0; i < index_count; ++i)
+		{
+			assert(indices[i] < vertex_count);
+			counts[indices[i]]++;
+		}
+
+		uint32_t offset = 0;
+		for (uint32_t v = 0; v < vertex_count; ++v)
+		{
+			offsets[v] = offset;
+			offset += counts[v];
+		}
+
+		// NOTE: counts is used as a cursor while filling and restored after
+		memset(counts, 0, vertex_count * sizeof(uint32_t));
+		for (uint32_t i = 0; i < index_count; ++i)
+		{
+			uint32_t vertex = indices[i];
+			triangles[offsets[vertex] + counts[vertex]] = i / 3;
+			counts[vertex]++;
+		}
+	}
+
+	void destroy()
+	{
+		delete[] counts;
+		delete[] offsets;
+		delete[] triangles;
+	}
+};
+
+VertexCacheStats MeshOptimizer::analyze_vertex_cache(const uint32_t* indices, uint32_t index_count, uint32_t vertex_count)
+{
+	assert(index_count % 3 == 0);
+
+	VertexCacheStats stats = {};
+	stats.triangle_count = index_count / 3;
+
+	FifoCache cache = {};
+	cache.init(vertex_count);
+
+	bool* referenced = new bool[vertex_count];
+	memset(referenced, 0, vertex_count * sizeof(bool));
+
+	for (uint32_t i = 0; i < index_count; ++i)
+	{
+		uint32_t vertex = indices[i];
+		assert(vertex < vertex_count);
+
+		if (cache.access(vertex))
+			stats.transformed_count++;
+
+		if (!referenced[vertex])
+		{
+			referenced[vertex] = true;
+			stats.vertex_count++;
+		}
+	}
+
+	delete[] referenced;
+	cache.destroy();
+
+	return stats;
+}
+
+void MeshOptimizer::optimize_vertex_cache(uint32_t* destination, const uint32_t* indices, uint32_t index_count, uint32_t vertex_count)
+{
+	assert(index_count % 3 == 0);
+	assert(destination != indices);
+
+	uint32_t triangle_count = index_count / 3;
+	if (triangle_count == 0)
+		return;
+
+	TriangleAdjacency adjacency = {};
+	adjacency.init(indices, index_count, vertex_count);
+
+	// Number of triangles still to emit for each vertex
+	uint32_t* live_triangles = new uint32_t[vertex_count];
+	memcpy(live_triangles, adjacency.counts, vertex_count * sizeof(uint32_t));
+
+	bool* emitted = new bool[triangle_count];
+	memset(emitted, 0, triangle_count * sizeof(bool));
+
+	FifoCache cache = {};
+	cache.init(vertex_count);
+
+	// Vertices of the emitted triangles, most recent last. When we run
+	// out of candidates we go back to the most recent vertex that still
+	// has triangles left.
+	uint32_t* dead_end = new uint32_t[index_count];
+	uint32_t dead_end_top = 0;
+
+	// Vertices touched by the last fan, candidates for the next one
+	uint32_t* candidates = new uint32_t[index_count];
+
+	uint32_t output_count = 0;
+	uint32_t input_cursor = 1;
+	int64_t fanning_vertex = 0;
+
+	while (fanning_vertex >= 0)
+	{
+		uint32_t fan = uint32_t(fanning_vertex);
+		uint32_t candidate_count = 0;
+
+		for (uint32_t a = 0; a < adjacency.counts[fan]; ++a)
+		{
+			uint32_t triangle = adjacency.triangles[adjacency.offsets[fan] + a];
+			if (emitted[triangle])
+				continue;
+
+			for (uint32_t k = 0; k < 3; ++k)
+			{
+				uint32_t vertex = indices[triangle * 3 + k];
+				destination[output_count++] = vertex;
+				dead_end[dead_end_top++] = vertex;
+				candidates[candidate_count++] = vertex;
+				live_triangles[vertex]--;
+				cache.access(vertex);
+			}
+
+			emitted[triangle] = true;
+		}
+
+		// Pick the candidate that stays in the cache after fanning around
+		// it, and among those the one that entered the cache first
+		int64_t best_vertex = -1;
+		int64_t best_priority = -1;
+		for (uint32_t c = 0; c < candidate_count; ++c)
+		{
+			uint32_t vertex = candidates[c];
+			if (live_triangles[vertex] == 0)
+				continue;
+
+			int64_t priority = 0;
+			uint32_t age = cache.timestamp - cache.times[vertex];
+			if (age + 2 * live_triangles[vertex] <= cache_size)
+			{
+				priority = age;
+			}
+
+			if (priority > best_priority)
+			{
+				best_priority = priority;
+				best_vertex = vertex;
+			}
+		}
+
+		if (best_vertex == -1)
+		{
+			// Dead end: go back to a recent vertex, then to the next
+			// vertex in input order
+			while (dead_end_top > 0)
+			{
+				uint32_t vertex = dead_end[--dead_end_top];
+				if (live_triangles[vertex] > 0)
+				{
+					best_vertex = vertex;
+					break;
+				}
+			}
+
+			while (best_vertex == -1 && input_cursor < vertex_count)
+			{
+				if (live_triangles[input_cursor] > 0)
+				{
+					best_vertex = input_cursor;
+				}
+
+				input_cursor++;
+			}
+		}
+
+		fanning_vertex = best_vertex;
+	}
+
+	assert(output_count == index_count);
+
+	delete[] candidates;
+	delete[] dead_end;
+	cache.destroy();
+	delete[] emitted;
+	delete[] live_triangles;
+	adjacency.destroy();
+}
+
+struct Cluster
+{
+	uint32_t first_triangle;
+	uint32_t triangle_count;
+	float sort_key;
+};
+
+static int compare_clusters(const void* a, const void* b)
+{
+	const Cluster* cluster_a = reinterpret_cast<const Cluster*>(a);
+	const Cluster* cluster_b = reinterpret_cast<const Cluster*>(b);
+
+	// Bigger keys first, ties keep the cache order
+	if (cluster_a->sort_key != cluster_b->sort_key)
+		return cluster_a->sort_key > cluster_b->sort_key ? -1 : 1;
+
+	return cluster_a->first_triangle < cluster_b->first_triangle ? -1 : 1;
+}
+
+void MeshOptimizer::optimize_overdraw(uint32_t* destination, const uint32_t* indices, uint32_t index_count, const glm::vec3* positions, uint32_t vertex_count, float threshold)
+{
+	assert(index_count % 3 == 0);
+	assert(destination != indices);
+
+	uint32_t triangle_count = index_count / 3;
+	if (triangle_count == 0)
+		return;
+
+	// Hard boundaries: triangles that miss the cache on all their vertices
+	// start a new cluster, reordering there doesn't cost any cache hit
+	uint32_t* hard_boundaries = new uint32_t[triangle_count + 1];
+	uint32_t hard_boundary_count = 0;
+
+	FifoCache cache = {};
+	cache.init(vertex_count);
+
+	for (uint32_t t = 0; t < triangle_count; ++t)
+	{
+		uint32_t misses = 0;
+		for (uint32_t k = 0; k < 3; ++k)
+		{
+			misses += cache.access(indices[t * 3 + k]) ? 1 : 0;
+		}
+
+		if (t == 0 || misses == 3)
+			hard_boundaries[hard_boundary_count++] = t;
+	}
+
+	hard_boundaries[hard_boundary_count] = triangle_count;
+
+	// Soft boundaries: a hard cluster is split again as soon as the ACMR
+	// of the current piece is within threshold of the ACMR of the whole
+	// hard cluster. Both are measured starting from an empty cache, so
+	// drawing the pieces in any order costs at most threshold times more
+	// vertex transforms than the hard cluster.
+	Cluster* clusters = new Cluster[triangle_count];
+	uint32_t cluster_count = 0;
+
+	for (uint32_t h = 0; h < hard_boundary_count; ++h)
+	{
+		uint32_t start = hard_boundaries[h];
+		uint32_t end = hard_boundaries[h + 1];
+
+		cache.flush();
+		uint32_t cluster_misses = 0;
+		for (uint32_t i = start * 3; i < end * 3; ++i)
+		{
+			cluster_misses += cache.access(indices[i]) ? 1 : 0;
+		}
+
+		float cluster_threshold = threshold * float(cluster_misses) / float(end - start);
+
+		cache.flush();
+		uint32_t first_cluster = cluster_count;
+		uint32_t piece_start = start;
+		uint32_t piece_misses = 0;
+
+		for (uint32_t t = start; t < end; ++t)
+		{
+			for (uint32_t k = 0; k < 3; ++k)
+			{
+				piece_misses += cache.access(indices[t * 3 + k]) ? 1 : 0;
+			}
+
+			if (float(piece_misses) / float(t + 1 - piece_start) <= cluster_threshold)
+			{
+				clusters[cluster_count++] = { piece_start, t + 1 - piece_start, 0.0f };
+				piece_start = t + 1;
+				piece_misses = 0;
+				cache.flush();
+			}
+		}
+
+		// The last piece never reached the target ACMR, so it goes with the
+		// piece before it
+		if (piece_start < end)
+		{
+			if (cluster_count > first_cluster)
+				clusters[cluster_count - 1].triangle_count += end - piece_start;
+			else
+				clusters[cluster_count++] = { piece_start, end - piece_start, 0.0f };
+		}
+	}
+
+	cache.destroy();
+	delete[] hard_boundaries;
+
+	// Sort key: how far the cluster sits from the center of the mesh along
+	// its own normal. Clusters on the outside, facing away from the center,
+	// are likely to occlude the others, so they are drawn first.
+	glm::vec3 mesh_center = glm::vec3(0.0f);
+	for (uint32_t i = 0; i < index_count; ++i)
+	{
+		mesh_center += positions[indices[i]];
+	}
+	mesh_center /= float(index_count);
+
+	for (uint32_t c = 0; c < cluster_count; ++c)
+	{
+		Cluster& cluster = clusters[c];
+		glm::vec3 cluster_center = glm::vec3(0.0f);
+		glm::vec3 cluster_normal = glm::vec3(0.0f);
+		float cluster_area = 0.0f;
+
+		for (uint32_t t = cluster.first_triangle; t < cluster.first_triangle + cluster.triangle_count; ++t)
+		{
+			const glm::vec3& p0 = positions[indices[t * 3 + 0]];
+			const glm::vec3& p1 = positions[indices[t * 3 + 1]];
+			const glm::vec3& p2 = positions[indices[t * 3 + 2]];
+
+			// The cross product is the normal scaled by twice the area
+			glm::vec3 normal = glm::cross(p1 - p0, p2 - p0);
+			float area = glm::length(normal);
+
+			cluster_center += (p0 + p1 + p2) * (area / 3.0f);
+			cluster_normal += normal;
+			cluster_area += area;
+		}
+
+		float normal_length = glm::length(cluster_normal);
+		if (cluster_area > 0.0f && normal_length > 0.0f)
+		{
+			cluster_center /= cluster_area;
+			cluster.sort_key = glm::dot(cluster_center - mesh_center, cluster_normal / normal_length);
+		}
+	}
+
+	qsort(clusters, cluster_count, sizeof(Cluster), compare_clusters);
+
+	uint32_t output_count = 0;
+	for (uint32_t c = 0; c < cluster_count; ++c)
+	{
+		memcpy(&destination[output_count], &indices[clusters[c].first_triangle * 3], clusters[c].triangle_count * 3 * sizeof(uint32_t));
+		output_count += clusters[c].triangle_count * 3;
+	}
+
+	assert(output_count == index_count);
+
+	delete[] clusters;
+}
+
+void MeshOptimizer::optimize_vertex_fetch(uint32_t* indices, uint32_t index_count, glm::vec3* positions, glm::vec3* normals, glm::vec2* uvs, uint32_t vertex_count)
+{
+	const uint32_t unused = ~0u;
+
+	uint32_t* remap = new uint32_t[vertex_count];
+	memset(remap, 0xff, vertex_count * sizeof(uint32_t));
+
+	uint32_t next_vertex = 0;
+	for (uint32_t i = 0; i < index_count; ++i)
+	{
+		uint32_t vertex = indices[i];
+		if (remap[vertex] == unused)
+			remap[vertex] = next_vertex++;
+
+		indices[i] = remap[vertex];
+	}
+
+	for (uint32_t v = 0; v < vertex_count; ++v)
+	{
+		if (remap[v] == unused)
+			remap[v] = next_vertex++;
+	}
+
+	assert(next_vertex == vertex_count);
+
+	glm::vec3* old_positions = new glm::vec3[vertex_count];
+	glm::vec3* old_normals = new glm::vec3[vertex_count];
+	glm::vec2* old_uvs = new glm::vec2[vertex_count];
+	memcpy(old_positions, positions, vertex_count * sizeof(glm::vec3));
+	memcpy(old_normals, normals, vertex_count * sizeof(glm::vec3));
+	memcpy(old_uvs, uvs, vertex_count * sizeof(glm::vec2));
+
+	for (uint32_t v = 0; v < vertex_count; ++v)
+	{
+		positions[remap[v]] = old_positions[v];
+		normals[remap[v]] = old_normals[v];
+		uvs[remap[v]] = old_uvs[v];
+	}
+
+	delete[] old_uvs;
+	delete[] old_normals;
+	delete[] old_positions;
+	delete[] remap;
+}
+
+void MeshOptimizer::optimize_primitive(uint32_t* indices, uint32_t index_count, glm::vec3* positions, glm::vec3* normals, glm::vec2* uvs, uint32_t vertex_count, VertexCacheStats* before, VertexCacheStats* after)
+{
+	*before = analyze_vertex_cache(indices, index_count, vertex_count);
+
+	uint32_t* scratch = new uint32_t[index_count];
+	optimize_vertex_cache(scratch, indices, index_count, vertex_count);
+	optimize_overdraw(indices, scratch, index_count, positions, vertex_count);
+	delete[] scratch;
+
+	optimize_vertex_fetch(indices, index_count, positions, normals, uvs, vertex_count);
+
+	*after = analyze_vertex_cache(indices, index_count, vertex_count);
+}
+
+} // namespace Resources
@@ -0,0 +1,63 @@
+#pragma once
+
+#include "resources.h"
+
+namespace Resources
+{
+
+// Post-transform vertex cache statistics of an index buffer, simulated
+// with a FIFO cache of MeshOptimizer::cache_size entries.
+struct VertexCacheStats
+{
+	uint32_t triangle_count = 0;
+	// Vertices referenced by at least one triangle
+	uint32_t vertex_count = 0;
+	// Cache misses, i.e. vertex shader invocations
+	uint32_t transformed_count = 0;
+
+	// Average cache miss ratio: transformed vertices per triangle.
+	// 3.0 is the worst case, around 0.5 the best a regular grid can do.
+	float acmr() const { return triangle_count > 0 ? float(transformed_count) / float(triangle_count) : 0.0f; }
+	// Average transform to vertex ratio: transformed vertices per
+	// referenced vertex. 1.0 is the best case.
+	float atvr() const { return vertex_count > 0 ? float(transformed_count) / float(vertex_count) : 0.0f; }
+
+	void add(const VertexCacheStats& other)
+	{
+		triangle_count += other.triangle_count;
+		vertex_count += other.vertex_count;
+		transformed_count += other.transformed_count;
+	}
+};
+
+// Reorders the triangles and vertices of indexed triangle lists so the GPU
+// transforms fewer vertices, shades fewer hidden pixels and fetches vertex
+// data more linearly. Indices are 32 bits and relative to the primitive.
+struct MeshOptimizer
+{
+	static const uint32_t cache_size = 16;
+
+	static VertexCacheStats analyze_vertex_cache(const uint32_t* indices, uint32_t index_count, uint32_t vertex_count);
+
+	// Tipsify (Sander, Nehab, Barczak 2007): fans around the vertex that
+	// keeps the most of its neighbours in the cache. destination must not
+	// alias indices.
+	static void optimize_vertex_cache(uint32_t* destination, const uint32_t* indices, uint32_t index_count, uint32_t vertex_count);
+
+	// Splits the cache optimized triangle order in clusters and sorts the
+	// clusters front to back, as seen from outside the mesh. threshold is
+	// how much the ACMR may degrade (1.05 = up to 5%) to get smaller
+	// clusters. destination must not alias indices.
+	static void optimize_overdraw(uint32_t* destination, const uint32_t* indices, uint32_t index_count, const glm::vec3* positions, uint32_t vertex_count, float threshold = 1.05f);
+
+	// Moves vertices in the order the indices first reference them, so
+	// vertex fetch walks memory forward. Unreferenced vertices are moved
+	// at the end. Indices are rewritten in place.
+	static void optimize_vertex_fetch(uint32_t* indices, uint32_t index_count, glm::vec3* positions, glm::vec3* normals, glm::vec2* uvs, uint32_t vertex_count);
+
+	// Runs the three passes above on a primitive, in place, and returns the
+	// vertex cache statistics of the original and of the optimized order
+	static void optimize_primitive(uint32_t* indices, uint32_t index_count, glm::vec3* positions, glm::vec3* normals, glm::vec2* uvs, uint32_t vertex_count, VertexCacheStats* before, VertexCacheStats* after);
+};
+
+} // namespace Resources
@@ -0,0 +1,412 @@
+#include "mesh_simplifier.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <cassert>
+
+namespace Resources
+{
+
+// Sum of squared distances to a set of planes, weighted by the area of the
+// triangles they come from: v^T A v + 2 b.v + c, with A symmetric
+struct Quadric
+{
+	double a00, a11, a22;
+	double a01, a02, a12;
+	double b0, b1, b2;
+	double c;
+	double weight;
+
+	void add_plane(const glm::vec3& normal, float distance, float area)
+	{
+		double x = normal.x;
+		double y = normal.y;
+		double z = normal.z;
+		double d = distance;
+
+		a00 += area * x * x;
+		a11 += area * y * y;
+		a22 += area * z * z;
+		a01 += area * x * y;
+		a02 += area * x * z;
+		a12 += area * y * z;
+		b0 += area * x * d;
+		b1 += area * y * d;
+		b2 += area * z * d;
+		c += area * d * d;
+		weight += area;
+	}
+
+	void add(const Quadric& other)
+	{
+		a00 += other.a00;
+		a11 += other.a11;
+		a22 += other.a22;
+		a01 += other.a01;
+		a02 += other.a02;
+		a12 += other.a12;
+		b0 += other.b0;
+		b1 += other.b1;
+		b2 += other.b2;
+		c += other.c;
+		weight += other.weight;
+	}
+
+	// Average squared distance of position to the planes
+	double error(const glm::vec3& position) const
+	{
+		if (weight <= 0.0)
+			return 0.0;
+
+		double x = position.x;
+		double y = position.y;
+		double z = position.z;
+
+		double result = x * (a00 * x + a01 * y + a02 * z)
+			+ y * (a01 * x + a11 * y + a12 * z)
+			+ z * (a02 * x + a12 * y + a22 * z)
+			+ 2.0 * (b0 * x + b1 * y + b2 * z)
+			+ c;
+
+		return fabs(result) / weight;
+	}
+};
+
+struct SortedPosition
+{
+	glm::vec3 position;
+	uint32_t vertex;
+};
+
+static int compare_positions(const void* a, const void* b)
+{
+	const SortedPosition* position_a = reinterpret_cast<const SortedPosition*>(a);
+	const SortedPosition* position_b = reinterpret_cast<const SortedPosition*>(b);
+
+	for (uint32_t i = 0; i < 3; ++i)
+	{
+		if (position_a->position[i] != position_b->position[i])
+			return position_a->position[i] < position_b->position[i] ? -1 : 1;
+	}
+
+	return 0;
+}
+
+static int compare_edges(const void* a, const void* b)
+{
+	uint64_t edge_a = *reinterpret_cast<const uint64_t*>(a);
+	uint64_t edge_b = *reinterpret_cast<const uint64_t*>(b);
+	return edge_a < edge_b ? -1 : (edge_a > edge_b ? 1 : 0);
+}
+
+static bool contains_edge(const uint64_t* edges, uint32_t edge_count, uint64_t edge)
+{
+	uint32_t first = 0;
+	uint32_t last = edge_count;
+	while (first < last)
+	{
+		uint32_t middle = first + (last - first) / 2;
+		if (edges[middle] < edge)
+			first = middle + 1;
+		else
+			last = middle;
+	}
+
+	return first < edge_count && edges[first] == edge;
+}
+
+// Moving source onto target
+struct Collapse
+{
+	uint32_t source;
+	uint32_t target;
+	double cost;
+};
+
+static int compare_collapses(const void* a, const void* b)
+{
+	const Collapse* collapse_a = reinterpret_cast<const Collapse*>(a);
+	const Collapse* collapse_b = reinterpret_cast<const Collapse*>(b);
+	return collapse_a->cost < collapse_b->cost ? -1 : (collapse_a->cost > collapse_b->cost ? 1 : 0);
+}
+
+// Vertices that can't be moved, or can't be moved onto
+enum VertexKind
+{
+	Free,
+	// On an open border or a non manifold edge: can't move, can be moved onto
+	Border,
+	// Shares its position with other vertices: neither
+	Seam
+};
+
+// Marks the seam and border vertices
+static void classify_vertices(const uint32_t* indices, uint32_t index_count, const glm::vec3* positions, uint32_t vertex_count, VertexKind* kinds)
+{
+	for (uint32_t v = 0; v < vertex_count; ++v)
+	{
+		kinds[v] = VertexKind::Free;
+	}
+
+	// Vertices at the same position belong to different sides of a uv or
+	// normal split
+	SortedPosition* sorted_positions = new SortedPosition[vertex_count];
+	for (uint32_t v = 0; v < vertex_count; ++v)
+	{
+		sorted_positions[v] = { positions[v], v };
+	}
+
+	qsort(sorted_positions, vertex_count, sizeof(SortedPosition), compare_positions);
+
+	for (uint32_t v = 1; v < vertex_count; ++v)
+	{
+		if (compare_positions(&sorted_positions[v - 1], &sorted_positions[v]) == 0)
+		{
+			kinds[sorted_positions[v - 1].vertex] = VertexKind::Seam;
+			kinds[sorted_positions[v].vertex] = VertexKind::Seam;
+		}
+	}
+
+	delete[] sorted_positions;
+
+	// An edge of a closed manifold mesh is used exactly once in each
+	// direction. Any other edge is a border.
+	uint64_t* edges = new uint64_t[index_count];
+	for (uint32_t i = 0; i < index_count; i += 3)
+	{
+		for (uint32_t e = 0; e < 3; ++e)
+		{
+			uint64_t a = indices[i + e];
+			uint64_t b = indices[i + (e + 1) % 3];
+			edges[i + e] = (a << 32) | b;
+		}
+	}
+
+	qsort(edges, index_count, sizeof(uint64_t), compare_edges);
+
+	for (uint32_t i = 0; i < index_count; ++i)
+	{
+		uint32_t a = uint32_t(edges[i] >> 32);
+		uint32_t b = uint32_t(edges[i] & 0xffffffffu);
+		uint64_t reverse = (uint64_t(b) << 32) | a;
+
+		bool duplicate = (i > 0 && edges[i - 1] == edges[i]) || (i + 1 < index_count && edges[i + 1] == edges[i]);
+		if (duplicate || !contains_edge(edges, index_count, reverse))
+		{
+			if (kinds[a] == VertexKind::Free)
+				kinds[a] = VertexKind::Border;
+			if (kinds[b] == VertexKind::Free)
+				kinds[b] = VertexKind::Border;
+		}
+	}
+
+	delete[] edges;
+}
+
+uint32_t MeshSimplifier::simplify(uint32_t* destination, const uint32_t* indices, uint32_t index_count, const glm::vec3* positions, uint32_t vertex_count,
+	uint32_t target_index_count, float target_error, float* error)
+{
+	assert(index_count % 3 == 0);
+	assert(destination != indices);
+
+	memcpy(destination, indices, index_count * sizeof(uint32_t));
+
+	VertexKind* kinds = new VertexKind[vertex_count];
+	classify_vertices(indices, index_count, positions, vertex_count, kinds);
+
+	// Quadric of every vertex: the planes of the triangles around it
+	Quadric* quadrics = new Quadric[vertex_count];
+	memset(quadrics, 0, vertex_count * sizeof(Quadric));
+
+	for (uint32_t i = 0; i < index_count; i += 3)
+	{
+		const glm::vec3& p0 = positions[indices[i + 0]];
+		const glm::vec3& p1 = positions[indices[i + 1]];
+		const glm::vec3& p2 = positions[indices[i + 2]];
+
+		glm::vec3 normal = glm::cross(p1 - p0, p2 - p0);
+		float length = glm::length(normal);
+		if (length == 0.0f)
+			continue;
+
+		normal /= length;
+		float distance = -glm::dot(normal, p0);
+		float area = length * 0.5f;
+
+		for (uint32_t k = 0; k < 3; ++k)
+		{
+			quadrics[indices[i + k]].add_plane(normal, distance, area);
+		}
+	}
+
+	uint32_t* collapse_remap = new uint32_t[vertex_count];
+	bool* collapse_locked = new bool[vertex_count];
+	// NOTE: Up to two candidates per edge, one in each direction
+	Collapse* collapses = new Collapse[index_count * 2];
+	uint32_t* adjacency_counts = new uint32_t[vertex_count];
+	uint32_t* adjacency_offsets = new uint32_t[vertex_count];
+	uint32_t* adjacency = new uint32_t[index_count];
+
+	double max_cost = double(target_error) * double(target_error);
+	double result_cost = 0.0;
+	uint32_t result_count = index_count;
+
+	while (result_count > target_index_count)
+	{
+		uint32_t triangle_count = result_count / 3;
+
+		// Every interior edge is seen from its two triangles, once in each
+		// direction: only the a < b one adds the candidates
+		uint32_t collapse_count = 0;
+		for (uint32_t i = 0; i < result_count; i += 3)
+		{
+			for (uint32_t e = 0; e < 3; ++e)
+			{
+				uint32_t a = destination[i + e];
+				uint32_t b = destination[i + (e + 1) % 3];
+				if (a >= b)
+					continue;
+
+				Quadric quadric = quadrics[a];
+				quadric.add(quadrics[b]);
+
+				if (kinds[a] == VertexKind::Free && kinds[b] != VertexKind::Seam)
+					collapses[collapse_count++] = { a, b, quadric.error(positions[b]) };
+				if (kinds[b] == VertexKind::Free && kinds[a] != VertexKind::Seam)
+					collapses[collapse_count++] = { b, a, quadric.error(positions[a]) };
+			}
+		}
+
+		if (collapse_count == 0)
+			break;
+
+		qsort(collapses, collapse_count, sizeof(Collapse), compare_collapses);
+
+		// Triangles around each vertex
+		memset(adjacency_counts, 0, vertex_count * sizeof(uint32_t));
+		for (uint32_t i = 0; i < result_count; ++i)
+		{
+			adjacency_counts[destination[i]]++;
+		}
+
+		uint32_t offset = 0;
+		for (uint32_t v = 0; v < vertex_count; ++v)
+		{
+			adjacency_offsets[v] = offset;
+			offset += adjacency_counts[v];
+			adjacency_counts[v] = 0;
+		}
+
+		for (uint32_t i = 0; i < result_count; ++i)
+		{
+			uint32_t v = destination[i];
+			adjacency[adjacency_offsets[v] + adjacency_counts[v]++] = i / 3;
+		}
+
+		for (uint32_t v = 0; v < vertex_count; ++v)
+		{
+			collapse_remap[v] = v;
+			collapse_locked[v] = false;
+		}
+
+		// NOTE: Both ends of a collapse are locked for the rest of the pass,
+		// so the triangles around a source still have their original
+		// vertices, or vertices moved at most once
+		uint32_t applied_count = 0;
+		for (uint32_t c = 0; c < collapse_count && triangle_count * 3 > target_index_count; ++c)
+		{
+			const Collapse& collapse = collapses[c];
+			if (collapse.cost > max_cost)
+				break;
+
+			if (collapse_locked[collapse.source] || collapse_locked[collapse.target])
+				continue;
+
+			// Moving the source must not flip any of the triangles that
+			// survive the collapse
+			uint32_t removed_count = 0;
+			bool flipped = false;
+			const uint32_t* triangles = adjacency + adjacency_offsets[collapse.source];
+
+			for (uint32_t t = 0; t < adjacency_counts[collapse.source] && !flipped; ++t)
+			{
+				uint32_t corners[3];
+				for (uint32_t k = 0; k < 3; ++k)
+				{
+					corners[k] = collapse_remap[destination[triangles[t] * 3 + k]];
+				}
+
+				if (corners[0] == collapse.target || corners[1] == collapse.target || corners[2] == collapse.target)
+				{
+					removed_count++;
+					continue;
+				}
+
+				// Rotate the source to the first corner
+				uint32_t k0 = corners[0] == collapse.source ? 0 : (corners[1] == collapse.source ? 1 : 2);
+				const glm::vec3& p1 = positions[corners[(k0 + 1) % 3]];
+				const glm::vec3& p2 = positions[corners[(k0 + 2) % 3]];
+				const glm::vec3& before = positions[collapse.source];
+				const glm::vec3& after = positions[collapse.target];
+
+				// NOTE: Turning a triangle by more than ~75 degrees counts as
+				// a flip as well, it folds the surface over just as badly
+				glm::vec3 normal_before = glm::cross(p1 - before, p2 - before);
+				glm::vec3 normal_after = glm::cross(p1 - after, p2 - after);
+				flipped = glm::dot(normal_before, normal_after) <= 0.25f * glm::length(normal_before) * glm::length(normal_after);
+			}
+
+			if (flipped)
+				continue;
+
+			collapse_remap[collapse.source] = collapse.target;
+			collapse_locked[collapse.source] = true;
+			collapse_locked[collapse.target] = true;
+			quadrics[collapse.target].add(quadrics[collapse.source]);
+
+			triangle_count -= removed_count;
+			result_cost = collapse.cost > result_cost ? collapse.cost : result_cost;
+			applied_count++;
+		}
+
+		if (applied_count == 0)
+			break;
+
+		// Apply the collapses and drop the triangles that became degenerate
+		uint32_t write = 0;
+		for (uint32_t i = 0; i < result_count; i += 3)
+		{
+			uint32_t a = collapse_remap[destination[i + 0]];
+			uint32_t b = collapse_remap[destination[i + 1]];
+			uint32_t c = collapse_remap[destination[i + 2]];
+			if (a == b || b == c || a == c)
+				continue;
+
+			destination[write + 0] = a;
+			destination[write + 1] = b;
+			destination[write + 2] = c;
+			write += 3;
+		}
+
+		result_count = write;
+	}
+
+	delete[] adjacency;
+	delete[] adjacency_offsets;
+	delete[] adjacency_counts;
+	delete[] collapses;
+	delete[] collapse_locked;
+	delete[] collapse_remap;
+	delete[] quadrics;
+	delete[] kinds;
+
+	if (error != nullptr)
+	{
+		*error = float(sqrt(result_cost));
+	}
+
+	return result_count;
+}
+
+} // namespace Resources
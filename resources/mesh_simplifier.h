@@ -0,0 +1,28 @@
+#pragma once
+
+#include "resources.h"
+
+namespace Resources
+{
+
+// Builds the LOD levels of indexed triangle lists. Indices are 32 bits and
+// relative to the primitive.
+struct MeshSimplifier
+{
+	// Quadric error metric edge collapse (Garland, Heckbert 1997). Edges are
+	// collapsed cheapest first, moving one vertex onto the other, until at
+	// most target_index_count indices are left or the next collapse would
+	// move the surface by more than target_error. Only the triangles
+	// change: the result references the vertices of the original.
+	// Vertices on open borders and on attribute seams (more than one vertex
+	// at the same position) never move, so the silhouette of open meshes
+	// and the uv/normal splits are kept.
+	// Writes at most index_count indices to destination, which must not
+	// alias indices, and returns how many were written. error receives how
+	// far the simplified surface is from the original, in object space
+	// units.
+	static uint32_t simplify(uint32_t* destination, const uint32_t* indices, uint32_t index_count, const glm::vec3* positions, uint32_t vertex_count,
+		uint32_t target_index_count, float target_error, float* error);
+};
+
+} // namespace Resources
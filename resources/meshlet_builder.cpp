@@ -0,0 +1,152 @@
+#include "meshlet_builder.h"
+
+#include <string.h>
+#include <math.h>
+#include <float.h>
+
+namespace Resources
+{
+
+uint32_t MeshletBuilder::build_meshlets(const uint32_t* indices, uint32_t index_count, const glm::vec3* positions, uint32_t vertex_count, Table<Meshlet>& meshlets)
+{
+	assert(index_count % 3 == 0);
+	if (index_count == 0)
+		return 0;
+
+	// NOTE: A vertex belongs to the current meshlet when its stamp is the
+	// id of the current meshlet, so the set is emptied by bumping the id
+	uint32_t* stamps = new uint32_t[vertex_count];
+	memset(stamps, 0xff, vertex_count * sizeof(uint32_t));
+
+	size_t first_meshlet = meshlets.count;
+	uint32_t meshlet_id = 0;
+
+	Meshlet meshlet = {};
+
+	for (uint32_t i = 0; i < index_count; i += 3)
+	{
+		uint32_t new_vertex_count = 0;
+		for (uint32_t j = 0; j < 3; ++j)
+		{
+			assert(indices[i + j] < vertex_count);
+			new_vertex_count += stamps[indices[i + j]] != meshlet_id ? 1 : 0;
+		}
+
+		// Repeated indices in a degenerate triangle are counted twice, which
+		// only makes the check a bit stricter
+		bool full = meshlet.vertex_count + new_vertex_count > max_meshlet_vertex_count
+			|| meshlet.index_count / 3 + 1 > max_meshlet_triangle_count;
+
+		if (full)
+		{
+			compute_bounds(indices, positions, meshlet);
+			meshlets.push(meshlet);
+
+			meshlet = {};
+			meshlet.index_offset = i;
+			meshlet_id++;
+		}
+
+		for (uint32_t j = 0; j < 3; ++j)
+		{
+			uint32_t index = indices[i + j];
+			if (stamps[index] != meshlet_id)
+			{
+				stamps[index] = meshlet_id;
+				meshlet.vertex_count++;
+			}
+		}
+
+		meshlet.index_count += 3;
+	}
+
+	compute_bounds(indices, positions, meshlet);
+	meshlets.push(meshlet);
+
+	delete[] stamps;
+
+	return uint32_t(meshlets.count - first_meshlet);
+}
+
+void MeshletBuilder::compute_bounds(const uint32_t* indices, const glm::vec3* positions, Meshlet& meshlet)
+{
+	const uint32_t* meshlet_indices = indices + meshlet.index_offset;
+	uint32_t triangle_count = meshlet.index_count / 3;
+
+	// Bounding sphere: centered on the bounding box, large enough to
+	// contain every vertex. Not the smallest one, but close for the
+	// compact clusters we build.
+	glm::vec3 bounds_min(FLT_MAX);
+	glm::vec3 bounds_max(-FLT_MAX);
+	for (uint32_t i = 0; i < meshlet.index_count; ++i)
+	{
+		bounds_min = glm::min(bounds_min, positions[meshlet_indices[i]]);
+		bounds_max = glm::max(bounds_max, positions[meshlet_indices[i]]);
+	}
+
+	glm::vec3 center = (bounds_min + bounds_max) * 0.5f;
+	float radius = 0.0f;
+	for (uint32_t i = 0; i < meshlet.index_count; ++i)
+	{
+		float distance = glm::length(positions[meshlet_indices[i]] - center);
+		radius = distance > radius ? distance : radius;
+	}
+
+	meshlet.center = center;
+	meshlet.radius = radius;
+
+	// Normal cone: the axis is the average of the triangle normals, the
+	// cone must contain every one of them
+	glm::vec3* normals = new glm::vec3[triangle_count];
+	glm::vec3 normal_sum(0.0f);
+	uint32_t valid_count = 0;
+
+	for (uint32_t t = 0; t < triangle_count; ++t)
+	{
+		const glm::vec3& a = positions[meshlet_indices[t * 3 + 0]];
+		const glm::vec3& b = positions[meshlet_indices[t * 3 + 1]];
+		const glm::vec3& c = positions[meshlet_indices[t * 3 + 2]];
+
+		glm::vec3 normal = glm::cross(b - a, c - a);
+		float area = glm::length(normal);
+		// NOTE: Degenerate triangles are never rasterized, they don't
+		// constrain the cone
+		if (area > 0.0f)
+		{
+			normals[valid_count] = normal / area;
+			normal_sum += normals[valid_count];
+			valid_count++;
+		}
+	}
+
+	meshlet.cone_axis = glm::vec3(0.0f, 0.0f, 1.0f);
+	meshlet.cone_cutoff = 1.0f;
+
+	float axis_length = glm::length(normal_sum);
+	if (valid_count > 0 && axis_length > 0.0f)
+	{
+		glm::vec3 axis = normal_sum / axis_length;
+
+		float min_dot = 1.0f;
+		for (uint32_t t = 0; t < valid_count; ++t)
+		{
+			float dot = glm::dot(axis, normals[t]);
+			min_dot = dot < min_dot ? dot : min_dot;
+		}
+
+		meshlet.cone_axis = axis;
+		// NOTE: Past ~84 degrees from the axis the cone hardly ever culls
+		// anything, so we don't bother
+		if (min_dot > 0.1f)
+		{
+			// The triangles face away from the camera when the view
+			// direction is within 90 - angle degrees of the axis, where
+			// angle is the half angle of the cone: cos(90 - angle) = sin(angle)
+			meshlet.cone_cutoff = sqrtf(1.0f - min_dot * min_dot);
+		}
+	}
+
+	delete[] normals;
+}
+
+} // namespace Resources
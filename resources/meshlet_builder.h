@@ -0,0 +1,24 @@
+#pragma once
+
+#include "resources.h"
+
+namespace Resources
+{
+
+// Splits indexed triangle lists in meshlets of at most
+// max_meshlet_vertex_count vertices and max_meshlet_triangle_count
+// triangles, and computes the bounds the GPU culls them with.
+struct MeshletBuilder
+{
+	// Walks the triangles in order and starts a new meshlet whenever the
+	// next triangle doesn't fit in the current one. The triangle order is
+	// kept, so the index buffer doesn't change: run it after the mesh
+	// optimizer and each meshlet is a run of triangles close to each other.
+	// Appends the meshlets to meshlets and returns how many were added.
+	static uint32_t build_meshlets(const uint32_t* indices, uint32_t index_count, const glm::vec3* positions, uint32_t vertex_count, Table<Meshlet>& meshlets);
+
+	// Bounding sphere and normal cone of the triangles of a meshlet
+	static void compute_bounds(const uint32_t* indices, const glm::vec3* positions, Meshlet& meshlet);
+};
+
+} // namespace Resources
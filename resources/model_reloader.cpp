@@ -0,0 +1,462 @@
+#include "model_reloader.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <cassert>
+#include <algorithm>
+
+namespace Resources
+{
+
+void RangeAllocator::init(uint32_t used_count, uint32_t max_count)
+{
+	assert(used_count <= max_count);
+	capacity = max_count;
+	tail = used_count;
+	free_ranges.count = 0;
+}
+
+bool RangeAllocator::allocate(uint32_t count, uint32_t& offset)
+{
+	if (count == 0)
+	{
+		offset = tail;
+		return true;
+	}
+
+	for (size_t i = 0; i < free_ranges.count; ++i)
+	{
+		Range& range = free_ranges[i];
+		if (range.count < count)
+			continue;
+
+		offset = range.offset;
+		range.offset += count;
+		range.count -= count;
+		if (range.count == 0)
+		{
+			memmove(&free_ranges.data[i], &free_ranges.data[i + 1], (free_ranges.count - i - 1) * sizeof(Range));
+			free_ranges.count--;
+		}
+
+		return true;
+	}
+
+	if (count > capacity - tail)
+		return false;
+
+	offset = tail;
+	tail += count;
+	return true;
+}
+
+void RangeAllocator::free(uint32_t offset, uint32_t count)
+{
+	if (count == 0)
+		return;
+
+	assert(offset + count <= tail);
+
+	// First free range past the freed one
+	size_t next = 0;
+	while (next < free_ranges.count && free_ranges[next].offset < offset)
+	{
+		next++;
+	}
+
+	bool merge_previous = next > 0 && free_ranges[next - 1].offset + free_ranges[next - 1].count == offset;
+	bool merge_next = next < free_ranges.count && offset + count == free_ranges[next].offset;
+
+	if (merge_previous && merge_next)
+	{
+		free_ranges[next - 1].count += count + free_ranges[next].count;
+		memmove(&free_ranges.data[next], &free_ranges.data[next + 1], (free_ranges.count - next - 1) * sizeof(Range));
+		free_ranges.count--;
+	}
+	else if (merge_previous)
+	{
+		free_ranges[next - 1].count += count;
+	}
+	else if (merge_next)
+	{
+		free_ranges[next].offset = offset;
+		free_ranges[next].count += count;
+	}
+	else
+	{
+		free_ranges.append(1);
+		memmove(&free_ranges.data[next + 1], &free_ranges.data[next], (free_ranges.count - next - 1) * sizeof(Range));
+		free_ranges[next] = { offset, count };
+	}
+
+	// The last free range goes back to the tail when it ends there
+	if (free_ranges.count > 0)
+	{
+		const Range& last = free_ranges[free_ranges.count - 1];
+		if (last.offset + last.count == tail)
+		{
+			tail = last.offset;
+			free_ranges.count--;
+		}
+	}
+}
+
+void RangeAllocator::release()
+{
+	free_ranges.release();
+	capacity = 0;
+	tail = 0;
+}
+
+// Element counts of every table a load appends to
+struct TableCounts
+{
+	size_t models;
+	size_t materials;
+	size_t meshes;
+	size_t textures;
+	size_t texture_pixels;
+	size_t vertices;
+	size_t meshlets;
+	size_t indices16;
+	size_t indices32;
+	size_t nodes;
+};
+
+static TableCounts count_tables(const AssetsInfo* assets_info)
+{
+	TableCounts counts = {};
+	counts.models = assets_info->models.count;
+	counts.materials = assets_info->materials.count;
+	counts.meshes = assets_info->meshes.count;
+	counts.textures = assets_info->textures.count;
+	counts.texture_pixels = assets_info->texture_pixels.count;
+	counts.vertices = assets_info->vertex_count();
+	counts.meshlets = assets_info->meshlets.count;
+	counts.indices16 = assets_info->indices16.count;
+	counts.indices32 = assets_info->indices32.count;
+	counts.nodes = assets_info->node_count();
+	return counts;
+}
+
+static void truncate_vertices(AssetsInfo* assets_info, size_t vertex_count)
+{
+	assets_info->positions.count = vertex_count;
+	assets_info->normals.count = vertex_count;
+	assets_info->uvs.count = vertex_count;
+	assets_info->quantized_positions.count = vertex_count;
+	assets_info->quantized_normals.count = vertex_count;
+	assets_info->quantized_uvs.count = vertex_count;
+}
+
+static void truncate_nodes(AssetsInfo* assets_info, size_t node_count)
+{
+	assets_info->node_parents.count = node_count;
+	assets_info->node_mesh_ids.count = node_count;
+	assets_info->node_translations.count = node_count;
+	assets_info->node_rotations.count = node_count;
+	assets_info->node_scales.count = node_count;
+	assets_info->node_model_matrices.count = node_count;
+}
+
+// Drops everything appended since counts were taken
+static void truncate_tables(AssetsInfo* assets_info, const TableCounts& counts)
+{
+	assets_info->models.count = counts.models;
+	assets_info->materials.count = counts.materials;
+	assets_info->meshes.count = counts.meshes;
+	assets_info->textures.count = counts.textures;
+	assets_info->texture_pixels.count = counts.texture_pixels;
+	assets_info->meshlets.count = counts.meshlets;
+	assets_info->indices16.count = counts.indices16;
+	assets_info->indices32.count = counts.indices32;
+	truncate_vertices(assets_info, counts.vertices);
+	truncate_nodes(assets_info, counts.nodes);
+}
+
+// Moves count elements appended at the end of a table to offset, which is
+// either where they are already or a range below them. The range can
+// overlap them when it starts in the geometry the reload freed at the end
+// of the table.
+template<typename T>
+static void move_range(Table<T>& table, size_t from, uint32_t offset, uint32_t count)
+{
+	if (offset != from)
+	{
+		assert(offset < from);
+		memmove(table.data + offset, table.data + from, count * sizeof(T));
+	}
+}
+
+// Frees the geometry of a mesh in the allocators of reloader
+static void free_mesh(ModelReloader* reloader, const Mesh& mesh)
+{
+	RangeAllocator& indices = mesh.index_type == IndexType::Uint16 ? reloader->indices16 : reloader->indices32;
+	for (uint32_t p = 0; p < mesh.primitive_count; ++p)
+	{
+		const Primitive& primitive = mesh.primitives[p];
+		reloader->vertices.free(primitive.vertex_offset, primitive.vertex_count);
+		indices.free(primitive.index_offset, primitive.index_count);
+		reloader->meshlets.free(primitive.meshlet_offset, primitive.meshlet_count);
+		for (uint32_t l = 1; l < primitive.lod_count; ++l)
+		{
+			indices.free(primitive.lods[l - 1].index_offset, primitive.lods[l - 1].index_count);
+			reloader->meshlets.free(primitive.lods[l - 1].meshlet_offset, primitive.lods[l - 1].meshlet_count);
+		}
+	}
+}
+
+static void copy_allocator(RangeAllocator& dst, const RangeAllocator& src)
+{
+	dst.capacity = src.capacity;
+	dst.tail = src.tail;
+	dst.free_ranges.count = 0;
+	if (src.free_ranges.count > 0)
+	{
+		dst.free_ranges.append(src.free_ranges.count);
+		memcpy(dst.free_ranges.data, src.free_ranges.data, src.free_ranges.count * sizeof(RangeAllocator::Range));
+	}
+}
+
+template<typename T>
+static void copy_nodes(Table<T>& table, uint32_t from, uint32_t to, uint32_t count)
+{
+	memcpy(table.data + to, table.data + from, count * sizeof(T));
+}
+
+// The loader writes the size of the file in the GLB header before
+// anything else, a file that is still being written is shorter
+static bool is_complete_glb(const char* path)
+{
+	FILE* file = fopen(path, "rb");
+	if (file == nullptr)
+		return false;
+
+	uint32_t header[3] = {};
+	bool complete = fread(header, sizeof(header), 1, file) == 1 && header[0] == GLTF_MAGIC && header[1] == GLTF_VERSION;
+	if (complete)
+	{
+		complete = fseek(file, 0, SEEK_END) == 0 && ftell(file) == long(header[2]);
+	}
+
+	fclose(file);
+	return complete;
+}
+
+void ModelReloader::init(AssetsInfo* assets_info, uint32_t vertex_capacity, uint32_t index16_capacity, uint32_t index32_capacity, uint32_t meshlet_capacity, uint32_t texture_capacity, uint32_t material_capacity)
+{
+	this->assets_info = assets_info;
+	this->texture_capacity = texture_capacity;
+	this->material_capacity = material_capacity;
+	vertices.init((uint32_t)assets_info->vertex_count(), vertex_capacity);
+	indices16.init((uint32_t)assets_info->indices16.count, index16_capacity);
+	indices32.init((uint32_t)assets_info->indices32.count, index32_capacity);
+	meshlets.init((uint32_t)assets_info->meshlets.count, meshlet_capacity);
+}
+
+void ModelReloader::cleanup()
+{
+	vertices.release();
+	indices16.release();
+	indices32.release();
+	meshlets.release();
+	assets_info = nullptr;
+}
+
+bool ModelReloader::reload(const ModelSource& source, uint32_t model_id, Application::ThreadPool* thread_pool, ReloadedRanges& ranges)
+{
+	if (!is_complete_glb(source.path))
+	{
+		printf("[ModelReloader]: %s is not a complete GLB file, keeping the loaded model\n", source.path);
+		return false;
+	}
+
+	// NOTE: Tables are only ever as long as the ranges handed out, holes
+	// included, so the loader appends right where the tails are
+	TableCounts before = count_tables(assets_info);
+	assert(before.vertices == vertices.tail && before.meshlets == meshlets.tail);
+	assert(before.indices16 == indices16.tail && before.indices32 == indices32.tail);
+
+	uint32_t new_model_id = 0;
+	Loader::load_models(&source, 1, assets_info, thread_pool, &new_model_id);
+	TableCounts after = count_tables(assets_info);
+
+	ranges = {};
+	ranges.vertex_count = uint32_t(after.vertices - before.vertices);
+	ranges.index16_count = uint32_t(after.indices16 - before.indices16);
+	ranges.index32_count = uint32_t(after.indices32 - before.indices32);
+	ranges.meshlet_count = uint32_t(after.meshlets - before.meshlets);
+	ranges.texture_offset = uint32_t(before.textures);
+	ranges.texture_count = uint32_t(after.textures - before.textures);
+
+	const Model new_model = assets_info->models[new_model_id];
+	const Model model = assets_info->models[model_id];
+
+	bool accepted = false;
+	if (new_model.node_count != model.node_count)
+	{
+		printf("[ModelReloader]: %s went from %u to %u nodes, reload the level to see it\n", model.name, model.node_count, new_model.node_count);
+	}
+	else if (after.textures > texture_capacity)
+	{
+		printf("[ModelReloader]: %s needs %zu textures, only %u fit\n", model.name, after.textures, texture_capacity);
+	}
+	else if (after.materials > material_capacity)
+	{
+		printf("[ModelReloader]: %s needs %zu materials, only %u fit\n", model.name, after.materials, material_capacity);
+	}
+	else
+	{
+		accepted = true;
+	}
+
+	if (!accepted)
+	{
+		truncate_tables(assets_info, before);
+		return false;
+	}
+
+	// The meshes of the model that no other model uses
+	Table<uint32_t> old_mesh_ids = {};
+	for (uint32_t n = 0; n < model.node_count; ++n)
+	{
+		uint32_t mesh_id = assets_info->node_mesh_ids[model.node_offset + n];
+		if (mesh_id != no_mesh)
+		{
+			old_mesh_ids.push(mesh_id);
+		}
+	}
+
+	std::sort(old_mesh_ids.data, old_mesh_ids.data + old_mesh_ids.count);
+	old_mesh_ids.count = std::unique(old_mesh_ids.data, old_mesh_ids.data + old_mesh_ids.count) - old_mesh_ids.data;
+	const uint32_t* node_mesh_ids = assets_info->node_mesh_ids.data;
+	const uint32_t* model_nodes_begin = node_mesh_ids + model.node_offset;
+	const uint32_t* model_nodes_end = model_nodes_begin + model.node_count;
+	const uint32_t* other_nodes_end = node_mesh_ids + before.nodes;
+	size_t unused_mesh_count = 0;
+	for (size_t i = 0; i < old_mesh_ids.count; ++i)
+	{
+		uint32_t mesh_id = old_mesh_ids[i];
+		if (std::find(node_mesh_ids, model_nodes_begin, mesh_id) != model_nodes_begin || std::find(model_nodes_end, other_nodes_end, mesh_id) != other_nodes_end)
+			continue;
+
+		old_mesh_ids[unused_mesh_count++] = mesh_id;
+	}
+	old_mesh_ids.count = unused_mesh_count;
+
+	// NOTE: The old geometry is freed before the new one is allocated, so
+	// a model can reuse its own ranges. The renderer waits for the GPU to
+	// be idle before it uploads the new ranges, nothing draws the old ones
+	// by then. The allocators are saved first to undo the frees when the
+	// new geometry doesn't fit.
+	RangeAllocator saved_allocators[4] = {};
+	copy_allocator(saved_allocators[0], vertices);
+	copy_allocator(saved_allocators[1], indices16);
+	copy_allocator(saved_allocators[2], indices32);
+	copy_allocator(saved_allocators[3], meshlets);
+
+	for (size_t i = 0; i < old_mesh_ids.count; ++i)
+	{
+		free_mesh(this, assets_info->meshes[old_mesh_ids[i]]);
+	}
+
+	if (!vertices.allocate(ranges.vertex_count, ranges.vertex_offset))
+	{
+		printf("[ModelReloader]: %s: Out of vertex space\n", model.name);
+		accepted = false;
+	}
+	else if (!indices16.allocate(ranges.index16_count, ranges.index16_offset))
+	{
+		printf("[ModelReloader]: %s: Out of 16 bit index space\n", model.name);
+		accepted = false;
+	}
+	else if (!indices32.allocate(ranges.index32_count, ranges.index32_offset))
+	{
+		printf("[ModelReloader]: %s: Out of 32 bit index space\n", model.name);
+		accepted = false;
+	}
+	else if (!meshlets.allocate(ranges.meshlet_count, ranges.meshlet_offset))
+	{
+		printf("[ModelReloader]: %s: Out of meshlet space\n", model.name);
+		accepted = false;
+	}
+
+	if (!accepted)
+	{
+		copy_allocator(vertices, saved_allocators[0]);
+		copy_allocator(indices16, saved_allocators[1]);
+		copy_allocator(indices32, saved_allocators[2]);
+		copy_allocator(meshlets, saved_allocators[3]);
+	}
+
+	for (uint32_t i = 0; i < 4; ++i)
+	{
+		saved_allocators[i].release();
+	}
+
+	if (!accepted)
+	{
+		old_mesh_ids.release();
+		truncate_tables(assets_info, before);
+		return false;
+	}
+
+	// Move the new geometry into its ranges
+	move_range(assets_info->positions, before.vertices, ranges.vertex_offset, ranges.vertex_count);
+	move_range(assets_info->normals, before.vertices, ranges.vertex_offset, ranges.vertex_count);
+	move_range(assets_info->uvs, before.vertices, ranges.vertex_offset, ranges.vertex_count);
+	move_range(assets_info->quantized_positions, before.vertices, ranges.vertex_offset, ranges.vertex_count);
+	move_range(assets_info->quantized_normals, before.vertices, ranges.vertex_offset, ranges.vertex_count);
+	move_range(assets_info->quantized_uvs, before.vertices, ranges.vertex_offset, ranges.vertex_count);
+	move_range(assets_info->indices16, before.indices16, ranges.index16_offset, ranges.index16_count);
+	move_range(assets_info->indices32, before.indices32, ranges.index32_offset, ranges.index32_count);
+	move_range(assets_info->meshlets, before.meshlets, ranges.meshlet_offset, ranges.meshlet_count);
+
+	int32_t vertex_delta = int32_t(ranges.vertex_offset) - int32_t(before.vertices);
+	int32_t index16_delta = int32_t(ranges.index16_offset) - int32_t(before.indices16);
+	int32_t index32_delta = int32_t(ranges.index32_offset) - int32_t(before.indices32);
+	int32_t meshlet_delta = int32_t(ranges.meshlet_offset) - int32_t(before.meshlets);
+	for (size_t m = before.meshes; m < after.meshes; ++m)
+	{
+		Mesh& mesh = assets_info->meshes[m];
+		int32_t index_delta = mesh.index_type == IndexType::Uint16 ? index16_delta : index32_delta;
+		for (uint32_t p = 0; p < mesh.primitive_count; ++p)
+		{
+			Primitive& primitive = mesh.primitives[p];
+			primitive.vertex_offset += vertex_delta;
+			primitive.index_offset += index_delta;
+			primitive.meshlet_offset += meshlet_delta;
+			for (uint32_t l = 1; l < primitive.lod_count; ++l)
+			{
+				primitive.lods[l - 1].index_offset += index_delta;
+				primitive.lods[l - 1].meshlet_offset += meshlet_delta;
+			}
+		}
+	}
+
+	// Replace the nodes of the model
+	copy_nodes(assets_info->node_parents, new_model.node_offset, model.node_offset, model.node_count);
+	copy_nodes(assets_info->node_mesh_ids, new_model.node_offset, model.node_offset, model.node_count);
+	copy_nodes(assets_info->node_translations, new_model.node_offset, model.node_offset, model.node_count);
+	copy_nodes(assets_info->node_rotations, new_model.node_offset, model.node_offset, model.node_count);
+	copy_nodes(assets_info->node_scales, new_model.node_offset, model.node_offset, model.node_count);
+	copy_nodes(assets_info->node_model_matrices, new_model.node_offset, model.node_offset, model.node_count);
+	truncate_nodes(assets_info, before.nodes);
+	assets_info->models.count = before.models;
+
+	uint32_t freed_mesh_count = uint32_t(old_mesh_ids.count);
+	old_mesh_ids.release();
+
+	// The tables end where the ranges do
+	truncate_vertices(assets_info, vertices.tail);
+	assets_info->indices16.count = indices16.tail;
+	assets_info->indices32.count = indices32.tail;
+	assets_info->meshlets.count = meshlets.tail;
+
+	printf("[ModelReloader]: Reloaded %s, %u vertices at %u, %u meshlets at %u, %u textures, freed %u meshes\n",
+		model.name, ranges.vertex_count, ranges.vertex_offset, ranges.meshlet_count, ranges.meshlet_offset, ranges.texture_count, freed_mesh_count);
+
+	return true;
+}
+
+} // namespace Resources
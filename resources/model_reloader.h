@@ -0,0 +1,81 @@
+#pragma once
+
+#include "resources.h"
+#include "loader.h"
+
+namespace Resources
+{
+
+// Hands out ranges of a table whose size can't grow past capacity (e.g.
+// because the table is mirrored in a fixed size GPU buffer). Everything
+// from tail to capacity is free, ranges below tail are free when they
+// are in free_ranges. Ranges are picked first fit, and freed ranges are
+// merged with their neighbours and given back to the tail when they end
+// there.
+struct RangeAllocator
+{
+	struct Range
+	{
+		uint32_t offset;
+		uint32_t count;
+	};
+
+	uint32_t capacity = 0;
+	uint32_t tail = 0;
+	// Sorted by offset, never adjacent to each other or to the tail
+	Table<Range> free_ranges;
+
+	void init(uint32_t used_count, uint32_t max_count);
+	// Returns false when there's no room for count elements
+	bool allocate(uint32_t count, uint32_t& offset);
+	void free(uint32_t offset, uint32_t count);
+	void release();
+};
+
+// Where a reload put the new data of a model, in elements of each table.
+// Only these ranges have to be uploaded again.
+struct ReloadedRanges
+{
+	uint32_t vertex_offset;
+	uint32_t vertex_count;
+	uint32_t index16_offset;
+	uint32_t index16_count;
+	uint32_t index32_offset;
+	uint32_t index32_count;
+	uint32_t meshlet_offset;
+	uint32_t meshlet_count;
+	uint32_t texture_offset;
+	uint32_t texture_count;
+};
+
+// Loads the models of a running level again when their source changes.
+// The vertices, indices and meshlets of a reloaded model go into the
+// ranges freed by the previous versions of the models, its own included,
+// or at the end of their table, so that the tables keep mirroring the GPU buffers and
+// nothing but the new ranges has to be uploaded.
+// NOTE: The nodes of the model are replaced in place, so the entities
+// that use it don't move, which only works if the node count doesn't
+// change. Materials, meshes and textures are appended: old meshes give
+// their geometry back once no node uses them, their metadata stays, so
+// every reload uses up more of the material and texture capacities.
+struct ModelReloader
+{
+	void init(AssetsInfo* assets_info, uint32_t vertex_capacity, uint32_t index16_capacity, uint32_t index32_capacity, uint32_t meshlet_capacity, uint32_t texture_capacity, uint32_t material_capacity);
+	void cleanup();
+
+	// Loads source as model_id. Returns false, leaving assets_info as it
+	// was, when the file is not a complete GLB file (e.g. it is still being
+	// written), when the node count of the model changed or when the new
+	// data doesn't fit.
+	bool reload(const ModelSource& source, uint32_t model_id, Application::ThreadPool* thread_pool, ReloadedRanges& ranges);
+
+	AssetsInfo* assets_info = nullptr;
+	RangeAllocator vertices;
+	RangeAllocator indices16;
+	RangeAllocator indices32;
+	RangeAllocator meshlets;
+	uint32_t texture_capacity = 0;
+	uint32_t material_capacity = 0;
+};
+
+} // namespace Resources
@@ -0,0 +1,631 @@
+#include "package.h"
+#include "loader.h"
+#include "mapped_file.h"
+#include "texture_encoder.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <cassert>
+
+namespace Resources
+{
+
+// In-memory view of a package file
+struct PackageView
+{
+	uint8_t* memory = nullptr;
+	const PackageHeader* header = nullptr;
+	const PackageEntry* entries = nullptr;
+	const Model* models = nullptr;
+	const Material* materials = nullptr;
+	const Mesh* meshes = nullptr;
+	const glm::vec3* positions = nullptr;
+	const glm::vec3* normals = nullptr;
+	const glm::vec2* uvs = nullptr;
+	const QuantizedPosition* quantized_positions = nullptr;
+	const QuantizedNormal* quantized_normals = nullptr;
+	const QuantizedUv* quantized_uvs = nullptr;
+	const Meshlet* meshlets = nullptr;
+	const Index16* indices16 = nullptr;
+	const Index32* indices32 = nullptr;
+	const uint32_t* node_parents = nullptr;
+	const uint32_t* node_mesh_ids = nullptr;
+	const glm::vec3* node_translations = nullptr;
+	const glm::quat* node_rotations = nullptr;
+	const glm::vec3* node_scales = nullptr;
+	const glm::mat4* node_model_matrices = nullptr;
+	const Texture* textures = nullptr;
+	const uint8_t* texture_pixels = nullptr;
+};
+
+// Offsets of each table from the start of the file. Every table starts
+// on a 16 bytes boundary.
+struct PackageLayout
+{
+	size_t entries;
+	size_t models;
+	size_t materials;
+	size_t meshes;
+	size_t positions;
+	size_t normals;
+	size_t uvs;
+	size_t quantized_positions;
+	size_t quantized_normals;
+	size_t quantized_uvs;
+	size_t meshlets;
+	size_t indices32;
+	size_t indices16;
+	size_t node_parents;
+	size_t node_mesh_ids;
+	size_t node_translations;
+	size_t node_rotations;
+	size_t node_scales;
+	size_t node_model_matrices;
+	size_t textures;
+	size_t texture_pixels;
+	size_t size;
+};
+
+static size_t align_16(size_t offset)
+{
+	return (offset + 15) & ~size_t(15);
+}
+
+static PackageLayout get_layout(const PackageHeader& header)
+{
+	PackageLayout layout = {};
+	layout.entries = align_16(sizeof(PackageHeader));
+	layout.models = align_16(layout.entries + header.source_count * sizeof(PackageEntry));
+	layout.materials = align_16(layout.models + header.model_count * sizeof(Model));
+	layout.meshes = align_16(layout.materials + header.material_count * sizeof(Material));
+	layout.positions = align_16(layout.meshes + header.mesh_count * sizeof(Mesh));
+	layout.normals = align_16(layout.positions + header.vertex_count * sizeof(glm::vec3));
+	layout.uvs = align_16(layout.normals + header.vertex_count * sizeof(glm::vec3));
+	layout.quantized_positions = align_16(layout.uvs + header.vertex_count * sizeof(glm::vec2));
+	layout.quantized_normals = align_16(layout.quantized_positions + header.vertex_count * sizeof(QuantizedPosition));
+	layout.quantized_uvs = align_16(layout.quantized_normals + header.vertex_count * sizeof(QuantizedNormal));
+	layout.meshlets = align_16(layout.quantized_uvs + header.vertex_count * sizeof(QuantizedUv));
+	layout.indices32 = align_16(layout.meshlets + header.meshlet_count * sizeof(Meshlet));
+	layout.indices16 = align_16(layout.indices32 + header.index32_count * sizeof(Index32));
+	layout.node_parents = align_16(layout.indices16 + header.index16_count * sizeof(Index16));
+	layout.node_mesh_ids = align_16(layout.node_parents + header.node_count * sizeof(uint32_t));
+	layout.node_translations = align_16(layout.node_mesh_ids + header.node_count * sizeof(uint32_t));
+	layout.node_rotations = align_16(layout.node_translations + header.node_count * sizeof(glm::vec3));
+	layout.node_scales = align_16(layout.node_rotations + header.node_count * sizeof(glm::quat));
+	layout.node_model_matrices = align_16(layout.node_scales + header.node_count * sizeof(glm::vec3));
+	layout.textures = align_16(layout.node_model_matrices + header.node_count * sizeof(glm::mat4));
+	layout.texture_pixels = align_16(layout.textures + header.texture_count * sizeof(Texture));
+	layout.size = layout.texture_pixels + header.texture_pixel_size;
+	return layout;
+}
+
+static bool read_package(const char* path, PackageView& view)
+{
+	FILE* file_handle = fopen(path, "rb");
+	if (file_handle == NULL)
+		return false;
+
+	fseek(file_handle, 0, SEEK_END);
+	size_t file_size = (size_t)ftell(file_handle);
+	fseek(file_handle, 0, SEEK_SET);
+
+	if (file_size < sizeof(PackageHeader))
+	{
+		fclose(file_handle);
+		return false;
+	}
+
+	// NOTE: The whole package is read with a single sequential read
+	uint8_t* memory = new uint8_t[file_size];
+	size_t bytes_read = fread(memory, 1, file_size, file_handle);
+	fclose(file_handle);
+
+	const PackageHeader* header = reinterpret_cast<const PackageHeader*>(memory);
+	bool valid = bytes_read == file_size
+		&& header->magic == PACKAGE_MAGIC
+		&& header->version == PACKAGE_VERSION
+		&& header->model_size == sizeof(Model)
+		&& header->material_size == sizeof(Material)
+		&& header->mesh_size == sizeof(Mesh)
+		&& get_layout(*header).size == file_size;
+
+	if (!valid)
+	{
+		printf("[Package]: %s is not a valid package (or was cooked by a different version)\n", path);
+		delete[] memory;
+		return false;
+	}
+
+	PackageLayout layout = get_layout(*header);
+	view.memory = memory;
+	view.header = header;
+	view.entries = reinterpret_cast<const PackageEntry*>(memory + layout.entries);
+	view.models = reinterpret_cast<const Model*>(memory + layout.models);
+	view.materials = reinterpret_cast<const Material*>(memory + layout.materials);
+	view.meshes = reinterpret_cast<const Mesh*>(memory + layout.meshes);
+	view.positions = reinterpret_cast<const glm::vec3*>(memory + layout.positions);
+	view.normals = reinterpret_cast<const glm::vec3*>(memory + layout.normals);
+	view.uvs = reinterpret_cast<const glm::vec2*>(memory + layout.uvs);
+	view.quantized_positions = reinterpret_cast<const QuantizedPosition*>(memory + layout.quantized_positions);
+	view.quantized_normals = reinterpret_cast<const QuantizedNormal*>(memory + layout.quantized_normals);
+	view.quantized_uvs = reinterpret_cast<const QuantizedUv*>(memory + layout.quantized_uvs);
+	view.meshlets = reinterpret_cast<const Meshlet*>(memory + layout.meshlets);
+	view.indices32 = reinterpret_cast<const Index32*>(memory + layout.indices32);
+	view.indices16 = reinterpret_cast<const Index16*>(memory + layout.indices16);
+	view.node_parents = reinterpret_cast<const uint32_t*>(memory + layout.node_parents);
+	view.node_mesh_ids = reinterpret_cast<const uint32_t*>(memory + layout.node_mesh_ids);
+	view.node_translations = reinterpret_cast<const glm::vec3*>(memory + layout.node_translations);
+	view.node_rotations = reinterpret_cast<const glm::quat*>(memory + layout.node_rotations);
+	view.node_scales = reinterpret_cast<const glm::vec3*>(memory + layout.node_scales);
+	view.node_model_matrices = reinterpret_cast<const glm::mat4*>(memory + layout.node_model_matrices);
+	view.textures = reinterpret_cast<const Texture*>(memory + layout.textures);
+	view.texture_pixels = memory + layout.texture_pixels;
+
+	return true;
+}
+
+// Appends the data a source contributed to an old package, moving it to
+// the current end of the assets_info tables
+static void append_entry(const PackageView& view, const PackageEntry& entry, AssetsInfo* assets_info)
+{
+	size_t model_id = assets_info->models.append(1);
+	size_t material_offset = assets_info->materials.append(entry.material_count);
+	size_t mesh_offset = assets_info->meshes.append(entry.mesh_count);
+	size_t vertex_offset = assets_info->append_vertices(entry.vertex_count);
+	size_t meshlet_offset = assets_info->meshlets.append(entry.meshlet_count);
+	size_t index16_offset = assets_info->indices16.append(entry.index16_count);
+	size_t index32_offset = assets_info->indices32.append(entry.index32_count);
+	size_t node_offset = assets_info->append_nodes(entry.node_count);
+	size_t texture_offset = assets_info->textures.append(entry.texture_count);
+	size_t texture_pixel_offset = assets_info->texture_pixels.append(entry.texture_pixel_size);
+
+	int32_t texture_delta = int32_t(texture_offset) - int32_t(entry.texture_offset);
+	int32_t texture_pixel_delta = int32_t(texture_pixel_offset) - int32_t(entry.texture_pixel_offset);
+	int32_t material_delta = int32_t(material_offset) - int32_t(entry.material_offset);
+	int32_t mesh_delta = int32_t(mesh_offset) - int32_t(entry.mesh_offset);
+	int32_t vertex_delta = int32_t(vertex_offset) - int32_t(entry.vertex_offset);
+	int32_t meshlet_delta = int32_t(meshlet_offset) - int32_t(entry.meshlet_offset);
+	int32_t index16_delta = int32_t(index16_offset) - int32_t(entry.index16_offset);
+	int32_t index32_delta = int32_t(index32_offset) - int32_t(entry.index32_offset);
+
+	for (uint32_t t = 0; t < entry.texture_count; ++t)
+	{
+		Texture texture = view.textures[entry.texture_offset + t];
+		texture.pixel_offset += texture_pixel_delta;
+		assets_info->textures[texture_offset + t] = texture;
+	}
+
+	memcpy(assets_info->texture_pixels.data + texture_pixel_offset, &view.texture_pixels[entry.texture_pixel_offset], entry.texture_pixel_size);
+
+	for (uint32_t m = 0; m < entry.material_count; ++m)
+	{
+		Material material = view.materials[entry.material_offset + m];
+		if (material.base_color_texture_id != no_texture)
+		{
+			material.base_color_texture_id += texture_delta;
+		}
+
+		assets_info->materials[material_offset + m] = material;
+	}
+
+	for (uint32_t m = 0; m < entry.mesh_count; ++m)
+	{
+		Mesh mesh = view.meshes[entry.mesh_offset + m];
+		for (uint32_t p = 0; p < mesh.primitive_count; ++p)
+		{
+			mesh.primitives[p].vertex_offset += vertex_delta;
+			mesh.primitives[p].index_offset += mesh.index_type == IndexType::Uint16 ? index16_delta : index32_delta;
+			mesh.primitives[p].material_id += material_delta;
+			mesh.primitives[p].meshlet_offset += meshlet_delta;
+			for (uint32_t l = 1; l < mesh.primitives[p].lod_count; ++l)
+			{
+				mesh.primitives[p].lods[l - 1].index_offset += mesh.index_type == IndexType::Uint16 ? index16_delta : index32_delta;
+				mesh.primitives[p].lods[l - 1].meshlet_offset += meshlet_delta;
+			}
+		}
+
+		assets_info->meshes[mesh_offset + m] = mesh;
+	}
+
+	memcpy(assets_info->positions.data + vertex_offset, &view.positions[entry.vertex_offset], entry.vertex_count * sizeof(glm::vec3));
+	memcpy(assets_info->normals.data + vertex_offset, &view.normals[entry.vertex_offset], entry.vertex_count * sizeof(glm::vec3));
+	memcpy(assets_info->uvs.data + vertex_offset, &view.uvs[entry.vertex_offset], entry.vertex_count * sizeof(glm::vec2));
+	memcpy(assets_info->quantized_positions.data + vertex_offset, &view.quantized_positions[entry.vertex_offset], entry.vertex_count * sizeof(QuantizedPosition));
+	memcpy(assets_info->quantized_normals.data + vertex_offset, &view.quantized_normals[entry.vertex_offset], entry.vertex_count * sizeof(QuantizedNormal));
+	memcpy(assets_info->quantized_uvs.data + vertex_offset, &view.quantized_uvs[entry.vertex_offset], entry.vertex_count * sizeof(QuantizedUv));
+	memcpy(assets_info->meshlets.data + meshlet_offset, &view.meshlets[entry.meshlet_offset], entry.meshlet_count * sizeof(Meshlet));
+
+	// NOTE: Indices are relative to their primitive, they don't move
+	memcpy(assets_info->indices16.data + index16_offset, &view.indices16[entry.index16_offset], entry.index16_count * sizeof(Index16));
+	memcpy(assets_info->indices32.data + index32_offset, &view.indices32[entry.index32_offset], entry.index32_count * sizeof(Index32));
+
+	// NOTE: Parents are relative to the first node of the model, they don't
+	// move either
+	memcpy(assets_info->node_parents.data + node_offset, &view.node_parents[entry.node_offset], entry.node_count * sizeof(uint32_t));
+	memcpy(assets_info->node_translations.data + node_offset, &view.node_translations[entry.node_offset], entry.node_count * sizeof(glm::vec3));
+	memcpy(assets_info->node_rotations.data + node_offset, &view.node_rotations[entry.node_offset], entry.node_count * sizeof(glm::quat));
+	memcpy(assets_info->node_scales.data + node_offset, &view.node_scales[entry.node_offset], entry.node_count * sizeof(glm::vec3));
+	memcpy(assets_info->node_model_matrices.data + node_offset, &view.node_model_matrices[entry.node_offset], entry.node_count * sizeof(glm::mat4));
+	for (uint32_t n = 0; n < entry.node_count; ++n)
+	{
+		uint32_t mesh_id = view.node_mesh_ids[entry.node_offset + n];
+		assets_info->node_mesh_ids[node_offset + n] = mesh_id != no_mesh ? mesh_id + mesh_delta : no_mesh;
+	}
+
+	Model model = view.models[entry.model_id];
+	model.node_offset = (uint32_t)node_offset;
+	assets_info->models[model_id] = model;
+}
+
+// A band of block rows of a texture level to encode
+struct EncodeJob
+{
+	uint32_t texture_id;
+	uint32_t level;
+	uint32_t first_row;
+	uint32_t row_count;
+};
+
+struct EncodeJobs
+{
+	// The textures as loaded, and where their levels are in pixels
+	const Texture* sources;
+	const uint8_t* source_pixels;
+	// The textures as stored in the package, and where they go in blocks
+	const Texture* textures;
+	uint8_t* blocks;
+
+	EncodeJob* jobs;
+};
+
+// Block rows per encode job, so that big levels are spread over the pool
+static const uint32_t encode_job_row_count = 16;
+
+static size_t level_offset(TextureFormat format, uint32_t width, uint32_t height, uint32_t level)
+{
+	return TextureEncoder::chain_size(format, width, height, level);
+}
+
+static void encode_job(uint32_t job_index, void* data)
+{
+	const EncodeJobs* jobs = static_cast<const EncodeJobs*>(data);
+	const EncodeJob& job = jobs->jobs[job_index];
+	const Texture& source = jobs->sources[job.texture_id];
+	const Texture& texture = jobs->textures[job.texture_id];
+
+	uint32_t width = (source.width >> job.level) > 0 ? source.width >> job.level : 1;
+	uint32_t height = (source.height >> job.level) > 0 ? source.height >> job.level : 1;
+	const uint8_t* pixels = jobs->source_pixels + source.pixel_offset + level_offset(source.format, source.width, source.height, job.level);
+	uint8_t* blocks = jobs->blocks + texture.pixel_offset + level_offset(texture.format, texture.width, texture.height, job.level);
+
+	TextureEncoder::encode_rows(texture.format, pixels, width, height, job.first_row, job.row_count, blocks);
+}
+
+// Encodes every texture the loader left in RGBA8 and moves every texture
+// to its final offset, updating the pixel ranges of the entries. Textures
+// reused from an old package are encoded already and are only copied.
+static void encode_textures(AssetsInfo* assets_info, PackageEntry* entries, uint32_t source_count, Application::ThreadPool* thread_pool, bool high_quality)
+{
+	uint32_t texture_count = (uint32_t)assets_info->textures.count;
+	Texture* sources = new Texture[texture_count];
+	memcpy(sources, assets_info->textures.data, texture_count * sizeof(Texture));
+
+	// Pick the formats and lay the blocks out, in entry order
+	uint32_t encoded_count = 0;
+	uint32_t job_count = 0;
+	uint32_t block_offset = 0;
+	for (uint32_t s = 0; s < source_count; ++s)
+	{
+		PackageEntry& entry = entries[s];
+		entry.texture_pixel_offset = block_offset;
+
+		for (uint32_t t = entry.texture_offset; t < entry.texture_offset + entry.texture_count; ++t)
+		{
+			Texture& texture = assets_info->textures[t];
+			if (texture.format == TextureFormat::Rgba8)
+			{
+				texture.format = TextureEncoder::pick_color_format(assets_info->texture_pixels.data + texture.pixel_offset, texture.width, texture.height, high_quality);
+				texture.pixel_size = (uint32_t)TextureEncoder::chain_size(texture.format, texture.width, texture.height, texture.mip_count);
+				for (uint32_t level = 0; level < texture.mip_count; ++level)
+				{
+					uint32_t height = (texture.height >> level) > 0 ? texture.height >> level : 1;
+					uint32_t row_count = TextureEncoder::block_row_count(texture.format, height);
+					job_count += (row_count + encode_job_row_count - 1) / encode_job_row_count;
+				}
+				encoded_count++;
+			}
+
+			texture.pixel_offset = block_offset;
+			block_offset += texture.pixel_size;
+		}
+
+		entry.texture_pixel_size = block_offset - entry.texture_pixel_offset;
+	}
+
+	EncodeJobs jobs = {};
+	jobs.sources = sources;
+	jobs.source_pixels = assets_info->texture_pixels.data;
+	jobs.textures = assets_info->textures.data;
+	jobs.jobs = new EncodeJob[job_count];
+
+	Table<uint8_t> blocks = {};
+	blocks.append(block_offset);
+	jobs.blocks = blocks.data;
+
+	uint32_t job_id = 0;
+	for (uint32_t t = 0; t < texture_count; ++t)
+	{
+		const Texture& source = sources[t];
+		const Texture& texture = assets_info->textures[t];
+		if (source.format == texture.format)
+		{
+			memcpy(blocks.data + texture.pixel_offset, assets_info->texture_pixels.data + source.pixel_offset, texture.pixel_size);
+			continue;
+		}
+
+		for (uint32_t level = 0; level < texture.mip_count; ++level)
+		{
+			uint32_t height = (texture.height >> level) > 0 ? texture.height >> level : 1;
+			uint32_t row_count = TextureEncoder::block_row_count(texture.format, height);
+			for (uint32_t row = 0; row < row_count; row += encode_job_row_count)
+			{
+				EncodeJob& job = jobs.jobs[job_id++];
+				job.texture_id = t;
+				job.level = level;
+				job.first_row = row;
+				job.row_count = row_count - row < encode_job_row_count ? row_count - row : encode_job_row_count;
+			}
+		}
+	}
+	assert(job_id == job_count);
+
+	if (thread_pool != nullptr)
+	{
+		thread_pool->dispatch(job_count, encode_job, &jobs);
+	}
+	else
+	{
+		for (uint32_t i = 0; i < job_count; ++i)
+		{
+			encode_job(i, &jobs);
+		}
+	}
+
+	if (encoded_count > 0)
+	{
+		printf("[Package]: Encoded %u textures, %.1f KB of texture data\n", encoded_count, double(block_offset) / 1024.0);
+	}
+
+	assets_info->texture_pixels.release();
+	assets_info->texture_pixels = blocks;
+
+	delete[] jobs.jobs;
+	delete[] sources;
+}
+
+static void write_table(FILE* file_handle, size_t offset, const void* data, size_t size)
+{
+	// Pad up to the start of the table
+	static const uint8_t zeros[16] = {};
+	size_t position = (size_t)ftell(file_handle);
+	assert(position <= offset && offset - position < 16);
+	fwrite(zeros, 1, offset - position, file_handle);
+
+	if (size > 0)
+	{
+		fwrite(data, 1, size, file_handle);
+	}
+}
+
+bool Package::cook(const char* path, const PackageSource* sources, uint32_t source_count, Application::ThreadPool* thread_pool, bool high_quality_textures)
+{
+	PackageView old_package = {};
+	bool has_old_package = read_package(path, old_package);
+	// NOTE: Switching the texture quality cooks every source again
+	bool reuse_old_package = has_old_package && old_package.header->high_quality_textures == uint32_t(high_quality_textures);
+
+	AssetsInfo* assets_info = new AssetsInfo();
+	PackageEntry* entries = new PackageEntry[source_count];
+	uint32_t cooked_count = 0;
+
+	for (uint32_t s = 0; s < source_count; ++s)
+	{
+		MappedFile file = {};
+		if (!file.open(sources[s].path))
+		{
+			printf("[Package]: Failed to open %s\n", sources[s].path);
+			delete[] entries;
+			assets_info->cleanup();
+			delete assets_info;
+			delete[] old_package.memory;
+			return false;
+		}
+
+		uint64_t content_hash = hash(file.data, file.size);
+		file.close();
+
+		PackageEntry& entry = entries[s];
+		memset(&entry, 0, sizeof(PackageEntry));
+		assert(strlen(sources[s].name) < sizeof(entry.name));
+		strcpy(entry.name, sources[s].name);
+		entry.content_hash = content_hash;
+		entry.model_id = (uint32_t)assets_info->models.count;
+		entry.material_offset = (uint32_t)assets_info->materials.count;
+		entry.mesh_offset = (uint32_t)assets_info->meshes.count;
+		entry.vertex_offset = (uint32_t)assets_info->vertex_count();
+		entry.meshlet_offset = (uint32_t)assets_info->meshlets.count;
+		entry.index16_offset = (uint32_t)assets_info->indices16.count;
+		entry.index32_offset = (uint32_t)assets_info->indices32.count;
+		entry.node_offset = (uint32_t)assets_info->node_count();
+		entry.texture_offset = (uint32_t)assets_info->textures.count;
+		entry.texture_pixel_offset = (uint32_t)assets_info->texture_pixels.count;
+
+		const PackageEntry* old_entry = nullptr;
+		for (uint32_t e = 0; reuse_old_package && e < old_package.header->source_count; ++e)
+		{
+			if (old_package.entries[e].content_hash == content_hash && strcmp(old_package.entries[e].name, entry.name) == 0)
+			{
+				old_entry = &old_package.entries[e];
+				break;
+			}
+		}
+
+		if (old_entry != nullptr)
+		{
+			append_entry(old_package, *old_entry, assets_info);
+		}
+		else
+		{
+			printf("[Package]: Cooking %s\n", sources[s].path);
+			uint32_t model_id = 0;
+			Loader::load_models(&sources[s], 1, assets_info, thread_pool, &model_id);
+			assert(model_id == entry.model_id);
+			cooked_count++;
+		}
+
+		entry.material_count = (uint32_t)assets_info->materials.count - entry.material_offset;
+		entry.mesh_count = (uint32_t)assets_info->meshes.count - entry.mesh_offset;
+		entry.vertex_count = (uint32_t)assets_info->vertex_count() - entry.vertex_offset;
+		entry.meshlet_count = (uint32_t)assets_info->meshlets.count - entry.meshlet_offset;
+		entry.index16_count = (uint32_t)assets_info->indices16.count - entry.index16_offset;
+		entry.index32_count = (uint32_t)assets_info->indices32.count - entry.index32_offset;
+		entry.node_count = (uint32_t)assets_info->node_count() - entry.node_offset;
+		entry.texture_count = (uint32_t)assets_info->textures.count - entry.texture_offset;
+		entry.texture_pixel_size = (uint32_t)assets_info->texture_pixels.count - entry.texture_pixel_offset;
+	}
+
+	encode_textures(assets_info, entries, source_count, thread_pool, high_quality_textures);
+
+	// Nothing to write if every source was reused at the same offsets
+	bool up_to_date = reuse_old_package && cooked_count == 0
+		&& old_package.header->source_count == source_count
+		&& memcmp(old_package.entries, entries, source_count * sizeof(PackageEntry)) == 0;
+
+	delete[] old_package.memory;
+
+	if (up_to_date)
+	{
+		printf("[Package]: %s is up to date\n", path);
+		delete[] entries;
+		assets_info->cleanup();
+		delete assets_info;
+		return true;
+	}
+
+	PackageHeader header = {};
+	header.magic = PACKAGE_MAGIC;
+	header.version = PACKAGE_VERSION;
+	header.model_size = sizeof(Model);
+	header.material_size = sizeof(Material);
+	header.mesh_size = sizeof(Mesh);
+	header.source_count = source_count;
+	header.model_count = (uint32_t)assets_info->models.count;
+	header.material_count = (uint32_t)assets_info->materials.count;
+	header.mesh_count = (uint32_t)assets_info->meshes.count;
+	header.vertex_count = (uint32_t)assets_info->vertex_count();
+	header.meshlet_count = (uint32_t)assets_info->meshlets.count;
+	header.index16_count = (uint32_t)assets_info->indices16.count;
+	header.index32_count = (uint32_t)assets_info->indices32.count;
+	header.node_count = (uint32_t)assets_info->node_count();
+	header.texture_count = (uint32_t)assets_info->textures.count;
+	header.texture_pixel_size = (uint32_t)assets_info->texture_pixels.count;
+	header.high_quality_textures = uint32_t(high_quality_textures);
+
+	PackageLayout layout = get_layout(header);
+
+	FILE* file_handle = fopen(path, "wb");
+	if (file_handle == NULL)
+	{
+		printf("[Package]: Failed to open %s for writing\n", path);
+		delete[] entries;
+		assets_info->cleanup();
+		delete assets_info;
+		return false;
+	}
+
+	write_table(file_handle, 0, &header, sizeof(header));
+	write_table(file_handle, layout.entries, entries, source_count * sizeof(PackageEntry));
+	write_table(file_handle, layout.models, assets_info->models.data, header.model_count * sizeof(Model));
+	write_table(file_handle, layout.materials, assets_info->materials.data, header.material_count * sizeof(Material));
+	write_table(file_handle, layout.meshes, assets_info->meshes.data, header.mesh_count * sizeof(Mesh));
+	write_table(file_handle, layout.positions, assets_info->positions.data, header.vertex_count * sizeof(glm::vec3));
+	write_table(file_handle, layout.normals, assets_info->normals.data, header.vertex_count * sizeof(glm::vec3));
+	write_table(file_handle, layout.uvs, assets_info->uvs.data, header.vertex_count * sizeof(glm::vec2));
+	write_table(file_handle, layout.quantized_positions, assets_info->quantized_positions.data, header.vertex_count * sizeof(QuantizedPosition));
+	write_table(file_handle, layout.quantized_normals, assets_info->quantized_normals.data, header.vertex_count * sizeof(QuantizedNormal));
+	write_table(file_handle, layout.quantized_uvs, assets_info->quantized_uvs.data, header.vertex_count * sizeof(QuantizedUv));
+	write_table(file_handle, layout.meshlets, assets_info->meshlets.data, header.meshlet_count * sizeof(Meshlet));
+	write_table(file_handle, layout.indices32, assets_info->indices32.data, header.index32_count * sizeof(Index32));
+	write_table(file_handle, layout.indices16, assets_info->indices16.data, header.index16_count * sizeof(Index16));
+	write_table(file_handle, layout.node_parents, assets_info->node_parents.data, header.node_count * sizeof(uint32_t));
+	write_table(file_handle, layout.node_mesh_ids, assets_info->node_mesh_ids.data, header.node_count * sizeof(uint32_t));
+	write_table(file_handle, layout.node_translations, assets_info->node_translations.data, header.node_count * sizeof(glm::vec3));
+	write_table(file_handle, layout.node_rotations, assets_info->node_rotations.data, header.node_count * sizeof(glm::quat));
+	write_table(file_handle, layout.node_scales, assets_info->node_scales.data, header.node_count * sizeof(glm::vec3));
+	write_table(file_handle, layout.node_model_matrices, assets_info->node_model_matrices.data, header.node_count * sizeof(glm::mat4));
+	write_table(file_handle, layout.textures, assets_info->textures.data, header.texture_count * sizeof(Texture));
+	write_table(file_handle, layout.texture_pixels, assets_info->texture_pixels.data, header.texture_pixel_size);
+
+	fclose(file_handle);
+
+	printf("[Package]: Wrote %s (%u sources, %u cooked, %u reused, %zu bytes)\n", path, source_count, cooked_count, source_count - cooked_count, layout.size);
+
+	delete[] entries;
+	assets_info->cleanup();
+	delete assets_info;
+	return true;
+}
+
+bool Package::load(const char* path, AssetsInfo* assets_info)
+{
+	PackageView view = {};
+	if (!read_package(path, view))
+		return false;
+
+	const PackageHeader& header = *view.header;
+	assert(assets_info->models.count == 0 && "Packages must be loaded into an empty AssetsInfo");
+
+	// NOTE: The tables are sized exactly for the package
+	assets_info->models.append(header.model_count);
+	assets_info->materials.append(header.material_count);
+	assets_info->meshes.append(header.mesh_count);
+	assets_info->append_vertices(header.vertex_count);
+	assets_info->meshlets.append(header.meshlet_count);
+	assets_info->indices16.append(header.index16_count);
+	assets_info->indices32.append(header.index32_count);
+	assets_info->append_nodes(header.node_count);
+	assets_info->textures.append(header.texture_count);
+	assets_info->texture_pixels.append(header.texture_pixel_size);
+
+	memcpy(assets_info->models.data, view.models, header.model_count * sizeof(Model));
+	memcpy(assets_info->materials.data, view.materials, header.material_count * sizeof(Material));
+	memcpy(assets_info->meshes.data, view.meshes, header.mesh_count * sizeof(Mesh));
+	memcpy(assets_info->positions.data, view.positions, header.vertex_count * sizeof(glm::vec3));
+	memcpy(assets_info->normals.data, view.normals, header.vertex_count * sizeof(glm::vec3));
+	memcpy(assets_info->uvs.data, view.uvs, header.vertex_count * sizeof(glm::vec2));
+	memcpy(assets_info->quantized_positions.data, view.quantized_positions, header.vertex_count * sizeof(QuantizedPosition));
+	memcpy(assets_info->quantized_normals.data, view.quantized_normals, header.vertex_count * sizeof(QuantizedNormal));
+	memcpy(assets_info->quantized_uvs.data, view.quantized_uvs, header.vertex_count * sizeof(QuantizedUv));
+	memcpy(assets_info->meshlets.data, view.meshlets, header.meshlet_count * sizeof(Meshlet));
+	memcpy(assets_info->indices16.data, view.indices16, header.index16_count * sizeof(Index16));
+	memcpy(assets_info->indices32.data, view.indices32, header.index32_count * sizeof(Index32));
+	memcpy(assets_info->node_parents.data, view.node_parents, header.node_count * sizeof(uint32_t));
+	memcpy(assets_info->node_mesh_ids.data, view.node_mesh_ids, header.node_count * sizeof(uint32_t));
+	memcpy(assets_info->node_translations.data, view.node_translations, header.node_count * sizeof(glm::vec3));
+	memcpy(assets_info->node_rotations.data, view.node_rotations, header.node_count * sizeof(glm::quat));
+	memcpy(assets_info->node_scales.data, view.node_scales, header.node_count * sizeof(glm::vec3));
+	memcpy(assets_info->node_model_matrices.data, view.node_model_matrices, header.node_count * sizeof(glm::mat4));
+	memcpy(assets_info->textures.data, view.textures, header.texture_count * sizeof(Texture));
+	memcpy(assets_info->texture_pixels.data, view.texture_pixels, header.texture_pixel_size);
+
+	delete[] view.memory;
+
+	return true;
+}
+
+uint64_t Package::hash(const void* data, size_t size)
+{
+	return hash_bytes(data, size);
+}
+
+} // namespace Resources
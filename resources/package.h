@@ -0,0 +1,118 @@
+#pragma once
+
+#include "resources.h"
+#include "loader.h"
+
+namespace Resources
+{
+
+static const uint32_t PACKAGE_MAGIC = 0x50444444; // "DDDP"
+// NOTE: Bump this every time the layout of the package or of any of the
+// structs stored in it changes, or when the loader starts producing
+// different data (e.g. a new optimization pass)
+static const uint32_t PACKAGE_VERSION = 11;
+
+// A source asset cooked into a package. Sources are cooked in order and
+// each one produces exactly one model, so the model id of a source is its
+// index in the package.
+typedef ModelSource PackageSource;
+
+// Binary package layout:
+//
+// PackageHeader
+// PackageEntry[source_count]
+// Model[model_count]
+// Material[material_count]
+// Mesh[mesh_count]
+// glm::vec3[vertex_count] (positions)
+// glm::vec3[vertex_count] (normals)
+// glm::vec2[vertex_count] (uvs)
+// QuantizedPosition[vertex_count]
+// QuantizedNormal[vertex_count]
+// QuantizedUv[vertex_count]
+// Meshlet[meshlet_count]
+// Index32[index32_count]
+// Index16[index16_count]
+// uint32_t[node_count] (parents)
+// uint32_t[node_count] (mesh ids)
+// glm::vec3[node_count] (translations)
+// glm::quat[node_count] (rotations)
+// glm::vec3[node_count] (scales)
+// glm::mat4[node_count] (model matrices)
+// Texture[texture_count]
+// uint8_t[texture_pixel_size] (texture blocks, every mip level)
+//
+// Tables are stored exactly like they are in AssetsInfo, already rebased
+// to their final offsets, so loading is one sequential read followed by a
+// memcpy per table, and the vertex streams and index tables can be copied
+// as they are into staging memory. Textures are stored block compressed,
+// with their mip chains, so loading a package never decodes an image and
+// the levels are uploaded as they are.
+struct PackageHeader
+{
+	uint32_t magic;
+	uint32_t version;
+	// Sizes of the stored structs, to catch layout changes across builds
+	uint32_t model_size;
+	uint32_t material_size;
+	uint32_t mesh_size;
+
+	uint32_t source_count;
+	uint32_t model_count;
+	uint32_t material_count;
+	uint32_t mesh_count;
+	uint32_t vertex_count;
+	uint32_t meshlet_count;
+	uint32_t index16_count;
+	uint32_t index32_count;
+	uint32_t node_count;
+	uint32_t texture_count;
+	uint32_t texture_pixel_size;
+	// 1 if the textures were encoded to BC7, see Package::cook
+	uint32_t high_quality_textures;
+};
+
+// What a single source contributed to the package
+struct PackageEntry
+{
+	char name[64];
+	uint64_t content_hash;
+	uint32_t model_id;
+	uint32_t material_offset;
+	uint32_t material_count;
+	uint32_t mesh_offset;
+	uint32_t mesh_count;
+	uint32_t vertex_offset;
+	uint32_t vertex_count;
+	uint32_t meshlet_offset;
+	uint32_t meshlet_count;
+	uint32_t index16_offset;
+	uint32_t index16_count;
+	uint32_t index32_offset;
+	uint32_t index32_count;
+	uint32_t node_offset;
+	uint32_t node_count;
+	uint32_t texture_offset;
+	uint32_t texture_count;
+	uint32_t texture_pixel_offset;
+	uint32_t texture_pixel_size;
+};
+
+struct Package
+{
+	// Cooks sources into the package at path. Sources whose content hash
+	// matches the existing package are not parsed again, their data is
+	// taken from the old package and moved to its new offsets. Textures are
+	// encoded to BC1 (opaque) or BC3 (with alpha), or to BC7 when
+	// high_quality_textures is set. Sources are parsed, and textures are
+	// encoded, on thread_pool (or on the calling thread when it is null).
+	static bool cook(const char* path, const PackageSource* sources, uint32_t source_count, Application::ThreadPool* thread_pool, bool high_quality_textures = false);
+
+	// Loads a cooked package into assets_info. Returns false if the package
+	// is missing or was cooked with a different version.
+	static bool load(const char* path, AssetsInfo* assets_info);
+
+	static uint64_t hash(const void* data, size_t size);
+};
+
+} // namespace Resources
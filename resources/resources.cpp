@@ -0,0 +1,120 @@
+#include "resources.h"
+
+#include <stdio.h>
+#include <glm/gtc/matrix_transform.hpp>
+
+namespace Resources
+{
+
+TableAllocationHook table_allocation_hook = nullptr;
+
+uint64_t hash_bytes(const void* data, size_t size, uint64_t hash)
+{
+	const uint8_t* bytes = reinterpret_cast<const uint8_t*>(data);
+	for (size_t i = 0; i < size; ++i)
+	{
+		hash ^= bytes[i];
+		hash *= 0x100000001b3ull;
+	}
+
+	return hash;
+}
+
+size_t AssetsInfo::append_vertices(size_t vertex_count)
+{
+	size_t first = positions.append(vertex_count);
+	normals.append(vertex_count);
+	uvs.append(vertex_count);
+	quantized_positions.append(vertex_count);
+	quantized_normals.append(vertex_count);
+	quantized_uvs.append(vertex_count);
+	return first;
+}
+
+size_t AssetsInfo::append_nodes(size_t node_count)
+{
+	size_t first = node_parents.append(node_count);
+	node_mesh_ids.append(node_count);
+	node_translations.append(node_count);
+	node_rotations.append(node_count);
+	node_scales.append(node_count);
+	node_model_matrices.append(node_count);
+	return first;
+}
+
+void AssetsInfo::update_node_matrices(const Model& model)
+{
+	const uint32_t* parents = node_parents.data + model.node_offset;
+	const glm::vec3* translations = node_translations.data + model.node_offset;
+	const glm::quat* rotations = node_rotations.data + model.node_offset;
+	const glm::vec3* scales = node_scales.data + model.node_offset;
+	glm::mat4* matrices = node_model_matrices.data + model.node_offset;
+
+	for (uint32_t n = 0; n < model.node_count; ++n)
+	{
+		// NOTE: glTF applies the scale first, then the rotation and the
+		// translation
+		glm::mat4 local = glm::translate(glm::mat4(1.0f), translations[n]) * glm::toMat4(rotations[n]);
+		local = glm::scale(local, scales[n]);
+
+		assert(parents[n] == no_node || parents[n] < n);
+		matrices[n] = parents[n] == no_node ? local : matrices[parents[n]] * local;
+	}
+}
+
+static void print_table(const char* name, size_t count, size_t element_size, size_t memory_size)
+{
+	printf("[AssetsInfo]: %-10s %8zu x %3zu bytes = %8.1f KB (%.1f KB reserved)\n", name, count, element_size, double(count * element_size) / 1024.0, double(memory_size) / 1024.0);
+}
+
+void AssetsInfo::print_memory_report() const
+{
+	print_table("models", models.count, sizeof(Model), models.memory_size());
+	print_table("materials", materials.count, sizeof(Material), materials.memory_size());
+	print_table("meshes", meshes.count, sizeof(Mesh), meshes.memory_size());
+	print_table("textures", textures.count, sizeof(Texture), textures.memory_size());
+	print_table("pixels", texture_pixels.count, sizeof(uint8_t), texture_pixels.memory_size());
+	print_table("positions", positions.count, sizeof(glm::vec3), positions.memory_size());
+	print_table("normals", normals.count, sizeof(glm::vec3), normals.memory_size());
+	print_table("uvs", uvs.count, sizeof(glm::vec2), uvs.memory_size());
+	print_table("qpositions", quantized_positions.count, sizeof(QuantizedPosition), quantized_positions.memory_size());
+	print_table("qnormals", quantized_normals.count, sizeof(QuantizedNormal), quantized_normals.memory_size());
+	print_table("quvs", quantized_uvs.count, sizeof(QuantizedUv), quantized_uvs.memory_size());
+	print_table("meshlets", meshlets.count, sizeof(Meshlet), meshlets.memory_size());
+	print_table("indices16", indices16.count, sizeof(Index16), indices16.memory_size());
+	print_table("indices32", indices32.count, sizeof(Index32), indices32.memory_size());
+	print_table("nodes", node_parents.count, 2 * sizeof(uint32_t) + 2 * sizeof(glm::vec3) + sizeof(glm::quat) + sizeof(glm::mat4),
+		node_parents.memory_size() + node_mesh_ids.memory_size() + node_translations.memory_size() + node_rotations.memory_size() + node_scales.memory_size() + node_model_matrices.memory_size());
+
+	size_t total = models.memory_size() + materials.memory_size() + meshes.memory_size() + textures.memory_size() + texture_pixels.memory_size()
+		+ positions.memory_size() + normals.memory_size() + uvs.memory_size()
+		+ quantized_positions.memory_size() + quantized_normals.memory_size() + quantized_uvs.memory_size() + meshlets.memory_size() + indices16.memory_size() + indices32.memory_size()
+		+ node_parents.memory_size() + node_mesh_ids.memory_size() + node_translations.memory_size() + node_rotations.memory_size() + node_scales.memory_size() + node_model_matrices.memory_size();
+	printf("[AssetsInfo]: %.1f KB reserved in total\n", double(total) / 1024.0);
+}
+
+void AssetsInfo::cleanup()
+{
+	models.release();
+	materials.release();
+	meshes.release();
+	textures.release();
+	texture_pixels.release();
+	positions.release();
+	normals.release();
+	uvs.release();
+	quantized_positions.release();
+	quantized_normals.release();
+	quantized_uvs.release();
+	meshlets.release();
+	indices16.release();
+	indices32.release();
+	node_parents.release();
+	node_mesh_ids.release();
+	node_translations.release();
+	node_rotations.release();
+	node_scales.release();
+	node_model_matrices.release();
+}
+
+} // namespace Resources
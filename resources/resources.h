@@ -1,6 +1,9 @@
 #pragma once
 
 #include <ctype.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <cassert>
 #define GLM_FORCE_RADIANS
 #define GLM_FORCE_DEPTH_ZERO_TO_ONE
 #define GLM_ENABLE_EXPERIMENTAL
@@ -10,34 +13,112 @@
 namespace Resources
 {
 
-struct Node
-{
-	char name[64];
-	uint32_t mesh_id;
-	glm::vec3 translation = { 0.0f, 0.0f, 0.0f };
-	glm::vec3 scale = { 1.0f, 1.0f, 1.0f };
-	glm::quat rotation = glm::identity<glm::quat>();
-};
+// Parent of a root node, mesh of a node that only groups its children
+const uint32_t no_node = UINT32_MAX;
+const uint32_t no_mesh = UINT32_MAX;
+// Texture of a material that only uses its factors
+const uint32_t no_texture = UINT32_MAX;
 
+// The nodes of a model are a range of the node tables of AssetsInfo (see
+// AssetsInfo::node_parents)
 struct Model
 {
 	char name[64];
+	uint32_t node_offset = 0;
 	uint32_t node_count = 0;
-	Node nodes[8];
 };
 
+// Levels of detail of a mesh, including the full resolution one
+const uint32_t max_lod_count = 4;
+
+// The triangles of a primitive at one level of detail. Every level draws
+// the same vertices with fewer triangles.
+struct PrimitiveLod
+{
+	uint32_t index_offset;
+	uint32_t index_count;
+	uint32_t meshlet_offset;
+	uint32_t meshlet_count;
+};
+
+// NOTE: Indices are relative to the first vertex of their primitive,
+// vertex_offset is passed to the draw as vertexOffset. The vertices of a
+// primitive are [vertex_offset, vertex_offset + vertex_count). index_offset is an
+// index into the index table of the mesh's index type.
+// Indexed triangle lists are split in meshlets, meshlet_count is 0 for
+// every other primitive.
+// index_offset, index_count and the meshlets are LOD 0, lods[0] is LOD 1.
+// A primitive can have fewer levels than its mesh when simplifying stops
+// paying off, it then keeps drawing its last one.
 struct Primitive
 {
 	uint32_t vertex_offset;
+	uint32_t vertex_count;
 	uint32_t index_offset;
 	uint32_t index_count;
 	uint32_t material_id;
+	uint32_t meshlet_offset;
+	uint32_t meshlet_count;
+	uint32_t lod_count;
+	PrimitiveLod lods[max_lod_count - 1];
+
+	PrimitiveLod lod(uint32_t level) const
+	{
+		if (level == 0 || lod_count <= 1)
+			return { index_offset, index_count, meshlet_offset, meshlet_count };
+
+		level = level < lod_count ? level : lod_count - 1;
+		return lods[level - 1];
+	}
+};
+
+const uint32_t max_meshlet_vertex_count = 64;
+const uint32_t max_meshlet_triangle_count = 124;
+
+// A cluster of consecutive triangles of a primitive, culled as a whole.
+// NOTE: The layout matches the Meshlet struct of cull_meshlets.comp (std430)
+struct Meshlet
+{
+	// Bounding sphere, in mesh space
+	glm::vec3 center;
+	float radius;
+	// Normal cone, in mesh space. No triangle of the meshlet faces a
+	// camera for which
+	// dot(center - camera, cone_axis) >= cone_cutoff * length(center - camera) + radius
+	// cone_cutoff is 1 when the triangles face too many directions.
+	glm::vec3 cone_axis;
+	float cone_cutoff;
+	// Relative to the index_offset of the primitive LOD
+	uint32_t index_offset;
+	uint32_t index_count;
+	uint32_t vertex_count;
+	uint32_t padding;
 };
 
+enum IndexType
+{
+	Uint16,
+	Uint32
+};
+
+// Largest primitive (in vertices) 16 bit indices can address
+const uint32_t max_index16_vertex_count = 65536;
+
 struct Mesh
 {
 	char name[64];
 	uint32_t primitive_count = 0;
+	// All the primitives of a mesh use the same index type: 16 bits
+	// unless one of them has more than max_index16_vertex_count vertices
+	IndexType index_type = IndexType::Uint16;
+	// Object space bounds of all the primitives, from the POSITION
+	// accessors. Quantized positions are relative to them.
+	glm::vec3 bounds_min = { 0.0f, 0.0f, 0.0f };
+	glm::vec3 bounds_max = { 0.0f, 0.0f, 0.0f };
+	// How far each LOD is from the full resolution surface, in object space
+	// units: the largest error of its primitives. lod_errors[0] is 0.
+	uint32_t lod_count = 1;
+	float lod_errors[max_lod_count] = {};
 	Primitive primitives[8];
 };
 
@@ -53,6 +134,8 @@ struct Material
 	char name[64];
 	uint32_t name_length = 0;
 	MaterialAlphaMode alpha_mode;
+	// Multiplies base_color_factor, sampled with TEXCOORD_0
+	uint32_t base_color_texture_id = no_texture;
 
 	struct PBRMetallicRoughness
 	{
@@ -62,34 +145,229 @@ struct Material
 	} pbr_metallic_roughness;
 };
 
-struct Vertex
+// How the levels of a texture are stored. The loader decodes textures to
+// Rgba8, packages store them block compressed (see TextureEncoder).
+enum TextureFormat
 {
-	glm::vec3 position;
-	glm::vec3 normal;
-	glm::vec2 tex_coord_0;
+	Rgba8,
+	// RGB, 8 bytes per 4x4 block
+	Bc1,
+	// RGBA, BC1 color and interpolated alpha, 16 bytes per block
+	Bc3,
+	// Two independent channels (red and green), 16 bytes per block
+	Bc5,
+	// RGBA, better quality than BC1 and BC3, 16 bytes per block
+	Bc7
+};
+
+// A texture with its full mip chain, sRGB encoded. The levels are stored
+// one after the other in AssetsInfo::texture_pixels, starting at
+// pixel_offset, each one half the size of the one before down to 1x1 (see
+// TextureDecoder and TextureEncoder).
+struct Texture
+{
+	uint32_t width;
+	uint32_t height;
+	uint32_t mip_count;
+	uint32_t pixel_offset;
+	uint32_t pixel_size;
+	TextureFormat format;
 };
 
 typedef uint16_t Index16;
-typedef uint16_t Index32;
+typedef uint32_t Index32;
+
+// Compact vertex streams, see VertexQuantizer
+// 16 bits unsigned normalized, relative to the bounds of the mesh.
+// w is padding: 3 components 16 bits formats are rarely supported for
+// vertex fetch.
+struct QuantizedPosition
+{
+	uint16_t x, y, z, w;
+};
 
+// Octahedral encoded unit vector, 16 bits signed normalized
+struct QuantizedNormal
+{
+	int16_t x, y;
+};
+
+// Half floats
+struct QuantizedUv
+{
+	uint16_t u, v;
+};
+
+// Which vertex streams the renderer uploads and draws with
+enum VertexFormat
+{
+	Float32,
+	Quantized
+};
 
-const size_t vertex_buffer_size = 4096;
-const size_t index_buffer_size = 8192;
 const size_t uniform_buffer_size = 1024;
 
+// FNV-1a, 64 bits. Data can be hashed in pieces by passing the result of
+// the previous piece as hash.
+const uint64_t hash_seed = 0xcbf29ce484222325ull;
+uint64_t hash_bytes(const void* data, size_t size, uint64_t hash = hash_seed);
+
+// Told about every allocation a table makes or releases, in bytes. Null
+// unless a tool installs one: the benchmarks use it to measure the loader.
+typedef void (*TableAllocationHook)(size_t old_size, size_t new_size);
+extern TableAllocationHook table_allocation_hook;
+
+// A growable array of trivially copyable elements. The capacity at least
+// doubles every time it runs out, so appending is amortized O(1).
+// NOTE: Appending may move the elements, keep indices into a table, not
+// pointers.
+template<typename T>
+struct Table
+{
+	T* data = nullptr;
+	size_t count = 0;
+	size_t capacity = 0;
+
+	T& operator[](size_t index)
+	{
+		assert(index < count);
+		return data[index];
+	}
+
+	const T& operator[](size_t index) const
+	{
+		assert(index < count);
+		return data[index];
+	}
+
+	// Makes room for at least new_capacity elements
+	void reserve(size_t new_capacity)
+	{
+		if (new_capacity <= capacity)
+			return;
+
+		data = static_cast<T*>(realloc(data, new_capacity * sizeof(T)));
+		assert(data != nullptr && "Out of memory");
+		if (table_allocation_hook != nullptr)
+		{
+			table_allocation_hook(capacity * sizeof(T), new_capacity * sizeof(T));
+		}
+		capacity = new_capacity;
+	}
+
+	// Appends element_count uninitialized elements and returns the index
+	// of the first one
+	size_t append(size_t element_count)
+	{
+		if (count + element_count > capacity)
+		{
+			size_t new_capacity = capacity > 0 ? capacity * 2 : 16;
+			if (new_capacity < count + element_count)
+				new_capacity = count + element_count;
+
+			reserve(new_capacity);
+		}
+
+		size_t first = count;
+		count += element_count;
+		return first;
+	}
+
+	size_t push(const T& element)
+	{
+		size_t index = append(1);
+		data[index] = element;
+		return index;
+	}
+
+	void release()
+	{
+		if (table_allocation_hook != nullptr && data != nullptr)
+		{
+			table_allocation_hook(capacity * sizeof(T), 0);
+		}
+		::free(data);
+		data = nullptr;
+		count = 0;
+		capacity = 0;
+	}
+
+	size_t memory_size() const
+	{
+		return capacity * sizeof(T);
+	}
+};
+
+// All the assets of a level. Tables start empty and grow with the loaded
+// content.
+// Vertices are stored as one table per attribute (structure of arrays):
+// the same index addresses a vertex in every stream, and each stream is
+// uploaded to the GPU as it is and bound to its own vertex binding.
+// Every vertex is stored both as floats, for the CPU side passes, and in
+// the quantized format the GPU reads by default.
 struct AssetsInfo
 {
-	size_t model_offset = 0;
-	size_t material_offset = 0;
-	size_t mesh_offset = 0;
-	size_t vertex_offset = 0;
-	size_t index_offset = 0;
-
-	Model models[16];
-	Material materials[16];
-	Mesh meshes[32];
-	Vertex vertices[vertex_buffer_size];
-	Index16 indices[index_buffer_size];
+	Table<Model> models;
+	Table<Material> materials;
+	Table<Mesh> meshes;
+
+	Table<Texture> textures;
+	Table<uint8_t> texture_pixels;
+
+	Table<glm::vec3> positions;
+	Table<glm::vec3> normals;
+	Table<glm::vec2> uvs;
+
+	Table<QuantizedPosition> quantized_positions;
+	Table<QuantizedNormal> quantized_normals;
+	Table<QuantizedUv> quantized_uvs;
+
+	Table<Meshlet> meshlets;
+
+	Table<Index16> indices16;
+	Table<Index32> indices32;
+
+	// The node hierarchy of every model, flattened. The nodes of a model
+	// are consecutive and sorted so that parents come before their
+	// children, parents are relative to the first node of the model.
+	Table<uint32_t> node_parents;
+	Table<uint32_t> node_mesh_ids;
+	// Local transform of each node, relative to its parent
+	Table<glm::vec3> node_translations;
+	Table<glm::quat> node_rotations;
+	Table<glm::vec3> node_scales;
+	// Node to model space, see update_node_matrices
+	Table<glm::mat4> node_model_matrices;
+
+	size_t vertex_count() const
+	{
+		assert(normals.count == positions.count && uvs.count == positions.count);
+		assert(quantized_positions.count == positions.count && quantized_normals.count == positions.count && quantized_uvs.count == positions.count);
+		return positions.count;
+	}
+
+	// Appends vertex_count vertices to every stream, returns the index of
+	// the first one
+	size_t append_vertices(size_t vertex_count);
+
+	size_t node_count() const
+	{
+		assert(node_mesh_ids.count == node_parents.count && node_model_matrices.count == node_parents.count);
+		assert(node_translations.count == node_parents.count && node_rotations.count == node_parents.count && node_scales.count == node_parents.count);
+		return node_parents.count;
+	}
+
+	// Appends node_count nodes to every node table, returns the index of
+	// the first one
+	size_t append_nodes(size_t node_count);
+
+	// Recomputes the model matrices of the nodes of a model from their
+	// local transforms, in a single pass over the sorted nodes
+	void update_node_matrices(const Model& model);
+
+	// Prints the memory used by each table
+	void print_memory_report() const;
+	void cleanup();
 };
 
 } // namespace Resources
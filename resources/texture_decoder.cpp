@@ -0,0 +1,164 @@
+#include "texture_decoder.h"
+#include "../application/stb_image.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+namespace Resources
+{
+
+// Lookup tables between 8 bits sRGB and linear values. Linear values are
+// stored with 12 bits of precision, enough to round trip every sRGB value.
+struct SrgbTables
+{
+	static const uint32_t linear_steps = 4096;
+
+	float to_linear[256];
+	uint8_t to_srgb[linear_steps];
+
+	SrgbTables()
+	{
+		for (uint32_t i = 0; i < 256; ++i)
+		{
+			float value = float(i) / 255.0f;
+			to_linear[i] = value <= 0.04045f ? value / 12.92f : powf((value + 0.055f) / 1.055f, 2.4f);
+		}
+
+		for (uint32_t i = 0; i < linear_steps; ++i)
+		{
+			float value = float(i) / float(linear_steps - 1);
+			float srgb = value <= 0.0031308f ? value * 12.92f : 1.055f * powf(value, 1.0f / 2.4f) - 0.055f;
+			to_srgb[i] = uint8_t(srgb * 255.0f + 0.5f);
+		}
+	}
+};
+
+static const SrgbTables& srgb_tables()
+{
+	// NOTE: Built once by the first thread that gets here, local statics
+	// are initialized thread safely
+	static const SrgbTables tables;
+	return tables;
+}
+
+bool TextureDecoder::read_size(const uint8_t* data, size_t size, uint32_t& width, uint32_t& height)
+{
+	int x = 0;
+	int y = 0;
+	int channels = 0;
+	if (!stbi_info_from_memory(data, int(size), &x, &y, &channels) || x <= 0 || y <= 0)
+		return false;
+
+	width = uint32_t(x);
+	height = uint32_t(y);
+	return true;
+}
+
+uint32_t TextureDecoder::mip_count(uint32_t width, uint32_t height)
+{
+	uint32_t extent = width > height ? width : height;
+	uint32_t count = 1;
+	while (extent > 1)
+	{
+		extent >>= 1;
+		count++;
+	}
+
+	return count;
+}
+
+uint32_t TextureDecoder::mip_extent(uint32_t extent, uint32_t level)
+{
+	extent >>= level;
+	return extent > 0 ? extent : 1;
+}
+
+size_t TextureDecoder::mip_chain_size(uint32_t width, uint32_t height)
+{
+	size_t size = 0;
+	uint32_t count = mip_count(width, height);
+	for (uint32_t level = 0; level < count; ++level)
+	{
+		size += size_t(mip_extent(width, level)) * mip_extent(height, level) * 4;
+	}
+
+	return size;
+}
+
+bool TextureDecoder::decode(const uint8_t* data, size_t size, uint32_t width, uint32_t height, uint8_t* pixels)
+{
+	int x = 0;
+	int y = 0;
+	int channels = 0;
+	stbi_uc* image = stbi_load_from_memory(data, int(size), &x, &y, &channels, 4);
+	bool decoded = image != nullptr && uint32_t(x) == width && uint32_t(y) == height;
+
+	if (decoded)
+	{
+		memcpy(pixels, image, size_t(width) * height * 4);
+		build_mips(pixels, width, height);
+	}
+	else
+	{
+		printf("[TextureDecoder]: Could not decode a %ux%u image: %s\n", width, height, image != nullptr ? "size mismatch" : stbi_failure_reason());
+
+		size_t chain_size = mip_chain_size(width, height);
+		for (size_t i = 0; i < chain_size; i += 4)
+		{
+			pixels[i + 0] = 255;
+			pixels[i + 1] = 0;
+			pixels[i + 2] = 255;
+			pixels[i + 3] = 255;
+		}
+	}
+
+	stbi_image_free(image);
+	return decoded;
+}
+
+void TextureDecoder::build_mips(uint8_t* pixels, uint32_t width, uint32_t height)
+{
+	const SrgbTables& tables = srgb_tables();
+	const float linear_scale = float(SrgbTables::linear_steps - 1);
+
+	uint32_t count = mip_count(width, height);
+	uint8_t* source = pixels;
+	for (uint32_t level = 1; level < count; ++level)
+	{
+		uint32_t source_width = mip_extent(width, level - 1);
+		uint32_t source_height = mip_extent(height, level - 1);
+		uint32_t level_width = mip_extent(width, level);
+		uint32_t level_height = mip_extent(height, level);
+		uint8_t* destination = source + size_t(source_width) * source_height * 4;
+
+		for (uint32_t y = 0; y < level_height; ++y)
+		{
+			// NOTE: A side of 1 is averaged with itself
+			const uint8_t* row_0 = source + size_t(2 * y) * source_width * 4;
+			const uint8_t* row_1 = source_height > 1 ? row_0 + size_t(source_width) * 4 : row_0;
+			uint8_t* texel = destination + size_t(y) * level_width * 4;
+
+			for (uint32_t x = 0; x < level_width; ++x)
+			{
+				uint32_t x_0 = 2 * x * 4;
+				uint32_t x_1 = source_width > 1 ? x_0 + 4 : x_0;
+
+				for (uint32_t c = 0; c < 3; ++c)
+				{
+					float linear = tables.to_linear[row_0[x_0 + c]] + tables.to_linear[row_0[x_1 + c]]
+						+ tables.to_linear[row_1[x_0 + c]] + tables.to_linear[row_1[x_1 + c]];
+					texel[c] = tables.to_srgb[uint32_t(linear * 0.25f * linear_scale + 0.5f)];
+				}
+
+				uint32_t alpha = uint32_t(row_0[x_0 + 3]) + row_0[x_1 + 3] + row_1[x_0 + 3] + row_1[x_1 + 3];
+				texel[3] = uint8_t((alpha + 2) / 4);
+				texel += 4;
+			}
+		}
+
+		source = destination;
+	}
+}
+
+} // namespace Resources
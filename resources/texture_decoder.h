@@ -0,0 +1,41 @@
+#pragma once
+
+#include "resources.h"
+
+namespace Resources
+{
+
+// Decodes the images embedded in glTF files (PNG, JPEG, ...) with
+// stb_image and builds their mip chains on the CPU, so that the renderer
+// only has to copy the levels and packages can store them as they are.
+// Every function works on its own memory only: many textures can be
+// decoded at once on different threads.
+struct TextureDecoder
+{
+	// Reads the size of an encoded image from its header, without decoding
+	// it. Returns false when the format is not supported.
+	static bool read_size(const uint8_t* data, size_t size, uint32_t& width, uint32_t& height);
+
+	// Levels of a full mip chain, down to 1x1
+	static uint32_t mip_count(uint32_t width, uint32_t height);
+	// Width or height of a level
+	static uint32_t mip_extent(uint32_t extent, uint32_t level);
+	// Bytes of a full RGBA8 mip chain, levels stored one after the other
+	static size_t mip_chain_size(uint32_t width, uint32_t height);
+
+	// Decodes an image of width x height (see read_size) to RGBA8 into the
+	// first level of pixels, then builds the other levels. pixels holds
+	// mip_chain_size bytes. Returns false when the image can't be decoded,
+	// pixels is then filled with magenta so the texture stands out.
+	static bool decode(const uint8_t* data, size_t size, uint32_t width, uint32_t height, uint8_t* pixels);
+
+	// Builds every level of an sRGB RGBA8 mip chain from the first one with
+	// a 2x2 box filter. Colors are averaged in linear space, so that the
+	// smaller levels don't get darker than the image; alpha is linear
+	// already.
+	// NOTE: Odd sizes drop their last row or column, like most GPU
+	// implementations of mip generation do.
+	static void build_mips(uint8_t* pixels, uint32_t width, uint32_t height);
+};
+
+} // namespace Resources
@@ -0,0 +1,474 @@
+#include "texture_encoder.h"
+
+#include <string.h>
+#include <math.h>
+#include <cassert>
+
+namespace Resources
+{
+
+// Texels of a block, in rows, RGBA8
+typedef uint8_t BlockTexels[16][4];
+
+static void load_block(const uint8_t* pixels, uint32_t width, uint32_t height, uint32_t block_x, uint32_t block_y, BlockTexels& texels)
+{
+	for (uint32_t y = 0; y < 4; ++y)
+	{
+		uint32_t pixel_y = block_y * 4 + y < height ? block_y * 4 + y : height - 1;
+		for (uint32_t x = 0; x < 4; ++x)
+		{
+			uint32_t pixel_x = block_x * 4 + x < width ? block_x * 4 + x : width - 1;
+			memcpy(texels[y * 4 + x], pixels + (size_t(pixel_y) * width + pixel_x) * 4, 4);
+		}
+	}
+}
+
+// Fits a line through the first channel_count channels of the texels: the
+// mean and the direction of largest variance, found by power iteration on
+// the covariance matrix. Returns the range of the texels along the line,
+// as distances from the mean.
+static void fit_line(const BlockTexels& texels, uint32_t channel_count, float mean[4], float axis[4], float& min_t, float& max_t)
+{
+	for (uint32_t c = 0; c < 4; ++c)
+	{
+		mean[c] = 0.0f;
+		axis[c] = 0.0f;
+	}
+
+	for (uint32_t i = 0; i < 16; ++i)
+	{
+		for (uint32_t c = 0; c < channel_count; ++c)
+		{
+			mean[c] += float(texels[i][c]) / 16.0f;
+		}
+	}
+
+	float covariance[4][4] = {};
+	for (uint32_t i = 0; i < 16; ++i)
+	{
+		for (uint32_t a = 0; a < channel_count; ++a)
+		{
+			for (uint32_t b = 0; b < channel_count; ++b)
+			{
+				covariance[a][b] += (float(texels[i][a]) - mean[a]) * (float(texels[i][b]) - mean[b]);
+			}
+		}
+	}
+
+	// NOTE: Start from the channel with the largest variance, its column
+	// of the covariance matrix is never orthogonal to the axis
+	uint32_t widest = 0;
+	for (uint32_t c = 1; c < channel_count; ++c)
+	{
+		widest = covariance[c][c] > covariance[widest][widest] ? c : widest;
+	}
+	axis[widest] = 1.0f;
+
+	for (uint32_t iteration = 0; iteration < 8; ++iteration)
+	{
+		float next[4] = {};
+		float length = 0.0f;
+		for (uint32_t a = 0; a < channel_count; ++a)
+		{
+			for (uint32_t b = 0; b < channel_count; ++b)
+			{
+				next[a] += covariance[a][b] * axis[b];
+			}
+			length += next[a] * next[a];
+		}
+
+		// Every texel is the same
+		if (length < 1e-6f)
+			break;
+
+		length = sqrtf(length);
+		for (uint32_t c = 0; c < channel_count; ++c)
+		{
+			axis[c] = next[c] / length;
+		}
+	}
+
+	min_t = 0.0f;
+	max_t = 0.0f;
+	for (uint32_t i = 0; i < 16; ++i)
+	{
+		float t = 0.0f;
+		for (uint32_t c = 0; c < channel_count; ++c)
+		{
+			t += (float(texels[i][c]) - mean[c]) * axis[c];
+		}
+		min_t = t < min_t ? t : min_t;
+		max_t = t > max_t ? t : max_t;
+	}
+}
+
+static uint32_t nearest(const int32_t palette[][4], uint32_t palette_count, const uint8_t* texel, uint32_t channel_count)
+{
+	uint32_t best = 0;
+	int32_t best_error = INT32_MAX;
+	for (uint32_t p = 0; p < palette_count; ++p)
+	{
+		int32_t error = 0;
+		for (uint32_t c = 0; c < channel_count; ++c)
+		{
+			int32_t delta = palette[p][c] - int32_t(texel[c]);
+			error += delta * delta;
+		}
+
+		if (error < best_error)
+		{
+			best = p;
+			best_error = error;
+		}
+	}
+
+	return best;
+}
+
+static uint8_t clamp_255(float value)
+{
+	return value <= 0.0f ? 0 : (value >= 255.0f ? 255 : uint8_t(value + 0.5f));
+}
+
+static uint16_t pack_565(const float color[3])
+{
+	uint32_t r = uint32_t(clamp_255(color[0]) * 31 + 127) / 255;
+	uint32_t g = uint32_t(clamp_255(color[1]) * 63 + 127) / 255;
+	uint32_t b = uint32_t(clamp_255(color[2]) * 31 + 127) / 255;
+	return uint16_t((r << 11) | (g << 5) | b);
+}
+
+static void unpack_565(uint16_t packed, int32_t color[4])
+{
+	uint32_t r = (packed >> 11) & 31;
+	uint32_t g = (packed >> 5) & 63;
+	uint32_t b = packed & 31;
+	color[0] = int32_t((r << 3) | (r >> 2));
+	color[1] = int32_t((g << 2) | (g >> 4));
+	color[2] = int32_t((b << 3) | (b >> 2));
+	color[3] = 255;
+}
+
+// BC1 color block, always in 4 colors mode. BC3 uses the same block for
+// its colors.
+static void encode_color_block(const BlockTexels& texels, uint8_t* block)
+{
+	float mean[4];
+	float axis[4];
+	float min_t;
+	float max_t;
+	fit_line(texels, 3, mean, axis, min_t, max_t);
+
+	// NOTE: Pull the endpoints in by 1/16 of the range. The extremes are
+	// rarely hit exactly and the interpolated colors land closer to most
+	// of the texels.
+	float inset = (max_t - min_t) / 16.0f;
+	min_t += inset;
+	max_t -= inset;
+
+	float endpoint_0[3];
+	float endpoint_1[3];
+	for (uint32_t c = 0; c < 3; ++c)
+	{
+		endpoint_0[c] = mean[c] + axis[c] * max_t;
+		endpoint_1[c] = mean[c] + axis[c] * min_t;
+	}
+
+	uint16_t color_0 = pack_565(endpoint_0);
+	uint16_t color_1 = pack_565(endpoint_1);
+	// 4 colors mode needs color_0 > color_1
+	if (color_0 < color_1)
+	{
+		uint16_t swap = color_0;
+		color_0 = color_1;
+		color_1 = swap;
+	}
+
+	uint32_t indices = 0;
+	if (color_0 != color_1)
+	{
+		int32_t palette[4][4];
+		unpack_565(color_0, palette[0]);
+		unpack_565(color_1, palette[1]);
+		for (uint32_t c = 0; c < 4; ++c)
+		{
+			palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+			palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+		}
+
+		for (uint32_t i = 0; i < 16; ++i)
+		{
+			indices |= nearest(palette, 4, texels[i], 3) << (i * 2);
+		}
+	}
+
+	block[0] = uint8_t(color_0);
+	block[1] = uint8_t(color_0 >> 8);
+	block[2] = uint8_t(color_1);
+	block[3] = uint8_t(color_1 >> 8);
+	for (uint32_t b = 0; b < 4; ++b)
+	{
+		block[4 + b] = uint8_t(indices >> (b * 8));
+	}
+}
+
+// BC4 block of one channel, in 8 values mode. BC3 stores its alpha and BC5
+// each of its channels in one.
+static void encode_channel_block(const BlockTexels& texels, uint32_t channel, uint8_t* block)
+{
+	uint8_t value_0 = 0;
+	uint8_t value_1 = 255;
+	for (uint32_t i = 0; i < 16; ++i)
+	{
+		value_0 = texels[i][channel] > value_0 ? texels[i][channel] : value_0;
+		value_1 = texels[i][channel] < value_1 ? texels[i][channel] : value_1;
+	}
+
+	uint64_t indices = 0;
+	if (value_0 != value_1)
+	{
+		int32_t palette[8][4] = {};
+		palette[0][0] = value_0;
+		palette[1][0] = value_1;
+		for (uint32_t p = 2; p < 8; ++p)
+		{
+			palette[p][0] = (int32_t(8 - p) * value_0 + int32_t(p - 1) * value_1) / 7;
+		}
+
+		for (uint32_t i = 0; i < 16; ++i)
+		{
+			uint8_t value = texels[i][channel];
+			indices |= uint64_t(nearest(palette, 8, &value, 1)) << (i * 3);
+		}
+	}
+
+	block[0] = value_0;
+	block[1] = value_1;
+	for (uint32_t b = 0; b < 6; ++b)
+	{
+		block[2 + b] = uint8_t(indices >> (b * 8));
+	}
+}
+
+struct BitWriter
+{
+	uint8_t* data;
+	uint32_t position;
+
+	void write(uint32_t value, uint32_t bit_count)
+	{
+		for (uint32_t i = 0; i < bit_count; ++i, ++position)
+		{
+			if ((value >> i) & 1)
+			{
+				data[position / 8] |= uint8_t(1 << (position % 8));
+			}
+		}
+	}
+};
+
+// BC7 block in mode 6: a single RGBA line with 7 bits endpoints, a p-bit
+// per endpoint and 4 bits indices. Mode 6 handles alpha and opaque texels
+// alike, which keeps the encoder to a single fit per block.
+static void encode_bc7_block(const BlockTexels& texels, uint8_t* block)
+{
+	static const int32_t weights[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+	float mean[4];
+	float axis[4];
+	float min_t;
+	float max_t;
+	fit_line(texels, 4, mean, axis, min_t, max_t);
+
+	// Quantize both endpoints to 7 bits per channel plus a shared p-bit,
+	// keeping the p-bit that gets closer to the line
+	uint32_t quantized[2][4];
+	uint32_t p_bits[2];
+	for (uint32_t e = 0; e < 2; ++e)
+	{
+		float t = e == 0 ? min_t : max_t;
+		float best_error = 1e30f;
+		for (uint32_t p = 0; p < 2; ++p)
+		{
+			uint32_t candidate[4];
+			float error = 0.0f;
+			for (uint32_t c = 0; c < 4; ++c)
+			{
+				float value = float(clamp_255(mean[c] + axis[c] * t));
+				int32_t q = int32_t((value - float(p)) / 2.0f + 0.5f);
+				candidate[c] = q < 0 ? 0 : (q > 127 ? 127 : uint32_t(q));
+				float delta = float((candidate[c] << 1) | p) - value;
+				error += delta * delta;
+			}
+
+			if (error < best_error)
+			{
+				best_error = error;
+				p_bits[e] = p;
+				memcpy(quantized[e], candidate, sizeof(candidate));
+			}
+		}
+	}
+
+	int32_t palette[16][4];
+	for (uint32_t i = 0; i < 16; ++i)
+	{
+		for (uint32_t c = 0; c < 4; ++c)
+		{
+			int32_t endpoint_0 = int32_t((quantized[0][c] << 1) | p_bits[0]);
+			int32_t endpoint_1 = int32_t((quantized[1][c] << 1) | p_bits[1]);
+			palette[i][c] = ((64 - weights[i]) * endpoint_0 + weights[i] * endpoint_1 + 32) >> 6;
+		}
+	}
+
+	uint32_t indices[16];
+	for (uint32_t i = 0; i < 16; ++i)
+	{
+		indices[i] = nearest(palette, 16, texels[i], 4);
+	}
+
+	// The highest bit of the first index is implicit and must be 0: swap
+	// the endpoints when it isn't
+	if (indices[0] & 8)
+	{
+		for (uint32_t c = 0; c < 4; ++c)
+		{
+			uint32_t swap = quantized[0][c];
+			quantized[0][c] = quantized[1][c];
+			quantized[1][c] = swap;
+		}
+
+		uint32_t swap = p_bits[0];
+		p_bits[0] = p_bits[1];
+		p_bits[1] = swap;
+
+		for (uint32_t i = 0; i < 16; ++i)
+		{
+			indices[i] = 15 - indices[i];
+		}
+	}
+
+	memset(block, 0, 16);
+	BitWriter writer = { block, 0 };
+	// Mode 6: six 0 bits and a 1
+	writer.write(1 << 6, 7);
+	for (uint32_t c = 0; c < 4; ++c)
+	{
+		writer.write(quantized[0][c], 7);
+		writer.write(quantized[1][c], 7);
+	}
+	writer.write(p_bits[0], 1);
+	writer.write(p_bits[1], 1);
+	writer.write(indices[0], 3);
+	for (uint32_t i = 1; i < 16; ++i)
+	{
+		writer.write(indices[i], 4);
+	}
+	assert(writer.position == 128);
+}
+
+uint32_t TextureEncoder::block_size(TextureFormat format)
+{
+	switch (format)
+	{
+	case TextureFormat::Rgba8:
+		return 4;
+	case TextureFormat::Bc1:
+		return 8;
+	default:
+		return 16;
+	}
+}
+
+uint32_t TextureEncoder::block_extent(TextureFormat format)
+{
+	return format == TextureFormat::Rgba8 ? 1 : 4;
+}
+
+uint32_t TextureEncoder::block_row_count(TextureFormat format, uint32_t height)
+{
+	uint32_t extent = block_extent(format);
+	return (height + extent - 1) / extent;
+}
+
+size_t TextureEncoder::level_size(TextureFormat format, uint32_t width, uint32_t height)
+{
+	uint32_t extent = block_extent(format);
+	size_t block_count = size_t((width + extent - 1) / extent) * ((height + extent - 1) / extent);
+	return block_count * block_size(format);
+}
+
+size_t TextureEncoder::chain_size(TextureFormat format, uint32_t width, uint32_t height, uint32_t mip_count)
+{
+	size_t size = 0;
+	for (uint32_t level = 0; level < mip_count; ++level)
+	{
+		uint32_t level_width = (width >> level) > 0 ? width >> level : 1;
+		uint32_t level_height = (height >> level) > 0 ? height >> level : 1;
+		size += level_size(format, level_width, level_height);
+	}
+
+	return size;
+}
+
+TextureFormat TextureEncoder::pick_color_format(const uint8_t* pixels, uint32_t width, uint32_t height, bool high_quality)
+{
+	if (high_quality)
+		return TextureFormat::Bc7;
+
+	size_t texel_count = size_t(width) * height;
+	for (size_t i = 0; i < texel_count; ++i)
+	{
+		if (pixels[i * 4 + 3] != 255)
+			return TextureFormat::Bc3;
+	}
+
+	return TextureFormat::Bc1;
+}
+
+void TextureEncoder::encode_rows(TextureFormat format, const uint8_t* pixels, uint32_t width, uint32_t height, uint32_t first_row, uint32_t row_count, uint8_t* blocks)
+{
+	uint32_t size = block_size(format);
+	uint32_t blocks_per_row = (width + 3) / 4;
+	uint8_t* block = blocks + size_t(first_row) * blocks_per_row * size;
+
+	if (format == TextureFormat::Rgba8)
+	{
+		memcpy(block, pixels + size_t(first_row) * width * 4, size_t(row_count) * width * 4);
+		return;
+	}
+
+	for (uint32_t block_y = first_row; block_y < first_row + row_count; ++block_y)
+	{
+		for (uint32_t block_x = 0; block_x < blocks_per_row; ++block_x)
+		{
+			BlockTexels texels;
+			load_block(pixels, width, height, block_x, block_y, texels);
+
+			switch (format)
+			{
+			case TextureFormat::Bc1:
+				encode_color_block(texels, block);
+				break;
+			case TextureFormat::Bc3:
+				encode_channel_block(texels, 3, block);
+				encode_color_block(texels, block + 8);
+				break;
+			case TextureFormat::Bc5:
+				encode_channel_block(texels, 0, block);
+				encode_channel_block(texels, 1, block + 8);
+				break;
+			case TextureFormat::Bc7:
+				encode_bc7_block(texels, block);
+				break;
+			default:
+				assert(false && "Unknown texture format");
+				break;
+			}
+
+			block += size;
+		}
+	}
+}
+
+} // namespace Resources
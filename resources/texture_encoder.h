@@ -0,0 +1,40 @@
+#pragma once
+
+#include "resources.h"
+
+namespace Resources
+{
+
+// Encodes RGBA8 mip levels (see TextureDecoder) to block compressed formats
+// on the CPU, so that cooked packages store textures the GPU samples as
+// they are. Levels are split in rows of 4x4 blocks: the rows of a level
+// can be encoded at once on different threads.
+struct TextureEncoder
+{
+	// Bytes of a block, or of a texel for Rgba8
+	static uint32_t block_size(TextureFormat format);
+	// Texels on each side of a block, 1 for Rgba8
+	static uint32_t block_extent(TextureFormat format);
+	// Rows of blocks of a level of height texels
+	static uint32_t block_row_count(TextureFormat format, uint32_t height);
+
+	// Bytes of a level of width x height texels. Levels smaller than a
+	// block take a whole one.
+	static size_t level_size(TextureFormat format, uint32_t width, uint32_t height);
+	// Bytes of the first mip_count levels of a texture, stored one after
+	// the other
+	static size_t chain_size(TextureFormat format, uint32_t width, uint32_t height, uint32_t mip_count);
+
+	// BC1 for opaque color textures and BC3 for the ones with alpha, or BC7
+	// for both when high_quality is set. pixels is the first RGBA8 level.
+	static TextureFormat pick_color_format(const uint8_t* pixels, uint32_t width, uint32_t height, bool high_quality);
+
+	// Encodes the block rows [first_row, first_row + row_count) of an RGBA8
+	// level of width x height texels. blocks points to the start of the
+	// encoded level. BC5 encodes the red and green channels only.
+	// NOTE: Blocks that go past the edge of the level repeat its last
+	// row and column.
+	static void encode_rows(TextureFormat format, const uint8_t* pixels, uint32_t width, uint32_t height, uint32_t first_row, uint32_t row_count, uint8_t* blocks);
+};
+
+} // namespace Resources
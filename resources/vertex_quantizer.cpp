@@ -0,0 +1,226 @@
+#include "vertex_quantizer.h"
+
+#include <string.h>
+#include <math.h>
+
+namespace Resources
+{
+
+uint16_t VertexQuantizer::float_to_half(float value)
+{
+	// NOTE: Based on Fabian Giesen's float_to_half_fast3_rtne. Halves have
+	// 5 bits of exponent (bias 15) and 10 bits of mantissa.
+	const uint32_t half_max = (127 + 16) << 23;
+	const uint32_t denormal_magic_bits = ((127 - 15) + (23 - 10) + 1) << 23;
+
+	uint32_t bits;
+	memcpy(&bits, &value, sizeof(bits));
+
+	uint32_t sign = bits & 0x80000000u;
+	bits ^= sign;
+
+	uint16_t result;
+	if (bits >= half_max)
+	{
+		// Too big for a half: infinity, NaNs stay NaNs
+		result = bits > 0x7f800000u ? 0x7e00 : 0x7c00;
+	}
+	else if (bits < (113u << 23))
+	{
+		// Denormal half: let the FPU do the rounding by adding a number
+		// whose exponent lines the half mantissa up with the float one
+		float denormal_magic;
+		memcpy(&denormal_magic, &denormal_magic_bits, sizeof(denormal_magic));
+
+		float magnitude;
+		memcpy(&magnitude, &bits, sizeof(magnitude));
+		magnitude += denormal_magic;
+
+		memcpy(&bits, &magnitude, sizeof(bits));
+		result = uint16_t(bits - denormal_magic_bits);
+	}
+	else
+	{
+		// Normal half: rebias the exponent and round to nearest even
+		uint32_t odd_mantissa = (bits >> 13) & 1;
+		bits += ((15u - 127u) << 23) + 0xfff;
+		bits += odd_mantissa;
+		result = uint16_t(bits >> 13);
+	}
+
+	return result | uint16_t(sign >> 16);
+}
+
+float VertexQuantizer::half_to_float(uint16_t value)
+{
+	uint32_t sign = uint32_t(value & 0x8000) << 16;
+	uint32_t exponent = (value >> 10) & 0x1f;
+	uint32_t mantissa = value & 0x3ff;
+
+	float result;
+	if (exponent == 0)
+	{
+		result = float(mantissa) * (1.0f / 16777216.0f);
+		return sign != 0 ? -result : result;
+	}
+
+	uint32_t bits;
+	if (exponent == 31)
+	{
+		bits = sign | 0x7f800000u | (mantissa << 13);
+	}
+	else
+	{
+		bits = sign | ((exponent + 127 - 15) << 23) | (mantissa << 13);
+	}
+
+	memcpy(&result, &bits, sizeof(result));
+	return result;
+}
+
+static float sign_not_zero(float value)
+{
+	return value >= 0.0f ? 1.0f : -1.0f;
+}
+
+static float snorm16_to_float(int16_t value)
+{
+	float result = float(value) / 32767.0f;
+	return result < -1.0f ? -1.0f : result;
+}
+
+static glm::vec3 decode_octahedral(float x, float y)
+{
+	glm::vec3 normal(x, y, 1.0f - fabsf(x) - fabsf(y));
+	if (normal.z < 0.0f)
+	{
+		float folded_x = (1.0f - fabsf(normal.y)) * sign_not_zero(normal.x);
+		float folded_y = (1.0f - fabsf(normal.x)) * sign_not_zero(normal.y);
+		normal.x = folded_x;
+		normal.y = folded_y;
+	}
+
+	return normal / glm::length(normal);
+}
+
+QuantizedNormal VertexQuantizer::encode_normal(glm::vec3 normal)
+{
+	QuantizedNormal result = {};
+
+	float sum = fabsf(normal.x) + fabsf(normal.y) + fabsf(normal.z);
+	if (sum == 0.0f)
+		return result;
+
+	float x = normal.x / sum;
+	float y = normal.y / sum;
+	if (normal.z < 0.0f)
+	{
+		float folded_x = (1.0f - fabsf(y)) * sign_not_zero(x);
+		float folded_y = (1.0f - fabsf(x)) * sign_not_zero(y);
+		x = folded_x;
+		y = folded_y;
+	}
+
+	// NOTE: Rounding each coordinate to the nearest value is not always the
+	// closest direction once decoded, so we try the 4 neighbours and keep
+	// the best one.
+	glm::vec3 unit_normal = normal / glm::length(normal);
+	float base_x = floorf(x * 32767.0f);
+	float base_y = floorf(y * 32767.0f);
+	float best_dot = -2.0f;
+
+	for (uint32_t i = 0; i < 4; ++i)
+	{
+		float candidate_x = base_x + float(i & 1);
+		float candidate_y = base_y + float(i >> 1);
+		if (candidate_x > 32767.0f || candidate_y > 32767.0f)
+			continue;
+
+		int16_t quantized_x = int16_t(candidate_x);
+		int16_t quantized_y = int16_t(candidate_y);
+		float dot = glm::dot(decode_octahedral(snorm16_to_float(quantized_x), snorm16_to_float(quantized_y)), unit_normal);
+		if (dot > best_dot)
+		{
+			best_dot = dot;
+			result.x = quantized_x;
+			result.y = quantized_y;
+		}
+	}
+
+	return result;
+}
+
+glm::vec3 VertexQuantizer::decode_normal(QuantizedNormal normal)
+{
+	return decode_octahedral(snorm16_to_float(normal.x), snorm16_to_float(normal.y));
+}
+
+void VertexQuantizer::quantize_vertices(const glm::vec3* positions, const glm::vec3* normals, const glm::vec2* uvs, uint32_t vertex_count,
+	glm::vec3 bounds_min, glm::vec3 bounds_max,
+	QuantizedPosition* quantized_positions, QuantizedNormal* quantized_normals, QuantizedUv* quantized_uvs,
+	QuantizationError* error)
+{
+	glm::vec3 extent = bounds_max - bounds_min;
+	// NOTE: Flat meshes have a zero extent on one axis, every position
+	// quantizes to 0 on it
+	glm::vec3 inverse_extent(
+		extent.x > 0.0f ? 1.0f / extent.x : 0.0f,
+		extent.y > 0.0f ? 1.0f / extent.y : 0.0f,
+		extent.z > 0.0f ? 1.0f / extent.z : 0.0f);
+
+	float max_position_error = 0.0f;
+	float min_normal_dot = 1.0f;
+	float max_uv_error = 0.0f;
+
+	for (uint32_t i = 0; i < vertex_count; ++i)
+	{
+		// Positions
+		glm::vec3 relative = (positions[i] - bounds_min) * inverse_extent;
+		uint16_t quantized[3];
+		for (uint32_t c = 0; c < 3; ++c)
+		{
+			float value = relative[c];
+			assert(value >= -0.0001f && value <= 1.0001f && "The position is outside of the mesh bounds");
+			value = value < 0.0f ? 0.0f : (value > 1.0f ? 1.0f : value);
+			quantized[c] = uint16_t(value * 65535.0f + 0.5f);
+		}
+
+		quantized_positions[i].x = quantized[0];
+		quantized_positions[i].y = quantized[1];
+		quantized_positions[i].z = quantized[2];
+		quantized_positions[i].w = 0;
+
+		glm::vec3 decoded_position = bounds_min + glm::vec3(quantized[0], quantized[1], quantized[2]) * (1.0f / 65535.0f) * extent;
+		float position_error = glm::length(decoded_position - positions[i]);
+		max_position_error = position_error > max_position_error ? position_error : max_position_error;
+
+		// Normals
+		quantized_normals[i] = encode_normal(normals[i]);
+
+		float normal_length = glm::length(normals[i]);
+		if (normal_length > 0.0f)
+		{
+			float dot = glm::dot(decode_normal(quantized_normals[i]), normals[i] / normal_length);
+			min_normal_dot = dot < min_normal_dot ? dot : min_normal_dot;
+		}
+
+		// Uvs
+		quantized_uvs[i].u = float_to_half(uvs[i].x);
+		quantized_uvs[i].v = float_to_half(uvs[i].y);
+
+		float uv_error_u = fabsf(half_to_float(quantized_uvs[i].u) - uvs[i].x);
+		float uv_error_v = fabsf(half_to_float(quantized_uvs[i].v) - uvs[i].y);
+		float uv_error = uv_error_u > uv_error_v ? uv_error_u : uv_error_v;
+		max_uv_error = uv_error > max_uv_error ? uv_error : max_uv_error;
+	}
+
+	if (error != nullptr)
+	{
+		min_normal_dot = min_normal_dot < -1.0f ? -1.0f : (min_normal_dot > 1.0f ? 1.0f : min_normal_dot);
+		error->position = max_position_error;
+		error->normal = acosf(min_normal_dot) * (180.0f / 3.14159265f);
+		error->uv = max_uv_error;
+	}
+}
+
+} // namespace Resources
@@ -0,0 +1,43 @@
+#pragma once
+
+#include "resources.h"
+
+namespace Resources
+{
+
+// Largest difference between the float vertices of a mesh and their
+// quantized version, decoded back
+struct QuantizationError
+{
+	// In object space units
+	float position = 0.0f;
+	// Angle between the original and the decoded normal, in degrees
+	float normal = 0.0f;
+	float uv = 0.0f;
+};
+
+// Encodes the float vertex streams into the compact ones the GPU reads:
+// 8 bytes positions, 4 bytes normals and 4 bytes uvs, 16 bytes per vertex
+// instead of 32.
+struct VertexQuantizer
+{
+	// IEEE 754 half precision, rounded to nearest
+	static uint16_t float_to_half(float value);
+	static float half_to_float(uint16_t value);
+
+	// Octahedral mapping (Meyer et al. 2010): the unit sphere is projected
+	// on an octahedron and unfolded to a square, then stored as two 16 bits
+	// signed normalized values. Zero length normals encode to +Z.
+	static QuantizedNormal encode_normal(glm::vec3 normal);
+	static glm::vec3 decode_normal(QuantizedNormal normal);
+
+	// Quantizes vertex_count vertices of a mesh. Positions are stored as 16
+	// bits unsigned normalized values relative to the bounds of the mesh,
+	// which must contain every position.
+	static void quantize_vertices(const glm::vec3* positions, const glm::vec3* normals, const glm::vec2* uvs, uint32_t vertex_count,
+		glm::vec3 bounds_min, glm::vec3 bounds_max,
+		QuantizedPosition* quantized_positions, QuantizedNormal* quantized_normals, QuantizedUv* quantized_uvs,
+		QuantizationError* error);
+};
+
+} // namespace Resources
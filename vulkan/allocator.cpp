@@ -0,0 +1,364 @@
+#include "allocator.h"
+#include <stdio.h>
+#include <string.h>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+namespace Vulkan
+{
+
+static uint32_t find_first_set(uint64_t value)
+{
+	assert(value != 0);
+#ifdef _MSC_VER
+	unsigned long index;
+	_BitScanForward64(&index, value);
+	return uint32_t(index);
+#else
+	return uint32_t(__builtin_ctzll(value));
+#endif
+}
+
+static uint32_t node_count(uint32_t order)
+{
+	return uint32_t(Allocator::block_size / (Allocator::min_allocation_size << order));
+}
+
+static uint32_t word_count(uint32_t order)
+{
+	return (node_count(order) + 63) / 64;
+}
+
+static void set_node(uint64_t* nodes, uint32_t index)
+{
+	nodes[index / 64] |= (uint64_t(1) << (index % 64));
+}
+
+static void clear_node(uint64_t* nodes, uint32_t index)
+{
+	nodes[index / 64] &= ~(uint64_t(1) << (index % 64));
+}
+
+static bool test_node(const uint64_t* nodes, uint32_t index)
+{
+	return (nodes[index / 64] & (uint64_t(1) << (index % 64))) != 0;
+}
+
+Allocator::Allocator(VkDevice device, VkPhysicalDevice gpu)
+{
+	this->device = device;
+	vkGetPhysicalDeviceMemoryProperties(gpu, &memory_properties);
+
+	VkPhysicalDeviceProperties properties;
+	vkGetPhysicalDeviceProperties(gpu, &properties);
+	non_coherent_atom_size = properties.limits.nonCoherentAtomSize;
+	// NOTE: Buddy nodes are aligned to at least min_allocation_size, so
+	// atom aligned ranges never spill out of their allocation
+	assert(non_coherent_atom_size <= min_allocation_size);
+
+	assert((min_allocation_size << (order_count - 1)) == block_size);
+}
+
+void Allocator::cleanup()
+{
+	if (allocation_count > 0)
+	{
+		printf("[Allocator]: %u allocations still alive at cleanup\n", allocation_count);
+	}
+
+	for (uint32_t i = 0; i < block_count; ++i)
+	{
+		destroy_block(blocks[i]);
+	}
+
+	block_count = 0;
+}
+
+Allocation Allocator::allocate(const VkMemoryRequirements& memory_requirements, VkMemoryPropertyFlags memory_property_flags, bool linear)
+{
+	Allocation allocation = {};
+	allocation.memory_type = find_memory_type(memory_requirements.memoryTypeBits, memory_property_flags);
+	bool host_visible = (memory_properties.memoryTypes[allocation.memory_type].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) != 0;
+
+	// Buddy nodes are aligned to their own size, so rounding the size up to
+	// the alignment takes care of the alignment requirement as well
+	VkDeviceSize size = memory_requirements.size;
+	if (size < memory_requirements.alignment)
+		size = memory_requirements.alignment;
+
+	uint32_t order = 0;
+	while ((min_allocation_size << order) < size && order < order_count)
+	{
+		order++;
+	}
+
+	allocation.requested_size = memory_requirements.size;
+	allocation_count++;
+	bytes_requested += memory_requirements.size;
+
+	// Allocations bigger than a block get their own device memory
+	if (order == order_count)
+	{
+		VkMemoryAllocateInfo allocate_info = { VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO };
+		allocate_info.allocationSize = memory_requirements.size;
+		allocate_info.memoryTypeIndex = allocation.memory_type;
+		VkResult result = vkAllocateMemory(device, &allocate_info, nullptr, &allocation.memory);
+		assert(result == VK_SUCCESS);
+
+		if (host_visible)
+		{
+			result = vkMapMemory(device, allocation.memory, 0, VK_WHOLE_SIZE, 0, &allocation.mapped);
+			assert(result == VK_SUCCESS);
+		}
+
+		allocation.offset = 0;
+		allocation.size = memory_requirements.size;
+		allocation.block = dedicated_block;
+		allocation.order = order;
+
+		dedicated_count++;
+		dedicated_bytes += allocation.size;
+
+		return allocation;
+	}
+
+	VkDeviceSize offset = 0;
+	uint32_t block_index = block_count;
+	for (uint32_t i = 0; i < block_count; ++i)
+	{
+		Block& block = blocks[i];
+		if (block.memory_type == allocation.memory_type && block.linear == linear && allocate_from_block(block, order, offset))
+		{
+			block_index = i;
+			break;
+		}
+	}
+
+	if (block_index == block_count)
+	{
+		block_index = create_block(allocation.memory_type, linear);
+		bool allocated = allocate_from_block(blocks[block_index], order, offset);
+		assert(allocated);
+	}
+
+	Block& block = blocks[block_index];
+	allocation.memory = block.memory;
+	allocation.offset = offset;
+	allocation.size = min_allocation_size << order;
+	allocation.block = block_index;
+	allocation.order = order;
+	allocation.mapped = block.mapped != nullptr ? (uint8_t*)block.mapped + offset : nullptr;
+
+	return allocation;
+}
+
+void Allocator::free(Allocation& allocation)
+{
+	if (allocation.memory == VK_NULL_HANDLE)
+		return;
+
+	assert(allocation_count > 0);
+	allocation_count--;
+
+	if (allocation.block == dedicated_block)
+	{
+		if (allocation.mapped != nullptr)
+		{
+			vkUnmapMemory(device, allocation.memory);
+		}
+
+		vkFreeMemory(device, allocation.memory, nullptr);
+
+		dedicated_count--;
+		dedicated_bytes -= allocation.size;
+	}
+	else
+	{
+		assert(allocation.block < block_count);
+		Block& block = blocks[allocation.block];
+		assert(block.memory == allocation.memory);
+		free_to_block(block, allocation.order, allocation.offset);
+	}
+
+	bytes_requested -= allocation.requested_size;
+
+	allocation = {};
+}
+
+AllocatorStats Allocator::get_stats()
+{
+	AllocatorStats stats = {};
+	stats.block_count = block_count;
+	stats.dedicated_count = dedicated_count;
+	stats.allocation_count = allocation_count;
+	stats.bytes_reserved = VkDeviceSize(block_count) * block_size + dedicated_bytes;
+	stats.bytes_used = dedicated_bytes;
+	stats.bytes_requested = bytes_requested;
+
+	VkDeviceSize bytes_free = 0;
+	VkDeviceSize largest_free_sum = 0;
+	for (uint32_t i = 0; i < block_count; ++i)
+	{
+		const Block& block = blocks[i];
+		stats.bytes_used += block.used;
+		bytes_free += block_size - block.used;
+
+		for (uint32_t order = order_count; order > 0; --order)
+		{
+			if (block.free_node_count[order - 1] > 0)
+			{
+				VkDeviceSize largest = min_allocation_size << (order - 1);
+				largest_free_sum += largest;
+				if (largest > stats.largest_free)
+				{
+					stats.largest_free = largest;
+				}
+				break;
+			}
+		}
+	}
+
+	// Fragmentation is measured per block: a block whose free memory is all
+	// in a single node is not fragmented, no matter how many blocks we have
+	stats.fragmentation = bytes_free > 0 ? 1.0f - float(double(largest_free_sum) / double(bytes_free)) : 0.0f;
+
+	return stats;
+}
+
+uint32_t Allocator::find_memory_type(uint32_t memory_type_bits, VkMemoryPropertyFlags properties)
+{
+	for (uint32_t i = 0; i < memory_properties.memoryTypeCount; ++i)
+	{
+		VkMemoryType memory_type = memory_properties.memoryTypes[i];
+		if ((memory_type_bits & (1 << i)) != 0 && (memory_type.propertyFlags & properties) == properties)
+		{
+			return i;
+		}
+	}
+
+	assert(!"No compatible memory found");
+	return 0;
+}
+
+uint32_t Allocator::create_block(uint32_t memory_type, bool linear)
+{
+	assert(block_count < max_block_count && "Out of allocator blocks");
+
+	Block& block = blocks[block_count];
+	block = {};
+	block.memory_type = memory_type;
+	block.linear = linear;
+
+	VkMemoryAllocateInfo allocate_info = { VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO };
+	allocate_info.allocationSize = block_size;
+	allocate_info.memoryTypeIndex = memory_type;
+	VkResult result = vkAllocateMemory(device, &allocate_info, nullptr, &block.memory);
+	assert(result == VK_SUCCESS);
+
+	if ((memory_properties.memoryTypes[memory_type].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) != 0)
+	{
+		result = vkMapMemory(device, block.memory, 0, VK_WHOLE_SIZE, 0, &block.mapped);
+		assert(result == VK_SUCCESS);
+	}
+
+	for (uint32_t order = 0; order < order_count; ++order)
+	{
+		uint32_t words = word_count(order);
+		block.free_nodes[order] = new uint64_t[words];
+		memset(block.free_nodes[order], 0, words * sizeof(uint64_t));
+	}
+
+	// The whole block starts as a single free node
+	set_node(block.free_nodes[order_count - 1], 0);
+	block.free_node_count[order_count - 1] = 1;
+
+	printf("[Allocator]: Created block %u (memory type %u, %s)\n", block_count, memory_type, linear ? "linear" : "optimal");
+
+	return block_count++;
+}
+
+void Allocator::destroy_block(Block& block)
+{
+	if (block.mapped != nullptr)
+	{
+		vkUnmapMemory(device, block.memory);
+	}
+
+	vkFreeMemory(device, block.memory, nullptr);
+
+	for (uint32_t order = 0; order < order_count; ++order)
+	{
+		delete[] block.free_nodes[order];
+	}
+
+	block = {};
+}
+
+bool Allocator::allocate_from_block(Block& block, uint32_t order, VkDeviceSize& offset)
+{
+	// Find the smallest free node that fits
+	uint32_t found_order = order;
+	while (found_order < order_count && block.free_node_count[found_order] == 0)
+	{
+		found_order++;
+	}
+
+	if (found_order == order_count)
+		return false;
+
+	uint32_t index = 0;
+	uint32_t words = word_count(found_order);
+	for (uint32_t w = 0; w < words; ++w)
+	{
+		if (block.free_nodes[found_order][w] != 0)
+		{
+			index = w * 64 + find_first_set(block.free_nodes[found_order][w]);
+			break;
+		}
+	}
+
+	clear_node(block.free_nodes[found_order], index);
+	block.free_node_count[found_order]--;
+
+	// Split it down to the requested order, every split frees the right buddy
+	while (found_order > order)
+	{
+		found_order--;
+		index *= 2;
+		set_node(block.free_nodes[found_order], index + 1);
+		block.free_node_count[found_order]++;
+	}
+
+	offset = VkDeviceSize(index) * (min_allocation_size << order);
+	block.used += min_allocation_size << order;
+
+	return true;
+}
+
+void Allocator::free_to_block(Block& block, uint32_t order, VkDeviceSize offset)
+{
+	uint32_t index = uint32_t(offset / (min_allocation_size << order));
+	block.used -= min_allocation_size << order;
+
+	// Merge with the buddy for as long as it is free
+	while (order < order_count - 1)
+	{
+		uint32_t buddy = index ^ 1;
+		if (!test_node(block.free_nodes[order], buddy))
+			break;
+
+		clear_node(block.free_nodes[order], buddy);
+		block.free_node_count[order]--;
+
+		index /= 2;
+		order++;
+	}
+
+	assert(!test_node(block.free_nodes[order], index) && "Double free");
+	set_node(block.free_nodes[order], index);
+	block.free_node_count[order]++;
+}
+
+} // namespace Vulkan
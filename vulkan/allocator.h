@@ -0,0 +1,109 @@
+#pragma once
+
+#include "volk.h"
+#include <cassert>
+
+#if _DEBUG
+#define VULKAN_DEBUG_ENABLED
+#endif
+
+namespace Vulkan
+{
+
+// A sub-allocation returned by the Allocator. Buffers and Images bind
+// to memory at offset and keep the Allocation around to free it.
+struct Allocation
+{
+	VkDeviceMemory memory = VK_NULL_HANDLE;
+	VkDeviceSize offset = 0;
+	// The size actually reserved (the requested size rounded up to a power of two)
+	VkDeviceSize size = 0;
+	VkDeviceSize requested_size = 0;
+	uint32_t memory_type = 0;
+	// Index of the block the allocation lives in, or dedicated_block when
+	// the allocation got its own VkDeviceMemory
+	uint32_t block = 0;
+	uint32_t order = 0;
+	// Host pointer to offset, only valid for host visible memory
+	void* mapped = nullptr;
+};
+
+struct AllocatorStats
+{
+	uint32_t block_count = 0;
+	uint32_t dedicated_count = 0;
+	uint32_t allocation_count = 0;
+	VkDeviceSize bytes_reserved = 0;
+	VkDeviceSize bytes_used = 0;
+	VkDeviceSize bytes_requested = 0;
+	VkDeviceSize largest_free = 0;
+	// 0.0 when all the free memory is in a single contiguous range,
+	// close to 1.0 when it is split in many small ranges
+	float fragmentation = 0.0f;
+};
+
+// A device memory heap. Memory is allocated from the driver in big blocks,
+// one set of blocks per memory type, and sub-allocated with a buddy
+// allocator. Linear resources (buffers, linear images) and optimal tiling
+// images never share a block, so we don't have to care about
+// bufferImageGranularity.
+// Host visible blocks are mapped once when they are created and stay
+// mapped until the allocator is destroyed.
+// NOTE: The allocator is not thread safe.
+struct Allocator
+{
+	static const VkDeviceSize block_size = 64 * 1024 * 1024;
+	static const VkDeviceSize min_allocation_size = 256;
+	// log2(block_size / min_allocation_size) + 1
+	static const uint32_t order_count = 19;
+	static const uint32_t max_block_count = 64;
+	static const uint32_t dedicated_block = ~0u;
+
+	Allocator(VkDevice device, VkPhysicalDevice gpu);
+
+	void cleanup();
+
+	Allocation allocate(const VkMemoryRequirements& memory_requirements, VkMemoryPropertyFlags memory_property_flags, bool linear);
+	void free(Allocation& allocation);
+
+	AllocatorStats get_stats();
+
+	VkDevice device;
+	VkPhysicalDeviceMemoryProperties memory_properties;
+	// Flushed ranges of host visible memory are aligned to it
+	VkDeviceSize non_coherent_atom_size = 1;
+
+private:
+
+	struct Block
+	{
+		VkDeviceMemory memory = VK_NULL_HANDLE;
+		uint32_t memory_type = 0;
+		bool linear = false;
+		void* mapped = nullptr;
+		VkDeviceSize used = 0;
+
+		// One bit per node of each order, set when the node is free.
+		// Order 0 nodes are min_allocation_size bytes, order
+		// (order_count - 1) is the whole block.
+		uint64_t* free_nodes[order_count] = {};
+		uint32_t free_node_count[order_count] = {};
+	};
+
+	Block blocks[max_block_count];
+	uint32_t block_count = 0;
+
+	uint32_t allocation_count = 0;
+	uint32_t dedicated_count = 0;
+	VkDeviceSize dedicated_bytes = 0;
+	VkDeviceSize bytes_requested = 0;
+
+	uint32_t find_memory_type(uint32_t memory_type_bits, VkMemoryPropertyFlags properties);
+
+	uint32_t create_block(uint32_t memory_type, bool linear);
+	void destroy_block(Block& block);
+	bool allocate_from_block(Block& block, uint32_t order, VkDeviceSize& offset);
+	void free_to_block(Block& block, uint32_t order, VkDeviceSize offset);
+};
+
+} // namespace Vulkan
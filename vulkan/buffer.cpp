@@ -4,26 +4,28 @@
 namespace Vulkan
 {
 
-Buffer::Buffer(VkDevice device, VkPhysicalDevice gpu, VkBufferUsageFlags usage_flags, VkMemoryPropertyFlags memory_property_flags, VkDeviceSize size, VkSharingMode sharing_mode, bool align)
+Buffer::Buffer(VkDevice device, Allocator* allocator, VkBufferUsageFlags usage_flags, VkMemoryPropertyFlags memory_property_flags, VkDeviceSize size, VkSharingMode sharing_mode, bool align)
 {
 	if (align)
 	{
 		this->size = ((size - 1) / 256 + 1) * 256;
 	}
+	else
 	{
 		this->size = size;
 	}
 	this->usage = usage_flags;
+	this->allocator = allocator;
 
 	// Create the buffer handle
 	VkBufferCreateInfo buffer_info = { VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO };
-	buffer_info.size = size;
+	buffer_info.size = this->size;
 	buffer_info.usage = usage_flags;
 	buffer_info.sharingMode = sharing_mode;
 	VkResult result = vkCreateBuffer(device, &buffer_info, nullptr, &buffer);
 	assert(result == VK_SUCCESS);
 
-	// Allocate the memory backing the buffer handle
+	// Sub-allocate the memory backing the buffer handle
 	VkMemoryRequirements memory_requirements;
 	vkGetBufferMemoryRequirements(device, buffer, &memory_requirements);
 
@@ -32,65 +34,71 @@ Buffer::Buffer(VkDevice device, VkPhysicalDevice gpu, VkBufferUsageFlags usage_f
 		assert(256 == memory_requirements.alignment);
 	}
 
-	VkMemoryAllocateInfo allocate_info = { VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO };
-	allocate_info.allocationSize = memory_requirements.size;
-	allocate_info.memoryTypeIndex = find_memory_type(gpu, memory_requirements.memoryTypeBits, memory_property_flags);
-	result = vkAllocateMemory(device, &allocate_info, nullptr, &device_memory);
-	assert(result == VK_SUCCESS);
+	allocation = allocator->allocate(memory_requirements, memory_property_flags, true);
 
 	// Attach the memory to the buffer object
-	result = vkBindBufferMemory(device, buffer, device_memory, 0);
+	result = vkBindBufferMemory(device, buffer, allocation.memory, allocation.offset);
 	assert(result == VK_SUCCESS);
 }
 
 VkResult Buffer::map(VkDevice device, VkDeviceSize size, VkDeviceSize offset)
 {
-	return vkMapMemory(device, device_memory, offset, size, 0, &mapped);
+	// NOTE: Host visible memory is persistently mapped by the allocator,
+	// so mapping a buffer is just pointer arithmetic
+	if (allocation.mapped == nullptr)
+		return VK_ERROR_MEMORY_MAP_FAILED;
+
+	assert(offset <= this->size && (size == VK_WHOLE_SIZE || offset + size <= this->size) && "Mapping past the end of the buffer");
+	if (offset > this->size || (size != VK_WHOLE_SIZE && offset + size > this->size))
+		return VK_ERROR_MEMORY_MAP_FAILED;
+
+	mapped = (uint8_t*)allocation.mapped + offset;
+	mapped_offset = offset;
+	mapped_size = size == VK_WHOLE_SIZE ? this->size - offset : size;
+	return VK_SUCCESS;
 }
 
 void Buffer::unmap(VkDevice device)
 {
-	if (mapped)
-	{
-		vkUnmapMemory(device, device_memory);
-		mapped = nullptr;
-	}
+	mapped = nullptr;
+	mapped_offset = 0;
+	mapped_size = 0;
 }
 
 VkResult Buffer::flush(VkDevice device, VkDeviceSize size, VkDeviceSize offset)
 {
+	VkDeviceSize end = offset + size;
+	if (size == VK_WHOLE_SIZE)
+	{
+		end = mapped != nullptr ? mapped_offset + mapped_size : this->size;
+	}
+	assert(offset <= end && end <= this->size && "Flushing past the end of the buffer");
+
+	// NOTE: The range must start and end on a multiple of
+	// nonCoherentAtomSize (or at the end of the memory). Allocations are
+	// aligned to at least an atom, the widened range stays in them.
+	// VK_WHOLE_SIZE would flush up to the end of the allocator block.
+	VkDeviceSize atom_size = allocator->non_coherent_atom_size;
+	VkDeviceSize begin = (allocation.offset + offset) / atom_size * atom_size;
+	VkDeviceSize aligned_end = (allocation.offset + end + atom_size - 1) / atom_size * atom_size;
+	if (aligned_end > allocation.offset + allocation.size)
+		aligned_end = allocation.offset + allocation.size;
+
 	VkMappedMemoryRange mapped_range = {};
 	mapped_range.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
-	mapped_range.memory = device_memory;
-	mapped_range.offset = offset;
-	mapped_range.size = size;
+	mapped_range.memory = allocation.memory;
+	mapped_range.offset = begin;
+	mapped_range.size = aligned_end - begin;
 	return vkFlushMappedMemoryRanges(device, 1, &mapped_range);
 }
 
 void Buffer::destroy(VkDevice device)
 {
-	vkFreeMemory(device, device_memory, nullptr);
 	vkDestroyBuffer(device, buffer, nullptr);
+	allocator->free(allocation);
 
-	device_memory = VK_NULL_HANDLE;
+	mapped = nullptr;
 	buffer = VK_NULL_HANDLE;
 }
 
-uint32_t Buffer::find_memory_type(VkPhysicalDevice gpu, uint32_t memory_type_bits, VkMemoryPropertyFlags properties)
-{
-	VkPhysicalDeviceMemoryProperties memoryProperties;
-	vkGetPhysicalDeviceMemoryProperties(gpu, &memoryProperties);
-
-	for (uint32_t i = 0; i < VK_MAX_MEMORY_TYPES; ++i)
-	{
-		VkMemoryType memoryType = memoryProperties.memoryTypes[i];
-		if ((memory_type_bits & (1 << i)) != 0 && (memoryType.propertyFlags & properties) == properties)
-		{
-			return i;
-		}
-	}
-
-	assert(!"No compatible memory found");
-}
-
 } // namespace Vulkan
\ No newline at end of file
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "volk.h"
+#include "allocator.h"
 #include <cassert>
 
 #if _DEBUG
@@ -12,21 +13,28 @@ namespace Vulkan
 
 struct Buffer
 {
-	Buffer(VkDevice device, VkPhysicalDevice gpu, VkBufferUsageFlags usageFlags, VkMemoryPropertyFlags memoryPropertyFlags, VkDeviceSize size, VkSharingMode sharing_mode = VK_SHARING_MODE_EXCLUSIVE, bool align = false);
+	Buffer(VkDevice device, Allocator* allocator, VkBufferUsageFlags usageFlags, VkMemoryPropertyFlags memoryPropertyFlags, VkDeviceSize size, VkSharingMode sharing_mode = VK_SHARING_MODE_EXCLUSIVE, bool align = false);
 	void destroy(VkDevice device);
+	// Maps [offset, offset + size) of the buffer, VK_WHOLE_SIZE maps up to
+	// its end
 	VkResult map(VkDevice device, VkDeviceSize size = VK_WHOLE_SIZE, VkDeviceSize offset = 0);
 	void unmap(VkDevice device);
+	// Flushes [offset, offset + size) of the buffer, VK_WHOLE_SIZE flushes up
+	// to the end of the mapped range. The range is widened to
+	// nonCoherentAtomSize.
 	VkResult flush(VkDevice device, VkDeviceSize size = VK_WHOLE_SIZE, VkDeviceSize offset = 0);
 	
 	VkBuffer buffer = VK_NULL_HANDLE;
-	VkDeviceMemory device_memory = VK_NULL_HANDLE;
+	// NOTE: The memory is owned by the allocator and shared with other
+	// resources, the buffer starts at allocation.offset
+	Allocator* allocator = nullptr;
+	Allocation allocation = {};
 	VkDeviceSize size = 0;
 	VkBufferUsageFlags usage;
 	void* mapped = nullptr;
-
-private:
-
-	uint32_t find_memory_type(VkPhysicalDevice physicalDevice, uint32_t memoryTypeBits, VkMemoryPropertyFlags properties);
+	// The range of the buffer map made available
+	VkDeviceSize mapped_offset = 0;
+	VkDeviceSize mapped_size = 0;
 };
 
 } // namespace Vulkan
\ No newline at end of file
@@ -10,12 +10,12 @@ Context::Context()
 {
 }
 
-bool Context::init()
+bool Context::init(bool headless)
 {
 	bool result = init_vulkan();
 	assert(result);
 
-	result = create_instance();
+	result = create_instance(headless);
 	assert(result);
 
 	return true;
@@ -78,9 +78,30 @@ bool Context::create_device(const char** device_required_extensions, uint32_t de
 	// Enable anisotropy
 	// TODO: Check for support first
 	gpu_enabled_features.samplerAnisotropy = VK_TRUE;
+	// Cooked packages store block compressed textures
+	gpu_enabled_features.textureCompressionBC = gpu_features.textureCompressionBC;
+	// Instanced indirect draws start at an instance of the instance buffer
+	gpu_enabled_features.drawIndirectFirstInstance = gpu_features.drawIndirectFirstInstance;
+	// Multi draw indirect: many draws per indirect call, each of which
+	// picks its material texture in an array
+	gpu_enabled_features.multiDrawIndirect = gpu_features.multiDrawIndirect;
+	gpu_enabled_features.shaderSampledImageArrayDynamicIndexing = gpu_features.shaderSampledImageArrayDynamicIndexing;
+
+	// gl_DrawID, which multi draw indirect draws read their draw data with
+	VkPhysicalDeviceShaderDrawParametersFeatures shader_draw_parameters_features = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SHADER_DRAW_PARAMETERS_FEATURES };
+	VkPhysicalDeviceFeatures2 gpu_features2 = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2 };
+	gpu_features2.pNext = &shader_draw_parameters_features;
+	vkGetPhysicalDeviceFeatures2(gpu, &gpu_features2);
+	shader_draw_parameters = shader_draw_parameters_features.shaderDrawParameters == VK_TRUE;
+
+	// Timeline semaphores, used to track asynchronous uploads
+	VkPhysicalDeviceTimelineSemaphoreFeaturesKHR timeline_semaphore_features = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES_KHR };
+	timeline_semaphore_features.timelineSemaphore = VK_TRUE;
+	timeline_semaphore_features.pNext = &shader_draw_parameters_features;
 
 	// Device create info
 	VkDeviceCreateInfo device_create_info = { VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO };
+	device_create_info.pNext = &timeline_semaphore_features;
 	device_create_info.pQueueCreateInfos = queue_create_info;
 	device_create_info.queueCreateInfoCount = queue_count;
 	device_create_info.pEnabledFeatures = &gpu_enabled_features;
@@ -100,10 +121,12 @@ bool Context::create_device(const char** device_required_extensions, uint32_t de
 	VkResult result = vkCreateDevice(gpu, &device_create_info, nullptr, &device);
 	assert(result == VK_SUCCESS);
 
+	allocator = new Allocator(device, gpu);
+
 	return true;
 }
 
-bool Context::create_instance()
+bool Context::create_instance(bool headless)
 {
 	// Query for the supported Vulkan API Version
 	uint32_t supported_api_version = volkGetInstanceVersion();
@@ -120,20 +143,39 @@ bool Context::create_instance()
 
 	// Required extensions
 	// TODO: VK_KHR_WIN32_SURFACE_EXTENSION_NAME should come from the WSI
-	const char* required_extensions[] = 
+	const char* surface_extensions[] = 
 	{
 		VK_KHR_SURFACE_EXTENSION_NAME,
 #ifdef VK_USE_PLATFORM_WIN32_KHR
 		VK_KHR_WIN32_SURFACE_EXTENSION_NAME,
 #endif
+	};
 
-#ifdef VULKAN_DEBUG_ENABLED
+	const char* debug_extensions[] =
+	{
 		VK_EXT_DEBUG_REPORT_EXTENSION_NAME,
 		VK_EXT_DEBUG_UTILS_EXTENSION_NAME,
-#endif
 	};
 
-	uint32_t required_extension_count = ARRAYSIZE(required_extensions);
+	// NOTE: A headless instance doesn't need any surface extension, which
+	// might not even be exposed by the ICD (ie lavapipe without a display)
+	const char* required_extensions[ARRAYSIZE(surface_extensions) + ARRAYSIZE(debug_extensions)];
+	uint32_t required_extension_count = 0;
+
+	if (!headless)
+	{
+		for (uint32_t i = 0; i < ARRAYSIZE(surface_extensions); ++i)
+		{
+			required_extensions[required_extension_count++] = surface_extensions[i];
+		}
+	}
+
+#ifdef VULKAN_DEBUG_ENABLED
+	for (uint32_t i = 0; i < ARRAYSIZE(debug_extensions); ++i)
+	{
+		required_extensions[required_extension_count++] = debug_extensions[i];
+	}
+#endif
 
 	// Query for available global extensions
 	VkResult result = vkEnumerateInstanceExtensionProperties(nullptr, &available_extensions_count, nullptr);
@@ -193,6 +235,13 @@ void Context::cleanup()
 	destroy_debug_report_callback();
 	destroy_debug_utils_messenger();
 
+	if (allocator != nullptr)
+	{
+		allocator->cleanup();
+		delete allocator;
+		allocator = nullptr;
+	}
+
 	vkDestroyDevice(device, nullptr);
 	device = VK_NULL_HANDLE;
 
@@ -275,17 +324,21 @@ bool Context::pick_suitable_gpu(VkSurfaceKHR surface, const char** gpu_required_
 			}
 
 			// Check for swap chain details support
-			// 
-			// Surface Format and Color Space
-			uint32_t available_format_count = 0;
-			vkGetPhysicalDeviceSurfaceFormatsKHR(available_gpus[i], surface, &available_format_count, nullptr);
-			// Present Mode
-			uint32_t available_present_mode_count = 0;
-			vkGetPhysicalDeviceSurfacePresentModesKHR(available_gpus[i], surface, &available_present_mode_count, nullptr);
-
-			// The current physical device doesn't support any format or any present mode, we move on to the next
-			if (available_format_count == 0 || available_present_mode_count == 0)
-				continue;
+			// NOTE: Headless contexts don't have a surface, and render
+			// to offscreen images instead.
+			if (surface != VK_NULL_HANDLE)
+			{
+				// Surface Format and Color Space
+				uint32_t available_format_count = 0;
+				vkGetPhysicalDeviceSurfaceFormatsKHR(available_gpus[i], surface, &available_format_count, nullptr);
+				// Present Mode
+				uint32_t available_present_mode_count = 0;
+				vkGetPhysicalDeviceSurfacePresentModesKHR(available_gpus[i], surface, &available_present_mode_count, nullptr);
+
+				// The current physical device doesn't support any format or any present mode, we move on to the next
+				if (available_format_count == 0 || available_present_mode_count == 0)
+					continue;
+			}
 
 			// Check for graphics queue support
 			QueueFamilyIndices queue_family_indices = find_queue_families(available_gpus[i], surface);
@@ -336,10 +389,15 @@ QueueFamilyIndices Context::find_queue_families(VkPhysicalDevice gpu, VkSurfaceK
 	// Look for graphics and present queues
 	for (uint32_t i = 0; i < queue_family_count; ++i)
 	{
-		VkQueueFlags required = VK_QUEUE_GRAPHICS_BIT;
+		// NOTE: The renderer records compute passes (culling) on the graphics queue
+		VkQueueFlags required = VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT;
 
-		VkBool32 present_support = VK_FALSE;
-		vkGetPhysicalDeviceSurfaceSupportKHR(gpu, i, surface, &present_support);
+		// NOTE: Without a surface we never present, so any graphics queue will do
+		VkBool32 present_support = VK_TRUE;
+		if (surface != VK_NULL_HANDLE)
+		{
+			vkGetPhysicalDeviceSurfaceSupportKHR(gpu, i, surface, &present_support);
+		}
 
 		if (present_support && ((queue_families[i].queueFlags & required) == required))
 		{
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "volk.h"
+#include "allocator.h"
 
 #if _DEBUG
 #define VULKAN_DEBUG_ENABLED
@@ -33,6 +34,8 @@ struct Context
 	VkPhysicalDeviceProperties gpu_properties = {};
 	VkPhysicalDeviceFeatures gpu_features = {};
 	VkPhysicalDeviceFeatures gpu_enabled_features = {};
+	// VkPhysicalDeviceShaderDrawParametersFeatures, enabled when supported
+	bool shader_draw_parameters = false;
 	VkSampleCountFlagBits msaa_samples = VK_SAMPLE_COUNT_1_BIT;
 
 	VkQueue graphics_queue = VK_NULL_HANDLE;
@@ -40,10 +43,18 @@ struct Context
 	uint32_t graphics_family_index = VK_QUEUE_FAMILY_IGNORED;
 	uint32_t transfer_family_index = VK_QUEUE_FAMILY_IGNORED;
 
+	// Device memory heap every Buffer and Image sub-allocates from.
+	// Created together with the logical device.
+	Allocator* allocator = nullptr;
+
 	Context();
 	~Context() {}
 
-	bool init();
+	// NOTE: A headless context doesn't enable any surface extension and
+	// can pick a GPU without a surface (pass VK_NULL_HANDLE to
+	// pick_suitable_gpu), so it works on software ICDs like lavapipe
+	// on machines without a display.
+	bool init(bool headless = false);
 	void cleanup();
 
 	bool pick_suitable_gpu(VkSurfaceKHR surface, const char** gpu_required_extensions, uint32_t gpu_required_extension_count);
@@ -54,7 +65,7 @@ private:
 
 	// Helpers
 	bool init_vulkan();
-	bool create_instance();
+	bool create_instance(bool headless);
 
 	// Vulkan Instance
 	//
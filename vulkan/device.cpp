@@ -1,6 +1,7 @@
 #include "device.h"
 #include <cassert>
 #include <stdio.h>
+#include <string.h>
 
 namespace Vulkan
 {
@@ -13,6 +14,7 @@ Device::Device(WSI* wsi, Context* context) : wsi(wsi), context(context)
 void Device::init()
 {
 	create_command_pools();
+	create_upload_timeline();
 	create_gpu_buffers();
 	create_color_buffer();
 	create_depth_buffer();
@@ -35,81 +37,458 @@ void Device::cleanup()
 	destroy_sync_objects();
 	destroy_render_pass();
 
+	if (read_back_buffer != nullptr)
+	{
+		read_back_buffer->destroy(context->device);
+		delete read_back_buffer;
+		read_back_buffer = nullptr;
+	}
+
 	free_command_buffers();
 	destroy_depth_buffer();
 	destroy_color_buffer();
+	destroy_upload_timeline();
 	free_gpu_buffers();
 	destroy_command_pools();
 	destroy_framebuffers();
 }
 
-VkDeviceSize Device::upload_vertex_buffer(Vulkan::Buffer* staging_buffer)
+VkDeviceSize Device::upload_vertex_buffer(const Vulkan::StagingSlice& staging_slice)
 {
-	VkDeviceSize vertex_offset = vertex_head_cursor;
-	// NOTE: For now we're copying the whole content of the buffer (staging_buffer->size)
-	// from its start offset (0). In the future we might want to take both information
-	// as input
-	VkCommandBuffer copy_cmd = create_transfer_command_buffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY);
+	return enqueue_buffer_upload(staging_slice, vertex_buffer, vertex_head_cursor, VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT);
+}
 
-	VkBufferCopy copy_region = {};
-	copy_region.srcOffset = 0;
-	copy_region.dstOffset = vertex_head_cursor;
-	copy_region.size = staging_buffer->size;
+VkDeviceSize Device::upload_index_buffer(const Vulkan::StagingSlice& staging_slice)
+{
+	return enqueue_buffer_upload(staging_slice, index_buffer, index_head_cursor, VK_ACCESS_INDEX_READ_BIT | VK_ACCESS_SHADER_READ_BIT);
+}
 
-	vkCmdCopyBuffer(copy_cmd, staging_buffer->buffer, vertex_buffer->buffer, 1, &copy_region);
+VkDeviceSize Device::upload_uniform_buffer(const Vulkan::StagingSlice& staging_slice)
+{
+	return enqueue_buffer_upload(staging_slice, uniform_buffer, uniform_head_cursor, VK_ACCESS_UNIFORM_READ_BIT);
+}
 
-	flush_transfer_command_buffer(copy_cmd);
+VkDeviceSize Device::upload_storage_buffer(const Vulkan::StagingSlice& staging_slice)
+{
+	return enqueue_buffer_upload(staging_slice, storage_buffer, storage_head_cursor, VK_ACCESS_SHADER_READ_BIT);
+}
 
-	vertex_head_cursor += staging_buffer->size;
+VkDeviceSize Device::reserve_vertex_buffer(VkDeviceSize size)
+{
+	return reserve_buffer_range(vertex_buffer, vertex_head_cursor, size);
+}
 
-	return vertex_offset;
+VkDeviceSize Device::reserve_index_buffer(VkDeviceSize size)
+{
+	return reserve_buffer_range(index_buffer, index_head_cursor, size);
 }
 
-VkDeviceSize Device::upload_index_buffer(Vulkan::Buffer* staging_buffer)
+VkDeviceSize Device::reserve_storage_buffer(VkDeviceSize size)
 {
-	VkDeviceSize index_offset = index_head_cursor;
-	// NOTE: For now we're copying the whole content of the buffer (staging_buffer->size)
-	// from its start offset (0). In the future we might want to take both information
-	// as input
-	VkCommandBuffer copy_cmd = create_transfer_command_buffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY);
+	return reserve_buffer_range(storage_buffer, storage_head_cursor, size);
+}
 
-	VkBufferCopy copy_region = {};
-	copy_region.srcOffset = 0;
-	copy_region.dstOffset = index_head_cursor;
-	copy_region.size = staging_buffer->size;
+void Device::update_vertex_buffer(const Vulkan::StagingSlice& staging_slice, VkDeviceSize offset)
+{
+	assert(offset + staging_slice.size <= vertex_head_cursor && "Updates must target uploaded or reserved ranges");
+	record_buffer_copy(staging_slice, vertex_buffer, offset, VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT);
+}
+
+void Device::update_index_buffer(const Vulkan::StagingSlice& staging_slice, VkDeviceSize offset)
+{
+	assert(offset + staging_slice.size <= index_head_cursor && "Updates must target uploaded or reserved ranges");
+	record_buffer_copy(staging_slice, index_buffer, offset, VK_ACCESS_INDEX_READ_BIT | VK_ACCESS_SHADER_READ_BIT);
+}
+
+void Device::update_uniform_buffer(const Vulkan::StagingSlice& staging_slice, VkDeviceSize offset)
+{
+	assert(offset + staging_slice.size <= uniform_head_cursor && "Updates must target uploaded or reserved ranges");
+	record_buffer_copy(staging_slice, uniform_buffer, offset, VK_ACCESS_UNIFORM_READ_BIT);
+}
 
-	vkCmdCopyBuffer(copy_cmd, staging_buffer->buffer, index_buffer->buffer, 1, &copy_region);
+void Device::update_storage_buffer(const Vulkan::StagingSlice& staging_slice, VkDeviceSize offset)
+{
+	assert(offset + staging_slice.size <= storage_head_cursor && "Updates must target uploaded or reserved ranges");
+	record_buffer_copy(staging_slice, storage_buffer, offset, VK_ACCESS_SHADER_READ_BIT);
+}
 
-	flush_transfer_command_buffer(copy_cmd);
+VkCommandBuffer Device::begin_upload_batch()
+{
+	if (upload_command_buffer == VK_NULL_HANDLE)
+	{
+		VkCommandBufferAllocateInfo command_buffer_ai = { VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO };
+		command_buffer_ai.commandPool = transfer_command_pool;
+		command_buffer_ai.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+		command_buffer_ai.commandBufferCount = 1;
 
-	index_head_cursor += staging_buffer->size;
+		VkResult result = vkAllocateCommandBuffers(context->device, &command_buffer_ai, &upload_command_buffer);
+		assert(result == VK_SUCCESS);
 
-	return index_offset;
+		VkCommandBufferBeginInfo command_buffer_bi = { VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO };
+		command_buffer_bi.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+		result = vkBeginCommandBuffer(upload_command_buffer, &command_buffer_bi);
+		assert(result == VK_SUCCESS);
+	}
+
+	return upload_command_buffer;
+}
+
+VkDeviceSize Device::enqueue_buffer_upload(const Vulkan::StagingSlice& staging_slice, Vulkan::Buffer* buffer, VkDeviceSize& head_cursor, VkAccessFlags dst_access)
+{
+	VkDeviceSize offset = reserve_buffer_range(buffer, head_cursor, staging_slice.size);
+	record_buffer_copy(staging_slice, buffer, offset, dst_access);
+	return offset;
 }
 
-VkDeviceSize Device::upload_uniform_buffer(Vulkan::Buffer* staging_buffer)
+VkDeviceSize Device::reserve_buffer_range(Vulkan::Buffer* buffer, VkDeviceSize& head_cursor, VkDeviceSize size)
 {
-	VkDeviceSize uniform_offset = uniform_head_cursor;
-	// NOTE: For now we're copying the whole content of the buffer (staging_buffer->size)
-	// from its start offset (0). In the future we might want to take both information
-	// as input
-	VkCommandBuffer copy_cmd = create_transfer_command_buffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY);
+	VkDeviceSize offset = head_cursor;
+	assert(offset + size <= buffer->size && "The destination buffer is full");
+
+	head_cursor += size;
+	return offset;
+}
+
+void Device::record_buffer_copy(const Vulkan::StagingSlice& staging_slice, Vulkan::Buffer* buffer, VkDeviceSize offset, VkAccessFlags dst_access)
+{
+	begin_upload_batch();
 
 	VkBufferCopy copy_region = {};
-	copy_region.srcOffset = 0;
-	copy_region.dstOffset = uniform_head_cursor;
-	copy_region.size = staging_buffer->size;
+	copy_region.srcOffset = staging_slice.offset;
+	copy_region.dstOffset = offset;
+	copy_region.size = staging_slice.size;
+
+	vkCmdCopyBuffer(upload_command_buffer, staging_slice.buffer, buffer->buffer, 1, &copy_region);
+
+	// When the transfer and graphics queues belong to different families the
+	// written range has to be released by the transfer queue and acquired by
+	// the graphics queue. On a single family the timeline semaphore wait is
+	// enough.
+	if (context->transfer_family_index != context->graphics_family_index)
+	{
+		// Uploads to a buffer are contiguous, so most of the time we can
+		// just grow the previous barrier
+		VkBufferMemoryBarrier* last = release_barrier_count > 0 ? &release_barriers[release_barrier_count - 1] : nullptr;
+		if (last != nullptr && last->buffer == buffer->buffer && last->offset + last->size == offset)
+		{
+			last->size += staging_slice.size;
+		}
+		else
+		{
+			assert(release_barrier_count < max_upload_barriers && "Too many upload barriers in a batch");
+
+			VkBufferMemoryBarrier& barrier = release_barriers[release_barrier_count++];
+			barrier = { VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER };
+			barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+			// NOTE: dstAccessMask is ignored by the release, we keep it
+			// around for the acquire on the graphics queue
+			barrier.dstAccessMask = dst_access;
+			barrier.srcQueueFamilyIndex = context->transfer_family_index;
+			barrier.dstQueueFamilyIndex = context->graphics_family_index;
+			barrier.buffer = buffer->buffer;
+			barrier.offset = offset;
+			barrier.size = staging_slice.size;
+		}
+	}
+}
+
+void Device::upload_image(Vulkan::Image* image, const void* data, uint32_t width, uint32_t height, uint32_t block_extent, uint32_t block_size)
+{
+	VkImageMemoryBarrier barrier = { VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER };
+	barrier.srcAccessMask = 0;
+	barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+	barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.image = image->image;
+	barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	barrier.subresourceRange.baseMipLevel = 0;
+	barrier.subresourceRange.levelCount = image->mip_levels;
+	barrier.subresourceRange.baseArrayLayer = 0;
+	barrier.subresourceRange.layerCount = 1;
+
+	vkCmdPipelineBarrier(begin_upload_batch(), VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+	const uint8_t* level_data = static_cast<const uint8_t*>(data);
+	for (uint32_t level = 0; level < image->mip_levels; ++level)
+	{
+		uint32_t level_width = (width >> level) > 0 ? width >> level : 1;
+		uint32_t level_height = (height >> level) > 0 ? height >> level : 1;
+		uint32_t blocks_per_row = (level_width + block_extent - 1) / block_extent;
+		uint32_t block_row_count = (level_height + block_extent - 1) / block_extent;
+		VkDeviceSize row_size = VkDeviceSize(blocks_per_row) * block_size;
+
+		// NOTE: Levels bigger than a staging segment (a 4096x4096 RGBA8
+		// level is 64MB) are staged in bands of whole block rows, each
+		// band copied to its own rows of the level
+		assert(row_size <= STAGING_SEGMENT_SIZE && "Texture row too big for the staging ring");
+		uint32_t band_row_count = uint32_t(STAGING_SEGMENT_SIZE / row_size);
+
+		for (uint32_t block_row = 0; block_row < block_row_count; block_row += band_row_count)
+		{
+			uint32_t row_count = block_row_count - block_row < band_row_count ? block_row_count - block_row : band_row_count;
+			VkDeviceSize band_size = row_size * row_count;
+
+			// NOTE: Every band is recorded before the next one is staged.
+			// When the staging segment is full allocate_staging submits what
+			// is recorded so far and the copies go on in a new batch, the
+			// image stays in TRANSFER_DST_OPTIMAL in between.
+			// NOTE: The default staging alignment is a multiple of every
+			// block size, as vkCmdCopyBufferToImage requires
+			Vulkan::StagingSlice staging_slice = allocate_staging(band_size);
+			memcpy(staging_slice.data, level_data, band_size);
+			level_data += band_size;
+
+			// The last band of a block compressed level can end inside a
+			// block, its extent stops at the edge of the level
+			uint32_t band_y = block_row * block_extent;
+			uint32_t band_height = row_count * block_extent;
+			band_height = band_y + band_height > level_height ? level_height - band_y : band_height;
+
+			VkBufferImageCopy region = {};
+			region.bufferOffset = staging_slice.offset;
+			region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+			region.imageSubresource.mipLevel = level;
+			region.imageSubresource.baseArrayLayer = 0;
+			region.imageSubresource.layerCount = 1;
+			region.imageOffset = { 0, int32_t(band_y), 0 };
+			region.imageExtent = { level_width, band_height, 1 };
+
+			vkCmdCopyBufferToImage(begin_upload_batch(), staging_slice.buffer, image->image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+		}
+	}
+
+	// The transition to SHADER_READ_ONLY_OPTIMAL is recorded when the batch
+	// is submitted, and doubles as the release to the graphics queue family
+	assert(release_image_barrier_count < max_upload_barriers && "Too many upload barriers in a batch");
+	barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+	barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+	barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	if (context->transfer_family_index != context->graphics_family_index)
+	{
+		barrier.srcQueueFamilyIndex = context->transfer_family_index;
+		barrier.dstQueueFamilyIndex = context->graphics_family_index;
+	}
+	release_image_barriers[release_image_barrier_count++] = barrier;
+}
+
+UploadToken Device::submit_uploads()
+{
+	UploadToken token = {};
+
+	if (upload_command_buffer == VK_NULL_HANDLE)
+	{
+		token.value = upload_timeline_value;
+		return token;
+	}
+
+	// Release the written ranges and images to the graphics queue family
+	if (release_barrier_count > 0 || release_image_barrier_count > 0)
+	{
+		VkBufferMemoryBarrier barriers[max_upload_barriers];
+		for (uint32_t i = 0; i < release_barrier_count; ++i)
+		{
+			barriers[i] = release_barriers[i];
+			barriers[i].dstAccessMask = 0;
+		}
+
+		VkImageMemoryBarrier image_barriers[max_upload_barriers];
+		for (uint32_t i = 0; i < release_image_barrier_count; ++i)
+		{
+			image_barriers[i] = release_image_barriers[i];
+			image_barriers[i].dstAccessMask = 0;
+		}
+
+		vkCmdPipelineBarrier(upload_command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr,
+			release_barrier_count, barriers, release_image_barrier_count, image_barriers);
+	}
+
+	VkResult result = vkEndCommandBuffer(upload_command_buffer);
+	assert(result == VK_SUCCESS);
+
+	upload_timeline_value++;
+
+	VkTimelineSemaphoreSubmitInfoKHR timeline_submit_info = { VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO_KHR };
+	timeline_submit_info.signalSemaphoreValueCount = 1;
+	timeline_submit_info.pSignalSemaphoreValues = &upload_timeline_value;
+
+	VkSubmitInfo submit_info = { VK_STRUCTURE_TYPE_SUBMIT_INFO };
+	submit_info.pNext = &timeline_submit_info;
+	submit_info.commandBufferCount = 1;
+	submit_info.pCommandBuffers = &upload_command_buffer;
+	submit_info.signalSemaphoreCount = 1;
+	submit_info.pSignalSemaphores = &upload_timeline_semaphore;
+
+	result = vkQueueSubmit(context->transfer_queue, 1, &submit_info, VK_NULL_HANDLE);
+	assert(result == VK_SUCCESS);
+
+	// The acquire half of the ownership transfer goes into the next frame
+	for (uint32_t i = 0; i < release_barrier_count; ++i)
+	{
+		assert(acquire_barrier_count < max_upload_barriers && "Too many pending acquire barriers");
+		acquire_barriers[acquire_barrier_count++] = release_barriers[i];
+	}
+	release_barrier_count = 0;
+
+	// NOTE: Within a single queue family the layout transition above is
+	// all an image needs, the frame waits on the timeline semaphore
+	for (uint32_t i = 0; i < release_image_barrier_count; ++i)
+	{
+		if (release_image_barriers[i].srcQueueFamilyIndex == release_image_barriers[i].dstQueueFamilyIndex)
+			continue;
+
+		assert(acquire_image_barrier_count < max_upload_barriers && "Too many pending acquire barriers");
+		acquire_image_barriers[acquire_image_barrier_count++] = release_image_barriers[i];
+	}
+	release_image_barrier_count = 0;
+	acquire_wait_value = upload_timeline_value;
+
+	// Keep the command buffer around until the GPU is done with it
+	recycle_upload_batches();
+	upload_batches[upload_batch_count].command_buffer = upload_command_buffer;
+	upload_batches[upload_batch_count].value = upload_timeline_value;
+	upload_batch_count++;
+	upload_command_buffer = VK_NULL_HANDLE;
+
+	token.value = upload_timeline_value;
+	return token;
+}
+
+bool Device::is_upload_complete(UploadToken token)
+{
+	uint64_t value = 0;
+	VkResult result = vkGetSemaphoreCounterValueKHR(context->device, upload_timeline_semaphore, &value);
+	assert(result == VK_SUCCESS);
+
+	return value >= token.value;
+}
+
+void Device::wait_for_upload(UploadToken token)
+{
+	// Make sure the batch the token refers to has been submitted
+	if (token.value > upload_timeline_value)
+	{
+		submit_uploads();
+	}
+
+	VkSemaphoreWaitInfoKHR wait_info = { VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO_KHR };
+	wait_info.semaphoreCount = 1;
+	wait_info.pSemaphores = &upload_timeline_semaphore;
+	wait_info.pValues = &token.value;
+
+	VkResult result = vkWaitSemaphoresKHR(context->device, &wait_info, UINT64_MAX);
+	assert(result == VK_SUCCESS);
+}
+
+void Device::record_upload_acquire_barriers(FrameResources& frame_resources)
+{
+	frame_resources.upload_wait_value = acquire_wait_value;
+	acquire_wait_value = 0;
+
+	if (acquire_barrier_count == 0 && acquire_image_barrier_count == 0)
+		return;
 
-	vkCmdCopyBuffer(copy_cmd, staging_buffer->buffer, uniform_buffer->buffer, 1, &copy_region);
+	for (uint32_t i = 0; i < acquire_barrier_count; ++i)
+	{
+		acquire_barriers[i].srcAccessMask = 0;
+	}
 
-	flush_transfer_command_buffer(copy_cmd);
+	for (uint32_t i = 0; i < acquire_image_barrier_count; ++i)
+	{
+		acquire_image_barriers[i].srcAccessMask = 0;
+	}
 
-	uniform_head_cursor += staging_buffer->size;
+	// NOTE: The source stages match the stages the frame submission waits
+	// on the upload timeline semaphore, so the acquire is ordered after the
+	// release on the transfer queue
+	VkPipelineStageFlags stages = VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+	vkCmdPipelineBarrier(frame_resources.command_buffer, stages, stages, 0, 0, nullptr, acquire_barrier_count, acquire_barriers, acquire_image_barrier_count, acquire_image_barriers);
+
+	acquire_barrier_count = 0;
+	acquire_image_barrier_count = 0;
+}
+
+void Device::recycle_upload_batches()
+{
+	uint64_t completed_value = 0;
+	VkResult result = vkGetSemaphoreCounterValueKHR(context->device, upload_timeline_semaphore, &completed_value);
+	assert(result == VK_SUCCESS);
+
+	// All slots taken: wait for the oldest batch
+	if (upload_batch_count == max_upload_batches && upload_batches[0].value > completed_value)
+	{
+		UploadToken oldest = {};
+		oldest.value = upload_batches[0].value;
+		wait_for_upload(oldest);
+		completed_value = oldest.value;
+	}
+
+	// Batches complete in submission order
+	uint32_t completed = 0;
+	while (completed < upload_batch_count && upload_batches[completed].value <= completed_value)
+	{
+		vkFreeCommandBuffers(context->device, transfer_command_pool, 1, &upload_batches[completed].command_buffer);
+		completed++;
+	}
+
+	for (uint32_t i = completed; i < upload_batch_count; ++i)
+	{
+		upload_batches[i - completed] = upload_batches[i];
+	}
+	upload_batch_count -= completed;
+}
+
+void Device::create_upload_timeline()
+{
+	VkSemaphoreTypeCreateInfoKHR semaphore_type_ci = { VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO_KHR };
+	semaphore_type_ci.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE_KHR;
+	semaphore_type_ci.initialValue = 0;
+
+	VkSemaphoreCreateInfo semaphore_ci = { VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO };
+	semaphore_ci.pNext = &semaphore_type_ci;
+
+	VkResult result = vkCreateSemaphore(context->device, &semaphore_ci, nullptr, &upload_timeline_semaphore);
+	assert(result == VK_SUCCESS);
 
-	return uniform_offset;
+	upload_timeline_value = 0;
 }
 
-void Device::upload_buffer_to_image(VkBuffer buffer, VkImage image, VkFormat format, uint32_t width, uint32_t height, VkImageLayout old_layout, VkImageLayout new_old_layout, VkImageLayout new_layout)
+void Device::destroy_upload_timeline()
+{
+	// Submit whatever is left so the command buffer can be freed
+	submit_uploads();
+	vkQueueWaitIdle(context->transfer_queue);
+	recycle_upload_batches();
+	assert(upload_batch_count == 0);
+
+	vkDestroySemaphore(context->device, upload_timeline_semaphore, nullptr);
+	upload_timeline_semaphore = VK_NULL_HANDLE;
+}
+
+Vulkan::StagingSlice Device::allocate_staging(VkDeviceSize size, VkDeviceSize alignment)
+{
+	assert(size <= STAGING_SEGMENT_SIZE && "Upload too big for the staging ring");
+
+	Vulkan::StagingSlice slice = staging_ring->allocate(size, alignment);
+	if (slice.data == nullptr)
+	{
+		// NOTE: The current segment is full. This should only happen during
+		// big loads: we wait for every pending copy to be done and start
+		// the segment over.
+		printf("[Device]: Staging segment %u full, waiting for the GPU\n", staging_ring->current_segment);
+		submit_uploads();
+		vkDeviceWaitIdle(context->device);
+		staging_ring->begin_segment(staging_ring->current_segment);
+		slice = staging_ring->allocate(size, alignment);
+	}
+
+	assert(slice.data != nullptr);
+	return slice;
+}
+
+void Device::upload_buffer_to_image(const Vulkan::StagingSlice& staging_slice, VkImage image, VkFormat format, uint32_t width, uint32_t height, VkImageLayout old_layout, VkImageLayout new_old_layout, VkImageLayout new_layout)
 {
 	VkCommandBuffer command_buffer = create_transfer_command_buffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY);
 
@@ -141,7 +520,7 @@ void Device::upload_buffer_to_image(VkBuffer buffer, VkImage image, VkFormat for
 	// Copy
 
 	VkBufferImageCopy region = {};
-	region.bufferOffset = 0;
+	region.bufferOffset = staging_slice.offset;
 	region.bufferRowLength = 0;
 	region.bufferImageHeight = 0;
 
@@ -153,7 +532,7 @@ void Device::upload_buffer_to_image(VkBuffer buffer, VkImage image, VkFormat for
 	region.imageOffset = { 0, 0, 0 };
 	region.imageExtent = { width, height, 1 };
 
-	vkCmdCopyBufferToImage(command_buffer, buffer, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+	vkCmdCopyBufferToImage(command_buffer, staging_slice.buffer, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
 
 	// Transition 2
 	barrier.oldLayout = new_old_layout;
@@ -185,29 +564,45 @@ void Device::create_gpu_buffers()
 	// TODO: Figure out the needed size
 	// NOTE: 10 MB
 	uint64_t size = 10 * 1024 * 1024;
+	// NOTE: 32 MB of vertices (1M vertices) and 16 MB of indices, so
+	// that levels with hundreds of thousands of vertices fit
+	uint64_t vertex_buffer_size = 32 * 1024 * 1024;
+	uint64_t index_buffer_size = 16 * 1024 * 1024;
+	// NOTE: 8 MB of meshlets (~170K meshlets)
+	uint64_t storage_buffer_size = 8 * 1024 * 1024;
 	// We'll transfer staging buffers data into it
 	// using offsets and alignments.
 	// https://developer.nvidia.com/vulkan-memory-management
 	vertex_buffer = new Vulkan::Buffer(
 		context->device,
-		context->gpu,
+		context->allocator,
 		VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
 		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-		size);
+		vertex_buffer_size);
 
+	// NOTE: Compute passes read the indices as well
 	index_buffer = new Vulkan::Buffer(
 		context->device,
-		context->gpu,
-		VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+		context->allocator,
+		VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
 		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-		size);
+		index_buffer_size);
 
 	uniform_buffer = new Vulkan::Buffer(
 		context->device,
-		context->gpu,
+		context->allocator,
 		VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
 		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
 		size);
+
+	storage_buffer = new Vulkan::Buffer(
+		context->device,
+		context->allocator,
+		VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+		storage_buffer_size);
+
+	staging_ring = new Vulkan::StagingRing(context->device, context->allocator, MAX_FRAMES_IN_FLIGHT, STAGING_SEGMENT_SIZE);
 }
 
 void Device::free_gpu_buffers()
@@ -215,6 +610,24 @@ void Device::free_gpu_buffers()
 	vertex_buffer->destroy(context->device);
 	index_buffer->destroy(context->device);
 	uniform_buffer->destroy(context->device);
+	storage_buffer->destroy(context->device);
+
+	staging_ring->destroy(context->device);
+	delete staging_ring;
+	staging_ring = nullptr;
+}
+
+void Device::advance_frame()
+{
+	frame_index = (frame_index + 1) % MAX_FRAMES_IN_FLIGHT;
+
+	// Staging slices handed out from now on belong to the new frame. Its
+	// segment was last used by the frame submitted MAX_FRAMES_IN_FLIGHT
+	// frames ago, so once its fence is signaled we can write over it.
+	// NOTE: begin_draw_frame waits on the same fence, so this only moves
+	// the wait a bit earlier, before the simulation update.
+	vkWaitForFences(context->device, 1, &frame_resources[frame_index].drawing_finished_fence, VK_TRUE, UINT64_MAX);
+	staging_ring->begin_segment(frame_index);
 }
 
 void Device::transition_image_layout(VkImage image, VkFormat format, VkImageLayout src_layout, VkImageLayout dst_layout)
@@ -390,20 +803,31 @@ FrameResources& Device::begin_draw_frame()
 
 	// Acquire a swapchain image
 	uint32_t image_index;
-	VkResult result = vkAcquireNextImageKHR(context->device, wsi->swapchain, UINT64_MAX, current_frame.image_acquired_semaphore, VK_NULL_HANDLE, &image_index);
-	if (result == VK_ERROR_OUT_OF_DATE_KHR || wsi->window_resized())
+	VkResult result = VK_SUCCESS;
+	if (wsi->headless)
 	{
-		// TODO: Move the resize logic to its own function
-		wsi->recreate_swapchain();
-		destroy_depth_buffer();
-		create_depth_buffer();
-		destroy_color_buffer();
-		create_color_buffer();
-		// TODO: Should we recreate the render pass as well?
+		// NOTE: Offscreen images are used in a round robin fashion, one per
+		// frame in flight. We already waited on the fence of the frame that
+		// last rendered into it.
+		image_index = frame_index % wsi->swapchain_image_count;
 	}
-	else if (result != VK_SUCCESS && result != VK_SUBOPTIMAL_KHR)
+	else
 	{
-		assert(!"Failed to acquire the next image");
+		result = vkAcquireNextImageKHR(context->device, wsi->swapchain, UINT64_MAX, current_frame.image_acquired_semaphore, VK_NULL_HANDLE, &image_index);
+		if (result == VK_ERROR_OUT_OF_DATE_KHR || wsi->window_resized())
+		{
+			// TODO: Move the resize logic to its own function
+			wsi->recreate_swapchain();
+			destroy_depth_buffer();
+			create_depth_buffer();
+			destroy_color_buffer();
+			create_color_buffer();
+			// TODO: Should we recreate the render pass as well?
+		}
+		else if (result != VK_SUCCESS && result != VK_SUBOPTIMAL_KHR)
+		{
+			assert(!"Failed to acquire the next image");
+		}
 	}
 
 	current_frame.image_index = image_index;
@@ -431,6 +855,17 @@ FrameResources& Device::begin_draw_frame()
 	vkCmdResetQueryPool(current_frame.command_buffer, current_frame.timestamp_query_pool, 0, current_frame.timestamp_query_pool_count);
 	vkCmdWriteTimestamp(current_frame.command_buffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, current_frame.timestamp_query_pool, 0);
 
+	// Kick off any upload recorded since the last frame and take ownership
+	// of what the transfer queue wrote. This has to happen outside of the
+	// render pass.
+	submit_uploads();
+	record_upload_acquire_barriers(current_frame);
+
+	return current_frame;
+}
+
+void Device::begin_render_pass(FrameResources& current_frame)
+{
 	VkRenderPassBeginInfo render_pass_bi = { VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO };
 	render_pass_bi.renderPass = render_pass;
 	render_pass_bi.framebuffer = current_frame.framebuffer;
@@ -447,8 +882,6 @@ FrameResources& Device::begin_draw_frame()
 	// will be embedded in the primary command buffer and no secondary command buffers will
 	// be executed
 	vkCmdBeginRenderPass(current_frame.command_buffer, &render_pass_bi, VK_SUBPASS_CONTENTS_INLINE);
-
-	return current_frame;
 }
 
 void Device::end_draw_frame(FrameResources& current_frame)
@@ -477,10 +910,36 @@ void Device::end_draw_frame(FrameResources& current_frame)
 
 	VkSubmitInfo submit_info = { VK_STRUCTURE_TYPE_SUBMIT_INFO };
 
-	VkSemaphore wait_semaphores[] = { current_frame.image_acquired_semaphore };
-	VkPipelineStageFlags wait_stages[] = { VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT };
+	VkSemaphore wait_semaphores[2];
+	VkPipelineStageFlags wait_stages[2];
+	uint64_t wait_values[2];
+	uint32_t wait_semaphore_count = 0;
+
+	// NOTE: In headless mode nothing is acquired from a presentation engine,
+	// so there is nothing to wait on before rendering
+	if (!wsi->headless)
+	{
+		wait_semaphores[wait_semaphore_count] = current_frame.image_acquired_semaphore;
+		wait_stages[wait_semaphore_count] = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+		wait_values[wait_semaphore_count] = 0;
+		wait_semaphore_count++;
+	}
+
+	// Vertex, index, uniform, storage and image data uploaded for this frame
+	if (current_frame.upload_wait_value > 0)
+	{
+		wait_semaphores[wait_semaphore_count] = upload_timeline_semaphore;
+		wait_stages[wait_semaphore_count] = VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+		wait_values[wait_semaphore_count] = current_frame.upload_wait_value;
+		wait_semaphore_count++;
+	}
+
+	VkTimelineSemaphoreSubmitInfoKHR timeline_submit_info = { VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO_KHR };
+	timeline_submit_info.waitSemaphoreValueCount = wait_semaphore_count;
+	timeline_submit_info.pWaitSemaphoreValues = wait_values;
 
-	submit_info.waitSemaphoreCount = ARRAYSIZE(wait_semaphores);
+	submit_info.pNext = current_frame.upload_wait_value > 0 ? &timeline_submit_info : nullptr;
+	submit_info.waitSemaphoreCount = wait_semaphore_count;
 	submit_info.pWaitSemaphores = wait_semaphores;
 	submit_info.pWaitDstStageMask = wait_stages;
 
@@ -491,7 +950,7 @@ void Device::end_draw_frame(FrameResources& current_frame)
 
 	// Specify the semaphores to signal once the command buffers have finished execution
 	VkSemaphore signal_semaphores[] = { current_frame.ready_to_present_semaphore };
-	submit_info.signalSemaphoreCount = ARRAYSIZE(signal_semaphores);
+	submit_info.signalSemaphoreCount = wsi->headless ? 0 : ARRAYSIZE(signal_semaphores);
 	submit_info.pSignalSemaphores = signal_semaphores;
 
 	// Submit the command buffer to the graphics queue with the current frame fence to signal once
@@ -499,6 +958,14 @@ void Device::end_draw_frame(FrameResources& current_frame)
 	result = vkQueueSubmit(context->graphics_queue, 1, &submit_info, current_frame.drawing_finished_fence);
 	assert(result == VK_SUCCESS);
 
+	last_submitted_frame = frame_index;
+
+	if (wsi->headless)
+	{
+		advance_frame();
+		return;
+	}
+
 	VkPresentInfoKHR present_info = { VK_STRUCTURE_TYPE_PRESENT_INFO_KHR };
 
 	// Specify which semaphores to wait on before presentation can happen
@@ -528,7 +995,65 @@ void Device::end_draw_frame(FrameResources& current_frame)
 		assert(!"Failed to acquire the next image");
 	}
 
-	frame_index = (frame_index + 1) % MAX_FRAMES_IN_FLIGHT;
+	advance_frame();
+}
+
+void Device::read_back_frame(void* pixels)
+{
+	assert(wsi->headless && "Reading back a frame is only supported in headless mode");
+	assert(last_submitted_frame >= 0 && "No frame has been submitted yet");
+
+	FrameResources& frame = frame_resources[last_submitted_frame];
+	VkDeviceSize size = wsi->swapchain_extent.width * wsi->swapchain_extent.height * 4;
+
+	if (read_back_buffer == nullptr)
+	{
+		read_back_buffer = new Vulkan::Buffer(
+			context->device,
+			context->allocator,
+			VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+			size);
+	}
+
+	// Wait for the frame to be rendered. The render pass leaves the offscreen
+	// image in VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, and its dependency to
+	// VK_SUBPASS_EXTERNAL makes the image visible to the copy below
+	vkWaitForFences(context->device, 1, &frame.drawing_finished_fence, VK_TRUE, UINT64_MAX);
+
+	VkCommandBuffer command_buffer = create_graphics_command_buffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY);
+
+	VkBufferImageCopy region = {};
+	region.bufferOffset = 0;
+	region.bufferRowLength = 0;
+	region.bufferImageHeight = 0;
+	region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	region.imageSubresource.mipLevel = 0;
+	region.imageSubresource.baseArrayLayer = 0;
+	region.imageSubresource.layerCount = 1;
+	region.imageOffset = { 0, 0, 0 };
+	region.imageExtent = { wsi->swapchain_extent.width, wsi->swapchain_extent.height, 1 };
+
+	vkCmdCopyImageToBuffer(command_buffer, wsi->swapchain_images[frame.image_index], VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, read_back_buffer->buffer, 1, &region);
+
+	// Make the transfer writes visible to the host
+	VkBufferMemoryBarrier barrier = { VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER };
+	barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+	barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.buffer = read_back_buffer->buffer;
+	barrier.offset = 0;
+	barrier.size = VK_WHOLE_SIZE;
+
+	vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0, 0, nullptr, 1, &barrier, 0, nullptr);
+
+	flush_graphics_command_buffer(command_buffer);
+
+	VkResult result = read_back_buffer->map(context->device, size);
+	assert(result == VK_SUCCESS);
+	memcpy(pixels, read_back_buffer->mapped, size);
+	read_back_buffer->unmap(context->device);
 }
 
 // Internal
@@ -566,7 +1091,9 @@ void Device::create_render_pass()
 	color_attachment_resolve.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
 	color_attachment_resolve.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
 	color_attachment_resolve.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-	color_attachment_resolve.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+	// NOTE: Offscreen images are never presented, but they are the source
+	// of the read back copy
+	color_attachment_resolve.finalLayout = wsi->headless ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
 
 	VkAttachmentReference color_attachment_resolve_ref = {};
 	color_attachment_resolve_ref.attachment = 2;
@@ -577,7 +1104,9 @@ void Device::create_render_pass()
 	depth_buffer_attachment.format = depth_buffer->image_format;
 	depth_buffer_attachment.samples = context->msaa_samples;
 	depth_buffer_attachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-	depth_buffer_attachment.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+	// NOTE: Stored, the renderer builds its depth pyramid from the depth of
+	// the previous frame
+	depth_buffer_attachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
 	depth_buffer_attachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
 	depth_buffer_attachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
 	depth_buffer_attachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
@@ -609,6 +1138,20 @@ void Device::create_render_pass()
 	dependency.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
 	dependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
 
+	// Headless frames are copied out of the resolve attachment. The final
+	// layout transition and the resolve writes have to happen before the
+	// copy reads the image: the implicit dependency at the end of the render
+	// pass only waits for BOTTOM_OF_PIPE, with no access made visible.
+	VkSubpassDependency read_back_dependency = {};
+	read_back_dependency.srcSubpass = 0;
+	read_back_dependency.dstSubpass = VK_SUBPASS_EXTERNAL;
+	read_back_dependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+	read_back_dependency.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+	read_back_dependency.dstStageMask = VK_PIPELINE_STAGE_TRANSFER_BIT;
+	read_back_dependency.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+
+	VkSubpassDependency dependencies[] = { dependency, read_back_dependency };
+
 	VkAttachmentDescription attachments[] = { color_attachment, depth_buffer_attachment, color_attachment_resolve };
 
 	VkRenderPassCreateInfo render_pass_ci = { VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO };
@@ -616,8 +1159,8 @@ void Device::create_render_pass()
 	render_pass_ci.pAttachments = attachments;
 	render_pass_ci.subpassCount = 1;
 	render_pass_ci.pSubpasses = &subpass;
-	render_pass_ci.dependencyCount = 1;
-	render_pass_ci.pDependencies = &dependency;
+	render_pass_ci.dependencyCount = wsi->headless ? 2 : 1;
+	render_pass_ci.pDependencies = dependencies;
 
 	VkResult result = vkCreateRenderPass(context->device, &render_pass_ci, nullptr, &render_pass);
 	assert(result == VK_SUCCESS);
@@ -634,7 +1177,7 @@ void Device::destroy_render_pass()
 void Device::create_color_buffer()
 {
 	VkFormat color_format = wsi->surface_format.format;
-	color_buffer = new Vulkan::Image(context->device, context->gpu, wsi->swapchain_extent, color_format, context->msaa_samples,
+	color_buffer = new Vulkan::Image(context->device, context->allocator, wsi->swapchain_extent, color_format, context->msaa_samples,
 									 VK_IMAGE_ASPECT_COLOR_BIT, VK_IMAGE_TILING_OPTIMAL,
 								 	 VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT | VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT,
 									 VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
@@ -650,12 +1193,13 @@ void Device::destroy_color_buffer()
 
 void Device::create_depth_buffer()
 {
-	VkFormat depth_format = find_supported_format(VK_IMAGE_TILING_OPTIMAL, VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT);
-	depth_buffer = new Vulkan::Image(context->device, context->gpu, wsi->swapchain_extent, depth_format, context->msaa_samples,
-									 VK_IMAGE_ASPECT_DEPTH_BIT, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT,
+	VkFormat depth_format = find_supported_format(VK_IMAGE_TILING_OPTIMAL, VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT);
+	depth_buffer = new Vulkan::Image(context->device, context->allocator, wsi->swapchain_extent, depth_format, context->msaa_samples,
+									 VK_IMAGE_ASPECT_DEPTH_BIT, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
 									 VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
 
 	transition_image_layout(depth_buffer->image, depth_format, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL);
+	depth_buffer_generation++;
 }
 
 VkFormat Device::find_supported_format(VkImageTiling tiling, VkFormatFeatureFlags features)
@@ -5,6 +5,7 @@
 #include "context.h"
 #include "buffer.h"
 #include "image.h"
+#include "staging_ring.h"
 
 namespace Vulkan
 {
@@ -13,6 +14,16 @@ namespace Vulkan
 // for our application.
 const int MAX_FRAMES_IN_FLIGHT = 3;
 
+// NOTE: 16 MB of staging memory per frame in flight
+const VkDeviceSize STAGING_SEGMENT_SIZE = 16 * 1024 * 1024;
+
+// Identifies a batch of asynchronous uploads. The batch is done once the
+// upload timeline semaphore reaches value.
+struct UploadToken
+{
+	uint64_t value = 0;
+};
+
 // A FrameResources struct manages the lifetime of
 // a single frame of animation.
 struct FrameResources
@@ -67,6 +78,11 @@ struct FrameResources
 	uint32_t timestamp_query_pool_count = 0;
 	VkQueryPool timestamp_query_pool = VK_NULL_HANDLE;
 
+	// Value of the upload timeline semaphore this frame
+	// waits on before reading vertex, index and uniform
+	// data. 0 when there's nothing to wait for.
+	uint64_t upload_wait_value = 0;
+
 	// Renderer-specific data
 	void* custom = nullptr;
 };
@@ -78,9 +94,19 @@ struct Device
 	void init();
 	void cleanup();
 
+	// Starts recording the frame. Work that can't run inside a render pass
+	// (compute dispatches, copies) is recorded between begin_draw_frame and
+	// begin_render_pass.
 	FrameResources& begin_draw_frame();
+	void begin_render_pass(FrameResources& frame_resources);
 	void end_draw_frame(FrameResources& frame_resources);
 
+	// Copies the last submitted frame into pixels (width * height * 4 bytes,
+	// in the offscreen image format). Only available in headless mode.
+	// NOTE: This waits for the frame to finish on the GPU, so it should
+	// only be called on demand (captures, tests) and not every frame.
+	void read_back_frame(void* pixels);
+
 	WSI* wsi;
 	Context* context;
 
@@ -90,7 +116,12 @@ struct Device
 	// Color Buffer
 	Vulkan::Image* color_buffer;
 	// Depth Buffer
+	// NOTE: Sampled by the compute passes of the next frame, which find it
+	// in DEPTH_STENCIL_ATTACHMENT_OPTIMAL
 	Vulkan::Image* depth_buffer;
+	// Incremented every time the depth buffer is created (e.g. when the
+	// window is resized), so that views of it can be written again
+	uint32_t depth_buffer_generation = 0;
 
 	// Command Pools
 	VkCommandPool command_pool = VK_NULL_HANDLE;
@@ -102,6 +133,10 @@ struct Device
 	// Query pool
 	VkQueryPool timestamp_query_pool;
 
+	// Headless read back
+	Vulkan::Buffer* read_back_buffer = nullptr;
+	int32_t last_submitted_frame = -1;
+
 	double frame_gpu_avg = 0.0f;
 	double frame_gpu_min = 100.0f;
 	double frame_gpu_max = -1.0f;
@@ -110,15 +145,65 @@ struct Device
 	Vulkan::Buffer* vertex_buffer;
 	Vulkan::Buffer* index_buffer;
 	Vulkan::Buffer* uniform_buffer;
+	// Read only data of the compute passes (e.g. meshlets)
+	Vulkan::Buffer* storage_buffer;
 	VkDeviceSize vertex_head_cursor = 0;
 	VkDeviceSize index_head_cursor = 0;
 	VkDeviceSize uniform_head_cursor = 0;
-
-	VkDeviceSize upload_vertex_buffer(Vulkan::Buffer* staging_buffer);
-	VkDeviceSize upload_index_buffer(Vulkan::Buffer* staging_buffer);
-	VkDeviceSize upload_uniform_buffer(Vulkan::Buffer* staging_buffer);
-
-	void upload_buffer_to_image(VkBuffer buffer, VkImage image, VkFormat format, uint32_t width, uint32_t height, VkImageLayout old_layout, VkImageLayout new_old_layout, VkImageLayout new_layout);
+	VkDeviceSize storage_head_cursor = 0;
+
+	// Staging memory for uploads. Slices are valid until the current frame
+	// in flight comes around again, so they must be consumed by then.
+	Vulkan::StagingRing* staging_ring;
+	Vulkan::StagingSlice allocate_staging(VkDeviceSize size, VkDeviceSize alignment = 16);
+
+	// NOTE: These record the copy into the pending upload batch on the
+	// transfer queue and return the destination offset right away. The
+	// batch is submitted by submit_uploads(), or at the latest when the
+	// next frame begins, and that frame waits for it on the GPU.
+	VkDeviceSize upload_vertex_buffer(const Vulkan::StagingSlice& staging_slice);
+	VkDeviceSize upload_index_buffer(const Vulkan::StagingSlice& staging_slice);
+	VkDeviceSize upload_uniform_buffer(const Vulkan::StagingSlice& staging_slice);
+	VkDeviceSize upload_storage_buffer(const Vulkan::StagingSlice& staging_slice);
+
+	// Moves the head of a buffer past size bytes without writing them and
+	// returns where they start, for ranges that are filled (and filled
+	// again) with the update functions
+	VkDeviceSize reserve_vertex_buffer(VkDeviceSize size);
+	VkDeviceSize reserve_index_buffer(VkDeviceSize size);
+	VkDeviceSize reserve_storage_buffer(VkDeviceSize size);
+
+	// Like the upload functions, but the copy overwrites a range at offset
+	// that was uploaded or reserved before.
+	// NOTE: Nothing stops frames in flight from reading the range while it
+	// is written, the caller has to make sure none of them uses it.
+	void update_vertex_buffer(const Vulkan::StagingSlice& staging_slice, VkDeviceSize offset);
+	void update_index_buffer(const Vulkan::StagingSlice& staging_slice, VkDeviceSize offset);
+	void update_uniform_buffer(const Vulkan::StagingSlice& staging_slice, VkDeviceSize offset);
+	void update_storage_buffer(const Vulkan::StagingSlice& staging_slice, VkDeviceSize offset);
+
+	// Copies every mip level of a sampled color image, stored one after the
+	// other in data (each level half the size of the one before, down to
+	// 1x1), and leaves it in SHADER_READ_ONLY_OPTIMAL. Levels are made of
+	// block_extent x block_extent blocks of block_size bytes: 4x4 for block
+	// compressed formats, 1x1 texels otherwise. The levels are staged here
+	// in bands of block rows that fit in a staging segment, so only a row
+	// of blocks has to fit in one. Like the buffer uploads, the copies go
+	// into the pending batch and the frames that begin once it is submitted
+	// can sample the image.
+	void upload_image(Vulkan::Image* image, const void* data, uint32_t width, uint32_t height, uint32_t block_extent, uint32_t block_size);
+
+	// Submits the pending upload batch, if any, in a single vkQueueSubmit.
+	// The returned token covers every upload recorded so far.
+	UploadToken submit_uploads();
+	bool is_upload_complete(UploadToken token);
+	void wait_for_upload(UploadToken token);
+
+	// Signaled by the transfer queue with an increasing value per batch
+	VkSemaphore upload_timeline_semaphore = VK_NULL_HANDLE;
+	uint64_t upload_timeline_value = 0;
+
+	void upload_buffer_to_image(const Vulkan::StagingSlice& staging_slice, VkImage image, VkFormat format, uint32_t width, uint32_t height, VkImageLayout old_layout, VkImageLayout new_old_layout, VkImageLayout new_layout);
 	void transition_image_layout(VkImage image, VkFormat format, VkImageLayout src_layout, VkImageLayout dst_layout);
 
 	VkCommandBuffer create_graphics_command_buffer(VkCommandBufferLevel level, bool begin = true);
@@ -133,6 +218,49 @@ private:
 	void create_gpu_buffers();
 	void free_gpu_buffers();
 
+	// Moves to the next frame in flight and recycles its staging segment
+	void advance_frame();
+
+	// Asynchronous upload helpers
+	static const uint32_t max_upload_barriers = 64;
+	static const uint32_t max_upload_batches = 16;
+
+	struct UploadBatch
+	{
+		VkCommandBuffer command_buffer = VK_NULL_HANDLE;
+		uint64_t value = 0;
+	};
+
+	// The batch being recorded and the release barriers it will end with
+	VkCommandBuffer upload_command_buffer = VK_NULL_HANDLE;
+	VkBufferMemoryBarrier release_barriers[max_upload_barriers];
+	uint32_t release_barrier_count = 0;
+	// NOTE: Images also need their layout transition, which is recorded
+	// with the release even when the queue families are the same
+	VkImageMemoryBarrier release_image_barriers[max_upload_barriers];
+	uint32_t release_image_barrier_count = 0;
+	// Acquire barriers the next frame has to record, and the timeline
+	// value it has to wait on
+	VkBufferMemoryBarrier acquire_barriers[max_upload_barriers];
+	uint32_t acquire_barrier_count = 0;
+	VkImageMemoryBarrier acquire_image_barriers[max_upload_barriers];
+	uint32_t acquire_image_barrier_count = 0;
+	uint64_t acquire_wait_value = 0;
+	// Submitted batches whose command buffers are not recycled yet
+	UploadBatch upload_batches[max_upload_batches];
+	uint32_t upload_batch_count = 0;
+
+	// Returns the command buffer of the pending batch, starting a new batch
+	// if there is none
+	VkCommandBuffer begin_upload_batch();
+	VkDeviceSize enqueue_buffer_upload(const Vulkan::StagingSlice& staging_slice, Vulkan::Buffer* buffer, VkDeviceSize& head_cursor, VkAccessFlags dst_access);
+	VkDeviceSize reserve_buffer_range(Vulkan::Buffer* buffer, VkDeviceSize& head_cursor, VkDeviceSize size);
+	void record_buffer_copy(const Vulkan::StagingSlice& staging_slice, Vulkan::Buffer* buffer, VkDeviceSize offset, VkAccessFlags dst_access);
+	void record_upload_acquire_barriers(FrameResources& frame_resources);
+	void recycle_upload_batches();
+	void create_upload_timeline();
+	void destroy_upload_timeline();
+
 	// Render pass helpers
 	void create_render_pass();
 	void destroy_render_pass();
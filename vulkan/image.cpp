@@ -3,9 +3,11 @@
 namespace Vulkan
 {
 
-Image::Image(VkDevice device, VkPhysicalDevice gpu, VkExtent2D extent, VkFormat format, VkSampleCountFlagBits samples, VkImageAspectFlags aspect_flags, VkImageTiling tiling, VkImageUsageFlags usage_flags, VkMemoryPropertyFlags memory_property_flags, VkSharingMode sharing_mode)
+Image::Image(VkDevice device, Allocator* allocator, VkExtent2D extent, VkFormat format, VkSampleCountFlagBits samples, VkImageAspectFlags aspect_flags, VkImageTiling tiling, VkImageUsageFlags usage_flags, VkMemoryPropertyFlags memory_property_flags, VkSharingMode sharing_mode, uint32_t mip_levels)
 {
 	image_format = format;
+	this->mip_levels = mip_levels;
+	this->allocator = allocator;
 
 	// Create the depth image
 	VkImageCreateInfo image_ci = { VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO };
@@ -13,7 +15,7 @@ Image::Image(VkDevice device, VkPhysicalDevice gpu, VkExtent2D extent, VkFormat
 	image_ci.extent.width = extent.width;
 	image_ci.extent.height = extent.height;
 	image_ci.extent.depth = 1;
-	image_ci.mipLevels = 1;
+	image_ci.mipLevels = mip_levels;
 	image_ci.arrayLayers = 1;
 	image_ci.format = format;
 	image_ci.tiling = tiling;
@@ -28,22 +30,18 @@ Image::Image(VkDevice device, VkPhysicalDevice gpu, VkExtent2D extent, VkFormat
 	VkMemoryRequirements memory_requirements;
 	vkGetImageMemoryRequirements(device, image, &memory_requirements);
 
-	VkMemoryAllocateInfo memory_ai = { VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO };
-	memory_ai.allocationSize = memory_requirements.size;
-	memory_ai.memoryTypeIndex = find_memory_type(gpu, memory_requirements.memoryTypeBits, memory_property_flags);
+	allocation = allocator->allocate(memory_requirements, memory_property_flags, tiling == VK_IMAGE_TILING_LINEAR);
 
-	result = vkAllocateMemory(device, &memory_ai, nullptr, &image_memory);
+	result = vkBindImageMemory(device, image, allocation.memory, allocation.offset);
 	assert(result == VK_SUCCESS);
 
-	vkBindImageMemory(device, image, image_memory, 0);
-
 	VkImageViewCreateInfo image_view_ci = { VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO };
 	image_view_ci.image = image;
 	image_view_ci.viewType = VK_IMAGE_VIEW_TYPE_2D;
 	image_view_ci.format = format;
 	image_view_ci.subresourceRange.aspectMask = aspect_flags;
 	image_view_ci.subresourceRange.baseMipLevel = 0;
-	image_view_ci.subresourceRange.levelCount = 1;
+	image_view_ci.subresourceRange.levelCount = mip_levels;
 	image_view_ci.subresourceRange.baseArrayLayer = 0;
 	image_view_ci.subresourceRange.layerCount = 1;
 
@@ -54,30 +52,12 @@ Image::Image(VkDevice device, VkPhysicalDevice gpu, VkExtent2D extent, VkFormat
 
 void Image::destroy(VkDevice device)
 {
-	vkFreeMemory(device, image_memory, nullptr);
-	vkDestroyImage(device, image, nullptr);
 	vkDestroyImageView(device, image_view, nullptr);
+	vkDestroyImage(device, image, nullptr);
+	allocator->free(allocation);
 
-	image_memory = VK_NULL_HANDLE;
 	image = VK_NULL_HANDLE;
 	image_view = VK_NULL_HANDLE;
 }
 
-uint32_t Image::find_memory_type(VkPhysicalDevice gpu, uint32_t memory_type_bits, VkMemoryPropertyFlags properties)
-{
-	VkPhysicalDeviceMemoryProperties memoryProperties;
-	vkGetPhysicalDeviceMemoryProperties(gpu, &memoryProperties);
-
-	for (uint32_t i = 0; i < VK_MAX_MEMORY_TYPES; ++i)
-	{
-		VkMemoryType memoryType = memoryProperties.memoryTypes[i];
-		if ((memory_type_bits & (1 << i)) != 0 && (memoryType.propertyFlags & properties) == properties)
-		{
-			return i;
-		}
-	}
-
-	assert(!"No compatible memory found");
-}
-
 } // namespace Vulkan
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "volk.h"
+#include "allocator.h"
 #include <cassert>
 
 #if _DEBUG
@@ -12,18 +13,20 @@ namespace Vulkan
 
 struct Image
 {
-	Image(VkDevice device, VkPhysicalDevice gpu, VkExtent2D extent, VkFormat format, VkSampleCountFlagBits samples, VkImageAspectFlags aspect_flags,
-		  VkImageTiling tiling, VkImageUsageFlags usage_flags, VkMemoryPropertyFlags memory_property_flags, VkSharingMode sharing_mode = VK_SHARING_MODE_EXCLUSIVE);
+	Image(VkDevice device, Allocator* allocator, VkExtent2D extent, VkFormat format, VkSampleCountFlagBits samples, VkImageAspectFlags aspect_flags,
+		  VkImageTiling tiling, VkImageUsageFlags usage_flags, VkMemoryPropertyFlags memory_property_flags, VkSharingMode sharing_mode = VK_SHARING_MODE_EXCLUSIVE,
+		  uint32_t mip_levels = 1);
 
 	void destroy(VkDevice device);
 	
 	VkImage image = VK_NULL_HANDLE;
 	VkImageView image_view = VK_NULL_HANDLE;
-	VkDeviceMemory image_memory = VK_NULL_HANDLE;
 	VkFormat image_format = VK_FORMAT_UNDEFINED;
+	// The view covers every level
+	uint32_t mip_levels = 1;
 
-private:
-	uint32_t find_memory_type(VkPhysicalDevice gpu, uint32_t memory_type_bits, VkMemoryPropertyFlags properties);
+	Allocator* allocator = nullptr;
+	Allocation allocation = {};
 };
 
 } // namespace Vulkan
@@ -33,6 +33,9 @@ VkPipelineShaderStageCreateInfo Shader::load_shader(VkDevice device, VkPhysicalD
 	VkResult result = vkCreateShaderModule(device, &shader_module_create_info, nullptr, &shader_module);
 	assert(result == VK_SUCCESS);
 
+	delete[] buffer;
+	fclose(fileHandle);
+
 	VkPipelineShaderStageCreateInfo stage_create_info = { VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO };
 	stage_create_info.stage = stage;
 	stage_create_info.module = shader_module;
@@ -41,4 +44,27 @@ VkPipelineShaderStageCreateInfo Shader::load_shader(VkDevice device, VkPhysicalD
 	return stage_create_info;
 }
 
+bool Shader::is_spirv_file(const char* shaderPath)
+{
+	const uint32_t spirv_magic = 0x07230203;
+	// Magic, version, generator, bound and schema
+	const size_t header_size = 5 * sizeof(uint32_t);
+
+	FILE* fileHandle = fopen(shaderPath, "rb");
+	if (fileHandle == NULL)
+		return false;
+
+	uint32_t magic = 0;
+	bool valid = fread(&magic, sizeof(magic), 1, fileHandle) == 1 && magic == spirv_magic;
+	if (valid)
+	{
+		fseek(fileHandle, 0, SEEK_END);
+		long size = ftell(fileHandle);
+		valid = size >= long(header_size) && size % 4 == 0;
+	}
+
+	fclose(fileHandle);
+	return valid;
+}
+
 } // namespace Vulkan
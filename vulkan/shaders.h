@@ -8,6 +8,11 @@ namespace Vulkan
 struct Shader
 {
 	static VkPipelineShaderStageCreateInfo load_shader(VkDevice device, VkPhysicalDevice gpu, const char* shaderPath, VkShaderStageFlagBits stage, const char* entrypoint = "main");
+
+	// Whether a file looks like a whole SPIR-V module: a header with the
+	// magic number and a size that is a multiple of 4. Cheap enough to
+	// check a file a compiler may still be writing before loading it.
+	static bool is_spirv_file(const char* shaderPath);
 };
 
 } // namespace Vulkan
@@ -0,0 +1,62 @@
+#include "staging_ring.h"
+#include <cassert>
+
+namespace Vulkan
+{
+
+StagingRing::StagingRing(VkDevice device, Allocator* allocator, uint32_t segment_count, VkDeviceSize segment_size)
+{
+	this->segment_count = segment_count;
+	this->segment_size = segment_size;
+
+	buffer = new Vulkan::Buffer(
+		device,
+		allocator,
+		VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+		segment_count * segment_size);
+
+	VkResult result = buffer->map(device);
+	assert(result == VK_SUCCESS);
+}
+
+void StagingRing::destroy(VkDevice device)
+{
+	buffer->unmap(device);
+	buffer->destroy(device);
+	delete buffer;
+	buffer = nullptr;
+}
+
+StagingSlice StagingRing::allocate(VkDeviceSize size, VkDeviceSize alignment)
+{
+	assert(alignment > 0 && (alignment & (alignment - 1)) == 0);
+
+	StagingSlice slice = {};
+
+	VkDeviceSize offset = (head + alignment - 1) & ~(alignment - 1);
+	if (offset + size > segment_size)
+		return slice;
+
+	head = offset + size;
+	if (head > peak_usage)
+	{
+		peak_usage = head;
+	}
+
+	slice.buffer = buffer->buffer;
+	slice.offset = current_segment * segment_size + offset;
+	slice.size = size;
+	slice.data = (uint8_t*)buffer->mapped + slice.offset;
+
+	return slice;
+}
+
+void StagingRing::begin_segment(uint32_t segment)
+{
+	assert(segment < segment_count);
+	current_segment = segment;
+	head = 0;
+}
+
+} // namespace Vulkan
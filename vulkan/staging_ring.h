@@ -0,0 +1,46 @@
+#pragma once
+
+#include "volk.h"
+#include "buffer.h"
+
+namespace Vulkan
+{
+
+// A range of the staging ring. data points to the mapped memory at offset.
+struct StagingSlice
+{
+	VkBuffer buffer = VK_NULL_HANDLE;
+	VkDeviceSize offset = 0;
+	VkDeviceSize size = 0;
+	void* data = nullptr;
+};
+
+// A single persistently mapped, host coherent staging buffer split in
+// one segment per frame in flight. Uploads recorded while a frame is
+// being prepared take slices from that frame's segment, and the segment
+// is recycled once the frame fence tells us the GPU is done with it.
+// Handing out a slice is a pointer bump: no memory is allocated and no
+// Vulkan object is created.
+struct StagingRing
+{
+	StagingRing(VkDevice device, Allocator* allocator, uint32_t segment_count, VkDeviceSize segment_size);
+	void destroy(VkDevice device);
+
+	// Returns a slice with data == nullptr if the current segment is full
+	StagingSlice allocate(VkDeviceSize size, VkDeviceSize alignment);
+
+	// Makes segment the current one and rewinds it. The caller must make
+	// sure the GPU is no longer reading from it.
+	void begin_segment(uint32_t segment);
+
+	Vulkan::Buffer* buffer = nullptr;
+	uint32_t segment_count = 0;
+	VkDeviceSize segment_size = 0;
+
+	uint32_t current_segment = 0;
+	VkDeviceSize head = 0;
+	// Highest usage of a single segment, useful to tune segment_size
+	VkDeviceSize peak_usage = 0;
+};
+
+} // namespace Vulkan
@@ -10,13 +10,31 @@ WSI::WSI(Application::Platform* platform) : platform(platform) {}
 
 bool WSI::init()
 {
+	headless = platform->headless;
+
 	context = new Vulkan::Context();
-	bool result = context->init();
+	bool result = context->init(headless);
 	assert(result);
 
+	if (headless)
+	{
+		const char* headless_required_extensions[] = { VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME };
+		result = context->pick_suitable_gpu(VK_NULL_HANDLE, headless_required_extensions, ARRAYSIZE(headless_required_extensions));
+		assert(result);
+
+		result = context->create_device(headless_required_extensions, ARRAYSIZE(headless_required_extensions));
+		assert(result);
+
+		context->retrieve_queues();
+
+		create_offscreen_images();
+
+		return true;
+	}
+
 	surface = create_surface(context->instance);
 
-	const char* device_required_extensions[] = { VK_KHR_SWAPCHAIN_EXTENSION_NAME };
+	const char* device_required_extensions[] = { VK_KHR_SWAPCHAIN_EXTENSION_NAME, VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME };
 	result = context->pick_suitable_gpu(surface, device_required_extensions, ARRAYSIZE(device_required_extensions));
 	assert(result);
 
@@ -32,6 +50,13 @@ bool WSI::init()
 
 void WSI::cleanup()
 {
+	if (headless)
+	{
+		destroy_offscreen_images();
+		context->cleanup();
+		return;
+	}
+
 	destroy_swapchain();
 
 	assert(surface != VK_NULL_HANDLE);
@@ -205,6 +230,46 @@ void WSI::destroy_swapchain()
 	swapchain = VK_NULL_HANDLE;
 }
 
+void WSI::create_offscreen_images()
+{
+	// NOTE: RGBA8 is supported as a color attachment and as a transfer
+	// source on every implementation, including software ones, and it
+	// makes reading the pixels back trivial.
+	surface_format = { VK_FORMAT_R8G8B8A8_UNORM, VK_COLOR_SPACE_SRGB_NONLINEAR_KHR };
+	swapchain_extent = { platform->window_parameters.width, platform->window_parameters.height };
+
+	swapchain_image_count = offscreen_image_count;
+	swapchain_images = new VkImage[swapchain_image_count];
+	swapchain_image_views = new VkImageView[swapchain_image_count];
+
+	for (uint32_t i = 0; i < swapchain_image_count; ++i)
+	{
+		offscreen_images[i] = new Vulkan::Image(context->device, context->allocator, swapchain_extent, surface_format.format, VK_SAMPLE_COUNT_1_BIT,
+												VK_IMAGE_ASPECT_COLOR_BIT, VK_IMAGE_TILING_OPTIMAL,
+												VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
+												VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+		swapchain_images[i] = offscreen_images[i]->image;
+		swapchain_image_views[i] = offscreen_images[i]->image_view;
+	}
+}
+
+void WSI::destroy_offscreen_images()
+{
+	for (uint32_t i = 0; i < swapchain_image_count; ++i)
+	{
+		offscreen_images[i]->destroy(context->device);
+		delete offscreen_images[i];
+		offscreen_images[i] = nullptr;
+	}
+
+	delete[] swapchain_images;
+	delete[] swapchain_image_views;
+	swapchain_images = nullptr;
+	swapchain_image_views = nullptr;
+	swapchain_image_count = 0;
+}
+
 VkSurfaceFormatKHR WSI::find_best_surface_format(VkSurfaceFormatKHR preferred_format)
 {
 	uint32_t available_format_count = 0;
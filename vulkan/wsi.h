@@ -2,6 +2,7 @@
 
 #include "volk.h"
 #include "context.h"
+#include "image.h"
 #include "../application/platform.h"
 
 namespace Vulkan
@@ -39,6 +40,15 @@ struct WSI
 	Application::Platform* platform;
 	bool is_resizing = false;
 
+	// Headless mode
+	// When the platform is headless we don't have a surface nor a swapchain.
+	// We render into a ring of offscreen images instead, and expose them
+	// through swapchain_images and swapchain_image_views so the Device and
+	// the Renderer don't need to know the difference.
+	bool headless = false;
+	static const uint32_t offscreen_image_count = 3;
+	Vulkan::Image* offscreen_images[offscreen_image_count] = {};
+
 private:
 
 	// Surface
@@ -53,6 +63,10 @@ private:
 	VkExtent2D choose_swapchain_extent(const VkSurfaceCapabilitiesKHR& surface_capabilities);
 	VkSurfaceCapabilitiesKHR surface_capabilities = {};
 
+	// Offscreen targets
+	void create_offscreen_images();
+	void destroy_offscreen_images();
+
 }; // struct WSI
 
 } // namespace Vulkan
\ No newline at end of file